@@ -0,0 +1,78 @@
+#include "assessmentstatemachine.h"
+
+AssessmentStateMachine::AssessmentStateMachine()
+{
+    // Present weather has no measured value to band; it only dwells
+    m_hysteresis[int(FlightFactor::Precipitation)] = {0.0, 900};
+    m_hysteresis[int(FlightFactor::Temperature)] = {0.05, 900};
+}
+
+void AssessmentStateMachine::setHysteresis(FlightFactor factor, const Hysteresis &hysteresis)
+{
+    m_hysteresis[int(factor)] = hysteresis;
+}
+
+FlightThresholds AssessmentStateMachine::releaseThresholds(const FlightThresholds &thresholds) const
+{
+    FlightThresholds release = thresholds;
+    
+    const double wind = 1.0 - m_hysteresis[int(FlightFactor::Wind)].band;
+    release.windCaution *= wind;
+    release.windUnsafe *= wind;
+    release.windNoFly *= wind;
+    release.gustCaution *= wind;
+    release.gustUnsafe *= wind;
+    
+    const double visibility = 1.0 + m_hysteresis[int(FlightFactor::Visibility)].band;
+    release.visibilityCaution *= visibility;
+    release.visibilityUnsafe *= visibility;
+    release.visibilityNoFly *= visibility;
+    
+    const double temperatureBand = m_hysteresis[int(FlightFactor::Temperature)].band;
+    const double margin = temperatureBand * (thresholds.maxTemperature - thresholds.minTemperature);
+    release.minTemperature += margin;
+    release.maxTemperature -= margin;
+    release.maxHumidity *= 1.0 - temperatureBand;
+    
+    return release;
+}
+
+bool AssessmentStateMachine::update(FlightFactor factor, FlightSafety raw, FlightSafety release, qint64 nowSecs)
+{
+    FactorState &state = m_states[int(factor)];
+    
+    if (!state.initialised || raw > state.current) {
+        bool changed = !state.initialised || raw != state.current;
+        state.initialised = true;
+        state.current = raw;
+        state.candidateSince = -1;
+        return changed;
+    }
+    
+    // Relaxing needs both grades below the current category
+    FlightSafety target = FlightConditions::worst(raw, release);
+    if (target >= state.current) {
+        state.candidateSince = -1;
+        return false;
+    }
+    
+    if (state.candidateSince < 0) {
+        state.candidate = target;
+        state.candidateSince = nowSecs;
+    } else {
+        state.candidate = FlightConditions::worst(state.candidate, target);
+    }
+    
+    if (nowSecs - state.candidateSince < m_hysteresis[int(factor)].dwellSeconds) {
+        return false;
+    }
+    
+    state.current = state.candidate;
+    state.candidateSince = -1;
+    return true;
+}
+
+void AssessmentStateMachine::reset()
+{
+    m_states = {};
+}
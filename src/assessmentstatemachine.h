@@ -0,0 +1,65 @@
+#pragma once
+
+#include <array>
+#include "flightconditions.h"
+
+enum class FlightFactor : quint8 {
+    Wind,
+    Visibility,
+    Precipitation,
+    Temperature,
+    Ceiling
+};
+
+// Debounces the per-factor categories of successive assessments. A worse
+// category is taken at once; a better one only once it has held for the
+// factor's dwell time and also holds against thresholds tightened by the
+// factor's band, so a value hovering at a limit does not flip the category
+// on every refresh.
+class AssessmentStateMachine
+{
+public:
+    static constexpr int kFactorCount = 5;
+    
+    struct Hysteresis {
+        double band = 0.1;       // fraction of the limit a value must clear to relax
+        int dwellSeconds = 600;  // how long the better category must hold
+    };
+    
+    AssessmentStateMachine();
+    
+    void setHysteresis(FlightFactor factor, const Hysteresis &hysteresis);
+    const Hysteresis &hysteresis(FlightFactor factor) const { return m_hysteresis[int(factor)]; }
+    
+    // The thresholds a relaxing category is checked against. Wind and
+    // visibility move by their band; temperature moves by its band of the
+    // allowed range and humidity by its band of the limit.
+    FlightThresholds releaseThresholds(const FlightThresholds &thresholds) const;
+    // The ceiling (ft AGL) a relaxing ceiling category is graded at: the
+    // reported one lowered by its band
+    double releaseCeiling(double ceiling) const { return ceiling * (1.0 - m_hysteresis[int(FlightFactor::Ceiling)].band); }
+    
+    // raw is graded at the normal thresholds, release at releaseThresholds().
+    // nowSecs is the observation time, so repeated reports of one observation
+    // do not count towards the dwell. Returns true when the factor's category
+    // changed.
+    bool update(FlightFactor factor, FlightSafety raw, FlightSafety release, qint64 nowSecs);
+    FlightSafety state(FlightFactor factor) const { return m_states[int(factor)].current; }
+    // When a better category started holding, or -1 while the factor is not
+    // relaxing
+    qint64 relaxingSince(FlightFactor factor) const { return m_states[int(factor)].candidateSince; }
+    
+    // Forgets all history; the next update of each factor is taken as is
+    void reset();
+
+private:
+    struct FactorState {
+        bool initialised = false;
+        FlightSafety current = FlightSafety::Safe;
+        FlightSafety candidate = FlightSafety::Safe; // worst relaxed grade seen while dwelling
+        qint64 candidateSince = -1;
+    };
+    
+    std::array<Hysteresis, kFactorCount> m_hysteresis;
+    std::array<FactorState, kFactorCount> m_states;
+};
@@ -0,0 +1,268 @@
+#include "batchassessment.h"
+#include "weatherphenomena.h"
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DRONEVIEW_HAVE_SSE2 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define DRONEVIEW_TARGET_AVX2
+#else
+#define DRONEVIEW_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace {
+
+void gradePhenomena(const WeatherBatch &batch, quint8 *precipitation)
+{
+    if (!batch.phenomena) {
+        std::memset(precipitation, int(FlightSafety::Safe), size_t(batch.count));
+        return;
+    }
+    for (qsizetype i = 0; i < batch.count; ++i) {
+        precipitation[i] = quint8(WeatherPhenomena::grade(batch.phenomena[i]));
+    }
+}
+
+void assessScalar(const WeatherBatch &batch, const FlightThresholds &thresholds,
+                  qsizetype begin, BatchGrades &grades)
+{
+    for (qsizetype i = begin; i < batch.count; ++i) {
+        FlightSafety wind = FlightConditions::gradeWind(batch.windSpeed[i], batch.windGust[i], thresholds);
+        FlightSafety visibility = FlightConditions::gradeVisibility(batch.visibility[i], thresholds);
+        FlightSafety temperature = FlightConditions::gradeTemperature(batch.temperature[i], batch.humidity[i], thresholds);
+        FlightSafety precipitation = FlightSafety(grades.precipitation[i]);
+        
+        grades.wind[i] = quint8(wind);
+        grades.visibility[i] = quint8(visibility);
+        grades.temperature[i] = quint8(temperature);
+        grades.overall[i] = quint8(FlightConditions::worst(FlightConditions::worst(wind, visibility),
+                                                           FlightConditions::worst(precipitation, temperature)));
+    }
+}
+
+#ifdef DRONEVIEW_HAVE_SSE2
+
+// Grades are carried as 0.0-3.0 in double lanes and only narrowed to bytes on store
+
+inline __m128d select128(__m128d mask, __m128d ifTrue, __m128d ifFalse)
+{
+    return _mm_or_pd(_mm_and_pd(mask, ifTrue), _mm_andnot_pd(mask, ifFalse));
+}
+
+// Low two int32 lanes to two bytes
+inline void store2(quint8 *out, __m128i lanes)
+{
+    __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(lanes, lanes), _mm_setzero_si128());
+    quint32 packed = quint32(_mm_cvtsi128_si32(bytes));
+    std::memcpy(out, &packed, 2);
+}
+
+qsizetype assessSse2(const WeatherBatch &batch, const FlightThresholds &t, BatchGrades &grades)
+{
+    const __m128d one = _mm_set1_pd(1.0);
+    const __m128d two = _mm_set1_pd(2.0);
+    const __m128d three = _mm_set1_pd(3.0);
+    const __m128d zero = _mm_setzero_pd();
+    
+    const qsizetype end = batch.count & ~qsizetype(1);
+    for (qsizetype i = 0; i < end; i += 2) {
+        __m128d speed = _mm_loadu_pd(batch.windSpeed + i);
+        __m128d gust = _mm_loadu_pd(batch.windGust + i);
+        __m128d vis = _mm_loadu_pd(batch.visibility + i);
+        __m128d temp = _mm_loadu_pd(batch.temperature + i);
+        __m128d hum = _mm_loadu_pd(batch.humidity + i);
+        
+        // Later selects take precedence, mirroring the early returns of the scalar graders
+        __m128d wind = select128(_mm_cmpgt_pd(speed, _mm_set1_pd(t.windCaution)), one, zero);
+        wind = select128(_mm_cmpgt_pd(gust, _mm_set1_pd(t.gustCaution)), one, wind);
+        wind = select128(_mm_cmpgt_pd(gust, _mm_set1_pd(t.gustUnsafe)), two, wind);
+        wind = select128(_mm_cmpgt_pd(speed, _mm_set1_pd(t.windUnsafe)), two, wind);
+        wind = select128(_mm_cmpgt_pd(speed, _mm_set1_pd(t.windNoFly)), three, wind);
+        
+        __m128d visibility = select128(_mm_cmplt_pd(vis, _mm_set1_pd(t.visibilityCaution)), one, zero);
+        visibility = select128(_mm_cmplt_pd(vis, _mm_set1_pd(t.visibilityUnsafe)), two, visibility);
+        visibility = select128(_mm_cmplt_pd(vis, _mm_set1_pd(t.visibilityNoFly)), three, visibility);
+        
+        __m128d outOfRange = _mm_or_pd(_mm_cmplt_pd(temp, _mm_set1_pd(t.minTemperature)),
+                                       _mm_cmpgt_pd(temp, _mm_set1_pd(t.maxTemperature)));
+        __m128d temperature = select128(_mm_cmpgt_pd(hum, _mm_set1_pd(t.maxHumidity)), one, zero);
+        temperature = select128(outOfRange, two, temperature);
+        
+        __m128i windCodes = _mm_cvttpd_epi32(wind);
+        __m128i visibilityCodes = _mm_cvttpd_epi32(visibility);
+        __m128i temperatureCodes = _mm_cvttpd_epi32(temperature);
+        __m128i worst = _mm_cvttpd_epi32(_mm_max_pd(_mm_max_pd(wind, visibility), temperature));
+        
+        store2(grades.wind.data() + i, windCodes);
+        store2(grades.visibility.data() + i, visibilityCodes);
+        store2(grades.temperature.data() + i, temperatureCodes);
+        
+        quint16 precipitation;
+        std::memcpy(&precipitation, grades.precipitation.constData() + i, 2);
+        __m128i overall = _mm_max_epu8(
+            _mm_packus_epi16(_mm_packs_epi32(worst, worst), _mm_setzero_si128()),
+            _mm_cvtsi32_si128(precipitation));
+        quint32 packed = quint32(_mm_cvtsi128_si32(overall));
+        std::memcpy(grades.overall.data() + i, &packed, 2);
+    }
+    return end;
+}
+
+DRONEVIEW_TARGET_AVX2
+inline __m256d select256(__m256d mask, __m256d ifTrue, __m256d ifFalse)
+{
+    return _mm256_blendv_pd(ifFalse, ifTrue, mask);
+}
+
+DRONEVIEW_TARGET_AVX2
+inline void store4(quint8 *out, __m128i lanes)
+{
+    __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(lanes, lanes), _mm_setzero_si128());
+    quint32 packed = quint32(_mm_cvtsi128_si32(bytes));
+    std::memcpy(out, &packed, 4);
+}
+
+DRONEVIEW_TARGET_AVX2
+qsizetype assessAvx2(const WeatherBatch &batch, const FlightThresholds &t, BatchGrades &grades)
+{
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256d two = _mm256_set1_pd(2.0);
+    const __m256d three = _mm256_set1_pd(3.0);
+    const __m256d zero = _mm256_setzero_pd();
+    
+    const qsizetype end = batch.count & ~qsizetype(3);
+    for (qsizetype i = 0; i < end; i += 4) {
+        __m256d speed = _mm256_loadu_pd(batch.windSpeed + i);
+        __m256d gust = _mm256_loadu_pd(batch.windGust + i);
+        __m256d vis = _mm256_loadu_pd(batch.visibility + i);
+        __m256d temp = _mm256_loadu_pd(batch.temperature + i);
+        __m256d hum = _mm256_loadu_pd(batch.humidity + i);
+        
+        // Ordered, non-signalling compares: NaN grades Safe exactly like the scalar path
+        __m256d wind = select256(_mm256_cmp_pd(speed, _mm256_set1_pd(t.windCaution), _CMP_GT_OQ), one, zero);
+        wind = select256(_mm256_cmp_pd(gust, _mm256_set1_pd(t.gustCaution), _CMP_GT_OQ), one, wind);
+        wind = select256(_mm256_cmp_pd(gust, _mm256_set1_pd(t.gustUnsafe), _CMP_GT_OQ), two, wind);
+        wind = select256(_mm256_cmp_pd(speed, _mm256_set1_pd(t.windUnsafe), _CMP_GT_OQ), two, wind);
+        wind = select256(_mm256_cmp_pd(speed, _mm256_set1_pd(t.windNoFly), _CMP_GT_OQ), three, wind);
+        
+        __m256d visibility = select256(_mm256_cmp_pd(vis, _mm256_set1_pd(t.visibilityCaution), _CMP_LT_OQ), one, zero);
+        visibility = select256(_mm256_cmp_pd(vis, _mm256_set1_pd(t.visibilityUnsafe), _CMP_LT_OQ), two, visibility);
+        visibility = select256(_mm256_cmp_pd(vis, _mm256_set1_pd(t.visibilityNoFly), _CMP_LT_OQ), three, visibility);
+        
+        __m256d outOfRange = _mm256_or_pd(_mm256_cmp_pd(temp, _mm256_set1_pd(t.minTemperature), _CMP_LT_OQ),
+                                          _mm256_cmp_pd(temp, _mm256_set1_pd(t.maxTemperature), _CMP_GT_OQ));
+        __m256d temperature = select256(_mm256_cmp_pd(hum, _mm256_set1_pd(t.maxHumidity), _CMP_GT_OQ), one, zero);
+        temperature = select256(outOfRange, two, temperature);
+        
+        store4(grades.wind.data() + i, _mm256_cvttpd_epi32(wind));
+        store4(grades.visibility.data() + i, _mm256_cvttpd_epi32(visibility));
+        store4(grades.temperature.data() + i, _mm256_cvttpd_epi32(temperature));
+        
+        __m128i worst = _mm256_cvttpd_epi32(_mm256_max_pd(_mm256_max_pd(wind, visibility), temperature));
+        quint32 precipitation;
+        std::memcpy(&precipitation, grades.precipitation.constData() + i, 4);
+        __m128i overall = _mm_max_epu8(
+            _mm_packus_epi16(_mm_packs_epi32(worst, worst), _mm_setzero_si128()),
+            _mm_cvtsi32_si128(int(precipitation)));
+        quint32 packed = quint32(_mm_cvtsi128_si32(overall));
+        std::memcpy(grades.overall.data() + i, &packed, 4);
+    }
+    return end;
+}
+
+bool cpuHasAvx2()
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+    __cpuid(info, 1);
+    bool osSavesYmm = (info[2] & (1 << 27)) && (info[2] & (1 << 28))
+        && (_xgetbv(0) & 0x6) == 0x6;
+    __cpuidex(info, 7, 0);
+    return osSavesYmm && (info[1] & (1 << 5));
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif // DRONEVIEW_HAVE_SSE2
+
+} // namespace
+
+void BatchGrades::resize(qsizetype count)
+{
+    wind.resize(count);
+    visibility.resize(count);
+    precipitation.resize(count);
+    temperature.resize(count);
+    overall.resize(count);
+}
+
+bool BatchAssessment::isSupported(Kernel kernel)
+{
+    switch (kernel) {
+    case Kernel::Scalar:
+        return true;
+#ifdef DRONEVIEW_HAVE_SSE2
+    case Kernel::Sse2:
+        return true;
+    case Kernel::Avx2: {
+        static const bool avx2 = cpuHasAvx2();
+        return avx2;
+    }
+#else
+    case Kernel::Sse2:
+    case Kernel::Avx2:
+        return false;
+#endif
+    }
+    return false;
+}
+
+BatchAssessment::Kernel BatchAssessment::bestKernel()
+{
+    if (isSupported(Kernel::Avx2)) {
+        return Kernel::Avx2;
+    }
+    if (isSupported(Kernel::Sse2)) {
+        return Kernel::Sse2;
+    }
+    return Kernel::Scalar;
+}
+
+void BatchAssessment::assess(const WeatherBatch &batch, const FlightAssessment::Limits &limits,
+                             BatchGrades &grades, Kernel kernel)
+{
+    grades.resize(batch.count);
+    if (batch.count == 0) {
+        return;
+    }
+    
+    // Present weather goes through the phenomena grader one record at a
+    // time; the vector kernels fold it into the overall grade
+    gradePhenomena(batch, grades.precipitation.data());
+    
+    if (!isSupported(kernel)) {
+        kernel = Kernel::Scalar;
+    }
+    
+    // SIMD comparisons see exactly the doubles the scalar graders use
+    const FlightThresholds thresholds(limits);
+    qsizetype done = 0;
+#ifdef DRONEVIEW_HAVE_SSE2
+    if (kernel == Kernel::Avx2) {
+        done = assessAvx2(batch, thresholds, grades);
+    } else if (kernel == Kernel::Sse2) {
+        done = assessSse2(batch, thresholds, grades);
+    }
+#endif
+
+    // Scalar tail, or the whole batch without SIMD
+    assessScalar(batch, thresholds, done, grades);
+}
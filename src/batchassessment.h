@@ -0,0 +1,48 @@
+#pragma once
+
+#include <QList>
+#include "flightconditions.h"
+
+// Struct-of-arrays weather records, count entries in every array, in
+// WeatherData units (kts, statute miles, °C, %). phenomena holds
+// WeatherPhenomena flags; it may be null when no wx is known.
+struct WeatherBatch {
+    qsizetype count = 0;
+    const double *windSpeed = nullptr;
+    const double *windGust = nullptr;
+    const double *visibility = nullptr;
+    const double *temperature = nullptr;
+    const double *humidity = nullptr;
+    const quint32 *phenomena = nullptr;
+};
+
+// FlightSafety codes per record and factor
+struct BatchGrades {
+    QList<quint8> wind;
+    QList<quint8> visibility;
+    QList<quint8> precipitation;
+    QList<quint8> temperature;
+    QList<quint8> overall;
+    
+    void resize(qsizetype count);
+    FlightSafety overallAt(qsizetype index) const { return FlightSafety(overall[index]); }
+};
+
+// Grades many records at once with the same thresholds as FlightConditions.
+// Every kernel gives bit-identical results to the scalar one.
+class BatchAssessment
+{
+public:
+    enum class Kernel {
+        Scalar,
+        Sse2,
+        Avx2
+    };
+    
+    // Fastest kernel this CPU and build support
+    static Kernel bestKernel();
+    static bool isSupported(Kernel kernel);
+    
+    static void assess(const WeatherBatch &batch, const FlightAssessment::Limits &limits,
+                       BatchGrades &grades, Kernel kernel = bestKernel());
+};
@@ -0,0 +1,160 @@
+#include "brokerclient.h"
+#include "brokerprotocol.h"
+#include <QCoreApplication>
+#include <QProcess>
+#include <QDir>
+#include <QDebug>
+
+BrokerClient::BrokerClient(QObject *parent)
+    : QObject(parent)
+    , m_socket(new QLocalSocket(this))
+    , m_reconnectTimer(new QTimer(this))
+    , m_launchAttempted(false)
+{
+    m_reconnectTimer->setSingleShot(true);
+    m_reconnectTimer->setInterval(5000);
+    connect(m_reconnectTimer, &QTimer::timeout, this, &BrokerClient::connectToBroker);
+    
+    connect(m_socket, &QLocalSocket::connected, this, &BrokerClient::handleConnected);
+    connect(m_socket, &QLocalSocket::disconnected, this, &BrokerClient::handleDisconnected);
+    connect(m_socket, &QLocalSocket::errorOccurred, this, &BrokerClient::handleSocketError);
+    connect(m_socket, &QLocalSocket::readyRead, this, &BrokerClient::handleReadyRead);
+}
+
+void BrokerClient::connectToBroker()
+{
+    if (m_socket->state() != QLocalSocket::UnconnectedState) {
+        return;
+    }
+    
+    m_socket->connectToServer(BrokerProtocol::serverName());
+}
+
+bool BrokerClient::isConnected() const
+{
+    return m_socket->state() == QLocalSocket::ConnectedState;
+}
+
+bool BrokerClient::isConnecting() const
+{
+    return m_socket->state() == QLocalSocket::ConnectingState;
+}
+
+void BrokerClient::subscribe(const QString &stationId)
+{
+    m_subscriptions.insert(stationId);
+    if (isConnected()) {
+        m_socket->write(BrokerProtocol::frame(BrokerProtocol::MessageType::Subscribe, stationId));
+    }
+}
+
+void BrokerClient::unsubscribe(const QString &stationId)
+{
+    m_subscriptions.remove(stationId);
+    if (isConnected()) {
+        m_socket->write(BrokerProtocol::frame(BrokerProtocol::MessageType::Unsubscribe, stationId));
+    }
+}
+
+void BrokerClient::refresh(const QString &stationId, RequestPriority priority)
+{
+    if (isConnected()) {
+        m_socket->write(BrokerProtocol::frame(BrokerProtocol::MessageType::Refresh, stationId, quint8(priority)));
+    }
+}
+
+void BrokerClient::handleConnected()
+{
+    qDebug() << "BrokerClient: connected to" << BrokerProtocol::serverName();
+    m_buffer.clear();
+    m_socket->write(BrokerProtocol::frame(BrokerProtocol::MessageType::Hello, BrokerProtocol::kVersion));
+    for (const QString &stationId : std::as_const(m_subscriptions)) {
+        m_socket->write(BrokerProtocol::frame(BrokerProtocol::MessageType::Subscribe, stationId));
+    }
+    emit connectionChanged(true);
+}
+
+void BrokerClient::handleDisconnected()
+{
+    qDebug() << "BrokerClient: broker connection lost";
+    emit connectionChanged(false);
+    m_reconnectTimer->start();
+}
+
+void BrokerClient::handleSocketError(QLocalSocket::LocalSocketError error)
+{
+    if (error == QLocalSocket::ServerNotFoundError || error == QLocalSocket::ConnectionRefusedError) {
+        if (!m_launchAttempted) {
+            launchBroker();
+        }
+        m_reconnectTimer->start();
+        emit connectionChanged(false); // whoever waited on this attempt goes upstream
+        return;
+    }
+    
+    qDebug() << "BrokerClient: socket error" << m_socket->errorString();
+}
+
+void BrokerClient::launchBroker()
+{
+    m_launchAttempted = true;
+    
+    QString program = QDir(QCoreApplication::applicationDirPath()).filePath("DroneViewBroker");
+#ifdef Q_OS_WIN
+    program += ".exe";
+#endif
+    if (!QProcess::startDetached(program, {})) {
+        qDebug() << "BrokerClient: could not start" << program << "- fetching upstream directly";
+    }
+}
+
+void BrokerClient::handleReadyRead()
+{
+    m_buffer.append(m_socket->readAll());
+    
+    QList<QByteArray> payloads;
+    if (!BrokerProtocol::takeMessages(m_buffer, payloads)) {
+        qDebug() << "BrokerClient: malformed message from broker, reconnecting";
+        m_socket->abort();
+        return;
+    }
+    
+    for (const QByteArray &payload : std::as_const(payloads)) {
+        handleMessage(payload);
+    }
+}
+
+void BrokerClient::handleMessage(const QByteArray &payload)
+{
+    QDataStream in(payload);
+    in.setVersion(QDataStream::Qt_6_0);
+    
+    quint8 type = 0;
+    in >> type;
+    
+    switch (BrokerProtocol::MessageType(type)) {
+    case BrokerProtocol::MessageType::Snapshot: {
+        QString stationId;
+        WeatherData data;
+        QDateTime fetchedAt;
+        bool settled = true;
+        in >> stationId >> data >> fetchedAt >> settled;
+        if (in.status() == QDataStream::Ok) {
+            emit snapshotReceived(stationId, data, fetchedAt, settled);
+        }
+        break;
+    }
+    case BrokerProtocol::MessageType::Error: {
+        QString stationId;
+        QString message;
+        in >> stationId >> message;
+        if (in.status() == QDataStream::Ok) {
+            emit errorReceived(stationId, message);
+        }
+        break;
+    }
+    default:
+        qDebug() << "BrokerClient: ignoring message type" << type;
+        break;
+    }
+}
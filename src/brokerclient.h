@@ -0,0 +1,53 @@
+#pragma once
+
+#include <QObject>
+#include <QLocalSocket>
+#include <QTimer>
+#include <QSet>
+#include "weatherservice.h"
+
+// Connection from one DroneView instance to the shared DroneViewBroker.
+// Starts the broker when none is running and reconnects if it goes away.
+// Connecting never blocks; connectionChanged reports how each attempt ended.
+class BrokerClient : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit BrokerClient(QObject *parent = nullptr);
+    
+    void connectToBroker();
+    bool isConnected() const;
+    // An attempt is under way; its outcome is signalled either way
+    bool isConnecting() const;
+    
+    void subscribe(const QString &stationId);
+    void unsubscribe(const QString &stationId);
+    // Answered with a snapshot, from the broker's cache when it is fresh;
+    // a fetch may first send an unsettled one
+    void refresh(const QString &stationId, RequestPriority priority);
+
+signals:
+    // settled is false for the first answer of a fetch that is still running;
+    // the final record follows
+    void snapshotReceived(const QString &stationId, const WeatherData &data, const QDateTime &fetchedAt,
+                          bool settled);
+    void errorReceived(const QString &stationId, const QString &message);
+    void connectionChanged(bool connected);
+
+private slots:
+    void handleConnected();
+    void handleDisconnected();
+    void handleSocketError(QLocalSocket::LocalSocketError error);
+    void handleReadyRead();
+
+private:
+    void launchBroker();
+    void handleMessage(const QByteArray &payload);
+    
+    QLocalSocket *m_socket;
+    QByteArray m_buffer;
+    QSet<QString> m_subscriptions;
+    QTimer *m_reconnectTimer;
+    bool m_launchAttempted;
+};
@@ -0,0 +1,22 @@
+#include <QCoreApplication>
+#include <QDebug>
+#include "weatherbroker.h"
+#include "networkdispatcher.h"
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    
+    app.setApplicationName("DroneView");
+    app.setApplicationVersion("1.0.0");
+    app.setOrganizationName("DroneOps");
+    
+    NetworkDispatcher::instance();
+    
+    WeatherBroker broker;
+    if (!broker.listen()) {
+        return 0; // listen() has logged why, usually another broker is running
+    }
+    
+    return app.exec();
+}
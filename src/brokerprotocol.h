@@ -0,0 +1,63 @@
+#pragma once
+
+#include <QByteArray>
+#include <QDataStream>
+#include <QIODevice>
+#include <QtEndian>
+#include "weathersnapshot.h"
+
+// Wire format between DroneView instances and the DroneViewBroker process
+// over a QLocalSocket. Every message is a big-endian quint32 payload size
+// followed by a QDataStream (Qt_6_0) payload that starts with its type.
+namespace BrokerProtocol {
+
+inline QString serverName() { return QStringLiteral("droneview-weather-broker"); }
+
+const quint32 kVersion = 4;
+const quint32 kMaxMessageSize = 4 * 1024 * 1024;
+
+enum class MessageType : quint8 {
+    Hello,       // client -> broker: protocol version
+    Subscribe,   // client -> broker: station id
+    Unsubscribe, // client -> broker: station id
+    Refresh,     // client -> broker: station id, RequestPriority
+    Snapshot,    // broker -> client: station id, WeatherData, fetched at (UTC),
+                 // settled (false for the first answer of a fetch still running)
+    Error        // broker -> client: station id, message
+};
+
+template<typename... Args>
+QByteArray frame(MessageType type, const Args &...args)
+{
+    QByteArray message(sizeof(quint32), Qt::Uninitialized);
+    {
+        QDataStream out(&message, QIODevice::WriteOnly | QIODevice::Append);
+        out.setVersion(QDataStream::Qt_6_0);
+        out << quint8(type);
+        (out << ... << args);
+    }
+    qToBigEndian<quint32>(quint32(message.size() - sizeof(quint32)), message.data());
+    return message;
+}
+
+// Moves every complete payload out of buffer. Returns false if the peer sent
+// something that cannot be a message, in which case the connection should go.
+inline bool takeMessages(QByteArray &buffer, QList<QByteArray> &payloads)
+{
+    qsizetype offset = 0;
+    while (buffer.size() - offset >= qsizetype(sizeof(quint32))) {
+        quint32 size = qFromBigEndian<quint32>(buffer.constData() + offset);
+        if (size == 0 || size > kMaxMessageSize) {
+            return false;
+        }
+        if (buffer.size() - offset - qsizetype(sizeof(quint32)) < qsizetype(size)) {
+            break;
+        }
+        payloads.append(buffer.mid(offset + sizeof(quint32), size));
+        offset += sizeof(quint32) + size;
+    }
+    buffer.remove(0, offset);
+    return true;
+}
+
+} // namespace BrokerProtocol
@@ -0,0 +1,613 @@
+#include "climatology.h"
+#include "weatherphenomena.h"
+#include "batchassessment.h"
+#include <QtConcurrent>
+#include <QStandardPaths>
+#include <QSettings>
+#include <QDataStream>
+#include <QDateTime>
+#include <QTimeZone>
+#include <QSaveFile>
+#include <QFile>
+#include <QDir>
+#include <QMap>
+#include <QVarLengthArray>
+#include <QDebug>
+#include <QtMath>
+#include <algorithm>
+#include <limits>
+#include <numeric>
+
+namespace {
+
+const quint32 kStoreMagic = 0x44564331; // "DVC1"
+const qint32 kStoreVersion = 1;
+const qsizetype kBlockRows = 64 * 1024;
+
+enum Column { Station, Valid, Tmpf, Relh, Sknt, Gust, Vsby, Wxcodes, ColumnCount };
+const char *const kColumnNames[ColumnCount] = {
+    "station", "valid", "tmpf", "relh", "sknt", "gust", "vsby", "wxcodes"
+};
+
+// Days since 1970-01-01 for a proleptic Gregorian date and back again
+// (H. Hinnant's civil calendar algorithms); QDate per row is far too slow
+qint64 daysFromCivil(int year, int month, int day)
+{
+    year -= month <= 2;
+    const qint64 era = (year >= 0 ? year : year - 399) / 400;
+    const int yearOfEra = int(year - era * 400);
+    const int dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    const int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * 146097 + dayOfEra - 719468;
+}
+
+int monthFromDays(qint64 days)
+{
+    days += 719468;
+    const qint64 era = (days >= 0 ? days : days - 146096) / 146097;
+    const int dayOfEra = int(days - era * 146097);
+    const int yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    const int dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    const int shiftedMonth = (5 * dayOfYear + 2) / 153;
+    return shiftedMonth < 10 ? shiftedMonth + 3 : shiftedMonth - 9;
+}
+
+int digits(const char *text, int count)
+{
+    int value = 0;
+    for (int i = 0; i < count; ++i) {
+        if (text[i] < '0' || text[i] > '9') {
+            return -1;
+        }
+        value = value * 10 + (text[i] - '0');
+    }
+    return value;
+}
+
+// "2020-03-01 06:53" in UTC, as written by the IEM download service
+bool parseValid(QByteArrayView text, qint64 &secs)
+{
+    if (text.size() < 16) {
+        return false;
+    }
+    const char *p = text.data();
+    int year = digits(p, 4);
+    int month = digits(p + 5, 2);
+    int day = digits(p + 8, 2);
+    int hour = digits(p + 11, 2);
+    int minute = digits(p + 14, 2);
+    if (year < 0 || month < 1 || month > 12 || day < 1 || day > 31 || hour < 0 || minute < 0) {
+        return false;
+    }
+    secs = daysFromCivil(year, month, day) * 86400 + hour * 3600 + minute * 60;
+    return true;
+}
+
+// "M" marks a missing value and "T" a trace amount
+float parseNumber(QByteArrayView text)
+{
+    if (text.isEmpty() || text == "M" || text == "T") {
+        return std::numeric_limits<float>::quiet_NaN();
+    }
+    bool ok = false;
+    double value = text.toDouble(&ok);
+    return ok ? float(value) : std::numeric_limits<float>::quiet_NaN();
+}
+
+void splitFields(QByteArrayView line, QVarLengthArray<QByteArrayView, 64> &fields)
+{
+    fields.clear();
+    while (true) {
+        qsizetype comma = line.indexOf(',');
+        if (comma < 0) {
+            fields.append(line);
+            return;
+        }
+        fields.append(line.first(comma));
+        line = line.sliced(comma + 1);
+    }
+}
+
+void appendRow(StationSeries &series, qint64 time, float temperature, float humidity,
+               float windSpeed, float windGust, float visibility, FlightSafety precipitation)
+{
+    series.time.append(time);
+    series.temperature.append(temperature);
+    series.humidity.append(humidity);
+    series.windSpeed.append(windSpeed);
+    series.windGust.append(windGust);
+    series.visibility.append(visibility);
+    series.precipitation.append(quint8(precipitation));
+}
+
+// Restores time order after a merge; a later copy of a timestamp wins
+void sortAndDeduplicate(StationSeries &series)
+{
+    if (std::is_sorted(series.time.cbegin(), series.time.cend())
+        && std::adjacent_find(series.time.cbegin(), series.time.cend()) == series.time.cend()) {
+        return;
+    }
+    
+    QList<qsizetype> order(series.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&series](qsizetype a, qsizetype b) {
+        return series.time[a] < series.time[b];
+    });
+    
+    StationSeries sorted;
+    sorted.stationId = series.stationId;
+    for (qsizetype i = 0; i < order.size(); ++i) {
+        if (i + 1 < order.size() && series.time[order[i]] == series.time[order[i + 1]]) {
+            continue;
+        }
+        qsizetype row = order[i];
+        appendRow(sorted, series.time[row], series.temperature[row], series.humidity[row],
+                  series.windSpeed[row], series.windGust[row], series.visibility[row],
+                  FlightSafety(series.precipitation[row]));
+    }
+    series = std::move(sorted);
+}
+
+struct OffsetChange {
+    qint64 atSecs;
+    int offsetSecs;
+};
+
+// UTC offset history of the station's zone over its archive, resolved up
+// front because QTimeZone lookups per row would dominate the aggregation
+QList<OffsetChange> offsetChanges(const StationSeries &series)
+{
+    QSettings settings("DroneView", "Settings");
+    QByteArray zoneId = settings.value(QString("climatology/%1/timeZone").arg(series.stationId)).toByteArray();
+    QTimeZone zone = zoneId.isEmpty() ? QTimeZone::systemTimeZone() : QTimeZone(zoneId);
+    if (!zone.isValid()) {
+        qDebug() << "Climatology: unknown time zone" << zoneId << "for" << series.stationId << "- using UTC";
+        return {{std::numeric_limits<qint64>::min(), 0}};
+    }
+    
+    QDateTime first = QDateTime::fromSecsSinceEpoch(series.time.first(), Qt::UTC);
+    QDateTime last = QDateTime::fromSecsSinceEpoch(series.time.last(), Qt::UTC);
+    
+    QList<OffsetChange> changes;
+    changes.append({std::numeric_limits<qint64>::min(), zone.offsetFromUtc(first)});
+    for (const QTimeZone::OffsetData &transition : zone.transitions(first, last)) {
+        changes.append({transition.atUtc.toSecsSinceEpoch(), transition.offsetFromUtc});
+    }
+    return changes;
+}
+
+struct Block {
+    int stationIndex;
+    std::shared_ptr<const StationSeries> series;
+    std::shared_ptr<const QList<OffsetChange>> offsets;
+    qsizetype begin;
+    qsizetype end;
+};
+
+ClimatologyTable gradeBlock(const Block &block, const FlightAssessment::Limits &limits)
+{
+    const StationSeries &series = *block.series;
+    const QList<OffsetChange> &offsets = *block.offsets;
+    
+    ClimatologyTable table;
+    table.stationId = series.stationId;
+    
+    auto next = std::upper_bound(offsets.cbegin(), offsets.cend(), series.time[block.begin],
+                                 [](qint64 secs, const OffsetChange &change) { return secs < change.atSecs; });
+    int offset = std::prev(next)->offsetSecs;
+    
+    // Widened for the batch kernels. A missing value compares false and so
+    // grades Safe; gust and humidity are zeroed with the wind or temperature
+    // they qualify so a missing factor is not graded at all.
+    const qsizetype rows = block.end - block.begin;
+    QList<double> windSpeed(rows), windGust(rows), visibility(rows), temperature(rows), humidity(rows);
+    for (qsizetype row = 0; row < rows; ++row) {
+        const qsizetype i = block.begin + row;
+        const float speed = series.windSpeed[i];
+        const float gust = series.windGust[i];
+        const float celsius = series.temperature[i];
+        const float relative = series.humidity[i];
+        windSpeed[row] = speed;
+        windGust[row] = qIsNaN(speed) || qIsNaN(gust) ? 0.0 : gust;
+        visibility[row] = series.visibility[i];
+        temperature[row] = celsius;
+        humidity[row] = qIsNaN(celsius) || qIsNaN(relative) ? 0.0 : relative;
+    }
+    
+    WeatherBatch batch;
+    batch.count = rows;
+    batch.windSpeed = windSpeed.data();
+    batch.windGust = windGust.data();
+    batch.visibility = visibility.data();
+    batch.temperature = temperature.data();
+    batch.humidity = humidity.data();
+    BatchGrades grades;
+    BatchAssessment::assess(batch, limits, grades);
+    
+    for (qsizetype row = 0; row < rows; ++row) {
+        const qsizetype i = block.begin + row;
+        const qint64 time = series.time[i];
+        while (next != offsets.cend() && time >= next->atSecs) {
+            offset = next->offsetSecs;
+            ++next;
+        }
+        
+        // The store holds present weather already graded
+        const FlightSafety precipitation = FlightSafety(series.precipitation[i]);
+        if (qIsNaN(temperature[row]) && qIsNaN(windSpeed[row]) && qIsNaN(visibility[row])
+            && precipitation == FlightSafety::Safe) {
+            continue; // nothing was reported
+        }
+        const FlightSafety safety = FlightConditions::worst(precipitation, grades.overallAt(row));
+        
+        // Round to the nearest hour: a routine report at :53 stands for the hour after it
+        const qint64 local = time + offset + 30 * 60;
+        const qint64 days = local >= 0 ? local / 86400 : (local - 86399) / 86400;
+        const int hour = int((local - days * 86400) / 3600);
+        table.cell(monthFromDays(days), hour).counts[int(safety)]++;
+    }
+    
+    return table;
+}
+
+// Reads the rows from first on of a column the store wrote as a QList of
+// width-byte values, skipping the rest
+template <typename T>
+bool readTail(QDataStream &in, qsizetype rows, qsizetype first, int width, QList<T> &column)
+{
+    quint32 count = 0;
+    in >> count;
+    if (qsizetype(count) != rows || in.skipRawData(first * width) != first * width) {
+        return false;
+    }
+    column.resize(rows - first);
+    for (T &value : column) {
+        in >> value;
+    }
+    return in.status() == QDataStream::Ok;
+}
+
+} // namespace
+
+double ClimatologyCell::flyableFraction() const
+{
+    quint32 total = observations();
+    if (total == 0) {
+        return 0.0;
+    }
+    return double(counts[int(FlightSafety::Safe)] + counts[int(FlightSafety::Caution)]) / total;
+}
+
+Climatology::Climatology(QObject *parent)
+    : QObject(parent)
+{
+}
+
+QString Climatology::storageDirectory()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/climatology";
+}
+
+QString Climatology::seriesPath(const QString &stationId)
+{
+    return storageDirectory() + "/" + stationId + ".dvc";
+}
+
+QStringList Climatology::stations() const
+{
+    QStringList result;
+    const QStringList files = QDir(storageDirectory()).entryList({"*.dvc"}, QDir::Files, QDir::Name);
+    for (const QString &file : files) {
+        result.append(file.chopped(4));
+    }
+    return result;
+}
+
+QFuture<qint64> Climatology::importArchive(const QString &path)
+{
+    return QtConcurrent::run([this, path]() {
+        return importFile(path);
+    });
+}
+
+qint64 Climatology::importFile(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        throw ClimatologyError(QString("Cannot open %1: %2").arg(path, file.errorString()));
+    }
+    
+    std::array<int, ColumnCount> columns;
+    columns.fill(-1);
+    bool haveHeader = false;
+    
+    QHash<QString, StationSeries> imported;
+    QByteArray currentStation;
+    StationSeries *current = nullptr;
+    QVarLengthArray<QByteArrayView, 64> fields;
+    QByteArray buffer(64 * 1024, Qt::Uninitialized);
+    qint64 rows = 0;
+    
+    while (true) {
+        qint64 length = file.readLine(buffer.data(), buffer.size());
+        if (length <= 0) {
+            break;
+        }
+        
+        QByteArrayView line(buffer.constData(), length);
+        while (!line.isEmpty() && (line.back() == '\n' || line.back() == '\r')) {
+            line.chop(1);
+        }
+        // The service prefixes debug output with '#'
+        if (line.isEmpty() || line.front() == '#') {
+            continue;
+        }
+        
+        splitFields(line, fields);
+        
+        if (!haveHeader) {
+            for (int i = 0; i < fields.size(); ++i) {
+                for (int column = 0; column < ColumnCount; ++column) {
+                    if (fields[i].trimmed() == kColumnNames[column]) {
+                        columns[column] = i;
+                    }
+                }
+            }
+            if (columns[Station] < 0 || columns[Valid] < 0) {
+                throw ClimatologyError(QString("%1 is not an IEM ASOS archive (no station/valid columns)").arg(path));
+            }
+            haveHeader = true;
+            continue;
+        }
+        
+        auto field = [&fields, &columns](Column column) {
+            int index = columns[column];
+            return index >= 0 && index < fields.size() ? fields[index] : QByteArrayView();
+        };
+        
+        qint64 time = 0;
+        if (!parseValid(field(Valid), time)) {
+            continue;
+        }
+        
+        QByteArrayView station = field(Station);
+        if (station.isEmpty()) {
+            continue;
+        }
+        // Archives are grouped by station, so the lookup rarely changes
+        if (!current || station != currentStation) {
+            currentStation = station.toByteArray();
+            QString stationId = QString::fromLatin1(currentStation).toUpper();
+            // IEM drops the K of US identifiers; keep ICAO ids throughout
+            if (stationId.size() == 3) {
+                stationId.prepend('K');
+            }
+            current = &imported[stationId];
+            current->stationId = stationId;
+        }
+        
+        float temperatureF = parseNumber(field(Tmpf));
+        float visibility = parseNumber(field(Vsby));
+        appendRow(*current, time,
+                  qIsNaN(temperatureF) ? temperatureF : (temperatureF - 32.0f) * 5.0f / 9.0f,
+                  parseNumber(field(Relh)),
+                  parseNumber(field(Sknt)),
+                  parseNumber(field(Gust)),
+                  visibility,
+                  WeatherPhenomena::grade(WeatherPhenomena::decode(field(Wxcodes))));
+        rows++;
+    }
+    
+    if (!haveHeader) {
+        throw ClimatologyError(QString("%1 is empty").arg(path));
+    }
+    
+    QMutexLocker importLocker(&m_importMutex);
+    QDir().mkpath(storageDirectory());
+    
+    for (auto it = imported.begin(); it != imported.end(); ++it) {
+        StationSeries &fresh = it.value();
+        
+        std::shared_ptr<const StationSeries> existing = series(it.key());
+        StationSeries merged = existing ? *existing : StationSeries();
+        merged.stationId = it.key();
+        merged.time.append(fresh.time);
+        merged.temperature.append(fresh.temperature);
+        merged.humidity.append(fresh.humidity);
+        merged.windSpeed.append(fresh.windSpeed);
+        merged.windGust.append(fresh.windGust);
+        merged.visibility.append(fresh.visibility);
+        merged.precipitation.append(fresh.precipitation);
+        sortAndDeduplicate(merged);
+        
+        if (!saveSeries(merged)) {
+            throw ClimatologyError(QString("Cannot write climatology store for %1").arg(it.key()));
+        }
+        
+        QMutexLocker locker(&m_mutex);
+        m_series.insert(it.key(), std::make_shared<const StationSeries>(std::move(merged)));
+    }
+    
+    qDebug() << "Climatology: imported" << rows << "rows for" << imported.size() << "stations from" << path;
+    emit stationsChanged();
+    return rows;
+}
+
+std::shared_ptr<const StationSeries> Climatology::series(const QString &stationId)
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        auto it = m_series.constFind(stationId);
+        if (it != m_series.constEnd()) {
+            return it.value();
+        }
+    }
+    
+    std::shared_ptr<const StationSeries> loaded = loadSeries(stationId);
+    if (loaded) {
+        QMutexLocker locker(&m_mutex);
+        m_series.insert(stationId, loaded);
+    }
+    return loaded;
+}
+
+std::shared_ptr<StationSeries> Climatology::loadSeries(const QString &stationId)
+{
+    QFile file(seriesPath(stationId));
+    if (!file.open(QIODevice::ReadOnly)) {
+        return nullptr;
+    }
+    
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_6_0);
+    in.setFloatingPointPrecision(QDataStream::SinglePrecision);
+    
+    quint32 magic = 0;
+    qint32 version = 0;
+    in >> magic >> version;
+    if (magic != kStoreMagic || version != kStoreVersion) {
+        qDebug() << "Climatology: ignoring store with unknown format" << file.fileName();
+        return nullptr;
+    }
+    
+    auto series = std::make_shared<StationSeries>();
+    in >> series->stationId >> series->time >> series->temperature >> series->humidity
+       >> series->windSpeed >> series->windGust >> series->visibility >> series->precipitation;
+    
+    const qsizetype rows = series->time.size();
+    if (in.status() != QDataStream::Ok
+        || series->temperature.size() != rows || series->humidity.size() != rows
+        || series->windSpeed.size() != rows || series->windGust.size() != rows
+        || series->visibility.size() != rows || series->precipitation.size() != rows) {
+        qDebug() << "Climatology: corrupt store" << file.fileName();
+        return nullptr;
+    }
+    return series;
+}
+
+std::shared_ptr<const StationSeries> Climatology::recentSeries(const QString &stationId, qint64 since)
+{
+    QFile file(seriesPath(stationId));
+    if (!file.open(QIODevice::ReadOnly)) {
+        return nullptr;
+    }
+    
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_6_0);
+    in.setFloatingPointPrecision(QDataStream::SinglePrecision);
+    
+    quint32 magic = 0;
+    qint32 version = 0;
+    in >> magic >> version;
+    if (magic != kStoreMagic || version != kStoreVersion) {
+        qDebug() << "Climatology: ignoring store with unknown format" << file.fileName();
+        return nullptr;
+    }
+    
+    auto series = std::make_shared<StationSeries>();
+    quint32 rows = 0;
+    in >> series->stationId >> rows;
+    if (in.status() != QDataStream::Ok || file.pos() + qint64(rows) * qint64(sizeof(qint64)) > file.size()) {
+        qDebug() << "Climatology: corrupt store" << file.fileName();
+        return nullptr;
+    }
+    
+    // The time column is sorted, so the first recent row is found by seeking
+    const qint64 times = file.pos();
+    qsizetype first = 0;
+    qsizetype last = rows;
+    while (first < last && in.status() == QDataStream::Ok) {
+        const qsizetype middle = (first + last) / 2;
+        qint64 time = 0;
+        file.seek(times + middle * qint64(sizeof(qint64)));
+        in >> time;
+        if (time < since) {
+            first = middle + 1;
+        } else {
+            last = middle;
+        }
+    }
+    
+    file.seek(times + first * qint64(sizeof(qint64)));
+    series->time.resize(rows - first);
+    for (qint64 &time : series->time) {
+        in >> time;
+    }
+    if (!readTail(in, rows, first, 4, series->temperature) || !readTail(in, rows, first, 4, series->humidity)
+        || !readTail(in, rows, first, 4, series->windSpeed) || !readTail(in, rows, first, 4, series->windGust)
+        || !readTail(in, rows, first, 4, series->visibility) || !readTail(in, rows, first, 1, series->precipitation)) {
+        qDebug() << "Climatology: corrupt store" << file.fileName();
+        return nullptr;
+    }
+    return series;
+}
+
+bool Climatology::saveSeries(const StationSeries &series)
+{
+    QSaveFile file(seriesPath(series.stationId));
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_6_0);
+    out.setFloatingPointPrecision(QDataStream::SinglePrecision);
+    out << kStoreMagic << kStoreVersion;
+    out << series.stationId << series.time << series.temperature << series.humidity
+        << series.windSpeed << series.windGust << series.visibility << series.precipitation;
+    
+    return out.status() == QDataStream::Ok && file.commit();
+}
+
+QFuture<QList<ClimatologyTable>> Climatology::aggregate(const QStringList &stationIds,
+                                                        const FlightAssessment::Limits &limits)
+{
+    // Loading the stores and finding their offset changes are the slow part
+    // for a cold cache, so they run on the pool too, ahead of the grading
+    auto prepared = QtConcurrent::run([this, stationIds]() {
+        // Fixed-size row blocks, so one long archive still spreads over every core
+        QList<Block> blocks;
+        for (int i = 0; i < stationIds.size(); ++i) {
+            std::shared_ptr<const StationSeries> stationSeries = series(stationIds[i]);
+            if (!stationSeries || stationSeries->size() == 0) {
+                continue;
+            }
+            
+            auto offsets = std::make_shared<const QList<OffsetChange>>(offsetChanges(*stationSeries));
+            for (qsizetype begin = 0; begin < stationSeries->size(); begin += kBlockRows) {
+                blocks.append({i, stationSeries, offsets, begin, qMin(begin + kBlockRows, stationSeries->size())});
+            }
+        }
+        return blocks;
+    });
+    
+    using Partials = QMap<int, ClimatologyTable>;
+    
+    return prepared.then([limits](const QList<Block> &blocks) {
+            return QtConcurrent::mappedReduced<Partials>(
+                blocks,
+                [limits](const Block &block) {
+                    return std::make_pair(block.stationIndex, gradeBlock(block, limits));
+                },
+                [](Partials &result, const std::pair<int, ClimatologyTable> &partial) {
+                    ClimatologyTable &table = result[partial.first];
+                    table.stationId = partial.second.stationId;
+                    for (size_t cell = 0; cell < table.cells.size(); ++cell) {
+                        for (size_t level = 0; level < table.cells[cell].counts.size(); ++level) {
+                            table.cells[cell].counts[level] += partial.second.cells[cell].counts[level];
+                        }
+                    }
+                });
+        })
+        .unwrap()
+        .then([stationIds](const Partials &partials) {
+            QList<ClimatologyTable> tables;
+            tables.reserve(stationIds.size());
+            for (int i = 0; i < stationIds.size(); ++i) {
+                ClimatologyTable table = partials.value(i);
+                table.stationId = stationIds[i];
+                tables.append(table);
+            }
+            return tables;
+        });
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <QObject>
+#include <QFuture>
+#include <QException>
+#include <QHash>
+#include <QMutex>
+#include <array>
+#include <memory>
+#include "flightconditions.h"
+
+// Error carried by futures returned from Climatology
+class ClimatologyError : public QException
+{
+public:
+    explicit ClimatologyError(const QString &message)
+        : m_message(message), m_what(message.toUtf8()) {}
+    
+    QString message() const { return m_message; }
+    const char *what() const noexcept override { return m_what.constData(); }
+    void raise() const override { throw *this; }
+    ClimatologyError *clone() const override { return new ClimatologyError(*this); }
+
+private:
+    QString m_message;
+    QByteArray m_what;
+};
+
+// One station's archive stored column by column. Missing values are NaN.
+struct StationSeries {
+    QString stationId;
+    QList<qint64> time;          // UTC seconds since epoch, ascending
+    QList<float> temperature;    // °C
+    QList<float> humidity;       // %
+    QList<float> windSpeed;      // kts
+    QList<float> windGust;       // kts
+    QList<float> visibility;     // statute miles
+    QList<quint8> precipitation; // FlightSafety of the present weather codes
+    
+    qsizetype size() const { return time.size(); }
+};
+
+struct ClimatologyCell {
+    std::array<quint32, 4> counts = {}; // indexed by FlightSafety
+    
+    quint32 observations() const { return counts[0] + counts[1] + counts[2] + counts[3]; }
+    // Share of observations graded Safe or Caution
+    double flyableFraction() const;
+};
+
+struct ClimatologyTable {
+    QString stationId;
+    std::array<ClimatologyCell, 12 * 24> cells; // month x local hour of day
+    
+    ClimatologyCell &cell(int month, int hour) { return cells[(month - 1) * 24 + hour]; }
+    const ClimatologyCell &cell(int month, int hour) const { return cells[(month - 1) * 24 + hour]; }
+};
+
+// Historical flyability from IEM ASOS/METAR archive downloads. Imports are
+// merged into a per-station columnar store under AppDataLocation; hours are
+// local to the station's zone (setting climatology/<ID>/timeZone, IANA id,
+// defaulting to the system zone).
+class Climatology : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit Climatology(QObject *parent = nullptr);
+    
+    // Stream-parses a CSV from the IEM ASOS download service (any number of
+    // stations) on a worker thread. Resolves with the number of rows imported.
+    QFuture<qint64> importArchive(const QString &path);
+    
+    QStringList stations() const;
+    
+    // Loads the stores and grades every stored observation against limits,
+    // all on the thread pool. One table per requested station, in order;
+    // unknown stations stay empty.
+    QFuture<QList<ClimatologyTable>> aggregate(const QStringList &stationIds,
+                                               const FlightAssessment::Limits &limits);
+    
+    // A station's stored archive, loaded on first use; null when none was imported
+    std::shared_ptr<const StationSeries> series(const QString &stationId);
+    // Only the rows from since (UTC seconds) on, read from the store without
+    // loading or caching the rest; blocks on file I/O, so call it off the
+    // GUI thread
+    static std::shared_ptr<const StationSeries> recentSeries(const QString &stationId, qint64 since);
+    
+    static QString storageDirectory();
+
+signals:
+    void stationsChanged();
+
+private:
+    qint64 importFile(const QString &path);
+    static std::shared_ptr<StationSeries> loadSeries(const QString &stationId);
+    static bool saveSeries(const StationSeries &series);
+    static QString seriesPath(const QString &stationId);
+    
+    mutable QMutex m_mutex;
+    QHash<QString, std::shared_ptr<const StationSeries>> m_series;
+    QMutex m_importMutex; // one merge at a time per store
+};
@@ -0,0 +1,286 @@
+#include "corridorsampler.h"
+#include "weatherphenomena.h"
+#include "ephemeris.h"
+#include <QDateTime>
+#include <QtMath>
+#include <cmath>
+#include <limits>
+
+namespace {
+
+const double kEarthRadiusKm = 6371.0088;
+const double kCoincidentKm = 0.05;    // a sample this close takes the station's values as is
+const int kMaxNearest = 8;
+const int kMaxCachedSegments = 4096;
+
+size_t segmentKey(const CorridorPoint &from, const CorridorPoint &to)
+{
+    return qHashMulti(0, from.latitude, from.longitude, from.altitude,
+                      to.latitude, to.longitude, to.altitude);
+}
+
+} // namespace
+
+CorridorSampler::CorridorSampler()
+    : m_thresholds(FlightAssessment::Limits())
+    , m_terrain(WindProfile::Terrain::Open)
+    , m_nearestCount(3)
+    , m_spacingKm(1.0)
+    , m_version(0)
+    , m_observationHash(0)
+    , m_pathHash(0)
+{
+}
+
+void CorridorSampler::setObservations(const QList<WeatherData> &observations)
+{
+    size_t hash = 0;
+    for (const WeatherData &data : observations) {
+        hash = qHashMulti(hash, data.stationId, data.timestamp.toMSecsSinceEpoch(),
+                          data.latitude, data.longitude, data.windSpeed, data.windGust,
+                          data.visibility, data.ceiling, data.phenomena, data.cloudCover);
+    }
+    if (hash == m_observationHash) {
+        return;
+    }
+    
+    m_stations.clear();
+    m_stations.reserve(observations.size());
+    const qint64 now = QDateTime::currentSecsSinceEpoch();
+    for (const WeatherData &data : observations) {
+        if (data.latitude == 0.0 && data.longitude == 0.0) {
+            continue; // position unknown
+        }
+        const double lat = qDegreesToRadians(data.latitude);
+        const qint64 observed = data.timestamp.isValid() ? data.timestamp.toSecsSinceEpoch() : now;
+        const bool daytime = Ephemeris::sunElevation(data.latitude, data.longitude, observed) > 0.0;
+        m_stations.append({data.stationId, data.latitude, data.longitude, std::sin(lat), std::cos(lat),
+                           data.windSpeed, data.windGust, data.visibility, data.ceiling, data.phenomena,
+                           WindProfile::estimateStability(data.windSpeed, data.cloudCover, daytime)});
+    }
+    m_observationHash = hash;
+    invalidate();
+}
+
+void CorridorSampler::setLimits(const FlightAssessment::Limits &limits)
+{
+    m_thresholds = FlightThresholds(limits);
+    invalidate();
+}
+
+void CorridorSampler::setTerrain(WindProfile::Terrain terrain)
+{
+    m_terrain = terrain;
+    invalidate();
+}
+
+void CorridorSampler::setNearestCount(int count)
+{
+    m_nearestCount = qBound(1, count, kMaxNearest);
+    invalidate();
+}
+
+void CorridorSampler::setSpacingKm(double spacingKm)
+{
+    m_spacingKm = qMax(0.1, spacingKm);
+    invalidate();
+}
+
+void CorridorSampler::invalidate()
+{
+    ++m_version;
+    m_segmentCache.clear();
+    m_pathHash = 0;
+    m_lastResult = CorridorResult();
+}
+
+CorridorResult CorridorSampler::sample(const QList<CorridorPoint> &path)
+{
+    if (path.size() < 2 || m_stations.isEmpty()) {
+        return CorridorResult();
+    }
+    
+    QList<size_t> keys;
+    keys.reserve(path.size() - 1);
+    for (qsizetype i = 1; i < path.size(); ++i) {
+        keys.append(segmentKey(path[i - 1], path[i]));
+    }
+    const size_t pathHash = qHashRange(keys.cbegin(), keys.cend(), size_t(m_version));
+    if (pathHash == m_pathHash && !m_lastResult.isEmpty()) {
+        CorridorResult result = m_lastResult;
+        result.recomputed = 0;
+        return result;
+    }
+    
+    if (m_segmentCache.size() > kMaxCachedSegments) {
+        m_segmentCache.clear();
+    }
+    
+    CorridorResult result;
+    result.segments.reserve(keys.size());
+    for (qsizetype i = 0; i < keys.size(); ++i) {
+        auto cached = m_segmentCache.constFind(keys[i]);
+        if (cached == m_segmentCache.constEnd()) {
+            cached = m_segmentCache.insert(keys[i], gradeSegment(path[i], path[i + 1]));
+            ++result.recomputed;
+        }
+        result.segments.append(cached.value());
+        result.lengthKm += cached->lengthKm;
+        result.overall = FlightConditions::worst(result.overall, cached->grade);
+    }
+    
+    m_pathHash = pathHash;
+    m_lastResult = result;
+    return result;
+}
+
+CorridorSegment CorridorSampler::gradeSegment(const CorridorPoint &from, const CorridorPoint &to) const
+{
+    CorridorSegment segment;
+    segment.from = from;
+    segment.to = to;
+    segment.lengthKm = distanceKm(from.latitude, from.longitude, to.latitude, to.longitude);
+    segment.trueCourse = bearing(from.latitude, from.longitude, to.latitude, to.longitude);
+    segment.visibility = std::numeric_limits<double>::max();
+    
+    // Unit vectors of the endpoints for spherical interpolation
+    const double lat1 = qDegreesToRadians(from.latitude);
+    const double lon1 = qDegreesToRadians(from.longitude);
+    const double lat2 = qDegreesToRadians(to.latitude);
+    const double lon2 = qDegreesToRadians(to.longitude);
+    const double x1 = std::cos(lat1) * std::cos(lon1), y1 = std::cos(lat1) * std::sin(lon1), z1 = std::sin(lat1);
+    const double x2 = std::cos(lat2) * std::cos(lon2), y2 = std::cos(lat2) * std::sin(lon2), z2 = std::sin(lat2);
+    const double angle = segment.lengthKm / kEarthRadiusKm;
+    const double sinAngle = std::sin(angle);
+    
+    const int steps = qMax(1, int(std::ceil(segment.lengthKm / m_spacingKm)));
+    for (int step = 0; step <= steps; ++step) {
+        const double f = double(step) / steps;
+        double latitude = from.latitude;
+        double longitude = from.longitude;
+        if (sinAngle > 1e-12) {
+            const double a = std::sin((1.0 - f) * angle) / sinAngle;
+            const double b = std::sin(f * angle) / sinAngle;
+            const double x = a * x1 + b * x2;
+            const double y = a * y1 + b * y2;
+            const double z = a * z1 + b * z2;
+            latitude = qRadiansToDegrees(std::atan2(z, std::sqrt(x * x + y * y)));
+            longitude = qRadiansToDegrees(std::atan2(y, x));
+        }
+        const double altitude = from.altitude + f * (to.altitude - from.altitude);
+        
+        Sample sample = interpolate(latitude, longitude, segment.stations);
+        double windSpeed = 0.0;
+        double windGust = 0.0;
+        WindProfile(m_terrain, sample.stability).project(sample.windSpeed, sample.windGust, &altitude, 1,
+                                                         &windSpeed, &windGust);
+        
+        segment.windSpeed = qMax(segment.windSpeed, windSpeed);
+        segment.windGust = qMax(segment.windGust, windGust);
+        segment.visibility = qMin(segment.visibility, sample.visibility);
+        segment.phenomena |= sample.phenomena;
+        if (!qIsNaN(sample.ceiling) && (qIsNaN(segment.ceiling) || sample.ceiling < segment.ceiling)) {
+            segment.ceiling = sample.ceiling;
+        }
+        
+        FlightSafety grade = FlightConditions::gradeWind(windSpeed, windGust, m_thresholds);
+        grade = FlightConditions::worst(grade, FlightConditions::gradeVisibility(sample.visibility, m_thresholds));
+        grade = FlightConditions::worst(grade, FlightConditions::gradeCeiling(sample.ceiling, altitude));
+        segment.grade = FlightConditions::worst(segment.grade, grade);
+    }
+    
+    segment.grade = FlightConditions::worst(segment.grade, WeatherPhenomena::grade(segment.phenomena));
+    return segment;
+}
+
+CorridorSampler::Sample CorridorSampler::interpolate(double latitude, double longitude, QStringList &stations) const
+{
+    // k nearest by insertion into a short sorted array
+    int nearest[kMaxNearest];
+    double distances[kMaxNearest];
+    int found = 0;
+    
+    const double lat = qDegreesToRadians(latitude);
+    const double sinLat = std::sin(lat);
+    const double cosLat = std::cos(lat);
+    for (int i = 0; i < m_stations.size(); ++i) {
+        const Station &station = m_stations[i];
+        // Spherical law of cosines; the sines and cosines of the station are cached
+        const double cosine = sinLat * station.sinLat
+            + cosLat * station.cosLat * std::cos(qDegreesToRadians(longitude - station.longitude));
+        const double distance = kEarthRadiusKm * std::acos(qBound(-1.0, cosine, 1.0));
+        
+        if (found == m_nearestCount && distance >= distances[found - 1]) {
+            continue;
+        }
+        int slot = found < m_nearestCount ? found++ : found - 1;
+        while (slot > 0 && distances[slot - 1] > distance) {
+            distances[slot] = distances[slot - 1];
+            nearest[slot] = nearest[slot - 1];
+            --slot;
+        }
+        distances[slot] = distance;
+        nearest[slot] = i;
+    }
+    
+    for (int i = 0; i < found; ++i) {
+        if (!stations.contains(m_stations[nearest[i]].id)) {
+            stations.append(m_stations[nearest[i]].id);
+        }
+    }
+    
+    // Present weather and stability are not interpolated: the nearest report stands
+    Sample sample;
+    sample.phenomena = m_stations[nearest[0]].phenomena;
+    sample.stability = m_stations[nearest[0]].stability;
+    if (distances[0] < kCoincidentKm) {
+        found = 1;
+    }
+    
+    double weightSum = 0.0;
+    double ceilingWeightSum = 0.0;
+    double ceiling = 0.0;
+    for (int i = 0; i < found; ++i) {
+        const Station &station = m_stations[nearest[i]];
+        const double weight = 1.0 / qMax(distances[i] * distances[i], kCoincidentKm * kCoincidentKm);
+        weightSum += weight;
+        sample.windSpeed += weight * station.windSpeed;
+        sample.windGust += weight * station.windGust;
+        sample.visibility += weight * station.visibility;
+        // A station without a ceiling reports none rather than zero
+        if (station.ceiling > 0.0) {
+            ceilingWeightSum += weight;
+            ceiling += weight * station.ceiling;
+        }
+    }
+    
+    sample.windSpeed /= weightSum;
+    sample.windGust /= weightSum;
+    sample.visibility /= weightSum;
+    if (ceilingWeightSum > 0.0) {
+        sample.ceiling = ceiling / ceilingWeightSum;
+    }
+    return sample;
+}
+
+double CorridorSampler::distanceKm(double lat1, double lon1, double lat2, double lon2)
+{
+    // Haversine, stable for the short legs of a flight plan
+    const double dLat = qDegreesToRadians(lat2 - lat1);
+    const double dLon = qDegreesToRadians(lon2 - lon1);
+    const double a = std::sin(dLat / 2.0) * std::sin(dLat / 2.0)
+        + std::cos(qDegreesToRadians(lat1)) * std::cos(qDegreesToRadians(lat2))
+        * std::sin(dLon / 2.0) * std::sin(dLon / 2.0);
+    return 2.0 * kEarthRadiusKm * std::atan2(std::sqrt(a), std::sqrt(1.0 - a));
+}
+
+double CorridorSampler::bearing(double lat1, double lon1, double lat2, double lon2)
+{
+    const double phi1 = qDegreesToRadians(lat1);
+    const double phi2 = qDegreesToRadians(lat2);
+    const double dLon = qDegreesToRadians(lon2 - lon1);
+    const double y = std::sin(dLon) * std::cos(phi2);
+    const double x = std::cos(phi1) * std::sin(phi2) - std::sin(phi1) * std::cos(phi2) * std::cos(dLon);
+    const double degrees = qRadiansToDegrees(std::atan2(y, x));
+    return degrees < 0.0 ? degrees + 360.0 : degrees;
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <QHash>
+#include <QList>
+#include <QStringList>
+#include "flightconditions.h"
+
+struct CorridorPoint {
+    double latitude = 0.0;
+    double longitude = 0.0;
+    double altitude = 0.0; // m AGL
+};
+
+// One leg of the plan between two consecutive points. Values are the worst
+// interpolated along the leg, in WeatherData units; ceiling is NaN when no
+// nearby station reports one.
+struct CorridorSegment {
+    CorridorPoint from;
+    CorridorPoint to;
+    double lengthKm = 0.0;
+    double trueCourse = 0.0; // initial great-circle bearing, degrees
+    double windSpeed = 0.0;
+    double windGust = 0.0;
+    double visibility = 0.0;
+    double ceiling = qQNaN();
+    quint32 phenomena = 0;
+    FlightSafety grade = FlightSafety::Safe;
+    QStringList stations; // contributing stations, nearest first
+};
+
+struct CorridorResult {
+    QList<CorridorSegment> segments;
+    FlightSafety overall = FlightSafety::Safe;
+    double lengthKm = 0.0;
+    int recomputed = 0; // segments graded by this call rather than taken from the cache
+    
+    bool isEmpty() const { return segments.isEmpty(); }
+};
+
+// Grades a multi-leg flight path against the weather of the stations around
+// it. Each leg is densified along the great circle; every sample takes the
+// inverse-distance weighted wind, visibility and ceiling of its nearest
+// stations, and projects the wind to the sample's altitude under the
+// stability of the nearest one, as FlightConditions does. Legs are cached by their endpoints for the current observation
+// version, so re-checking an edited plan only regrades the legs that moved.
+class CorridorSampler
+{
+public:
+    CorridorSampler();
+    
+    // Bumps the observation version unless the set is unchanged
+    void setObservations(const QList<WeatherData> &observations);
+    void setLimits(const FlightAssessment::Limits &limits);
+    void setTerrain(WindProfile::Terrain terrain);
+    void setNearestCount(int count);
+    void setSpacingKm(double spacingKm);
+    
+    quint64 observationVersion() const { return m_version; }
+    bool hasObservations() const { return !m_stations.isEmpty(); }
+    
+    CorridorResult sample(const QList<CorridorPoint> &path);
+    
+    static double distanceKm(double lat1, double lon1, double lat2, double lon2);
+    // Initial true course from the first point to the second, in [0, 360)
+    static double bearing(double lat1, double lon1, double lat2, double lon2);
+
+private:
+    struct Station {
+        QString id;
+        double latitude;
+        double longitude;
+        double sinLat; // cached for the great-circle distance
+        double cosLat;
+        double windSpeed;
+        double windGust;
+        double visibility;
+        double ceiling;
+        quint32 phenomena;
+        WindProfile::Stability stability; // at the observation time
+    };
+    
+    struct Sample {
+        double windSpeed = 0.0;
+        double windGust = 0.0;
+        double visibility = 0.0;
+        double ceiling = qQNaN();
+        quint32 phenomena = 0;
+        WindProfile::Stability stability = WindProfile::Stability::D;
+    };
+    
+    Sample interpolate(double latitude, double longitude, QStringList &stations) const;
+    CorridorSegment gradeSegment(const CorridorPoint &from, const CorridorPoint &to) const;
+    void invalidate();
+    
+    QList<Station> m_stations;
+    FlightThresholds m_thresholds;
+    WindProfile::Terrain m_terrain;
+    int m_nearestCount;
+    double m_spacingKm;
+    
+    quint64 m_version;
+    size_t m_observationHash;
+    QHash<size_t, CorridorSegment> m_segmentCache;
+    size_t m_pathHash;
+    CorridorResult m_lastResult;
+};
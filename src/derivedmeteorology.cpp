@@ -0,0 +1,134 @@
+#include "derivedmeteorology.h"
+#include "weatherphenomena.h"
+#include <QStringList>
+#include <cmath>
+
+namespace DerivedMeteorology {
+
+namespace {
+
+// Magnus coefficients over water, as used for the METAR humidity
+const double kMagnusA = 17.625;
+const double kMagnusB = 243.04;
+const double kMagnusE0 = 6.1094; // hPa
+
+IcingRisk icingRisk(double temperature, double spread, quint32 phenomena)
+{
+    using namespace WeatherPhenomena;
+    
+    if ((phenomena & Freezing) && (phenomena & (kPrecipitation | Fog))) {
+        return IcingRisk::Severe;
+    }
+    if (qIsNaN(temperature) || temperature > 2.0 || temperature < -20.0) {
+        return IcingRisk::None;
+    }
+    
+    // Supercooled water needs visible moisture: precipitation, fog or a
+    // saturated layer near the surface
+    bool precipitation = phenomena & kPrecipitation;
+    bool moisture = precipitation || (phenomena & (Mist | Fog)) || (!qIsNaN(spread) && spread <= 3.0);
+    if (!moisture) {
+        return IcingRisk::None;
+    }
+    if (temperature <= 0.0 && temperature >= -10.0 && (precipitation || spread <= 1.0)) {
+        return IcingRisk::Moderate;
+    }
+    return IcingRisk::Light;
+}
+
+double feelsLike(double temperature, double humidity, double windKts)
+{
+    const double windKmh = windKts * 1.852;
+    if (temperature <= 10.0 && windKmh > 4.8) {
+        // Environment Canada / NWS wind chill
+        const double v = std::pow(windKmh, 0.16);
+        return 13.12 + 0.6215 * temperature - 11.37 * v + 0.3965 * temperature * v;
+    }
+    if (temperature >= 26.7 && humidity >= 40.0) {
+        // Rothfusz heat index regression, in °F
+        const double t = temperature * 9.0 / 5.0 + 32.0;
+        const double r = humidity;
+        const double hi = -42.379 + 2.04901523 * t + 10.14333127 * r - 0.22475541 * t * r
+            - 6.83783e-3 * t * t - 5.481717e-2 * r * r + 1.22874e-3 * t * t * r
+            + 8.5282e-4 * t * r * r - 1.99e-6 * t * t * r * r;
+        return (hi - 32.0) * 5.0 / 9.0;
+    }
+    return temperature;
+}
+
+} // namespace
+
+void apply(WeatherData *observations, qsizetype count)
+{
+    for (qsizetype i = 0; i < count; ++i) {
+        WeatherData &data = observations[i];
+        const double temperature = data.temperature;
+        
+        // Vapour pressure from the dewpoint, or the dewpoint from humidity
+        double vapour = qQNaN();
+        if (!qIsNaN(data.dewpoint)) {
+            vapour = kMagnusE0 * std::exp(kMagnusA * data.dewpoint / (kMagnusB + data.dewpoint));
+        } else if (data.humidity > 0.0) {
+            // gamma is the Magnus exponent of the dewpoint
+            const double gamma = std::log(data.humidity / 100.0) + kMagnusA * temperature / (kMagnusB + temperature);
+            vapour = kMagnusE0 * std::exp(gamma);
+            data.dewpoint = kMagnusB * gamma / (kMagnusA - gamma);
+        }
+        const double spread = temperature - data.dewpoint;
+        
+        // Pressure altitude from the altimeter setting, then density altitude
+        // from the virtual temperature at station pressure
+        const double elevationFt = data.elevation * 3.28084;
+        const double pressureAltitude = data.altimeter > 0.0
+            ? elevationFt + (29.92 - data.altimeter) * 1000.0
+            : elevationFt;
+        const double stationPressure = 1013.25 * std::pow(1.0 - 6.8756e-6 * pressureAltitude, 5.2559);
+        const double vapourRatio = qIsNaN(vapour) ? 0.0 : 0.379 * vapour / stationPressure;
+        const double virtualTemperature = (temperature + 273.15) / (1.0 - vapourRatio);
+        data.densityAltitude = 145442.16 * (1.0 - std::pow(stationPressure / 1013.25 * 288.15 / virtualTemperature, 0.234969));
+        
+        // Convective cloud base: about 400 ft per °C of spread
+        data.cloudBase = qIsNaN(spread) ? qQNaN() : qMax(0.0, spread * 400.0);
+        data.icingRisk = quint8(icingRisk(temperature, spread, data.phenomena));
+        
+        if (!data.provenance.contains("feelsLike")) {
+            data.feelsLike = feelsLike(temperature, data.humidity, data.windSpeed);
+        }
+        if (!data.provenance.contains("cloudCover") && !data.skyCover.isEmpty()) {
+            data.cloudCover = cloudCoverFromSky(data.skyCover);
+        }
+    }
+}
+
+double cloudCoverFromSky(const QString &skyCover)
+{
+    double cover = 0.0;
+    const QStringList layers = skyCover.split(',', Qt::SkipEmptyParts);
+    for (const QString &layer : layers) {
+        QString amount = layer.trimmed().section(' ', 0, 0).toUpper();
+        // Midpoints of the okta ranges
+        if (amount == "FEW") {
+            cover = qMax(cover, 18.75);
+        } else if (amount == "SCT") {
+            cover = qMax(cover, 43.75);
+        } else if (amount == "BKN") {
+            cover = qMax(cover, 75.0);
+        } else if (amount == "OVC" || amount == "VV" || amount == "OVX") {
+            cover = 100.0;
+        }
+    }
+    return cover;
+}
+
+QString icingRiskName(IcingRisk risk)
+{
+    switch (risk) {
+    case IcingRisk::None: return "None";
+    case IcingRisk::Light: return "Light";
+    case IcingRisk::Moderate: return "Moderate";
+    case IcingRisk::Severe: return "Severe";
+    }
+    return QString();
+}
+
+} // namespace DerivedMeteorology
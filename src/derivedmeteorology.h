@@ -0,0 +1,29 @@
+#pragma once
+
+#include <QString>
+#include "weatherservice.h"
+
+// Quantities computed from the observed ones rather than reported: density
+// altitude, estimated cloud base, feels-like temperature, icing potential
+// and cloud cover from the sky layers
+namespace DerivedMeteorology {
+
+enum class IcingRisk : quint8 {
+    None,
+    Light,
+    Moderate,
+    Severe
+};
+
+// Fills the derived fields of every observation in one pass. feelsLike and
+// cloudCover are only filled in when no provider reported them.
+void apply(WeatherData *observations, qsizetype count);
+inline void apply(WeatherData &observation) { apply(&observation, 1); }
+
+// Cover of the most opaque layer in a skyCover string such as
+// "SCT at 2500 ft, BKN at 8000 ft", in percent
+double cloudCoverFromSky(const QString &skyCover);
+
+QString icingRiskName(IcingRisk risk);
+
+} // namespace DerivedMeteorology
@@ -0,0 +1,198 @@
+#include "droneprofiles.h"
+#include "weatherphenomena.h"
+#include "operatingrules.h"
+#include <QStandardPaths>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QSaveFile>
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QDebug>
+
+namespace {
+
+DroneProfile makeProfile(const QString &id, const QString &name, double maxWindSpeed, double maxWindGust,
+                         double minTemperature, double maxTemperature)
+{
+    DroneProfile profile;
+    profile.id = id;
+    profile.name = name;
+    profile.limits.maxWindSpeed = maxWindSpeed;
+    profile.limits.maxWindGust = maxWindGust;
+    profile.limits.minVisibility = 4.83; // 3 statute miles, Part 107
+    profile.limits.minTemperature = minTemperature;
+    profile.limits.maxTemperature = maxTemperature;
+    profile.thresholds = FlightThresholds(profile.limits);
+    return profile;
+}
+
+DroneProfile profileFromJson(const QJsonObject &object)
+{
+    DroneProfile profile;
+    FlightAssessment::Limits &limits = profile.limits;
+    profile.id = object["id"].toString();
+    profile.name = object["name"].toString(profile.id);
+    limits.maxWindSpeed = object["maxWindSpeed"].toDouble(limits.maxWindSpeed);
+    limits.maxWindGust = object["maxWindGust"].toDouble(limits.maxWindGust);
+    limits.minVisibility = object["minVisibility"].toDouble(limits.minVisibility);
+    limits.minTemperature = object["minTemperature"].toDouble(limits.minTemperature);
+    limits.maxTemperature = object["maxTemperature"].toDouble(limits.maxTemperature);
+    limits.maxHumidity = object["maxHumidity"].toDouble(limits.maxHumidity);
+    profile.thresholds = FlightThresholds(limits);
+    profile.nightOperations = object["nightOperations"].toBool(profile.nightOperations);
+    return profile;
+}
+
+QJsonObject profileToJson(const DroneProfile &profile)
+{
+    QJsonObject object;
+    object["id"] = profile.id;
+    object["name"] = profile.name;
+    object["maxWindSpeed"] = profile.limits.maxWindSpeed;
+    object["maxWindGust"] = profile.limits.maxWindGust;
+    object["minVisibility"] = profile.limits.minVisibility;
+    object["minTemperature"] = profile.limits.minTemperature;
+    object["maxTemperature"] = profile.limits.maxTemperature;
+    object["maxHumidity"] = profile.limits.maxHumidity;
+    object["nightOperations"] = profile.nightOperations;
+    return object;
+}
+
+} // namespace
+
+DroneProfileLibrary::DroneProfileLibrary(QObject *parent)
+    : QObject(parent)
+{
+}
+
+QList<DroneProfile> DroneProfileLibrary::defaultProfiles()
+{
+    // Manufacturer wind resistance ratings; gust limits leave some margin
+    return {
+        makeProfile("mini", "DJI Mini 4 Pro", 10.7, 12.0, -10.0, 40.0),
+        makeProfile("mavic", "DJI Mavic 3", 12.0, 15.0, -10.0, 40.0),
+        makeProfile("matrice", "DJI Matrice 350 RTK", 12.0, 17.0, -20.0, 50.0),
+        makeProfile("vtol", "Fixed-wing VTOL", 12.0, 18.0, -10.0, 40.0),
+    };
+}
+
+QString DroneProfileLibrary::storagePath()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/droneprofiles.json";
+}
+
+bool DroneProfileLibrary::load()
+{
+    QFile file(storagePath());
+    if (!file.exists()) {
+        m_profiles = defaultProfiles();
+        saveProfiles(m_profiles);
+        emit profilesChanged();
+        return true;
+    }
+    
+    if (!file.open(QIODevice::ReadOnly)) {
+        qDebug() << "DroneProfileLibrary: cannot read" << file.fileName() << file.errorString();
+        return false;
+    }
+    
+    QJsonParseError error;
+    QJsonDocument document = QJsonDocument::fromJson(file.readAll(), &error);
+    if (error.error != QJsonParseError::NoError) {
+        qDebug() << "DroneProfileLibrary:" << file.fileName() << error.errorString();
+        return false;
+    }
+    
+    QList<DroneProfile> profiles;
+    const QJsonArray entries = document.object()["profiles"].toArray();
+    for (const QJsonValue &entry : entries) {
+        DroneProfile profile = profileFromJson(entry.toObject());
+        if (!profile.id.isEmpty()) {
+            profiles.append(profile);
+        }
+    }
+    
+    m_profiles = profiles;
+    emit profilesChanged();
+    return true;
+}
+
+bool DroneProfileLibrary::saveProfiles(const QList<DroneProfile> &profiles)
+{
+    QJsonArray entries;
+    for (const DroneProfile &profile : profiles) {
+        entries.append(profileToJson(profile));
+    }
+    QJsonObject root;
+    root["profiles"] = entries;
+    
+    QDir().mkpath(QFileInfo(storagePath()).absolutePath());
+    QSaveFile file(storagePath());
+    if (!file.open(QIODevice::WriteOnly)) {
+        qDebug() << "DroneProfileLibrary: cannot write" << file.fileName() << file.errorString();
+        return false;
+    }
+    file.write(QJsonDocument(root).toJson());
+    return file.commit();
+}
+
+void DroneProfileLibrary::setOperatingAltitude(double altitude, WindProfile::Terrain terrain)
+{
+    m_altitude = altitude;
+    m_terrain = terrain;
+}
+
+QList<FleetStatus> DroneProfileLibrary::assess(const WeatherData &weather) const
+{
+    const FlightSafety precipitation = WeatherPhenomena::grade(weather.phenomena);
+    const FlightSafety icing = FlightSafety(qMin<int>(weather.icingRisk, int(FlightSafety::NoFly)));
+    const FlightSafety ceiling = FlightConditions::gradeCeiling(weather.ceiling > 0.0 ? weather.ceiling : qQNaN(), m_altitude);
+    
+    const bool located = weather.latitude != 0.0 || weather.longitude != 0.0;
+    const qint64 time = (weather.timestamp.isValid() ? weather.timestamp : QDateTime::currentDateTimeUtc()).toSecsSinceEpoch();
+    const double sunElevation = located ? Ephemeris::sunElevation(weather.latitude, weather.longitude, time) : qQNaN();
+    const Daylight daylight = !located || sunElevation > Ephemeris::kSunriseElevation ? Daylight::Day
+        : sunElevation > Ephemeris::kCivilTwilightElevation ? Daylight::CivilTwilight : Daylight::Night;
+    
+    // The same projection FlightConditions grades the current profile with
+    WindProfile windProfile(m_terrain, WindProfile::estimateStability(weather.windSpeed, weather.cloudCover,
+                                                                      sunElevation > 0.0));
+    double windSpeed = 0.0;
+    double windGust = 0.0;
+    windProfile.project(weather.windSpeed, weather.windGust, &m_altitude, 1, &windSpeed, &windGust);
+    
+    // Only the profile id differs between airframes
+    const bool hasRules = m_rules && !m_rules->isEmpty();
+    RuleInputs inputs;
+    if (hasRules) {
+        inputs = RuleInputs::from(weather, QStringView(), m_altitude, sunElevation);
+    }
+    
+    QList<FleetStatus> fleet;
+    fleet.reserve(m_profiles.size());
+    for (const DroneProfile &profile : m_profiles) {
+        FleetStatus status;
+        status.profileId = profile.id;
+        status.name = profile.name;
+        status.wind = FlightConditions::gradeWind(windSpeed, windGust, profile.thresholds);
+        status.visibility = FlightConditions::gradeVisibility(weather.visibility, profile.thresholds);
+        status.precipitation = precipitation;
+        status.ceiling = ceiling;
+        status.temperature = FlightConditions::worst(
+            FlightConditions::gradeTemperature(weather.temperature, weather.humidity, profile.thresholds), icing);
+        // Without a position the sun is unknown and, as in FlightConditions, not graded
+        status.daylight = FlightConditions::gradeDaylight(daylight, m_nightOperations && profile.nightOperations);
+        if (hasRules) {
+            inputs.profile = profile.id;
+            status.rules = m_rules->grade(inputs);
+        }
+        status.overall = FlightConditions::worst(FlightConditions::worst(status.wind, status.visibility),
+                                                 FlightConditions::worst(status.precipitation, status.temperature));
+        status.overall = FlightConditions::worst(status.overall, FlightConditions::worst(status.ceiling, status.daylight));
+        status.overall = FlightConditions::worst(status.overall, status.rules);
+        fleet.append(status);
+    }
+    return fleet;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <QObject>
+#include <QList>
+#include "flightconditions.h"
+
+// One airframe's operating envelope. limits keep the values as written in
+// the profile file (m/s, km, °C); thresholds are the same envelope
+// converted once into observation units for grading. nightOperations is
+// cleared for airframes without anti-collision lighting, which stay grounded
+// after civil twilight even under a night waiver.
+struct DroneProfile {
+    QString id;
+    QString name;
+    FlightAssessment::Limits limits;
+    FlightThresholds thresholds;
+    bool nightOperations = true;
+};
+
+// One airframe's row of the fleet go/no-go matrix
+struct FleetStatus {
+    QString profileId;
+    QString name;
+    FlightSafety wind = FlightSafety::Safe;
+    FlightSafety visibility = FlightSafety::Safe;
+    FlightSafety precipitation = FlightSafety::Safe;
+    FlightSafety temperature = FlightSafety::Safe;
+    FlightSafety ceiling = FlightSafety::Safe;
+    FlightSafety daylight = FlightSafety::Safe;
+    FlightSafety rules = FlightSafety::Safe; // worst matching operating rule
+    FlightSafety overall = FlightSafety::Safe;
+    
+    bool canFly() const { return overall <= FlightSafety::Caution; }
+};
+
+// The fleet's airframes, loaded from droneprofiles.json under AppDataLocation.
+// The file is seeded with a default mixed fleet the first time it is missing.
+class DroneProfileLibrary : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit DroneProfileLibrary(QObject *parent = nullptr);
+    
+    bool load();
+    QList<DroneProfile> profiles() const { return m_profiles; }
+    // Checked for every airframe under its own profile id
+    void setOperatingRules(std::shared_ptr<const RuleProgram> rules) { m_rules = std::move(rules); }
+    // Wind is graded at this height (m AGL), as in FlightConditions; the
+    // rules see it too
+    void setOperatingAltitude(double altitude, WindProfile::Terrain terrain);
+    // The operator's night waiver, as in FlightConditions
+    void setNightOperations(bool allowed) { m_nightOperations = allowed; }
+    
+    // Grades one observation against every airframe in a single pass. Wind
+    // aloft, icing, present weather and the ceiling do not depend on the
+    // airframe, so they are worked out only once.
+    QList<FleetStatus> assess(const WeatherData &weather) const;
+    
+    static QList<DroneProfile> defaultProfiles();
+    static QString storagePath();
+
+signals:
+    void profilesChanged();
+
+private:
+    static bool saveProfiles(const QList<DroneProfile> &profiles);
+    
+    QList<DroneProfile> m_profiles;
+    std::shared_ptr<const RuleProgram> m_rules;
+    double m_altitude = WindProfile::kReferenceHeight;
+    WindProfile::Terrain m_terrain = WindProfile::Terrain::Open;
+    bool m_nightOperations = false;
+};
@@ -0,0 +1,238 @@
+#include "ephemeris.h"
+#include <QtMath>
+#include <cmath>
+#include <vector>
+
+namespace {
+
+const double kDegrees = M_PI / 180.0;
+const double kSiderealDegreesPerDay = 360.98564736629;
+const double kSolarDegreesPerDay = 360.0; // rate of the sun's hour angle
+
+// Time-dependent terms of the sun's position
+struct SolarTerms {
+    double sinDeclination;
+    double cosDeclination;
+    double hourAngle; // Greenwich hour angle, radians
+};
+
+SolarTerms solarTerms(double utcSecs)
+{
+    const double n = utcSecs / 86400.0 - 10957.5; // days since J2000.0
+    const double meanLongitude = 280.460 + 0.9856474 * n;
+    const double meanAnomaly = (357.528 + 0.9856003 * n) * kDegrees;
+    const double eclipticLongitude = (meanLongitude + 1.915 * std::sin(meanAnomaly)
+                                      + 0.020 * std::sin(2.0 * meanAnomaly)) * kDegrees;
+    const double obliquity = (23.439 - 0.0000004 * n) * kDegrees;
+    
+    const double sinLongitude = std::sin(eclipticLongitude);
+    const double rightAscension = std::atan2(std::cos(obliquity) * sinLongitude, std::cos(eclipticLongitude));
+    const double sinDeclination = std::sin(obliquity) * sinLongitude;
+    const double siderealTime = std::fmod(280.46061837 + kSiderealDegreesPerDay * n, 360.0) * kDegrees;
+    
+    return {sinDeclination, std::sqrt(1.0 - sinDeclination * sinDeclination), siderealTime - rightAscension};
+}
+
+// Wraps an angle in degrees to (-180, 180]
+double wrap180(double degrees)
+{
+    degrees = std::fmod(degrees, 360.0);
+    if (degrees > 180.0) {
+        degrees -= 360.0;
+    } else if (degrees <= -180.0) {
+        degrees += 360.0;
+    }
+    return degrees;
+}
+
+QDateTime fromSecs(double secs)
+{
+    return QDateTime::fromSecsSinceEpoch(qint64(std::llround(secs)), Qt::UTC);
+}
+
+// Coefficients of one timestamp: sin(elevation) = sinLat * a + cosLat * (cosLon * b - sinLon * c)
+struct TimeTerm {
+    double a; // sin δ
+    double b; // cos δ cos GHA
+    double c; // cos δ sin GHA
+};
+
+TimeTerm timeTerm(double utcSecs)
+{
+    const SolarTerms terms = solarTerms(utcSecs);
+    return {terms.sinDeclination,
+            terms.cosDeclination * std::cos(terms.hourAngle),
+            terms.cosDeclination * std::sin(terms.hourAngle)};
+}
+
+// A site's trigonometry, computed once however many times are evaluated
+struct SiteTerms {
+    double sinLatitude;
+    double cosLatitude;
+    double sinLongitude;
+    double cosLongitude;
+    
+    SiteTerms(double latitude, double longitude)
+        : sinLatitude(std::sin(latitude * kDegrees))
+        , cosLatitude(std::cos(latitude * kDegrees))
+        , sinLongitude(std::sin(longitude * kDegrees))
+        , cosLongitude(std::cos(longitude * kDegrees))
+    {
+    }
+};
+
+inline double sinElevationAt(const SiteTerms &site, double a, double b, double c)
+{
+    // cos δ cos H of the local hour angle H = GHA + λ
+    const double cosHour = site.cosLongitude * b - site.sinLongitude * c;
+    return site.sinLatitude * a + site.cosLatitude * cosHour;
+}
+
+inline double elevationAt(const SiteTerms &site, double a, double b, double c)
+{
+    return std::asin(qBound(-1.0, sinElevationAt(site, a, b, c), 1.0)) / kDegrees;
+}
+
+inline double azimuthAt(const SiteTerms &site, double a, double b, double c)
+{
+    const double cosHour = site.cosLongitude * b - site.sinLongitude * c;
+    const double sinHour = site.cosLongitude * c + site.sinLongitude * b;
+    // Clockwise from north
+    const double degrees = std::atan2(-sinHour, a * site.cosLatitude - cosHour * site.sinLatitude) / kDegrees;
+    return degrees < 0.0 ? degrees + 360.0 : degrees;
+}
+
+const double kSinSunrise = std::sin(Ephemeris::kSunriseElevation * kDegrees);
+const double kSinCivilTwilight = std::sin(Ephemeris::kCivilTwilightElevation * kDegrees);
+
+// Daylight from the sine of the elevation, so no inverse trigonometry
+inline quint8 daylightAt(double sinElevation)
+{
+    return quint8(sinElevation > kSinCivilTwilight) + quint8(sinElevation > kSinSunrise);
+}
+
+// The coefficients of a run of timestamps, for the batch calls
+struct TimeTable {
+    std::vector<double> a;
+    std::vector<double> b;
+    std::vector<double> c;
+    
+    TimeTable(qint64 startSecs, int stepSecs, qsizetype count)
+        : a(count), b(count), c(count)
+    {
+        for (qsizetype t = 0; t < count; ++t) {
+            const TimeTerm term = timeTerm(double(startSecs) + double(t) * stepSecs);
+            a[t] = term.a;
+            b[t] = term.b;
+            c[t] = term.c;
+        }
+    }
+};
+
+} // namespace
+
+double Ephemeris::sunElevation(double latitude, double longitude, qint64 utcSecs)
+{
+    const TimeTerm term = timeTerm(double(utcSecs));
+    return elevationAt(SiteTerms(latitude, longitude), term.a, term.b, term.c);
+}
+
+void Ephemeris::sunPosition(double latitude, double longitude, qint64 utcSecs, double &elevation, double &azimuth)
+{
+    const TimeTerm term = timeTerm(double(utcSecs));
+    const SiteTerms site(latitude, longitude);
+    elevation = elevationAt(site, term.a, term.b, term.c);
+    azimuth = azimuthAt(site, term.a, term.b, term.c);
+}
+
+Daylight Ephemeris::daylight(double latitude, double longitude, qint64 utcSecs)
+{
+    const TimeTerm term = timeTerm(double(utcSecs));
+    return Daylight(daylightAt(sinElevationAt(SiteTerms(latitude, longitude), term.a, term.b, term.c)));
+}
+
+SunEvents Ephemeris::events(double latitude, double longitude, const QDate &date)
+{
+    SunEvents result;
+    if (!date.isValid()) {
+        return result;
+    }
+    
+    // Transit: the local hour angle GHA + longitude crosses zero
+    double noon = double(QDateTime(date, QTime(12, 0), Qt::UTC).toSecsSinceEpoch()) - longitude / 15.0 * 3600.0;
+    for (int i = 0; i < 3; ++i) {
+        SolarTerms terms = solarTerms(noon);
+        double hourAngle = wrap180(terms.hourAngle / kDegrees + longitude);
+        noon -= hourAngle / kSolarDegreesPerDay * 86400.0;
+    }
+    result.solarNoon = fromSecs(noon);
+    
+    const double sinLatitude = std::sin(latitude * kDegrees);
+    const double cosLatitude = std::cos(latitude * kDegrees);
+    
+    // Hour angle of the given elevation, refined once with the declination
+    // at the first estimate; side is -1 before noon and +1 after
+    auto crossing = [&](double elevation, double side) -> QDateTime {
+        const double sinElevation = std::sin(elevation * kDegrees);
+        double time = noon;
+        for (int i = 0; i < 2; ++i) {
+            SolarTerms terms = solarTerms(time);
+            double cosHourAngle = (sinElevation - sinLatitude * terms.sinDeclination)
+                / (cosLatitude * terms.cosDeclination);
+            if (cosHourAngle < -1.0 || cosHourAngle > 1.0) {
+                return QDateTime();
+            }
+            time = noon + side * std::acos(cosHourAngle) / kDegrees / kSolarDegreesPerDay * 86400.0;
+        }
+        return fromSecs(time);
+    };
+    
+    result.civilDawn = crossing(kCivilTwilightElevation, -1.0);
+    result.sunrise = crossing(kSunriseElevation, -1.0);
+    result.sunset = crossing(kSunriseElevation, 1.0);
+    result.civilDusk = crossing(kCivilTwilightElevation, 1.0);
+    return result;
+}
+
+void Ephemeris::sunPositions(const EphemerisSites &sites, qint64 startSecs, int stepSecs, qsizetype timeCount,
+                             double *elevation, double *azimuth)
+{
+    const TimeTable table(startSecs, stepSecs, timeCount);
+    const double *a = table.a.data();
+    const double *b = table.b.data();
+    const double *c = table.c.data();
+    
+    for (qsizetype index = 0; index < sites.count; ++index) {
+        const SiteTerms site(sites.latitude[index], sites.longitude[index]);
+        double *elevationRow = elevation + index * timeCount;
+        for (qsizetype t = 0; t < timeCount; ++t) {
+            elevationRow[t] = elevationAt(site, a[t], b[t], c[t]);
+        }
+        
+        if (!azimuth) {
+            continue;
+        }
+        double *azimuthRow = azimuth + index * timeCount;
+        for (qsizetype t = 0; t < timeCount; ++t) {
+            azimuthRow[t] = azimuthAt(site, a[t], b[t], c[t]);
+        }
+    }
+}
+
+void Ephemeris::classify(const EphemerisSites &sites, qint64 startSecs, int stepSecs, qsizetype timeCount,
+                         quint8 *daylight)
+{
+    const TimeTable table(startSecs, stepSecs, timeCount);
+    const double *a = table.a.data();
+    const double *b = table.b.data();
+    const double *c = table.c.data();
+    
+    // Compared as sines, so the inner loop has no inverse trigonometry
+    for (qsizetype index = 0; index < sites.count; ++index) {
+        const SiteTerms site(sites.latitude[index], sites.longitude[index]);
+        quint8 *row = daylight + index * timeCount;
+        for (qsizetype t = 0; t < timeCount; ++t) {
+            row[t] = daylightAt(sinElevationAt(site, a[t], b[t], c[t]));
+        }
+    }
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <QDateTime>
+
+enum class Daylight : quint8 {
+    Night,
+    CivilTwilight, // sun between 6° below the horizon and sunrise/sunset
+    Day
+};
+
+// Struct-of-arrays sites, count entries in every array, in degrees
+struct EphemerisSites {
+    qsizetype count = 0;
+    const double *latitude = nullptr;
+    const double *longitude = nullptr;
+};
+
+// UTC times of one day's solar events; invalid when the event does not
+// happen, as in polar day or night
+struct SunEvents {
+    QDateTime civilDawn;
+    QDateTime sunrise;
+    QDateTime solarNoon;
+    QDateTime sunset;
+    QDateTime civilDusk;
+};
+
+// Sun position from the Astronomical Almanac's low-precision formulae,
+// good to about 0.01° between 1950 and 2050. Elevations are geometric;
+// sunrise and sunset use the conventional -0.833° for refraction and the
+// solar disc. The batch calls evaluate the time-dependent terms once per
+// timestamp and share them across sites, leaving a few multiply-adds per
+// site and time that the compiler vectorizes. The single-instant calls
+// work on the stack and never allocate, so per-report assessment can use
+// them.
+class Ephemeris
+{
+public:
+    static constexpr double kSunriseElevation = -0.833;
+    static constexpr double kCivilTwilightElevation = -6.0;
+    
+    static double sunElevation(double latitude, double longitude, qint64 utcSecs);
+    static void sunPosition(double latitude, double longitude, qint64 utcSecs, double &elevation, double &azimuth);
+    static Daylight daylight(double latitude, double longitude, qint64 utcSecs);
+    // Events of the solar day whose noon falls nearest midday UTC of date at
+    // the site's longitude
+    static SunEvents events(double latitude, double longitude, const QDate &date);
+    
+    // timeCount timestamps from startSecs, stepSecs apart, for every site.
+    // Outputs are site-major: index site * timeCount + time. azimuth may be
+    // null; it costs an atan2 per value.
+    static void sunPositions(const EphemerisSites &sites, qint64 startSecs, int stepSecs, qsizetype timeCount,
+                             double *elevation, double *azimuth = nullptr);
+    static void classify(const EphemerisSites &sites, qint64 startSecs, int stepSecs, qsizetype timeCount,
+                         quint8 *daylight);
+};
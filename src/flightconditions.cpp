@@ -2,166 +2,483 @@
 // most drones have a 19 sustained wind and 25 gusting and temp ranges from 32 to 104
 
 #include "flightconditions.h"
+#include "weatherphenomena.h"
+#include "derivedmeteorology.h"
+#include "assessmentstatemachine.h"
+#include "operatingrules.h"
 #include <QDebug>
+#include <algorithm>
+
+FlightThresholds::FlightThresholds(const FlightAssessment::Limits &limits)
+{
+    double maxWind = limits.maxWindSpeed * 1.94384;
+    double maxGust = limits.maxWindGust * 1.94384;
+    double minVisibility = limits.minVisibility / 1.60934;
+    
+    windCaution = maxWind * 0.7;
+    windUnsafe = maxWind;
+    windNoFly = maxWind * 1.5;
+    gustCaution = maxGust;
+    gustUnsafe = maxGust * 1.3;
+    visibilityCaution = minVisibility * 1.5;
+    visibilityUnsafe = minVisibility;
+    visibilityNoFly = minVisibility * 0.5;
+    minTemperature = limits.minTemperature;
+    maxTemperature = limits.maxTemperature;
+    maxHumidity = limits.maxHumidity;
+}
+
+namespace {
+
+QString fahrenheit(double celsius)
+{
+    return QString("%1°F").arg((celsius * 9.0 / 5.0) + 32.0, 0, 'f', 1);
+}
+
+QString factorName(FlightFactor factor)
+{
+    switch (factor) {
+    case FlightFactor::Wind: return "Wind";
+    case FlightFactor::Visibility: return "Visibility";
+    case FlightFactor::Precipitation: return "Precipitation";
+    case FlightFactor::Temperature: return "Temperature";
+    case FlightFactor::Ceiling: return "Ceiling";
+    }
+    return QString();
+}
+
+QString safetyName(FlightSafety safety)
+{
+    switch (safety) {
+    case FlightSafety::Safe: return "safe";
+    case FlightSafety::Caution: return "caution";
+    case FlightSafety::Unsafe: return "unsafe";
+    case FlightSafety::NoFly: return "no fly";
+    }
+    return QString();
+}
+
+} // namespace
+
+QString FlightFinding::text(const RuleProgram *rules) const
+{
+    switch (code) {
+    case FindingCode::HighWind:
+        return QString("High wind speed: %1 kts (limit: %2 kts)").arg(measured, 0, 'f', 1).arg(limit, 0, 'f', 1);
+    case FindingCode::HighGust:
+        return QString("High wind gusts: %1 kts (limit: %2 kts)").arg(measured, 0, 'f', 1).arg(limit, 0, 'f', 1);
+    case FindingCode::WindNearLimit:
+        return "Monitor wind conditions closely";
+    case FindingCode::LowVisibility:
+        return QString("Low visibility: %1 mi (minimum: %2 mi)").arg(measured, 0, 'f', 1).arg(limit, 0, 'f', 1);
+    case FindingCode::ReducedVisibility:
+        return "Reduced visibility - maintain closer visual contact";
+    case FindingCode::PresentWeather:
+        return WeatherPhenomena::describe(detail)
+            + ((detail & WeatherPhenomena::Vicinity) ? " in the vicinity" : "") + " detected";
+    case FindingCode::LowTemperature:
+        return QString("Temperature too low: %1 (minimum: %2)").arg(fahrenheit(measured), fahrenheit(limit));
+    case FindingCode::HighTemperature:
+        return QString("Temperature too high: %1 (maximum: %2)").arg(fahrenheit(measured), fahrenheit(limit));
+    case FindingCode::HighHumidity:
+        return QString("High humidity: %1% (maximum: %2%)").arg(measured, 0, 'f', 0).arg(limit, 0, 'f', 0);
+    case FindingCode::Icing:
+        return QString("%1 airframe icing risk").arg(DerivedMeteorology::icingRiskName(DerivedMeteorology::IcingRisk(detail)));
+    case FindingCode::Darkness:
+        if (detail == quint32(Daylight::CivilTwilight)) {
+            return "Civil twilight - anti-collision lighting visible for 3 SM required";
+        }
+        return QString("Night: sun %1° below the horizon - Part 107 night rules apply").arg(-measured, 0, 'f', 0);
+    case FindingCode::OperatingRule:
+        if (rules && int(detail) < rules->size()) {
+            return QString("Operating rule: %1").arg(rules->rule(int(detail)).name);
+        }
+        return QString("Operating rule %1 matched").arg(detail + 1);
+    case FindingCode::LowCeiling:
+        return QString("Low ceiling: %1 ft AGL (500 ft clearance needs %2 ft)").arg(measured, 0, 'f', 0).arg(limit, 0, 'f', 0);
+    case FindingCode::Held:
+        if (measured < 0.0) {
+            return QString("%1 held at %2 until it clears the release margin")
+                .arg(factorName(FlightFactor(detail)), safetyName(severity));
+        }
+        return QString("%1 held at %2: better conditions for %3 of %4 min")
+            .arg(factorName(FlightFactor(detail)), safetyName(severity))
+            .arg(int(measured / 60.0)).arg(int(limit / 60.0));
+    }
+    return QString();
+}
+
+QString FlightAssessment::overallMessage() const
+{
+    switch (overall) {
+    case FlightSafety::Safe: return "Conditions are SAFE for drone operations";
+    case FlightSafety::Caution: return "CAUTION advised - monitor conditions closely";
+    case FlightSafety::Unsafe: return "Conditions are UNSAFE - flight not recommended";
+    case FlightSafety::NoFly: return "NO FLY - Dangerous conditions present";
+    }
+    return QString();
+}
+
+QStringList FlightAssessment::warnings() const
+{
+    QStringList result;
+    for (int i = 0; i < findingCount; ++i) {
+        if (!findings[i].isAdvisory()) {
+            result.append(findings[i].text(rules.get()));
+        }
+    }
+    return result;
+}
+
+QStringList FlightAssessment::recommendations() const
+{
+    QStringList result;
+    for (int i = 0; i < findingCount; ++i) {
+        if (findings[i].isAdvisory()) {
+            result.append(findings[i].text(rules.get()));
+        }
+    }
+    
+    switch (overall) {
+    case FlightSafety::Safe:
+        break;
+    case FlightSafety::Caution:
+        result << "Consider postponing non-essential flights" << "Maintain visual line of sight at all times";
+        break;
+    case FlightSafety::Unsafe:
+        result << "Wait for improved weather conditions" << "Monitor weather updates frequently";
+        break;
+    case FlightSafety::NoFly:
+        result << "Do not attempt flight operations" << "Secure all equipment";
+        break;
+    }
+    return result;
+}
 
 FlightConditions::FlightConditions(QObject *parent)
     : QObject(parent)
+    , m_thresholds(m_assessment.limits)
+    , m_altitude(WindProfile::kReferenceHeight)
+    , m_terrain(WindProfile::Terrain::Open)
+    , m_nightOperations(false)
+    , m_sunElevation(0.0)
+    , m_stateMachine(new AssessmentStateMachine)
+    , m_now(0)
+    , m_categoryChanged(false)
+    , m_daylight(Daylight::Day)
+    , m_matchedRules{}
+    , m_matchedRuleCount(0)
 {
 }
 
+FlightConditions::~FlightConditions() = default;
+
 void FlightConditions::setLimits(const FlightAssessment::Limits &limits)
 {
     m_assessment.limits = limits;
+    m_thresholds = FlightThresholds(limits);
+    m_stateMachine->reset(); // old categories say nothing about new limits
+}
+
+void FlightConditions::setOperatingAltitude(double altitude, WindProfile::Terrain terrain)
+{
+    m_altitude = altitude;
+    m_terrain = terrain;
+    m_stateMachine->reset();
 }
 
 void FlightConditions::assessConditions(const WeatherData &weather)
 {
-    m_assessment.warnings.clear();
-    m_assessment.recommendations.clear();
+    m_assessment.clearFindings();
+    m_releaseThresholds = m_stateMachine->releaseThresholds(m_thresholds);
+    m_categoryChanged = false;
+    const FlightSafety previousOverall = m_assessment.overall;
+    
+    // Dwell times run on observation time: a partial and a refined report
+    // of the same observation are one sample, not two minutes apart
+    QDateTime observed = weather.timestamp.isValid() ? weather.timestamp : QDateTime::currentDateTimeUtc();
+    m_now = observed.toSecsSinceEpoch();
+    m_sunElevation = Ephemeris::sunElevation(weather.latitude, weather.longitude, m_now);
     
     m_assessment.wind = assessWindConditions(weather);
     m_assessment.visibility = assessVisibilityConditions(weather);
     m_assessment.precipitation = assessPrecipitationConditions(weather);
     m_assessment.temperature = assessTemperatureConditions(weather);
+    m_assessment.ceiling = assessCeilingConditions(weather);
     
-    m_assessment.overall = determineOverallSafety();
-    
-    switch (m_assessment.overall) {
-    case FlightSafety::Safe:
-        m_assessment.overallMessage = "Conditions are SAFE for drone operations";
-        break;
-    case FlightSafety::Caution:
-        m_assessment.overallMessage = "CAUTION advised - monitor conditions closely";
-        m_assessment.recommendations.append("Consider postponing non-essential flights");
-        m_assessment.recommendations.append("Maintain visual line of sight at all times");
-        break;
-    case FlightSafety::Unsafe:
-        m_assessment.overallMessage = "Conditions are UNSAFE - flight not recommended";
-        m_assessment.recommendations.append("Wait for improved weather conditions");
-        m_assessment.recommendations.append("Monitor weather updates frequently");
-        break;
-    case FlightSafety::NoFly:
-        m_assessment.overallMessage = "NO FLY - Dangerous conditions present";
-        m_assessment.recommendations.append("Do not attempt flight operations");
-        m_assessment.recommendations.append("Secure all equipment");
-        break;
+    m_assessment.overall = worst(determineOverallSafety(), assessDaylight(weather));
+    m_assessment.overall = worst(m_assessment.overall, assessOperatingRules(weather));
+    if (m_assessment.overall != previousOverall) {
+        m_categoryChanged = true;
     }
     
     emit assessmentUpdated(m_assessment);
+    if (m_categoryChanged) {
+        emit safetyChanged(m_assessment);
+    }
 }
 
-FlightSafety FlightConditions::assessWindConditions(const WeatherData &weather)
+FlightSafety FlightConditions::settle(FlightFactor factor, FlightSafety raw, FlightSafety release)
 {
-    if (weather.windSpeed > m_assessment.limits.maxWindSpeed * 1.94384) {
-        m_assessment.warnings.append(QString("High wind speed: %1 kts (limit: %2 kts)")
-                                    .arg(weather.windSpeed, 0, 'f', 1)
-                                    .arg(m_assessment.limits.maxWindSpeed * 1.94384, 0, 'f', 1));
-        
-        if (weather.windSpeed > m_assessment.limits.maxWindSpeed * 1.94384 * 1.5) {
-            return FlightSafety::NoFly;
-        } else {
-            return FlightSafety::Unsafe;
-        }
+    if (m_stateMachine->update(factor, raw, release, m_now)) {
+        m_categoryChanged = true;
     }
     
-    if (weather.windGust > m_assessment.limits.maxWindGust * 1.94384) {
-        m_assessment.warnings.append(QString("High wind gusts: %1 kts (limit: %2 kts)")
-                                    .arg(weather.windGust, 0, 'f', 1)
-                                    .arg(m_assessment.limits.maxWindGust * 1.94384, 0, 'f', 1));
-        
-        if (weather.windGust > m_assessment.limits.maxWindGust * 1.94384 * 1.3) {
-            return FlightSafety::Unsafe;
-        } else {
-            return FlightSafety::Caution;
-        }
+    // The findings above describe the raw grade; say why the factor is
+    // still reported worse than that
+    const FlightSafety held = m_stateMachine->state(factor);
+    if (held != raw) {
+        const qint64 since = m_stateMachine->relaxingSince(factor);
+        m_assessment.addFinding({FindingCode::Held, held, quint32(factor), since < 0 ? -1.0 : double(qMax<qint64>(0, m_now - since)),
+                                 double(m_stateMachine->hysteresis(factor).dwellSeconds)});
     }
-    
-    if (weather.windSpeed > m_assessment.limits.maxWindSpeed * 1.94384 * 0.7) {
-        m_assessment.recommendations.append("Monitor wind conditions closely");
+    return held;
+}
+
+FlightSafety FlightConditions::gradeWind(double windSpeed, double windGust, const FlightThresholds &thresholds)
+{
+    if (windSpeed > thresholds.windUnsafe) {
+        return windSpeed > thresholds.windNoFly ? FlightSafety::NoFly : FlightSafety::Unsafe;
+    }
+    if (windGust > thresholds.gustCaution) {
+        return windGust > thresholds.gustUnsafe ? FlightSafety::Unsafe : FlightSafety::Caution;
+    }
+    if (windSpeed > thresholds.windCaution) {
+        return FlightSafety::Caution;
+    }
+    return FlightSafety::Safe;
+}
+
+FlightSafety FlightConditions::gradeVisibility(double visibility, const FlightThresholds &thresholds)
+{
+    if (visibility < thresholds.visibilityUnsafe) {
+        return visibility < thresholds.visibilityNoFly ? FlightSafety::NoFly : FlightSafety::Unsafe;
+    }
+    if (visibility < thresholds.visibilityCaution) {
+        return FlightSafety::Caution;
+    }
+    return FlightSafety::Safe;
+}
+
+FlightSafety FlightConditions::gradeTemperature(double temperature, double humidity, const FlightThresholds &thresholds)
+{
+    if (temperature < thresholds.minTemperature || temperature > thresholds.maxTemperature) {
+        return FlightSafety::Unsafe;
+    }
+    if (humidity > thresholds.maxHumidity) {
         return FlightSafety::Caution;
     }
+    return FlightSafety::Safe;
+}
+
+FlightSafety FlightConditions::gradeCeiling(double ceiling, double altitude)
+{
+    if (qIsNaN(ceiling)) {
+        return FlightSafety::Safe;
+    }
     
+    // Keep the 500 ft VFR clearance below cloud
+    const double altitudeFt = altitude * 3.28084;
+    if (ceiling <= altitudeFt) {
+        return FlightSafety::Unsafe;
+    }
+    if (ceiling < altitudeFt + 500.0) {
+        return FlightSafety::Caution;
+    }
     return FlightSafety::Safe;
 }
 
-FlightSafety FlightConditions::assessVisibilityConditions(const WeatherData &weather)
+FlightSafety FlightConditions::gradeDaylight(Daylight daylight, bool nightOperations)
+{
+    switch (daylight) {
+    case Daylight::Day:
+        return FlightSafety::Safe;
+    case Daylight::CivilTwilight:
+        return FlightSafety::Caution;
+    case Daylight::Night:
+        return nightOperations ? FlightSafety::Caution : FlightSafety::Unsafe;
+    }
+    return FlightSafety::Safe;
+}
+
+FlightSafety FlightConditions::gradeIcing(quint8 icingRisk)
+{
+    return FlightSafety(qMin<int>(icingRisk, int(FlightSafety::NoFly)));
+}
+
+void FlightConditions::projectWind(const WeatherData &weather, double altitude, WindProfile::Terrain terrain,
+                                   double sunElevation, double &windSpeed, double &windGust)
 {
-    if (weather.visibility < m_assessment.limits.minVisibility / 1.60934) {
-        m_assessment.warnings.append(QString("Low visibility: %1 mi (minimum: %2 mi)")
-                                    .arg(weather.visibility, 0, 'f', 1)
-                                    .arg(m_assessment.limits.minVisibility / 1.60934, 0, 'f', 1));
-        
-        if (weather.visibility < m_assessment.limits.minVisibility / 1.60934 * 0.5) {
-            return FlightSafety::NoFly;
-        } else {
-            return FlightSafety::Unsafe;
+    // Insolation drives the daytime stability classes
+    WindProfile profile(terrain, WindProfile::estimateStability(weather.windSpeed, weather.cloudCover,
+                                                                sunElevation > 0.0));
+    profile.project(weather.windSpeed, weather.windGust, &altitude, 1, &windSpeed, &windGust);
+}
+
+FlightSafety FlightConditions::gradeWeather(const WeatherData &weather, const GradingContext &context)
+{
+    const FlightThresholds &thresholds = context.thresholds;
+    
+    double windSpeed = 0.0;
+    double windGust = 0.0;
+    projectWind(weather, context.altitude, context.terrain, context.sunElevation, windSpeed, windGust);
+    
+    FlightSafety safety = gradeWind(windSpeed, windGust, thresholds);
+    safety = worst(safety, gradeVisibility(weather.visibility, thresholds));
+    safety = worst(safety, WeatherPhenomena::grade(weather.phenomena));
+    safety = worst(safety, gradeTemperature(weather.temperature, weather.humidity, thresholds));
+    safety = worst(safety, gradeIcing(weather.icingRisk));
+    safety = worst(safety, gradeCeiling(reportedCeiling(weather), context.altitude));
+    
+    if (context.rules && !context.rules->isEmpty()) {
+        const RuleInputs inputs = RuleInputs::from(weather, context.profileId, context.altitude, context.sunElevation);
+        for (int i = 0; i < context.rules->size(); ++i) {
+            if (context.rules->matches(i, inputs)) {
+                safety = worst(safety, context.rules->rule(i).severity);
+            }
         }
     }
+    return safety;
+}
+
+FlightSafety FlightConditions::assessWindConditions(const WeatherData &weather)
+{
+    const FlightThresholds &thresholds = m_thresholds;
     
-    if (weather.visibility < m_assessment.limits.minVisibility / 1.60934 * 1.5) {
-        m_assessment.recommendations.append("Reduced visibility - maintain closer visual contact");
-        return FlightSafety::Caution;
+    double windSpeed = 0.0;
+    double windGust = 0.0;
+    projectWind(weather, m_altitude, m_terrain, m_sunElevation, windSpeed, windGust);
+    
+    FlightSafety safety = gradeWind(windSpeed, windGust, thresholds);
+    
+    if (windSpeed > thresholds.windUnsafe) {
+        m_assessment.addFinding({FindingCode::HighWind, safety, 0, windSpeed, thresholds.windUnsafe});
+    } else if (windGust > thresholds.gustCaution) {
+        m_assessment.addFinding({FindingCode::HighGust, safety, 0, windGust, thresholds.gustCaution});
+    } else if (windSpeed > thresholds.windCaution) {
+        m_assessment.addFinding({FindingCode::WindNearLimit, safety, 0, windSpeed, thresholds.windUnsafe});
     }
     
-    return FlightSafety::Safe;
+    return settle(FlightFactor::Wind, safety, gradeWind(windSpeed, windGust, m_releaseThresholds));
+}
+
+FlightSafety FlightConditions::assessVisibilityConditions(const WeatherData &weather)
+{
+    const FlightThresholds &thresholds = m_thresholds;
+    
+    FlightSafety safety = gradeVisibility(weather.visibility, thresholds);
+    
+    if (weather.visibility < thresholds.visibilityUnsafe) {
+        m_assessment.addFinding({FindingCode::LowVisibility, safety, 0, weather.visibility, thresholds.visibilityUnsafe});
+    } else if (weather.visibility < thresholds.visibilityCaution) {
+        m_assessment.addFinding({FindingCode::ReducedVisibility, safety, 0, weather.visibility, thresholds.visibilityUnsafe});
+    }
+    
+    return settle(FlightFactor::Visibility, safety, gradeVisibility(weather.visibility, m_releaseThresholds));
 }
 
 FlightSafety FlightConditions::assessPrecipitationConditions(const WeatherData &weather)
 {
-    QString condition = weather.condition.toLower();
+    FlightSafety safety = WeatherPhenomena::grade(weather.phenomena);
     
-    if (condition.contains("thunderstorm") || condition.contains("storm")) {
-        m_assessment.warnings.append("Thunderstorm conditions detected");
-        return FlightSafety::NoFly;
+    if (safety != FlightSafety::Safe) {
+        m_assessment.addFinding({FindingCode::PresentWeather, safety, weather.phenomena, 0.0, 0.0});
     }
     
-    if (condition.contains("rain") || condition.contains("drizzle")) {
-        if (condition.contains("heavy")) {
-            m_assessment.warnings.append("Heavy precipitation detected");
-            return FlightSafety::Unsafe;
-        } else {
-            m_assessment.warnings.append("Precipitation detected");
-            return FlightSafety::Caution;
-        }
+    return settle(FlightFactor::Precipitation, safety, safety);
+}
+
+FlightSafety FlightConditions::assessTemperatureConditions(const WeatherData &weather)
+{
+    const FlightThresholds &thresholds = m_thresholds;
+    FlightSafety safety = gradeTemperature(weather.temperature, weather.humidity, thresholds);
+    
+    if (weather.temperature < thresholds.minTemperature) {
+        m_assessment.addFinding({FindingCode::LowTemperature, safety, 0, weather.temperature, thresholds.minTemperature});
+    } else if (weather.temperature > thresholds.maxTemperature) {
+        m_assessment.addFinding({FindingCode::HighTemperature, safety, 0, weather.temperature, thresholds.maxTemperature});
+    } else if (weather.humidity > thresholds.maxHumidity) {
+        m_assessment.addFinding({FindingCode::HighHumidity, safety, 0, weather.humidity, thresholds.maxHumidity});
     }
     
-    if (condition.contains("snow") || condition.contains("sleet")) {
-        m_assessment.warnings.append("Snow/sleet conditions detected");
-        return FlightSafety::Unsafe;
+    // Ice on props costs lift and battery long before it is visible
+    FlightSafety icing = gradeIcing(weather.icingRisk);
+    if (icing != FlightSafety::Safe) {
+        safety = worst(safety, icing);
+        m_assessment.addFinding({FindingCode::Icing, icing, weather.icingRisk, weather.temperature, 0.0});
     }
     
-    if (condition.contains("fog") || condition.contains("mist")) {
-        m_assessment.warnings.append("Reduced visibility due to fog/mist");
-        return FlightSafety::Caution;
+    FlightSafety release = worst(gradeTemperature(weather.temperature, weather.humidity, m_releaseThresholds), icing);
+    return settle(FlightFactor::Temperature, safety, release);
+}
+
+FlightSafety FlightConditions::assessCeilingConditions(const WeatherData &weather)
+{
+    // The same cloud clearance the raster and corridor grade; no report
+    // means no ceiling
+    const double ceiling = reportedCeiling(weather);
+    FlightSafety safety = gradeCeiling(ceiling, m_altitude);
+    
+    if (safety != FlightSafety::Safe) {
+        m_assessment.addFinding({FindingCode::LowCeiling, safety, 0, ceiling, m_altitude * 3.28084 + 500.0});
     }
     
-    return FlightSafety::Safe;
+    return settle(FlightFactor::Ceiling, safety, gradeCeiling(m_stateMachine->releaseCeiling(ceiling), m_altitude));
 }
 
-FlightSafety FlightConditions::assessTemperatureConditions(const WeatherData &weather)
+FlightSafety FlightConditions::assessDaylight(const WeatherData &weather)
 {
-    if (weather.temperature < m_assessment.limits.minTemperature) {
-        m_assessment.warnings.append(QString("Temperature too low: %1°F (minimum: %2°F)")
-                                    .arg((weather.temperature * 9.0 / 5.0) + 32.0, 0, 'f', 1)
-                                    .arg((m_assessment.limits.minTemperature * 9.0 / 5.0) + 32.0, 0, 'f', 1));
-        return FlightSafety::Unsafe;
+    if (weather.latitude == 0.0 && weather.longitude == 0.0) {
+        return FlightSafety::Safe; // position unknown
     }
     
-    if (weather.temperature > m_assessment.limits.maxTemperature) {
-        m_assessment.warnings.append(QString("Temperature too high: %1°F (maximum: %2°F)")
-                                    .arg((weather.temperature * 9.0 / 5.0) + 32.0, 0, 'f', 1)
-                                    .arg((m_assessment.limits.maxTemperature * 9.0 / 5.0) + 32.0, 0, 'f', 1));
-        return FlightSafety::Unsafe;
+    // Not debounced: the sun's position is exact, not a noisy measurement
+    Daylight daylight = m_sunElevation > Ephemeris::kSunriseElevation ? Daylight::Day
+        : m_sunElevation > Ephemeris::kCivilTwilightElevation ? Daylight::CivilTwilight : Daylight::Night;
+    FlightSafety safety = gradeDaylight(daylight, m_nightOperations);
+    if (daylight != m_daylight) {
+        m_daylight = daylight;
+        m_categoryChanged = true; // sunset is news even when the overall grade holds
+    }
+    if (daylight != Daylight::Day) {
+        m_assessment.addFinding({FindingCode::Darkness, safety, quint32(daylight), m_sunElevation,
+                                 daylight == Daylight::Night ? Ephemeris::kCivilTwilightElevation : Ephemeris::kSunriseElevation});
     }
+    return safety;
+}
+
+FlightSafety FlightConditions::assessOperatingRules(const WeatherData &weather)
+{
+    // Not debounced either: a rule is policy, applied as written, so a new
+    // rule set or a different set of matches is a change in itself
+    bool changed = m_assessment.rules != m_rules;
+    m_assessment.rules = m_rules;
     
-    if (weather.humidity > m_assessment.limits.maxHumidity) {
-        m_assessment.warnings.append(QString("High humidity: %1%% (maximum: %2%%)")
-                                    .arg(weather.humidity, 0, 'f', 0)
-                                    .arg(m_assessment.limits.maxHumidity, 0, 'f', 0));
-        return FlightSafety::Caution;
+    std::array<quint32, FlightAssessment::kMaxFindings> matched;
+    int matchCount = 0;
+    FlightSafety safety = FlightSafety::Safe;
+    if (m_rules && !m_rules->isEmpty()) {
+        const RuleInputs inputs = RuleInputs::from(weather, m_profileId, m_altitude, m_sunElevation);
+        for (int i = 0; i < m_rules->size(); ++i) {
+            if (m_rules->matches(i, inputs)) {
+                const FlightSafety severity = m_rules->rule(i).severity;
+                m_assessment.addFinding({FindingCode::OperatingRule, severity, quint32(i), 0.0, 0.0});
+                safety = worst(safety, severity);
+                if (matchCount < int(matched.size())) {
+                    matched[matchCount++] = quint32(i);
+                }
+            }
+        }
     }
     
-    return FlightSafety::Safe;
+    changed = changed || matchCount != m_matchedRuleCount
+        || !std::equal(matched.begin(), matched.begin() + matchCount, m_matchedRules.begin());
+    if (changed) {
+        m_matchedRules = matched;
+        m_matchedRuleCount = matchCount;
+        m_categoryChanged = true;
+    }
+    return safety;
 }
 
 FlightSafety FlightConditions::determineOverallSafety() const
@@ -169,21 +486,24 @@ FlightSafety FlightConditions::determineOverallSafety() const
     if (m_assessment.wind == FlightSafety::NoFly ||
         m_assessment.visibility == FlightSafety::NoFly ||
         m_assessment.precipitation == FlightSafety::NoFly ||
-        m_assessment.temperature == FlightSafety::NoFly) {
+        m_assessment.temperature == FlightSafety::NoFly ||
+        m_assessment.ceiling == FlightSafety::NoFly) {
         return FlightSafety::NoFly;
     }
     
     if (m_assessment.wind == FlightSafety::Unsafe ||
         m_assessment.visibility == FlightSafety::Unsafe ||
         m_assessment.precipitation == FlightSafety::Unsafe ||
-        m_assessment.temperature == FlightSafety::Unsafe) {
+        m_assessment.temperature == FlightSafety::Unsafe ||
+        m_assessment.ceiling == FlightSafety::Unsafe) {
         return FlightSafety::Unsafe;
     }
     
     if (m_assessment.wind == FlightSafety::Caution ||
         m_assessment.visibility == FlightSafety::Caution ||
         m_assessment.precipitation == FlightSafety::Caution ||
-        m_assessment.temperature == FlightSafety::Caution) {
+        m_assessment.temperature == FlightSafety::Caution ||
+        m_assessment.ceiling == FlightSafety::Caution) {
         return FlightSafety::Caution;
     }
     
@@ -1,7 +1,13 @@
 #pragma once
 
 #include <QObject>
+#include <array>
+#include <memory>
 #include "weatherservice.h"
+#include "windprofile.h"
+#include "ephemeris.h"
+
+class RuleProgram;
 
 enum class FlightSafety {
     Safe,
@@ -10,16 +16,74 @@ enum class FlightSafety {
     NoFly
 };
 
+// What a finding is about. Advisory codes become recommendations rather
+// than warnings when formatted.
+enum class FindingCode : quint8 {
+    HighWind,
+    HighGust,
+    WindNearLimit,       // advisory
+    LowVisibility,
+    ReducedVisibility,   // advisory
+    PresentWeather,
+    LowTemperature,
+    HighTemperature,
+    HighHumidity,
+    Icing,               // detail holds the DerivedMeteorology::IcingRisk
+    Darkness,            // detail holds the Daylight; advisory in civil twilight
+    OperatingRule,       // detail holds the rule's index in FlightAssessment::rules
+    Held,                // detail holds the FlightFactor kept at a worse category
+                         // than its current grade; measured is how long the
+                         // better grade has held (s, -1 if not yet), limit the dwell
+    LowCeiling           // ft AGL; limit is the operating altitude plus 500 ft
+};
+
+// One structured result of an assessment. Values are in WeatherData units
+// (kts, statute miles, °C, %); detail holds the WeatherPhenomena flags of
+// a PresentWeather finding.
+struct FlightFinding {
+    FindingCode code = FindingCode::HighWind;
+    FlightSafety severity = FlightSafety::Safe;
+    quint32 detail = 0;
+    double measured = 0.0;
+    double limit = 0.0;
+    
+    bool isAdvisory() const
+    {
+        return code == FindingCode::WindNearLimit || code == FindingCode::ReducedVisibility
+            || (code == FindingCode::Darkness && detail == quint32(Daylight::CivilTwilight));
+    }
+    // rules names OperatingRule findings; they are numbered without it
+    QString text(const RuleProgram *rules = nullptr) const;
+};
+
 struct FlightAssessment {
-    FlightSafety overall;
-    FlightSafety wind;
-    FlightSafety visibility;
-    FlightSafety precipitation;
-    FlightSafety temperature;
+    FlightSafety overall = FlightSafety::Safe;
+    FlightSafety wind = FlightSafety::Safe;
+    FlightSafety visibility = FlightSafety::Safe;
+    FlightSafety precipitation = FlightSafety::Safe;
+    FlightSafety temperature = FlightSafety::Safe;
+    FlightSafety ceiling = FlightSafety::Safe;
+    
+    // Fixed capacity so assessing never allocates; one finding per factor
+    // plus the operating rules that matched, as many as fit
+    static constexpr int kMaxFindings = 16;
+    std::array<FlightFinding, kMaxFindings> findings;
+    int findingCount = 0;
+    // The rule set the OperatingRule findings refer to
+    std::shared_ptr<const RuleProgram> rules;
+    
+    void clearFindings() { findingCount = 0; }
+    void addFinding(const FlightFinding &finding)
+    {
+        if (findingCount < kMaxFindings) {
+            findings[findingCount++] = finding;
+        }
+    }
     
-    QString overallMessage;
-    QStringList warnings;
-    QStringList recommendations;
+    // Display text, formatted on demand for UI consumers
+    QString overallMessage() const;
+    QStringList warnings() const;
+    QStringList recommendations() const;
     
     struct Limits {
         double maxWindSpeed = 10.0; // m/s
@@ -31,30 +95,119 @@ struct FlightAssessment {
     } limits;
 };
 
+// Limits converted once into WeatherData units (kts, statute miles, °C)
+// with every grading band resolved, so comparisons do no arithmetic
+struct FlightThresholds {
+    double windCaution = 0.0;
+    double windUnsafe = 0.0;
+    double windNoFly = 0.0;
+    double gustCaution = 0.0;
+    double gustUnsafe = 0.0;
+    double visibilityCaution = 0.0;
+    double visibilityUnsafe = 0.0;
+    double visibilityNoFly = 0.0;
+    double minTemperature = 0.0;
+    double maxTemperature = 0.0;
+    double maxHumidity = 0.0;
+    
+    FlightThresholds() = default;
+    explicit FlightThresholds(const FlightAssessment::Limits &limits);
+};
+
+// Everything besides the weather that a raw grade depends on
+struct GradingContext {
+    FlightThresholds thresholds;
+    double altitude = WindProfile::kReferenceHeight; // m AGL
+    WindProfile::Terrain terrain = WindProfile::Terrain::Open;
+    double sunElevation = 0.0; // degrees, at the time graded
+    const RuleProgram *rules = nullptr;
+    QStringView profileId;
+};
+
+class AssessmentStateMachine;
+enum class FlightFactor : quint8;
+
 class FlightConditions : public QObject
 {
     Q_OBJECT
 
 public:
     explicit FlightConditions(QObject *parent = nullptr);
+    ~FlightConditions() override;
     
     const FlightAssessment& currentAssessment() const { return m_assessment; }
     void setLimits(const FlightAssessment::Limits &limits);
+    // Wind is graded at this height (m AGL) after projecting the 10 m
+    // observation through a boundary-layer profile over the given terrain
+    void setOperatingAltitude(double altitude, WindProfile::Terrain terrain);
+    double operatingAltitude() const { return m_altitude; }
+    // Whether the crew holds the Part 107 night qualification
+    void setNightOperations(bool allowed) { m_nightOperations = allowed; }
+    // The safety office's rules, checked after the built-in limits; profile
+    // is the DroneProfile id the rules see
+    void setOperatingRules(std::shared_ptr<const RuleProgram> rules) { m_rules = std::move(rules); }
+    void setProfileId(const QString &profileId) { m_profileId = profileId; }
+    // Hysteresis applied to the factor categories of currentAssessment()
+    AssessmentStateMachine *stateMachine() const { return m_stateMachine.get(); }
+    
+    // Side-effect free grading shared with batch consumers such as the
+    // climatology engine. Inputs use WeatherData units (kts, statute miles, °C).
+    static FlightSafety gradeWind(double windSpeed, double windGust, const FlightThresholds &thresholds);
+    static FlightSafety gradeVisibility(double visibility, const FlightThresholds &thresholds);
+    static FlightSafety gradeTemperature(double temperature, double humidity, const FlightThresholds &thresholds);
+    // ceiling in ft AGL, NaN when none is reported; altitude in m AGL
+    static FlightSafety gradeCeiling(double ceiling, double altitude);
+    static FlightSafety gradeDaylight(Daylight daylight, bool nightOperations);
+    static FlightSafety worst(FlightSafety a, FlightSafety b) { return a > b ? a : b; }
+    // The overall grade assessConditions() gives for a first report: wind at
+    // altitude, visibility, present weather, temperature and icing, ceiling
+    // and the operating rules, without hysteresis and without daylight
+    static FlightSafety gradeWeather(const WeatherData &weather, const GradingContext &context);
 
 public slots:
     void assessConditions(const WeatherData &weather);
 
 signals:
+    // After every assessment, e.g. for persistence
     void assessmentUpdated(const FlightAssessment &assessment);
+    // Only when a factor, the daylight, the matching operating rules or the
+    // overall grade changed, for displays and alerts
+    void safetyChanged(const FlightAssessment &assessment);
 
 private:
+    // The 10 m wind projected to altitude under the stability of the moment
+    static void projectWind(const WeatherData &weather, double altitude, WindProfile::Terrain terrain,
+                            double sunElevation, double &windSpeed, double &windGust);
+    static FlightSafety gradeIcing(quint8 icingRisk);
+    // ft AGL, NaN when none is reported
+    static double reportedCeiling(const WeatherData &weather) { return weather.ceiling > 0.0 ? weather.ceiling : qQNaN(); }
+    
     FlightSafety assessWindConditions(const WeatherData &weather);
     FlightSafety assessVisibilityConditions(const WeatherData &weather);
     FlightSafety assessPrecipitationConditions(const WeatherData &weather);
     FlightSafety assessTemperatureConditions(const WeatherData &weather);
+    FlightSafety assessCeilingConditions(const WeatherData &weather);
+    FlightSafety assessDaylight(const WeatherData &weather);
+    FlightSafety assessOperatingRules(const WeatherData &weather);
+    // Passes a factor's grade through the hysteresis layer
+    FlightSafety settle(FlightFactor factor, FlightSafety raw, FlightSafety release);
     FlightSafety determineOverallSafety() const;
     QString getSafetyString(FlightSafety safety) const;
     QString getSafetyColor(FlightSafety safety) const;
     
     FlightAssessment m_assessment;
+    FlightThresholds m_thresholds;
+    FlightThresholds m_releaseThresholds;
+    double m_altitude;
+    WindProfile::Terrain m_terrain;
+    bool m_nightOperations;
+    double m_sunElevation; // at the observation, degrees
+    std::shared_ptr<const RuleProgram> m_rules;
+    QString m_profileId;
+    std::unique_ptr<AssessmentStateMachine> m_stateMachine;
+    qint64 m_now;
+    bool m_categoryChanged;
+    Daylight m_daylight; // at the previous assessment
+    std::array<quint32, FlightAssessment::kMaxFindings> m_matchedRules; // rule indices, likewise
+    int m_matchedRuleCount;
 };
\ No newline at end of file
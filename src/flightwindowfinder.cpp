@@ -0,0 +1,410 @@
+#include "flightwindowfinder.h"
+#include "derivedmeteorology.h"
+#include "ephemeris.h"
+#include <QtMath>
+#include <limits>
+
+namespace {
+
+const qint64 kMaxSpanSeconds = 7 * 24 * 3600;
+
+bool sameValue(double a, double b)
+{
+    return a == b || (qIsNaN(a) && qIsNaN(b));
+}
+
+bool sameForecast(const WeatherData::Forecast &a, const WeatherData::Forecast &b)
+{
+    return a.changeIndicator == b.changeIndicator
+        && sameValue(a.temperature, b.temperature)
+        && sameValue(a.windSpeed, b.windSpeed)
+        && sameValue(a.windGust, b.windGust)
+        && sameValue(a.visibility, b.visibility)
+        && a.phenomena == b.phenomena;
+}
+
+bool sameLimits(const FlightAssessment::Limits &a, const FlightAssessment::Limits &b)
+{
+    return a.maxWindSpeed == b.maxWindSpeed && a.maxWindGust == b.maxWindGust
+        && a.minVisibility == b.minVisibility && a.minTemperature == b.minTemperature
+        && a.maxTemperature == b.maxTemperature && a.maxHumidity == b.maxHumidity;
+}
+
+qint64 floorToSlot(qint64 secs)
+{
+    qint64 slot = FlightWindowFinder::kSlotSeconds;
+    return (secs >= 0 ? secs / slot : (secs - slot + 1) / slot) * slot;
+}
+
+} // namespace
+
+FlightWindowFinder::FlightWindowFinder(QObject *parent)
+    : QObject(parent)
+    , m_thresholds(m_limits)
+    , m_altitude(WindProfile::kReferenceHeight)
+    , m_terrain(WindProfile::Terrain::Open)
+    , m_origin(0)
+    , m_hasSite(false)
+    , m_latitude(0.0)
+    , m_longitude(0.0)
+    , m_nightOperations(false)
+{
+}
+
+void FlightWindowFinder::setSite(double latitude, double longitude, bool nightOperations)
+{
+    if (m_hasSite && latitude == m_latitude && longitude == m_longitude && nightOperations == m_nightOperations) {
+        return;
+    }
+    
+    const bool moved = !m_hasSite || latitude != m_latitude || longitude != m_longitude;
+    m_hasSite = true;
+    m_latitude = latitude;
+    m_longitude = longitude;
+    m_nightOperations = nightOperations;
+    if (moved) {
+        regradePeriods(); // the sun, and so the stability, differs
+    }
+    rebuildSlots();
+    emit windowsChanged();
+}
+
+FlightSafety FlightWindowFinder::gradePeriod(const WeatherData::Forecast &forecast, qint64 start, qint64 end) const
+{
+    // A period is graded as a report at its midpoint would be
+    WeatherData weather;
+    weather.latitude = m_latitude;
+    weather.longitude = m_longitude;
+    weather.timestamp = QDateTime::fromSecsSinceEpoch(start + (end - start) / 2, Qt::UTC);
+    weather.temperature = forecast.temperature;
+    weather.windSpeed = forecast.windSpeed;
+    weather.windDirection = forecast.windDirection;
+    weather.windGust = forecast.windGust;
+    weather.visibility = forecast.visibility;
+    weather.phenomena = forecast.phenomena;
+    DerivedMeteorology::apply(weather);
+    
+    GradingContext context;
+    context.thresholds = m_thresholds;
+    context.altitude = m_altitude;
+    context.terrain = m_terrain;
+    context.sunElevation = Ephemeris::sunElevation(m_latitude, m_longitude, weather.timestamp.toSecsSinceEpoch());
+    context.rules = m_rules.get();
+    context.profileId = m_profileId;
+    return FlightConditions::gradeWeather(weather, context);
+}
+
+void FlightWindowFinder::regradePeriods()
+{
+    for (Period &period : m_periods) {
+        period.grade = gradePeriod(period.forecast, period.start, period.end);
+    }
+}
+
+void FlightWindowFinder::setLimits(const FlightAssessment::Limits &limits)
+{
+    if (sameLimits(limits, m_limits)) {
+        return;
+    }
+    
+    // New limits change the grade of every period
+    m_limits = limits;
+    m_thresholds = FlightThresholds(limits);
+    regradePeriods();
+    rebuildSlots();
+    emit windowsChanged();
+}
+
+void FlightWindowFinder::setOperatingAltitude(double altitude, WindProfile::Terrain terrain)
+{
+    if (altitude == m_altitude && terrain == m_terrain) {
+        return;
+    }
+    
+    m_altitude = altitude;
+    m_terrain = terrain;
+    regradePeriods();
+    rebuildSlots();
+    emit windowsChanged();
+}
+
+void FlightWindowFinder::setOperatingRules(std::shared_ptr<const RuleProgram> rules)
+{
+    if (rules == m_rules) {
+        return;
+    }
+    
+    m_rules = std::move(rules);
+    regradePeriods();
+    rebuildSlots();
+    emit windowsChanged();
+}
+
+void FlightWindowFinder::setProfileId(const QString &profileId)
+{
+    if (profileId == m_profileId) {
+        return;
+    }
+    
+    m_profileId = profileId;
+    if (m_rules) {
+        regradePeriods();
+        rebuildSlots();
+        emit windowsChanged();
+    }
+}
+
+void FlightWindowFinder::setForecast(const QList<WeatherData::Forecast> &forecast)
+{
+    QList<Period> periods;
+    periods.reserve(forecast.size());
+    for (int i = 0; i < forecast.size(); ++i) {
+        const WeatherData::Forecast &entry = forecast[i];
+        if (!entry.time.isValid()) {
+            continue;
+        }
+        
+        Period period;
+        period.forecast = entry;
+        period.start = entry.time.toSecsSinceEpoch();
+        if (entry.endTime.isValid()) {
+            period.end = entry.endTime.toSecsSinceEpoch();
+        } else if (i + 1 < forecast.size() && forecast[i + 1].time.isValid()) {
+            period.end = forecast[i + 1].time.toSecsSinceEpoch(); // runs until the next entry
+        } else {
+            period.end = period.start + 3600;
+        }
+        if (period.end > period.start) {
+            periods.append(period);
+        }
+    }
+    
+    // Reuse the grade of every period the amendment left untouched and
+    // collect the span covered by what was added, changed or dropped
+    qint64 dirtyStart = std::numeric_limits<qint64>::max();
+    qint64 dirtyEnd = std::numeric_limits<qint64>::min();
+    QList<bool> matched(m_periods.size(), false);
+    
+    for (Period &period : periods) {
+        bool reused = false;
+        for (int i = 0; i < m_periods.size(); ++i) {
+            const Period &old = m_periods[i];
+            if (!matched[i] && old.start == period.start && old.end == period.end
+                && sameForecast(old.forecast, period.forecast)) {
+                period.grade = old.grade;
+                matched[i] = true;
+                reused = true;
+                break;
+            }
+        }
+        if (!reused) {
+            period.grade = gradePeriod(period.forecast, period.start, period.end);
+            dirtyStart = qMin(dirtyStart, period.start);
+            dirtyEnd = qMax(dirtyEnd, period.end);
+        }
+    }
+    for (int i = 0; i < m_periods.size(); ++i) {
+        if (!matched[i]) {
+            dirtyStart = qMin(dirtyStart, m_periods[i].start);
+            dirtyEnd = qMax(dirtyEnd, m_periods[i].end);
+        }
+    }
+    
+    if (dirtyStart > dirtyEnd) {
+        return; // same forecast again
+    }
+    
+    qint64 spanStart = std::numeric_limits<qint64>::max();
+    qint64 spanEnd = std::numeric_limits<qint64>::min();
+    for (const Period &period : std::as_const(periods)) {
+        spanStart = qMin(spanStart, period.start);
+        spanEnd = qMax(spanEnd, period.end);
+    }
+    
+    m_periods = periods;
+    
+    bool sameSpan = !m_slots.isEmpty() && !m_periods.isEmpty()
+        && floorToSlot(spanStart) == m_origin
+        && m_slots.size() == qCeil(double(qMin(spanEnd, spanStart + kMaxSpanSeconds) - m_origin) / kSlotSeconds);
+    if (sameSpan) {
+        regradeSlots(dirtyStart, dirtyEnd);
+    } else {
+        rebuildSlots();
+    }
+    emit windowsChanged();
+}
+
+void FlightWindowFinder::rebuildSlots()
+{
+    m_slots.clear();
+    invalidateRuns();
+    if (m_periods.isEmpty()) {
+        return;
+    }
+    
+    qint64 spanStart = std::numeric_limits<qint64>::max();
+    qint64 spanEnd = std::numeric_limits<qint64>::min();
+    for (const Period &period : std::as_const(m_periods)) {
+        spanStart = qMin(spanStart, period.start);
+        spanEnd = qMax(spanEnd, period.end);
+    }
+    spanEnd = qMin(spanEnd, spanStart + kMaxSpanSeconds);
+    
+    m_origin = floorToSlot(spanStart);
+    m_slots.resize(qCeil(double(spanEnd - m_origin) / kSlotSeconds));
+    updateDaylight();
+    regradeSlots(m_origin, spanEnd);
+}
+
+void FlightWindowFinder::updateDaylight()
+{
+    m_daylight.clear();
+    if (!m_hasSite || m_slots.isEmpty()) {
+        return;
+    }
+    
+    // Minute resolution, so twilight starting inside a slot still counts
+    const int perSlot = kSlotSeconds / 60;
+    QList<quint8> minutes(m_slots.size() * perSlot);
+    const EphemerisSites site{1, &m_latitude, &m_longitude};
+    Ephemeris::classify(site, m_origin, 60, minutes.size(), minutes.data());
+    
+    m_daylight.resize(m_slots.size());
+    for (qsizetype slot = 0; slot < m_slots.size(); ++slot) {
+        quint8 darkest = quint8(Daylight::Day);
+        for (int minute = 0; minute < perSlot; ++minute) {
+            darkest = qMin(darkest, minutes[slot * perSlot + minute]);
+        }
+        m_daylight[slot] = darkest;
+    }
+}
+
+void FlightWindowFinder::regradeSlots(qint64 from, qint64 to)
+{
+    qsizetype first = qMax<qsizetype>(0, (floorToSlot(from) - m_origin) / kSlotSeconds);
+    qsizetype last = qMin<qsizetype>(m_slots.size(), (to - m_origin + kSlotSeconds - 1) / kSlotSeconds);
+    
+    for (qsizetype slot = first; slot < last; ++slot) {
+        qint64 slotStart = m_origin + slot * kSlotSeconds;
+        qint64 slotEnd = slotStart + kSlotSeconds;
+        
+        // Uncovered gaps are not flyable; TEMPO and PROB overlays count at full weight
+        bool covered = false;
+        FlightSafety safety = FlightSafety::Safe;
+        for (const Period &period : std::as_const(m_periods)) {
+            if (period.start < slotEnd && period.end > slotStart) {
+                covered = true;
+                safety = FlightConditions::worst(safety, period.grade);
+            }
+        }
+        if (!m_daylight.isEmpty()) {
+            safety = FlightConditions::worst(safety, FlightConditions::gradeDaylight(Daylight(m_daylight[slot]), m_nightOperations));
+        }
+        m_slots[slot] = quint8(covered ? safety : FlightSafety::NoFly);
+    }
+    invalidateRuns();
+}
+
+void FlightWindowFinder::invalidateRuns()
+{
+    for (QList<int> &runs : m_runLengths) {
+        runs.clear();
+    }
+    m_nextStarts.clear();
+}
+
+const QList<int> &FlightWindowFinder::runLengths(FlightSafety acceptable) const
+{
+    QList<int> &runs = m_runLengths[int(acceptable)];
+    if (runs.isEmpty() && !m_slots.isEmpty()) {
+        runs.resize(m_slots.size() + 1);
+        runs[m_slots.size()] = 0;
+        for (qsizetype slot = m_slots.size() - 1; slot >= 0; --slot) {
+            runs[slot] = m_slots[slot] <= quint8(acceptable) ? runs[slot + 1] + 1 : 0;
+        }
+    }
+    return runs;
+}
+
+const QList<int> &FlightWindowFinder::nextStarts(FlightSafety acceptable, int minimumSlots) const
+{
+    quint32 key = (quint32(minimumSlots) << 2) | quint32(acceptable);
+    auto it = m_nextStarts.find(key);
+    if (it != m_nextStarts.end()) {
+        return it.value();
+    }
+    
+    const QList<int> &runs = runLengths(acceptable);
+    QList<int> starts(m_slots.size() + 1);
+    starts[m_slots.size()] = -1;
+    for (qsizetype slot = m_slots.size() - 1; slot >= 0; --slot) {
+        starts[slot] = runs[slot] >= minimumSlots ? int(slot) : starts[slot + 1];
+    }
+    return m_nextStarts.insert(key, starts).value();
+}
+
+FlightSafety FlightWindowFinder::gradeAt(const QDateTime &time) const
+{
+    qint64 offset = time.toSecsSinceEpoch() - m_origin;
+    if (m_slots.isEmpty() || offset < 0 || offset >= m_slots.size() * qint64(kSlotSeconds)) {
+        return FlightSafety::NoFly;
+    }
+    return FlightSafety(m_slots[offset / kSlotSeconds]);
+}
+
+FlightWindow FlightWindowFinder::nextWindow(const QDateTime &from, int minimumMinutes,
+                                            FlightSafety acceptable) const
+{
+    if (m_slots.isEmpty()) {
+        return FlightWindow();
+    }
+    
+    qint64 minimumSecs = qint64(qMax(1, minimumMinutes)) * 60;
+    int minimumSlots = int((minimumSecs + kSlotSeconds - 1) / kSlotSeconds);
+    const QList<int> &runs = runLengths(acceptable);
+    const QList<int> &starts = nextStarts(acceptable, minimumSlots);
+    
+    qint64 fromSecs = from.toSecsSinceEpoch();
+    qint64 offset = fromSecs - m_origin;
+    qsizetype slot = offset <= 0 ? 0 : offset / kSlotSeconds;
+    if (slot >= m_slots.size()) {
+        return FlightWindow();
+    }
+    
+    // A window already open at from is cut short by from itself
+    if (runs[slot] > 0) {
+        qint64 start = qMax(fromSecs, m_origin + slot * kSlotSeconds);
+        qint64 end = m_origin + (slot + runs[slot]) * kSlotSeconds;
+        if (end - start >= minimumSecs) {
+            return {QDateTime::fromSecsSinceEpoch(start, Qt::UTC), QDateTime::fromSecsSinceEpoch(end, Qt::UTC)};
+        }
+        slot += runs[slot];
+    }
+    
+    int found = slot < m_slots.size() ? starts[slot] : -1;
+    if (found < 0) {
+        return FlightWindow();
+    }
+    qint64 start = m_origin + found * qint64(kSlotSeconds);
+    qint64 end = start + runs[found] * qint64(kSlotSeconds);
+    return {QDateTime::fromSecsSinceEpoch(start, Qt::UTC), QDateTime::fromSecsSinceEpoch(end, Qt::UTC)};
+}
+
+QList<FlightWindow> FlightWindowFinder::windows(int minimumMinutes, FlightSafety acceptable) const
+{
+    QList<FlightWindow> result;
+    if (m_slots.isEmpty()) {
+        return result;
+    }
+    
+    QDateTime from = QDateTime::fromSecsSinceEpoch(m_origin, Qt::UTC);
+    while (true) {
+        FlightWindow window = nextWindow(from, minimumMinutes, acceptable);
+        if (!window.isValid()) {
+            break;
+        }
+        result.append(window);
+        from = window.end;
+    }
+    return result;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <QObject>
+#include <QDateTime>
+#include <QHash>
+#include <array>
+#include <memory>
+#include "flightconditions.h"
+
+struct FlightWindow {
+    QDateTime start;
+    QDateTime end;
+    
+    bool isValid() const { return start.isValid() && end.isValid(); }
+    qint64 durationSecs() const { return start.secsTo(end); }
+};
+
+// Grades every forecast period like FlightConditions grades a report, at the
+// operating altitude and against the operating rules, and finds contiguous
+// windows that stay at or below an acceptable grade. The forecast span is
+// cut into fixed slots: an amendment regrades only the slots its changed
+// periods cover, and per-query run tables make lookups while scrubbing
+// through forecast time O(1). Time outside the forecast counts as NoFly.
+class FlightWindowFinder : public QObject
+{
+    Q_OBJECT
+
+public:
+    static const int kSlotSeconds = 300;
+    
+    explicit FlightWindowFinder(QObject *parent = nullptr);
+    
+    void setLimits(const FlightAssessment::Limits &limits);
+    // As FlightConditions::setOperatingAltitude
+    void setOperatingAltitude(double altitude, WindProfile::Terrain terrain);
+    void setOperatingRules(std::shared_ptr<const RuleProgram> rules);
+    void setProfileId(const QString &profileId);
+    void setForecast(const QList<WeatherData::Forecast> &forecast);
+    // Slots in darkness at the site grade no better than
+    // FlightConditions::gradeDaylight; without a site only weather counts.
+    // The sun at the site also sets the stability each period's wind is
+    // projected under.
+    void setSite(double latitude, double longitude, bool nightOperations);
+    
+    bool isEmpty() const { return m_slots.isEmpty(); }
+    FlightSafety gradeAt(const QDateTime &time) const;
+    // Earliest window starting at or after from that lasts at least
+    // minimumMinutes; invalid when the forecast has none
+    FlightWindow nextWindow(const QDateTime &from, int minimumMinutes,
+                            FlightSafety acceptable = FlightSafety::Safe) const;
+    QList<FlightWindow> windows(int minimumMinutes, FlightSafety acceptable = FlightSafety::Safe) const;
+
+signals:
+    void windowsChanged();
+
+private:
+    struct Period {
+        WeatherData::Forecast forecast;
+        qint64 start;
+        qint64 end;
+        FlightSafety grade;
+    };
+    
+    FlightSafety gradePeriod(const WeatherData::Forecast &forecast, qint64 start, qint64 end) const;
+    // Every period again, after a change to what grading depends on
+    void regradePeriods();
+    void regradeSlots(qint64 from, qint64 to);
+    void rebuildSlots();
+    void updateDaylight();
+    void invalidateRuns();
+    const QList<int> &runLengths(FlightSafety acceptable) const;
+    const QList<int> &nextStarts(FlightSafety acceptable, int minimumSlots) const;
+    
+    FlightAssessment::Limits m_limits;
+    FlightThresholds m_thresholds;
+    double m_altitude;
+    WindProfile::Terrain m_terrain;
+    std::shared_ptr<const RuleProgram> m_rules;
+    QString m_profileId;
+    QList<Period> m_periods;
+    qint64 m_origin;       // UTC seconds at the start of slot 0
+    QList<quint8> m_slots; // worst FlightSafety of each slot
+    
+    bool m_hasSite;
+    double m_latitude;
+    double m_longitude;
+    bool m_nightOperations;
+    QList<quint8> m_daylight; // darkest Daylight of each slot
+    
+    // Lazily rebuilt after every change
+    mutable std::array<QList<int>, 4> m_runLengths; // slots until the grade first exceeds the level
+    mutable QHash<quint32, QList<int>> m_nextStarts; // (level, minimum slots) -> first qualifying slot
+};
@@ -0,0 +1,248 @@
+#include "gustriskestimator.h"
+#include "climatology.h"
+#include <QtConcurrent>
+#include <QPromise>
+#include <QRandomGenerator>
+#include <QThread>
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+namespace {
+
+// METAR reports a gust only when the peak beats the mean by 10 kts, so an
+// observation without one still bounds its gust factor
+const double kGustReportMargin = 10.0;
+const double kDefaultGustFactor = 1.3;
+const double kDefaultGustFactorDeviation = 0.1;
+const double kMaxTrendPerHour = 10.0;
+
+struct Chunk {
+    int trials;
+    quint64 seed;
+};
+
+struct Tally {
+    qint64 hits = 0;
+    qint64 trials = 0;
+};
+
+Tally simulate(const GustModel &model, double current, double limit, int minutes,
+               double speedFactor, const Chunk &chunk)
+{
+    std::mt19937_64 rng(chunk.seed);
+    std::normal_distribution<double> normal;
+    
+    // One-minute steps of the Ornstein-Uhlenbeck anomaly about the trend
+    const double phi = std::exp(-1.0 / model.correlationMinutes);
+    const double innovation = model.deviation * std::sqrt(1.0 - phi * phi);
+    const double trendPerMinute = model.trendPerHour / 60.0;
+    const double start = current - model.level;
+    
+    Tally tally;
+    tally.trials = chunk.trials;
+    for (int trial = 0; trial < chunk.trials; ++trial) {
+        double anomaly = start;
+        for (int minute = 1; minute <= minutes; ++minute) {
+            anomaly = phi * anomaly + innovation * normal(rng);
+            const double wind = qMax(0.0, model.level + trendPerMinute * minute + anomaly) * speedFactor;
+            const double factor = qMax(1.0, model.gustFactor + model.gustFactorDeviation * normal(rng));
+            if (wind * factor > limit) {
+                ++tally.hits;
+                break;
+            }
+        }
+    }
+    return tally;
+}
+
+} // namespace
+
+GustRiskEstimator::GustRiskEstimator(QObject *parent)
+    : QObject(parent)
+    , m_speedFactor(1.0)
+{
+}
+
+void GustRiskEstimator::setOperatingAltitude(double altitude, WindProfile::Terrain terrain)
+{
+    m_speedFactor = WindProfile(terrain).speedFactor(altitude);
+}
+
+void GustRiskEstimator::addObservation(const WeatherData &data)
+{
+    // A missing value would poison the fit; the report is left out whole
+    if (data.stationId.isEmpty() || !std::isfinite(data.windSpeed) || !std::isfinite(data.windGust)
+        || data.windSpeed < 0.0 || data.windGust < 0.0) {
+        return;
+    }
+    
+    qint64 time = (data.timestamp.isValid() ? data.timestamp : QDateTime::currentDateTimeUtc()).toSecsSinceEpoch();
+    insert(data.stationId, {time, data.windSpeed, data.windGust});
+}
+
+void GustRiskEstimator::addHistory(const StationSeries &series)
+{
+    const qint64 since = QDateTime::currentSecsSinceEpoch() - kHistoryHours * 3600;
+    auto first = std::lower_bound(series.time.cbegin(), series.time.cend(), since);
+    for (qsizetype i = first - series.time.cbegin(); i < series.size(); ++i) {
+        if (qIsNaN(series.windSpeed[i])) {
+            continue;
+        }
+        double gust = qIsNaN(series.windGust[i]) ? 0.0 : series.windGust[i];
+        insert(series.stationId, {series.time[i], series.windSpeed[i], gust});
+    }
+}
+
+void GustRiskEstimator::insert(const QString &stationId, const Observation &observation)
+{
+    QList<Observation> &history = m_history[stationId];
+    
+    auto position = std::lower_bound(history.begin(), history.end(), observation.time,
+                                     [](const Observation &existing, qint64 time) { return existing.time < time; });
+    if (position != history.end() && position->time == observation.time) {
+        *position = observation; // a refresh of the same report
+    } else {
+        history.insert(position, observation);
+    }
+    
+    const qint64 since = history.last().time - kHistoryHours * 3600;
+    while (history.first().time < since) {
+        history.removeFirst();
+    }
+}
+
+GustModel GustRiskEstimator::fit(const QString &stationId) const
+{
+    GustModel model;
+    const QList<Observation> history = m_history.value(stationId);
+    const int n = history.size();
+    model.observations = n;
+    if (n == 0) {
+        return model;
+    }
+    
+    // Least-squares trend over hours before the latest report
+    const qint64 now = history.last().time;
+    model.level = history.last().windSpeed;
+    if (n >= 3) {
+        double sumX = 0.0, sumY = 0.0, sumXX = 0.0, sumXY = 0.0;
+        for (const Observation &observation : history) {
+            const double x = (observation.time - now) / 3600.0;
+            sumX += x;
+            sumY += observation.windSpeed;
+            sumXX += x * x;
+            sumXY += x * observation.windSpeed;
+        }
+        const double spread = n * sumXX - sumX * sumX;
+        if (spread > 1e-9) {
+            model.trendPerHour = qBound(-kMaxTrendPerHour, (n * sumXY - sumX * sumY) / spread, kMaxTrendPerHour);
+        }
+        model.level = qMax(0.0, (sumY - model.trendPerHour * sumX) / n);
+        
+        // Residual spread and lag-one autocorrelation give the OU parameters
+        double sumRR = 0.0, sumLag = 0.0, previous = 0.0;
+        for (int i = 0; i < n; ++i) {
+            const double x = (history[i].time - now) / 3600.0;
+            const double residual = history[i].windSpeed - (model.level + model.trendPerHour * x);
+            sumRR += residual * residual;
+            if (i > 0) {
+                sumLag += residual * previous;
+            }
+            previous = residual;
+        }
+        model.deviation = std::sqrt(sumRR / (n - 2));
+        
+        const double rho = sumRR > 0.0 ? sumLag / sumRR : 0.0;
+        const double intervalMinutes = (now - history.first().time) / 60.0 / (n - 1);
+        if (rho > 0.01 && rho < 0.99 && intervalMinutes > 0.0) {
+            model.correlationMinutes = qBound(5.0, -intervalMinutes / std::log(rho), 180.0);
+        } else if (rho <= 0.01) {
+            model.correlationMinutes = 5.0; // reports are effectively independent
+        }
+    }
+    // Too few reports to see the variability; assume a fifth of the wind
+    model.deviation = qMax(model.deviation, n >= 3 ? 1.0 : qMax(2.0, 0.2 * model.level));
+    
+    double sum = 0.0, sumSquares = 0.0;
+    int count = 0;
+    for (const Observation &observation : history) {
+        if (observation.windSpeed <= 0.0) {
+            continue;
+        }
+        const double factor = observation.windGust > observation.windSpeed
+            ? observation.windGust / observation.windSpeed
+            : qMin(kDefaultGustFactor, (observation.windSpeed + kGustReportMargin) / observation.windSpeed);
+        sum += factor;
+        sumSquares += factor * factor;
+        ++count;
+    }
+    if (count == 0) {
+        model.gustFactor = kDefaultGustFactor;
+        model.gustFactorDeviation = kDefaultGustFactorDeviation;
+    } else {
+        model.gustFactor = sum / count;
+        model.gustFactorDeviation = count >= 2
+            ? std::sqrt(qMax(0.0, (sumSquares - sum * sum / count) / (count - 1)))
+            : kDefaultGustFactorDeviation;
+    }
+    return model;
+}
+
+QFuture<GustRisk> GustRiskEstimator::estimate(const QString &stationId, double limit,
+                                              int flightMinutes, int trials) const
+{
+    const GustModel model = fit(stationId);
+    if (model.observations == 0) {
+        QPromise<GustRisk> promise;
+        promise.start();
+        promise.setException(GustRiskError(QString("No wind observations for %1").arg(stationId)));
+        promise.finish();
+        return promise.future();
+    }
+    
+    // Several chunks per core so uneven trial lengths still balance
+    const double current = m_history.value(stationId).last().windSpeed;
+    const int chunkCount = qMax(1, QThread::idealThreadCount() * 4);
+    const quint64 seed = QRandomGenerator::global()->generate64();
+    QList<Chunk> chunks;
+    for (int i = 0; i < chunkCount; ++i) {
+        int share = trials / chunkCount + (i < trials % chunkCount ? 1 : 0);
+        if (share > 0) {
+            chunks.append({share, seed + quint64(i) * 0x9E3779B97F4A7C15ull});
+        }
+    }
+    
+    const double speedFactor = m_speedFactor;
+    return QtConcurrent::mappedReduced<Tally>(
+        chunks,
+        [model, current, limit, flightMinutes, speedFactor](const Chunk &chunk) {
+            return simulate(model, current, limit, flightMinutes, speedFactor, chunk);
+        },
+        [](Tally &result, const Tally &partial) {
+            result.hits += partial.hits;
+            result.trials += partial.trials;
+        })
+        .then([model, limit, flightMinutes](const Tally &tally) {
+            GustRisk risk;
+            risk.trials = int(tally.trials);
+            risk.limit = limit;
+            risk.flightMinutes = flightMinutes;
+            risk.model = model;
+            if (tally.trials == 0) {
+                return risk;
+            }
+            
+            // Wilson score interval, which stays inside [0, 1] near the ends
+            const double z = 1.96;
+            const double n = double(tally.trials);
+            const double p = tally.hits / n;
+            const double denominator = 1.0 + z * z / n;
+            const double centre = (p + z * z / (2.0 * n)) / denominator;
+            const double half = z * std::sqrt(p * (1.0 - p) / n + z * z / (4.0 * n * n)) / denominator;
+            risk.probability = p;
+            risk.lower = qMax(0.0, centre - half);
+            risk.upper = qMin(1.0, centre + half);
+            return risk;
+        });
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <QObject>
+#include <QFuture>
+#include <QException>
+#include <QHash>
+#include "weatherservice.h"
+#include "windprofile.h"
+
+struct StationSeries;
+
+// Error carried by futures returned from GustRiskEstimator
+class GustRiskError : public QException
+{
+public:
+    explicit GustRiskError(const QString &message)
+        : m_message(message), m_what(message.toUtf8()) {}
+    
+    QString message() const { return m_message; }
+    const char *what() const noexcept override { return m_what.constData(); }
+    void raise() const override { throw *this; }
+    GustRiskError *clone() const override { return new GustRiskError(*this); }
+
+private:
+    QString m_message;
+    QByteArray m_what;
+};
+
+// Gust process fitted from a station's recent observations, in kts
+struct GustModel {
+    double level = 0.0;              // sustained wind on the trend line at the latest report
+    double trendPerHour = 0.0;
+    double deviation = 0.0;          // of the sustained wind about the trend
+    double correlationMinutes = 30.0;
+    double gustFactor = 1.0;         // mean gust / sustained wind
+    double gustFactorDeviation = 0.0;
+    int observations = 0;
+};
+
+struct GustRisk {
+    double probability = 0.0; // of at least one gust above the limit during the flight
+    double lower = 0.0;       // 95% Wilson interval
+    double upper = 0.0;
+    int trials = 0;
+    double limit = 0.0;       // kts
+    int flightMinutes = 0;
+    GustModel model;
+};
+
+// Monte Carlo estimate of the chance that gusts exceed an airframe limit
+// during a flight, rather than a threshold on the one reported gust. Keeps
+// a few hours of observations per station; the sustained wind is simulated
+// as a trending Ornstein-Uhlenbeck process and each minute's peak as the
+// wind times a sampled gust factor. Trials are spread over every core.
+class GustRiskEstimator : public QObject
+{
+    Q_OBJECT
+
+public:
+    static const int kHistoryHours = 6;
+    
+    explicit GustRiskEstimator(QObject *parent = nullptr);
+    
+    // Projects simulated winds from the 10 m observations to this height
+    void setOperatingAltitude(double altitude, WindProfile::Terrain terrain);
+    
+    // Seeds a station's history from archived observations, e.g. the
+    // climatology store, keeping those within the last kHistoryHours
+    void addHistory(const StationSeries &series);
+    bool hasHistory(const QString &stationId) const { return !m_history.value(stationId).isEmpty(); }
+    GustModel fit(const QString &stationId) const;
+    
+    // Fails with GustRiskError when the station has no observations
+    QFuture<GustRisk> estimate(const QString &stationId, double limit,
+                               int flightMinutes = 25, int trials = 40000) const;
+
+public slots:
+    // Takes final fused observations; a report without a finite wind and
+    // gust is ignored, and a later one with the same time replaces it
+    void addObservation(const WeatherData &data);
+
+private:
+    struct Observation {
+        qint64 time; // UTC seconds
+        double windSpeed;
+        double windGust;
+    };
+    
+    void insert(const QString &stationId, const Observation &observation);
+    
+    QHash<QString, QList<Observation>> m_history; // per station, ascending time
+    double m_speedFactor;
+};
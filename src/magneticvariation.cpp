@@ -0,0 +1,330 @@
+#include "magneticvariation.h"
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QStandardPaths>
+#include <QTextStream>
+#include <QtMath>
+#include <QDebug>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace {
+
+// WGS 84 ellipsoid
+const double kSemiMajorAxis = 6378.137; // km
+const double kFlattening = 1.0 / 298.257223563;
+const double kEccentricitySquared = kFlattening * (2.0 - kFlattening);
+
+// The east component divides by cos(latitude); declination is undefined
+// at the geographic poles anyway
+const double kMaxLatitude = 89.999;
+
+// Wraps an angle in degrees to (-180, 180]
+double wrap180(double degrees)
+{
+    degrees = std::fmod(degrees, 360.0);
+    if (degrees > 180.0) {
+        degrees -= 360.0;
+    } else if (degrees <= -180.0) {
+        degrees += 360.0;
+    }
+    return degrees;
+}
+
+double wrap360(double degrees)
+{
+    degrees = std::fmod(degrees, 360.0);
+    return degrees < 0.0 ? degrees + 360.0 : degrees;
+}
+
+} // namespace
+
+MagneticModel::MagneticModel()
+    : m_epoch(0.0)
+    , m_degree(0)
+{
+}
+
+bool MagneticModel::load(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        qDebug() << "MagneticModel: cannot read" << path << file.errorString();
+        return false;
+    }
+    
+    // Header "2025.0  WMM-2025  11/13/2024", then "n m g h gdot hdot" rows
+    // up to a line of nines
+    QTextStream stream(&file);
+    const QStringList header = stream.readLine().simplified().split(' ');
+    bool ok = false;
+    const double epoch = header.value(0).toDouble(&ok);
+    if (!ok) {
+        qDebug() << "MagneticModel:" << path << "has no epoch";
+        return false;
+    }
+    
+    struct Row {
+        int n;
+        int m;
+        double values[4];
+    };
+    QList<Row> rows;
+    int degree = 0;
+    while (!stream.atEnd()) {
+        const QString line = stream.readLine().trimmed();
+        if (line.isEmpty()) {
+            continue;
+        }
+        if (line.startsWith("9999")) {
+            break;
+        }
+        
+        const QStringList fields = line.simplified().split(' ');
+        Row row{};
+        bool valid = fields.size() >= 6;
+        row.n = fields.value(0).toInt(&ok);
+        valid = valid && ok;
+        row.m = fields.value(1).toInt(&ok);
+        valid = valid && ok && row.n >= 1 && row.n <= 200 && row.m >= 0 && row.m <= row.n;
+        for (int i = 0; i < 4 && valid; ++i) {
+            row.values[i] = fields[i + 2].toDouble(&ok);
+            valid = ok;
+        }
+        if (!valid) {
+            qDebug() << "MagneticModel:" << path << "malformed line" << line;
+            return false;
+        }
+        degree = qMax(degree, row.n);
+        rows.append(row);
+    }
+    if (degree == 0) {
+        qDebug() << "MagneticModel:" << path << "has no coefficients";
+        return false;
+    }
+    
+    const int size = index(degree, degree) + 1;
+    m_g = QList<double>(size, 0.0);
+    m_h = QList<double>(size, 0.0);
+    m_gDot = QList<double>(size, 0.0);
+    m_hDot = QList<double>(size, 0.0);
+    for (const Row &row : rows) {
+        const int i = index(row.n, row.m);
+        m_g[i] = row.values[0];
+        m_h[i] = row.values[1];
+        m_gDot[i] = row.values[2];
+        m_hDot[i] = row.values[3];
+    }
+    m_name = header.value(1);
+    m_epoch = epoch;
+    m_degree = degree;
+    return true;
+}
+
+double MagneticModel::declination(double latitude, double longitude, double heightKm, double year) const
+{
+    double result = 0.0;
+    declinations(latitude, &longitude, 1, heightKm, year, &result);
+    return result;
+}
+
+void MagneticModel::declinations(double latitude, const double *longitudes, qsizetype count, double heightKm,
+                                 double year, double *results) const
+{
+    if (!isValid()) {
+        std::fill(results, results + count, 0.0);
+        return;
+    }
+    
+    const int degree = m_degree;
+    const int size = index(degree, degree) + 1;
+    const double elapsed = year - m_epoch;
+    
+    // Geodetic to geocentric latitude and radius
+    const double phi = qDegreesToRadians(qBound(-kMaxLatitude, latitude, kMaxLatitude));
+    const double sinPhi = std::sin(phi);
+    const double cosPhi = std::cos(phi);
+    const double curvature = kSemiMajorAxis / std::sqrt(1.0 - kEccentricitySquared * sinPhi * sinPhi);
+    const double p = (curvature + heightKm) * cosPhi;
+    const double z = (curvature * (1.0 - kEccentricitySquared) + heightKm) * sinPhi;
+    const double r = std::hypot(p, z);
+    const double geocentric = std::asin(z / r);
+    const double mu = std::sin(geocentric);
+    const double s = std::cos(geocentric);
+    
+    // Schmidt semi-normalised P(n, m)(sin φ') and their derivatives in φ',
+    // by the standard recursions; the derivatives avoid dividing by cos φ'
+    std::vector<double> legendre(size), derivative(size);
+    legendre[0] = 1.0;
+    derivative[0] = 0.0;
+    for (int m = 1; m <= degree; ++m) {
+        const double k = m == 1 ? 1.0 : std::sqrt((2.0 * m - 1.0) / (2.0 * m));
+        const int previous = index(m - 1, m - 1);
+        legendre[index(m, m)] = k * s * legendre[previous];
+        derivative[index(m, m)] = k * (s * derivative[previous] - mu * legendre[previous]);
+    }
+    for (int m = 0; m <= degree; ++m) {
+        for (int n = m + 1; n <= degree; ++n) {
+            const int previous = index(n - 1, m);
+            double value = (2.0 * n - 1.0) * mu * legendre[previous];
+            double slope = (2.0 * n - 1.0) * (s * legendre[previous] + mu * derivative[previous]);
+            if (n - 2 >= m) {
+                const double c = std::sqrt(double((n - 1) * (n - 1) - m * m));
+                value -= c * legendre[index(n - 2, m)];
+                slope -= c * derivative[index(n - 2, m)];
+            }
+            const double norm = std::sqrt(double(n * n - m * m));
+            legendre[index(n, m)] = value / norm;
+            derivative[index(n, m)] = slope / norm;
+        }
+    }
+    
+    // Everything but the longitude folded into per-order sums, so each
+    // longitude costs one pass over m:
+    //   X' = -Σm (xg cos mλ + xh sin mλ)
+    //   Y' = Σm m (yg sin mλ - yh cos mλ) / cos φ'
+    //   Z' = -Σm (zg cos mλ + zh sin mλ)
+    std::vector<double> xg(degree + 1, 0.0), xh(degree + 1, 0.0);
+    std::vector<double> yg(degree + 1, 0.0), yh(degree + 1, 0.0);
+    std::vector<double> zg(degree + 1, 0.0), zh(degree + 1, 0.0);
+    const double ratio = kReferenceRadius / r;
+    double radial = ratio * ratio;
+    for (int n = 1; n <= degree; ++n) {
+        radial *= ratio; // (a/r)^(n+2)
+        for (int m = 0; m <= n; ++m) {
+            const int i = index(n, m);
+            const double g = m_g[i] + elapsed * m_gDot[i];
+            const double h = m_h[i] + elapsed * m_hDot[i];
+            xg[m] += radial * derivative[i] * g;
+            xh[m] += radial * derivative[i] * h;
+            yg[m] += radial * legendre[i] * g;
+            yh[m] += radial * legendre[i] * h;
+            zg[m] += (n + 1) * radial * legendre[i] * g;
+            zh[m] += (n + 1) * radial * legendre[i] * h;
+        }
+    }
+    
+    // Rotation from geocentric back to geodetic north
+    const double sinPsi = std::sin(geocentric - phi);
+    const double cosPsi = std::cos(geocentric - phi);
+    
+    for (qsizetype i = 0; i < count; ++i) {
+        const double lambda = qDegreesToRadians(longitudes[i]);
+        const double cosLambda = std::cos(lambda);
+        const double sinLambda = std::sin(lambda);
+        double cosM = 1.0, sinM = 0.0;
+        double north = 0.0, east = 0.0, down = 0.0;
+        for (int m = 0; m <= degree; ++m) {
+            north -= xg[m] * cosM + xh[m] * sinM;
+            east += m * (yg[m] * sinM - yh[m] * cosM);
+            down -= zg[m] * cosM + zh[m] * sinM;
+            const double nextCos = cosM * cosLambda - sinM * sinLambda;
+            sinM = sinM * cosLambda + cosM * sinLambda;
+            cosM = nextCos;
+        }
+        east /= s;
+        north = north * cosPsi - down * sinPsi;
+        results[i] = qRadiansToDegrees(std::atan2(east, north));
+    }
+}
+
+double MagneticModel::decimalYear(const QDate &date)
+{
+    return date.year() + (date.dayOfYear() - 1) / double(date.daysInYear());
+}
+
+QString MagneticModel::defaultPath()
+{
+    const QString appData = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/WMM.COF";
+    if (QFileInfo::exists(appData)) {
+        return appData;
+    }
+    return QDir(QCoreApplication::applicationDirPath()).filePath("WMM.COF");
+}
+
+MagneticVariation::MagneticVariation()
+    : m_spacing(1.0)
+    , m_rows(0)
+    , m_columns(0)
+{
+}
+
+void MagneticVariation::build(const MagneticModel &model, const QDate &date, double heightKm, double spacing)
+{
+    if (!model.isValid() || !date.isValid()) {
+        m_grid.clear();
+        m_date = QDate();
+        return;
+    }
+    
+    const double year = MagneticModel::decimalYear(date);
+    if (!model.covers(year)) {
+        qDebug() << "MagneticVariation:" << model.name() << "does not cover" << date.toString(Qt::ISODate);
+    }
+    
+    // A whole number of cells over the half circle of latitude
+    m_rows = qMax(2, qRound(180.0 / qBound(0.1, spacing, 10.0))) + 1;
+    m_spacing = 180.0 / (m_rows - 1);
+    m_columns = 2 * (m_rows - 1) + 1;
+    m_grid.resize(qsizetype(m_rows) * m_columns);
+    
+    std::vector<double> longitudes(m_columns), row(m_columns);
+    for (int column = 0; column < m_columns; ++column) {
+        longitudes[column] = -180.0 + column * m_spacing;
+    }
+    for (int r = 0; r < m_rows; ++r) {
+        model.declinations(-90.0 + r * m_spacing, longitudes.data(), m_columns, heightKm, year, row.data());
+        float *line = m_grid.data() + qsizetype(r) * m_columns;
+        for (int column = 0; column < m_columns; ++column) {
+            line[column] = float(row[column]);
+        }
+    }
+    m_date = date;
+}
+
+double MagneticVariation::declination(double latitude, double longitude) const
+{
+    if (m_grid.isEmpty()) {
+        return 0.0;
+    }
+    
+    const double y = (qBound(-90.0, latitude, 90.0) + 90.0) / m_spacing;
+    const double x = (wrap180(longitude) + 180.0) / m_spacing;
+    const int row = qMin(int(y), m_rows - 2);
+    const int column = qMin(int(x), m_columns - 2);
+    const double fy = y - row;
+    const double fx = x - column;
+    
+    const float *bottom = m_grid.constData() + qsizetype(row) * m_columns + column;
+    const float *top = bottom + m_columns;
+    // Near the magnetic poles neighbouring cells can straddle ±180°
+    const double origin = bottom[0];
+    const double d10 = origin + wrap180(bottom[1] - origin);
+    const double d01 = origin + wrap180(top[0] - origin);
+    const double d11 = origin + wrap180(top[1] - origin);
+    
+    const double south = origin + fx * (d10 - origin);
+    const double north = d01 + fx * (d11 - d01);
+    return wrap180(south + fy * (north - south));
+}
+
+double MagneticVariation::toMagnetic(double trueBearing, double latitude, double longitude) const
+{
+    return wrap360(trueBearing - declination(latitude, longitude));
+}
+
+double MagneticVariation::toTrue(double magneticBearing, double latitude, double longitude) const
+{
+    return wrap360(magneticBearing + declination(latitude, longitude));
+}
+
+void MagneticVariation::toMagnetic(const double *trueBearings, const double *latitudes, const double *longitudes,
+                                   qsizetype count, double *results) const
+{
+    for (qsizetype i = 0; i < count; ++i) {
+        results[i] = toMagnetic(trueBearings[i], latitudes[i], longitudes[i]);
+    }
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <QDate>
+#include <QList>
+#include <QString>
+
+// Main-field spherical harmonic model read from the World Magnetic Model's
+// WMM.COF coefficient file. Evaluation follows the WMM technical report:
+// geodetic position to geocentric, Schmidt semi-normalised Legendre
+// functions, field rotated back to the ellipsoid's north.
+class MagneticModel
+{
+public:
+    static constexpr double kReferenceRadius = 6371.2; // km
+    
+    MagneticModel();
+    
+    // False, with the reason logged, when the file is missing or malformed
+    bool load(const QString &path);
+    bool isValid() const { return m_degree > 0; }
+    QString name() const { return m_name; }
+    double epoch() const { return m_epoch; }
+    // The model is published for five years from its epoch
+    bool covers(double year) const { return year >= m_epoch && year < m_epoch + 5.0; }
+    
+    // Declination in degrees, east positive, at geodetic latitude and
+    // longitude, height in km above the ellipsoid and decimal year
+    double declination(double latitude, double longitude, double heightKm, double year) const;
+    // Column form along one latitude: the Legendre functions are evaluated
+    // once and each longitude only adds its cos/sin(mλ) terms
+    void declinations(double latitude, const double *longitudes, qsizetype count, double heightKm, double year,
+                      double *results) const;
+    
+    static double decimalYear(const QDate &date);
+    // WMM.COF under AppDataLocation, else next to the executable
+    static QString defaultPath();
+
+private:
+    static int index(int n, int m) { return n * (n + 1) / 2 + m; }
+    
+    QString m_name;
+    double m_epoch;
+    int m_degree;
+    // Gauss coefficients (nT) and secular variation (nT/year) by index(n, m)
+    QList<double> m_g;
+    QList<double> m_h;
+    QList<double> m_gDot;
+    QList<double> m_hDot;
+};
+
+// Declination cached on a regular latitude/longitude grid for one date and
+// height, so converting a bearing is a bilinear lookup. Declination changes
+// by well under a degree per degree of latitude or longitude away from the
+// magnetic poles, which a one-degree grid follows to a few hundredths.
+class MagneticVariation
+{
+public:
+    MagneticVariation();
+    
+    void build(const MagneticModel &model, const QDate &date, double heightKm = 0.0, double spacing = 1.0);
+    bool isValid() const { return !m_grid.isEmpty(); }
+    QDate date() const { return m_date; }
+    
+    double declination(double latitude, double longitude) const;
+    // Bearings in degrees, returned in [0, 360); unchanged while the grid is
+    // not built
+    double toMagnetic(double trueBearing, double latitude, double longitude) const;
+    double toTrue(double magneticBearing, double latitude, double longitude) const;
+    // Per waypoint or telemetry sample; arrays hold count values
+    void toMagnetic(const double *trueBearings, const double *latitudes, const double *longitudes,
+                    qsizetype count, double *results) const;
+
+private:
+    QDate m_date;
+    double m_spacing;
+    int m_rows;    // latitudes -90 to 90
+    int m_columns; // longitudes -180 to 180, both ends stored
+    QList<float> m_grid;
+};
@@ -3,6 +3,7 @@
 #include <QPalette>
 #include <QDir>
 #include "mainwindow.h"
+#include "networkdispatcher.h"
 
 int main(int argc, char *argv[])
 {
@@ -30,6 +31,9 @@ int main(int argc, char *argv[])
     darkPalette.setColor(QPalette::HighlightedText, Qt::black);
     app.setPalette(darkPalette);
     
+    // Start the network I/O thread before any service issues a request
+    NetworkDispatcher::instance();
+    
     MainWindow window;
     window.show();
     
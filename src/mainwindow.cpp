@@ -2,18 +2,33 @@
 #include "weatherservice.h"
 #include "locationservice.h"
 #include "flightconditions.h"
+#include "assessmentstatemachine.h"
+#include "climatology.h"
+#include "weathersnapshot.h"
+#include "brokerclient.h"
+#include "flightwindowfinder.h"
+#include "droneprofiles.h"
+#include "gustriskestimator.h"
+#include "weatherraster.h"
+#include "operatingrules.h"
 #include "widgets/weatherwidget.h"
 #include "widgets/radarwidget.h"
 #include "widgets/windwidget.h"
+#include "widgets/flightplanwidget.h"
 #include "widgets/airportpresetwidget.h"
 #include "settingsdialog.h"
 #include "aboutdialog.h"
+#include "ratelimiter.h"
 
 
 #include <QApplication>
 #include <QMessageBox>
+#include <QFileDialog>
+#include <QLocale>
+#include <QSettings>
 #include <QDateTime>
 #include <QSplitter>
+#include <QtConcurrent>
 #include <QGeoCoordinate>
 #include <QDebug>
 
@@ -24,14 +39,28 @@ MainWindow::MainWindow(QWidget *parent)
     , m_weatherWidget(nullptr)
     , m_radarWidget(nullptr)
     , m_windWidget(nullptr)
+    , m_flightPlanWidget(nullptr)
     , m_weatherService(nullptr)
     , m_locationService(nullptr)
     , m_flightConditions(nullptr)
+    , m_climatology(nullptr)
+    , m_brokerClient(nullptr)
+    , m_windowFinder(nullptr)
+    , m_droneProfiles(nullptr)
+    , m_gustRisk(nullptr)
+    , m_rasterGenerator(nullptr)
+    , m_overlayTimer(nullptr)
+    , m_overlayGeneration(0)
+    , m_operatingRules(nullptr)
     , m_locationLabel(nullptr)
     , m_timeLabel(nullptr)
     , m_connectionLabel(nullptr)
     , m_updateTimer(nullptr)
     , m_timeTimer(nullptr)
+    , m_lastMinute(0)
+    , m_diagnosticsAction(nullptr)
+    , m_importArchiveAction(nullptr)
+    , m_climatologyAction(nullptr)
     , m_airportPresetWidget(nullptr)
 {
     setWindowTitle("DroneView - Flight Operations Dashboard");
@@ -41,23 +70,91 @@ MainWindow::MainWindow(QWidget *parent)
     m_weatherService = new WeatherService(this);
     m_locationService = new LocationService(this);
     m_flightConditions = new FlightConditions(this);
+    m_climatology = new Climatology(this);
+    m_windowFinder = new FlightWindowFinder(this);
+    m_droneProfiles = new DroneProfileLibrary(this);
+    m_droneProfiles->load();
+    m_gustRisk = new GustRiskEstimator(this);
+    m_rasterGenerator = new WeatherRasterGenerator(this);
+    
+    // Panning and zooming ask for an overlay per step; build the last one
+    m_overlayTimer = new QTimer(this);
+    m_overlayTimer->setSingleShot(true);
+    m_overlayTimer->setInterval(400);
+    connect(m_overlayTimer, &QTimer::timeout, this, &MainWindow::buildOverlay);
+    
+    QSettings settings("DroneView", "Settings");
+    const double altitude = settings.value("flight/altitudeMeters", 60.0).toDouble();
+    const WindProfile::Terrain terrain = WindProfile::terrainFromName(settings.value("flight/terrain", "open").toString());
+    m_flightConditions->setOperatingAltitude(altitude, terrain);
+    m_flightConditions->setNightOperations(settings.value("flight/nightOperations", false).toBool());
+    m_droneProfiles->setNightOperations(settings.value("flight/nightOperations", false).toBool());
+    m_flightConditions->setProfileId(settings.value("flight/profile").toString());
+    m_gustRisk->setOperatingAltitude(altitude, terrain);
+    m_rasterGenerator->setOperatingAltitude(altitude, terrain);
+    m_droneProfiles->setOperatingAltitude(altitude, terrain);
+    m_windowFinder->setOperatingAltitude(altitude, terrain);
+    m_windowFinder->setProfileId(settings.value("flight/profile").toString());
+    m_magneticModel.load(settings.value("magnetic/modelFile", MagneticModel::defaultPath()).toString());
+    updateMagneticVariation();
+    
+    const std::pair<FlightFactor, const char *> factors[] = {
+        {FlightFactor::Wind, "wind"}, {FlightFactor::Visibility, "visibility"},
+        {FlightFactor::Precipitation, "precipitation"}, {FlightFactor::Temperature, "temperature"},
+        {FlightFactor::Ceiling, "ceiling"},
+    };
+    for (const auto &factor : factors) {
+        AssessmentStateMachine::Hysteresis hysteresis = m_flightConditions->stateMachine()->hysteresis(factor.first);
+        QString key = QString("hysteresis/%1/").arg(factor.second);
+        hysteresis.band = settings.value(key + "band", hysteresis.band).toDouble();
+        hysteresis.dwellSeconds = settings.value(key + "dwellSeconds", hysteresis.dwellSeconds).toInt();
+        m_flightConditions->stateMachine()->setHysteresis(factor.first, hysteresis);
+    }
+    
+    // Consoles on the same host share one upstream poller
+    if (settings.value("broker/enabled", true).toBool()) {
+        m_brokerClient = new BrokerClient(this);
+        m_weatherService->setBrokerClient(m_brokerClient);
+        m_brokerClient->connectToBroker();
+    }
     
     setupUI();
+    // Routes are graded like the live assessment
+    m_flightPlanWidget->setOperatingConditions(m_flightConditions->currentAssessment().limits, altitude, terrain);
     setupMenuBar();
     setupToolBar();
     setupStatusBar();
     setupStyling();
     
+    // Recompiled on every save of the rule file; a broken edit keeps the
+    // last good rules and says why in the status bar
+    m_operatingRules = new OperatingRules(this);
+    connect(m_operatingRules, &OperatingRules::rulesChanged, this, &MainWindow::applyOperatingRules);
+    connect(m_operatingRules, &OperatingRules::loadFailed, this, [this](const QString &message) {
+        statusBar()->showMessage("Operating rules not reloaded: " + message, 15000);
+    });
+    m_operatingRules->load(settings.value("rules/file", OperatingRules::storagePath()).toString());
+    
     m_updateTimer = new QTimer(this);
-    connect(m_updateTimer, &QTimer::timeout, this, &MainWindow::refreshWeatherData);
+    connect(m_updateTimer, &QTimer::timeout, this, &MainWindow::pollWeatherData);
     m_updateTimer->start(300000); // Update every 5 minutes
     
     m_timeTimer = new QTimer(this);
     connect(m_timeTimer, &QTimer::timeout, [this]() {
-        m_timeLabel->setText(QDateTime::currentDateTime().toString("hh:mm:ss UTC"));
+        const QDateTime now = QDateTime::currentDateTimeUtc();
+        m_timeLabel->setText(now.toString("hh:mm:ss UTC"));
+        // A late or coalesced tick can skip second 0; the minute still changes
+        const qint64 minute = now.toSecsSinceEpoch() / 60;
+        if (minute != m_lastMinute) {
+            m_lastMinute = minute;
+            updateNextWindow(); // an open window shrinks as time passes
+            updateMagneticVariation();
+        }
     });
     m_timeTimer->start(1000);
     
+    // Show the last known state before the first round trip starts
+    restoreSnapshot();
     refreshWeatherData();
 }
 
@@ -84,6 +181,10 @@ void MainWindow::setupMenuBar()
     connect(m_refreshAction, &QAction::triggered, this, &MainWindow::refreshWeatherData);
     fileMenu->addAction(m_refreshAction);
     
+    m_importArchiveAction = new QAction("&Import ASOS Archive...", this);
+    connect(m_importArchiveAction, &QAction::triggered, this, &MainWindow::importClimatologyArchive);
+    fileMenu->addAction(m_importArchiveAction);
+    
     fileMenu->addSeparator();
     
     m_settingsAction = new QAction("&Settings...", this);
@@ -106,6 +207,14 @@ void MainWindow::setupMenuBar()
     connect(m_fullScreenAction, &QAction::triggered, this, &MainWindow::toggleFullScreen);
     viewMenu->addAction(m_fullScreenAction);
     
+    m_diagnosticsAction = new QAction("Network &Diagnostics...", this);
+    connect(m_diagnosticsAction, &QAction::triggered, this, &MainWindow::showNetworkDiagnostics);
+    viewMenu->addAction(m_diagnosticsAction);
+    
+    m_climatologyAction = new QAction("Flight &Climatology...", this);
+    connect(m_climatologyAction, &QAction::triggered, this, &MainWindow::showClimatology);
+    viewMenu->addAction(m_climatologyAction);
+    
     auto *helpMenu = menuBar()->addMenu("&Help");
     
     auto *aboutAction = new QAction("&About", this);
@@ -140,6 +249,10 @@ void MainWindow::setupStatusBar()
     
     connect(m_locationService, &LocationService::locationUpdated,
             this, &MainWindow::updateLocation);
+    
+    connect(RateLimiter::instance(), &RateLimiter::statsChanged, this, [this]() {
+        m_connectionLabel->setToolTip(RateLimiter::instance()->diagnostics());
+    });
 }
 
 void MainWindow::updateLocation()
@@ -163,6 +276,80 @@ void MainWindow::refreshWeatherData()
     
     m_connectionLabel->setText("Status: Connected");
 }
+
+void MainWindow::pollWeatherData()
+{
+    // Timer driven refreshes yield to anything the user asked for
+    auto position = m_locationService->currentPosition();
+    if (position.isValid()) {
+        m_weatherService->fetchWeatherData(position.latitude(), position.longitude(), RequestPriority::Background);
+    } else {
+        m_weatherService->fetchWeatherData(37.7749, -122.4194, RequestPriority::Background);
+    }
+}
+
+void MainWindow::showNetworkDiagnostics()
+{
+    QMessageBox::information(this, "Network Diagnostics", RateLimiter::instance()->diagnostics());
+}
+
+void MainWindow::importClimatologyArchive()
+{
+    QString path = QFileDialog::getOpenFileName(this, "Import ASOS Archive", QString(),
+                                                "IEM ASOS archives (*.csv *.txt);;All files (*)");
+    if (path.isEmpty()) {
+        return;
+    }
+    
+    m_importArchiveAction->setEnabled(false);
+    statusBar()->showMessage("Importing " + path + "...");
+    
+    m_climatology->importArchive(path)
+        .then(this, [this](qint64 rows) {
+            statusBar()->showMessage(QString("Imported %1 observations").arg(rows), 5000);
+            m_importArchiveAction->setEnabled(true);
+        })
+        .onFailed(this, [this](const ClimatologyError &error) {
+            statusBar()->clearMessage();
+            m_importArchiveAction->setEnabled(true);
+            QMessageBox::warning(this, "Import ASOS Archive", error.message());
+        });
+}
+
+void MainWindow::showClimatology()
+{
+    QString stationId = m_weatherService->getPreferredAirport();
+    if (stationId.isEmpty()) {
+        stationId = m_weatherService->currentWeather().stationId;
+    }
+    if (!m_climatology->stations().contains(stationId)) {
+        QMessageBox::information(this, "Flight Climatology",
+                                 QString("No archive has been imported for %1 yet.\n\n"
+                                         "Download one from the IEM ASOS service and use File > Import ASOS Archive.")
+                                 .arg(stationId.isEmpty() ? "this station" : stationId));
+        return;
+    }
+    
+    int month = QDate::currentDate().month();
+    m_climatology->aggregate({stationId}, m_flightConditions->currentAssessment().limits)
+        .then(this, [this, stationId, month](const QList<ClimatologyTable> &tables) {
+            QStringList lines;
+            lines.append(QString("%1 in %2, share of observations within limits:\n")
+                         .arg(stationId, QLocale().monthName(month)));
+            for (int hour = 0; hour < 24; ++hour) {
+                const ClimatologyCell &cell = tables.first().cell(month, hour);
+                if (cell.observations() == 0) {
+                    continue;
+                }
+                lines.append(QString("%1:00  %2%  (%3 obs)")
+                             .arg(hour, 2, 10, QChar('0'))
+                             .arg(cell.flyableFraction() * 100.0, 0, 'f', 0)
+                             .arg(cell.observations()));
+            }
+            QMessageBox::information(this, "Flight Climatology", lines.join("\n"));
+        });
+}
+
 void MainWindow::showAbout()
 {
     AboutDialog dialog(this);
@@ -186,6 +373,7 @@ void MainWindow::createTabbedInterface()
     
     m_weatherWidget = new WeatherWidget(this);
     m_windWidget = new WindWidget(this);
+    m_windWidget->setMagneticVariation(&m_magneticVariation);
     
     weatherLayout->addWidget(m_weatherWidget, 1);
     weatherLayout->addWidget(m_windWidget, 1);
@@ -203,7 +391,13 @@ void MainWindow::createTabbedInterface()
     
     m_tabWidget->addTab(radarTab, "Weather Radar");
     
-
+    // FLIGHT PLANNING TAB
+    m_flightPlanWidget = new FlightPlanWidget(this);
+    m_flightPlanWidget->setWeatherService(m_weatherService);
+    m_flightPlanWidget->setMagneticVariation(&m_magneticVariation);
+    m_tabWidget->addTab(m_flightPlanWidget, "Flight Planning");
+    
+    
     
     mainLayout->addWidget(m_tabWidget);
     
@@ -214,14 +408,173 @@ void MainWindow::createTabbedInterface()
             m_windWidget, &WindWidget::updateWindData);
     connect(m_weatherService, &WeatherService::weatherDataUpdated,
             m_flightConditions, &FlightConditions::assessConditions);
-    connect(m_flightConditions, &FlightConditions::assessmentUpdated,
+    // Only real category transitions restyle the panel
+    connect(m_flightConditions, &FlightConditions::safetyChanged,
             m_weatherWidget, &WeatherWidget::updateFlightConditions);
+    connect(m_flightConditions, &FlightConditions::assessmentUpdated,
+            this, [this](const FlightAssessment &assessment) {
+                WeatherSnapshot::save(m_weatherService->currentWeather(), assessment);
+                
+                // Unchanged TAF periods keep their grades; only amendments are regraded
+                const WeatherData &weather = m_weatherService->currentWeather();
+                m_windowFinder->setLimits(assessment.limits);
+                m_windowFinder->setSite(weather.latitude, weather.longitude,
+                                        QSettings("DroneView", "Settings").value("flight/nightOperations", false).toBool());
+                m_windowFinder->setForecast(weather.hourlyForecast);
+            });
+    connect(m_windowFinder, &FlightWindowFinder::windowsChanged, this, &MainWindow::updateNextWindow);
+    connect(m_weatherService, &WeatherService::weatherDataUpdated,
+            this, [this](const WeatherData &data) {
+                m_weatherWidget->updateFleetStatus(m_droneProfiles->assess(data));
+            });
+    connect(m_weatherService, &WeatherService::observationSettled,
+            this, &MainWindow::updateGustRisk);
+    connect(m_radarWidget, &RadarWidget::overlayRequested, this, &MainWindow::generateOverlay);
+    connect(m_droneProfiles, &DroneProfileLibrary::profilesChanged,
+            this, [this]() {
+                const WeatherData &weather = m_weatherService->currentWeather();
+                if (weather.timestamp.isValid()) {
+                    m_weatherWidget->updateFleetStatus(m_droneProfiles->assess(weather));
+                }
+            });
     connect(m_locationService, &LocationService::locationUpdated,
             [this](const QGeoCoordinate &coord) {
                 m_radarWidget->updateLocation(coord.latitude(), coord.longitude());
+                m_flightPlanWidget->updateCurrentLocation(coord.latitude(), coord.longitude());
             });
 }
 
+void MainWindow::updateNextWindow()
+{
+    QSettings settings("DroneView", "Settings");
+    int minimumMinutes = settings.value("windows/minimumMinutes", 120).toInt();
+    m_weatherWidget->updateNextWindow(m_windowFinder->nextWindow(QDateTime::currentDateTimeUtc(), minimumMinutes),
+                                      minimumMinutes);
+}
+
+void MainWindow::updateGustRisk(const WeatherData &data)
+{
+    // An imported archive that reaches into the last hours gives the fit
+    // history from the first refresh on. Only its tail is read, on the pool.
+    if (!m_gustRisk->hasHistory(data.stationId) && !m_gustHistoryRequested.contains(data.stationId)) {
+        m_gustHistoryRequested.insert(data.stationId);
+        const QString stationId = data.stationId;
+        const qint64 since = QDateTime::currentSecsSinceEpoch() - GustRiskEstimator::kHistoryHours * 3600;
+        QtConcurrent::run([stationId, since]() {
+            return Climatology::recentSeries(stationId, since);
+        }).then(this, [this, data](const std::shared_ptr<const StationSeries> &series) {
+            if (series) {
+                m_gustRisk->addHistory(*series);
+            }
+            estimateGustRisk(data);
+        });
+        return;
+    }
+    estimateGustRisk(data);
+}
+
+void MainWindow::estimateGustRisk(const WeatherData &data)
+{
+    m_gustRisk->addObservation(data);
+    
+    QSettings settings("DroneView", "Settings");
+    int flightMinutes = settings.value("flight/durationMinutes", 25).toInt();
+    double limit = FlightThresholds(m_flightConditions->currentAssessment().limits).gustUnsafe;
+    m_gustRisk->estimate(data.stationId, limit, flightMinutes)
+        .then(this, [this](const GustRisk &risk) {
+            m_weatherWidget->updateGustRisk(risk);
+        })
+        .onFailed(this, [](const GustRiskError &error) {
+            qDebug() << "Gust risk:" << error.message();
+        });
+}
+
+void MainWindow::generateOverlay(const RasterBounds &bounds, int width, int height)
+{
+    m_overlayBounds = bounds;
+    m_overlaySize = QSize(width, height);
+    m_overlayTimer->start();
+}
+
+void MainWindow::buildOverlay()
+{
+    const quint64 generation = ++m_overlayGeneration;
+    const RasterBounds bounds = m_overlayBounds;
+    const QSize size = m_overlaySize;
+    
+    // Stations beyond the view still shape the field near its edges
+    const double latitudeMargin = (bounds.north - bounds.south) / 4.0;
+    const double longitudeMargin = (bounds.east - bounds.west) / 4.0;
+    const double south = bounds.south - latitudeMargin;
+    const double north = bounds.north + latitudeMargin;
+    const double west = bounds.west - longitudeMargin;
+    const double east = bounds.east + longitudeMargin;
+    
+    // One area request for every station in view, rather than a fetch round
+    // per station; the overlay only needs the METAR fields
+    m_rasterGenerator->setLimits(m_flightConditions->currentAssessment().limits);
+    m_weatherService->metarsWithin(south, west, north, east, RequestPriority::Background)
+        .then(this, [this, generation, bounds, size](const QList<WeatherData> &reports) {
+            if (generation != m_overlayGeneration || reports.isEmpty()) {
+                return; // superseded, or nothing reported
+            }
+            m_rasterGenerator->generate(reports, bounds, size.width(), size.height())
+                .then(this, [this, generation](const WeatherRaster &raster) {
+                    if (generation == m_overlayGeneration) {
+                        m_radarWidget->setWeatherRaster(raster);
+                    }
+                });
+        })
+        .onFailed(this, [](const WeatherFetchError &error) {
+            qDebug() << "MainWindow: no overlay observations:" << error.message();
+        });
+}
+
+void MainWindow::applyOperatingRules()
+{
+    std::shared_ptr<const RuleProgram> rules = m_operatingRules->program();
+    m_flightConditions->setOperatingRules(rules);
+    m_droneProfiles->setOperatingRules(rules);
+    m_windowFinder->setOperatingRules(rules);
+    
+    const WeatherData &weather = m_weatherService->currentWeather();
+    if (weather.timestamp.isValid()) {
+        m_flightConditions->assessConditions(weather);
+        m_weatherWidget->updateFleetStatus(m_droneProfiles->assess(weather));
+    }
+}
+
+void MainWindow::updateMagneticVariation()
+{
+    // The grid follows the secular variation a day at a time
+    const QDate today = QDateTime::currentDateTimeUtc().date();
+    if (m_magneticModel.isValid() && m_magneticVariation.date() != today) {
+        m_magneticVariation.build(m_magneticModel, today);
+    }
+}
+
+void MainWindow::restoreSnapshot()
+{
+    QString stationId = m_weatherService->getPreferredAirport();
+    WeatherSnapshot snapshot = stationId.isEmpty()
+        ? WeatherSnapshot::loadLatest()
+        : WeatherSnapshot::load(stationId);
+    if (!snapshot.isValid()) {
+        return;
+    }
+    
+    m_weatherWidget->updateWeatherData(snapshot.weather);
+    m_windWidget->updateWindData(snapshot.weather);
+    m_weatherWidget->updateFlightConditions(snapshot.assessment);
+    m_weatherWidget->showSnapshotAge(snapshot.observedAt());
+    
+    m_windowFinder->setLimits(snapshot.assessment.limits);
+    m_windowFinder->setSite(snapshot.weather.latitude, snapshot.weather.longitude,
+                            QSettings("DroneView", "Settings").value("flight/nightOperations", false).toBool());
+    m_windowFinder->setForecast(snapshot.weather.hourlyForecast);
+    m_weatherWidget->updateFleetStatus(m_droneProfiles->assess(snapshot.weather));
+}
+
 void MainWindow::setupStyling()
 {
     setStyleSheet(R"(
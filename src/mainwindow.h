@@ -11,6 +11,9 @@
 #include <QToolBar>
 #include <QAction>
 #include <QTimer>
+#include <QSet>
+#include "magneticvariation.h"
+#include "weatherraster.h"
 
 class WeatherWidget;
 class RadarWidget;
@@ -18,8 +21,16 @@ class WindWidget;
 class WeatherService;
 class LocationService;
 class FlightConditions;
+class Climatology;
+class BrokerClient;
+class FlightWindowFinder;
+class DroneProfileLibrary;
+class GustRiskEstimator;
+class WeatherRasterGenerator;
+class OperatingRules;
 class SettingsDialog;
 class AirportPresetWidget;
+class FlightPlanWidget;
 
 class MainWindow : public QMainWindow
 {
@@ -32,6 +43,10 @@ public:
 private slots:
     void updateLocation();
     void refreshWeatherData();
+    void pollWeatherData();
+    void showNetworkDiagnostics();
+    void importClimatologyArchive();
+    void showClimatology();
     void showAbout();
     void toggleFullScreen();
     void showSettings();
@@ -44,6 +59,14 @@ private:
     void setupStatusBar();
     void setupStyling();
     void createTabbedInterface();
+    void restoreSnapshot();
+    void updateNextWindow();
+    void updateGustRisk(const WeatherData &data);
+    void estimateGustRisk(const WeatherData &data);
+    void generateOverlay(const RasterBounds &bounds, int width, int height);
+    void buildOverlay();
+    void updateMagneticVariation();
+    void applyOperatingRules();
     
     QWidget *m_centralWidget;
     QTabWidget *m_tabWidget;
@@ -51,10 +74,25 @@ private:
     WeatherWidget *m_weatherWidget;
     RadarWidget *m_radarWidget;
     WindWidget *m_windWidget;
+    FlightPlanWidget *m_flightPlanWidget;
     
     WeatherService *m_weatherService;
     LocationService *m_locationService;
     FlightConditions *m_flightConditions;
+    Climatology *m_climatology;
+    BrokerClient *m_brokerClient;
+    FlightWindowFinder *m_windowFinder;
+    DroneProfileLibrary *m_droneProfiles;
+    GustRiskEstimator *m_gustRisk;
+    QSet<QString> m_gustHistoryRequested; // stations whose archive tail was read
+    WeatherRasterGenerator *m_rasterGenerator;
+    QTimer *m_overlayTimer;
+    RasterBounds m_overlayBounds; // of the latest request
+    QSize m_overlaySize;
+    quint64 m_overlayGeneration; // results of older requests are dropped
+    OperatingRules *m_operatingRules;
+    MagneticModel m_magneticModel;
+    MagneticVariation m_magneticVariation;
     
     QLabel *m_locationLabel;
     QLabel *m_timeLabel;
@@ -62,10 +100,14 @@ private:
     
     QTimer *m_updateTimer;
     QTimer *m_timeTimer;
+    qint64 m_lastMinute; // UTC minutes since the epoch at the last per-minute update
     
     QAction *m_refreshAction;
     QAction *m_settingsAction;
     QAction *m_fullScreenAction;
+    QAction *m_diagnosticsAction;
+    QAction *m_importArchiveAction;
+    QAction *m_climatologyAction;
     QAction *m_exitAction;
     
     AirportPresetWidget *m_airportPresetWidget;
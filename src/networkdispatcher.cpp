@@ -0,0 +1,178 @@
+#include "networkdispatcher.h"
+#include <QCoreApplication>
+#include <QMutexLocker>
+#include <QSet>
+#include <QDebug>
+
+NetworkDispatcher *NetworkDispatcher::instance()
+{
+    static NetworkDispatcher *dispatcher = new NetworkDispatcher();
+    return dispatcher;
+}
+
+NetworkDispatcher::NetworkDispatcher(QObject *parent)
+    : QObject(parent)
+    , m_thread(new QThread(this))
+    , m_worker(nullptr)
+    , m_nextRequestId(1)
+{
+    m_thread->setObjectName("DroneView network I/O");
+    
+    m_worker = new NetworkWorker(this);
+    m_worker->moveToThread(m_thread);
+    connect(m_thread, &QThread::finished, m_worker, &QObject::deleteLater);
+    
+    // The limiter's wake-up timer must run where requests are admitted
+    RateLimiter::instance()->moveToThread(m_thread);
+    
+    if (QCoreApplication::instance()) {
+        connect(QCoreApplication::instance(), &QCoreApplication::aboutToQuit,
+                this, &NetworkDispatcher::shutdown);
+    }
+    
+    m_thread->start();
+}
+
+void NetworkDispatcher::shutdown()
+{
+    m_thread->quit();
+    m_thread->wait();
+}
+
+quint64 NetworkDispatcher::get(const QNetworkRequest &request, RequestPriority priority,
+                               QObject *context, ResponseHandler onFinished, double cost)
+{
+    quint64 requestId = m_nextRequestId++;
+    
+    {
+        QMutexLocker locker(&m_mutex);
+        m_pending.insert(requestId, {QPointer<QObject>(context), std::move(onFinished)});
+    }
+    
+    NetworkWorker *worker = m_worker;
+    QMetaObject::invokeMethod(worker, [worker, requestId, request, priority, cost]() {
+        worker->start(requestId, request, priority, cost);
+    }, Qt::QueuedConnection);
+    
+    return requestId;
+}
+
+void NetworkDispatcher::abort(quint64 requestId)
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        if (m_pending.remove(requestId) == 0) {
+            return;
+        }
+    }
+    
+    NetworkWorker *worker = m_worker;
+    QMetaObject::invokeMethod(worker, [worker, requestId]() {
+        worker->abort(requestId);
+    }, Qt::QueuedConnection);
+}
+
+void NetworkDispatcher::admit(const QString &host, RequestPriority priority,
+                              QObject *context, std::function<void()> onAdmitted, double cost)
+{
+    QPointer<QObject> target(context);
+    QMetaObject::invokeMethod(RateLimiter::instance(), [host, priority, target, onAdmitted, cost]() {
+        RateLimiter::instance()->submit(host, priority, [target, onAdmitted]() {
+            if (target) {
+                QMetaObject::invokeMethod(target.data(), onAdmitted, Qt::QueuedConnection);
+            }
+        }, cost);
+    }, Qt::QueuedConnection);
+}
+
+void NetworkDispatcher::deliver(const NetworkResponse &response)
+{
+    PendingRequest pending;
+    {
+        QMutexLocker locker(&m_mutex);
+        auto it = m_pending.find(response.requestId);
+        if (it == m_pending.end()) {
+            return; // aborted
+        }
+        pending = it.value();
+        m_pending.erase(it);
+    }
+    
+    if (!pending.context) {
+        return;
+    }
+    
+    ResponseHandler onFinished = pending.onFinished;
+    QMetaObject::invokeMethod(pending.context.data(), [onFinished, response]() {
+        onFinished(response);
+    }, Qt::QueuedConnection);
+}
+
+// ---------------------------------------------------------------------------
+
+NetworkWorker::NetworkWorker(NetworkDispatcher *dispatcher)
+    : QObject(nullptr)
+    , m_dispatcher(dispatcher)
+    , m_networkManager(nullptr)
+{
+}
+
+void NetworkWorker::start(quint64 requestId, const QNetworkRequest &request, RequestPriority priority, double cost)
+{
+    if (!m_networkManager) {
+        // Created lazily so it is owned by the I/O thread
+        m_networkManager = new QNetworkAccessManager(this);
+    }
+    
+    const quint64 ticket = RateLimiter::instance()->submit(request.url().host(), priority, [this, requestId, request]() {
+        m_queued.remove(requestId);
+        
+        QNetworkReply *reply = m_networkManager->get(request);
+        m_replies.insert(requestId, reply);
+        connect(reply, &QNetworkReply::finished, this, [this, requestId, reply]() {
+            finish(requestId, reply);
+        });
+    }, cost);
+    // Unless it was admitted right away
+    if (!m_replies.contains(requestId)) {
+        m_queued.insert(requestId, ticket);
+    }
+}
+
+void NetworkWorker::abort(quint64 requestId)
+{
+    QNetworkReply *reply = m_replies.take(requestId);
+    if (reply) {
+        reply->disconnect(this);
+        reply->abort();
+        reply->deleteLater();
+    } else if (m_queued.contains(requestId)) {
+        // Still waiting for the rate limiter: give back its place and tokens
+        RateLimiter::instance()->cancel(m_queued.take(requestId));
+    }
+}
+
+void NetworkWorker::finish(quint64 requestId, QNetworkReply *reply)
+{
+    m_replies.remove(requestId);
+    reply->deleteLater();
+    
+    NetworkResponse response;
+    response.requestId = requestId;
+    response.url = reply->url();
+    response.error = reply->error();
+    response.errorString = reply->errorString();
+    response.httpStatus = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    response.body = reply->readAll();
+    response.headers = reply->rawHeaderPairs();
+    
+    // Parse here rather than on the caller's (usually GUI) thread. Local
+    // stand-ins do not always label their JSON, so sniff the body as well.
+    QByteArray start = response.body.left(64).trimmed();
+    bool looksLikeJson = start.startsWith('{') || start.startsWith('[');
+    if (response.ok() && (looksLikeJson || reply->header(QNetworkRequest::ContentTypeHeader).toString().contains("json"))) {
+        response.json = QJsonDocument::fromJson(response.body);
+    }
+    
+    m_dispatcher->deliver(response);
+}
\ No newline at end of file
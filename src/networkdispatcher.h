@@ -0,0 +1,92 @@
+#pragma once
+
+#include <QObject>
+#include <QThread>
+#include <QMutex>
+#include <QHash>
+#include <QSet>
+#include <QPointer>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QJsonDocument>
+#include <atomic>
+#include <functional>
+#include "ratelimiter.h"
+
+struct NetworkResponse {
+    quint64 requestId = 0;
+    QUrl url;
+    QNetworkReply::NetworkError error = QNetworkReply::NoError;
+    QString errorString;
+    int httpStatus = 0;
+    QByteArray body;
+    QJsonDocument json; // parsed on the I/O thread for JSON content types
+    QList<QNetworkReply::RawHeaderPair> headers;
+    
+    bool ok() const { return error == QNetworkReply::NoError; }
+};
+
+class NetworkWorker;
+
+// Owns the dedicated network I/O thread. All DNS, TLS, decompression and
+// body reads happen there; callers get a NetworkResponse delivered on the
+// thread of the context object they passed in. Safe to call from any thread.
+class NetworkDispatcher : public QObject
+{
+    Q_OBJECT
+
+public:
+    using ResponseHandler = std::function<void(const NetworkResponse &)>;
+    
+    static NetworkDispatcher *instance();
+    
+    // Issues the request once the host's rate limiter admits it. onFinished is
+    // dropped if context is destroyed first.
+    quint64 get(const QNetworkRequest &request, RequestPriority priority,
+                QObject *context, ResponseHandler onFinished, double cost = 1.0);
+    void abort(quint64 requestId);
+    
+    // Rate limiting only, for traffic issued outside Qt networking (the web
+    // view's own tile loads): onAdmitted runs on context's thread
+    void admit(const QString &host, RequestPriority priority,
+               QObject *context, std::function<void()> onAdmitted, double cost = 1.0);
+
+private:
+    explicit NetworkDispatcher(QObject *parent = nullptr);
+    void deliver(const NetworkResponse &response);
+    void shutdown();
+    
+    struct PendingRequest {
+        QPointer<QObject> context;
+        ResponseHandler onFinished;
+    };
+    
+    QThread *m_thread;
+    NetworkWorker *m_worker;
+    QMutex m_mutex;
+    QHash<quint64, PendingRequest> m_pending;
+    std::atomic<quint64> m_nextRequestId;
+    
+    friend class NetworkWorker;
+};
+
+// Lives on the I/O thread and owns its QNetworkAccessManager
+class NetworkWorker : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit NetworkWorker(NetworkDispatcher *dispatcher);
+    
+    void start(quint64 requestId, const QNetworkRequest &request, RequestPriority priority, double cost);
+    void abort(quint64 requestId);
+
+private:
+    void finish(quint64 requestId, QNetworkReply *reply);
+    
+    NetworkDispatcher *m_dispatcher;
+    QNetworkAccessManager *m_networkManager;
+    QHash<quint64, QNetworkReply *> m_replies;
+    QHash<quint64, quint64> m_queued; // limiter tickets by request id
+};
\ No newline at end of file
@@ -0,0 +1,640 @@
+#include "operatingrules.h"
+#include "weatherphenomena.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QFileSystemWatcher>
+#include <QStandardPaths>
+#include <QTimer>
+#include <QDebug>
+#include <iterator>
+#include <vector>
+
+namespace {
+
+struct FieldName {
+    const char *name;
+    RuleField field;
+};
+
+const FieldName kFieldNames[] = {
+    {"wind", RuleField::Wind},
+    {"gust", RuleField::Gust},
+    {"direction", RuleField::Direction},
+    {"visibility", RuleField::Visibility},
+    {"ceiling", RuleField::Ceiling},
+    {"temperature", RuleField::Temperature},
+    {"dewpoint", RuleField::Dewpoint},
+    {"spread", RuleField::Spread},
+    {"humidity", RuleField::Humidity},
+    {"pressure", RuleField::Pressure},
+    {"cloudcover", RuleField::CloudCover},
+    {"densityaltitude", RuleField::DensityAltitude},
+    {"cloudbase", RuleField::CloudBase},
+    {"icing", RuleField::Icing},
+    {"elevation", RuleField::Elevation},
+    {"altitude", RuleField::Altitude},
+    {"sun", RuleField::Sun},
+};
+
+// String fields, by the index TextEqual carries
+const char *const kTextFields[] = {"profile", "station"};
+
+struct Token {
+    enum Kind { End, Number, Identifier, String, Symbol };
+    Kind kind = End;
+    QString text;
+    double number = 0.0;
+    int column = 0;
+};
+
+// Tokens of one rule line; # starts a comment. False on a stray character
+// or an unterminated string, with the offending column in failedColumn.
+bool tokenize(QStringView line, std::vector<Token> &tokens, int &failedColumn)
+{
+    int i = 0;
+    const int length = int(line.size());
+    while (i < length) {
+        const QChar c = line[i];
+        if (c.isSpace()) {
+            ++i;
+            continue;
+        }
+        if (c == '#') {
+            break;
+        }
+        
+        Token token;
+        token.column = i + 1;
+        if (c.isDigit() || (c == '.' && i + 1 < length && line[i + 1].isDigit())) {
+            int end = i;
+            while (end < length && (line[end].isDigit() || line[end] == '.')) {
+                ++end;
+            }
+            bool ok = false;
+            token.kind = Token::Number;
+            token.number = line.mid(i, end - i).toDouble(&ok);
+            if (!ok) {
+                failedColumn = token.column;
+                return false;
+            }
+            i = end;
+        } else if (c.isLetter() || c == '_') {
+            int end = i;
+            while (end < length && (line[end].isLetterOrNumber() || line[end] == '_')) {
+                ++end;
+            }
+            token.kind = Token::Identifier;
+            token.text = line.mid(i, end - i).toString().toLower();
+            i = end;
+        } else if (c == '"') {
+            const int end = int(line.indexOf('"', i + 1));
+            if (end < 0) {
+                failedColumn = token.column;
+                return false;
+            }
+            token.kind = Token::String;
+            token.text = line.mid(i + 1, end - i - 1).toString();
+            i = end + 1;
+        } else {
+            static const char *const symbols[] = {"<=", ">=", "==", "!=", "<", ">", "=", "+", "-", "*", "/",
+                                                  "(", ")", ":"};
+            token.kind = Token::Symbol;
+            for (const char *symbol : symbols) {
+                if (line.mid(i).startsWith(QLatin1String(symbol))) {
+                    token.text = QLatin1String(symbol);
+                    break;
+                }
+            }
+            if (token.text.isEmpty()) {
+                failedColumn = token.column;
+                return false;
+            }
+            i += int(token.text.size());
+        }
+        tokens.push_back(token);
+    }
+    
+    Token end;
+    end.column = length + 1;
+    tokens.push_back(end);
+    return true;
+}
+
+} // namespace
+
+// Recursive descent over one line's tokens, emitting postfix bytecode as it
+// goes and tracking the stack depth the rule will need
+class RuleCompiler
+{
+public:
+    RuleCompiler(RuleProgram &program, std::vector<Token> tokens)
+        : m_program(program)
+        , m_tokens(std::move(tokens))
+    {
+    }
+    
+    bool compile(int line)
+    {
+        OperatingRule rule;
+        rule.line = line;
+        
+        const Token severity = next();
+        if (severity.kind != Token::Identifier) {
+            return fail(severity, "expected caution, unsafe or nofly");
+        }
+        if (severity.text == "caution") {
+            rule.severity = FlightSafety::Caution;
+        } else if (severity.text == "unsafe") {
+            rule.severity = FlightSafety::Unsafe;
+        } else if (severity.text == "nofly") {
+            rule.severity = FlightSafety::NoFly;
+        } else {
+            return fail(severity, QString("unknown severity '%1'").arg(severity.text));
+        }
+        
+        const Token name = next();
+        if (name.kind != Token::String || name.text.isEmpty()) {
+            return fail(name, "expected the rule's name in quotes");
+        }
+        rule.name = name.text;
+        if (!expectSymbol(":")) {
+            return false;
+        }
+        
+        m_program.m_starts.append(m_program.m_code.size());
+        if (!parseRule()) {
+            return false;
+        }
+        if (peek().kind != Token::End) {
+            return fail(peek(), QString("unexpected '%1'").arg(peek().text));
+        }
+        m_program.m_rules.append(rule);
+        return true;
+    }
+    
+    QString error() const { return m_error; }
+
+private:
+    using Op = RuleProgram::Op;
+    
+    const Token &peek() const { return m_tokens[m_position]; }
+    const Token &next()
+    {
+        const Token &token = m_tokens[m_position];
+        if (m_position + 1 < m_tokens.size()) {
+            ++m_position; // stays on End
+        }
+        return token;
+    }
+    bool isSymbol(const char *symbol) const { return peek().kind == Token::Symbol && peek().text == QLatin1String(symbol); }
+    bool isKeyword(const char *keyword) const { return peek().kind == Token::Identifier && peek().text == QLatin1String(keyword); }
+    
+    bool fail(const Token &token, const QString &message)
+    {
+        m_error = QString("column %1: %2").arg(token.column).arg(message);
+        return false;
+    }
+    
+    bool expectSymbol(const char *symbol)
+    {
+        if (!isSymbol(symbol)) {
+            return fail(peek(), QString("expected '%1'").arg(QLatin1String(symbol)));
+        }
+        ++m_position;
+        return true;
+    }
+    
+    // Pushing instructions grow the stack by one, binary operators shrink it
+    bool append(Op op, int stackChange, quint8 a = 0, quint32 b = 0, double value = 0.0)
+    {
+        m_depth += stackChange;
+        if (m_depth > RuleProgram::kMaxStack) {
+            return fail(peek(), "expression too deeply nested");
+        }
+        RuleProgram::Instruction instruction;
+        instruction.op = op;
+        instruction.a = a;
+        instruction.b = b;
+        instruction.value = value;
+        m_program.m_code.append(instruction);
+        return true;
+    }
+    
+    // rule := or ('unless' or)?
+    bool parseRule()
+    {
+        if (!parseOr()) {
+            return false;
+        }
+        if (isKeyword("unless")) {
+            ++m_position;
+            return parseOr() && append(Op::Not, 0) && append(Op::And, -1);
+        }
+        return true;
+    }
+    
+    bool parseOr()
+    {
+        if (!parseAnd()) {
+            return false;
+        }
+        while (isKeyword("or")) {
+            ++m_position;
+            if (!parseAnd() || !append(Op::Or, -1)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    
+    bool parseAnd()
+    {
+        if (!parseNot()) {
+            return false;
+        }
+        while (isKeyword("and")) {
+            ++m_position;
+            if (!parseNot() || !append(Op::And, -1)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    
+    bool parseNot()
+    {
+        if (isKeyword("not")) {
+            ++m_position;
+            return parseNot() && append(Op::Not, 0);
+        }
+        return parseComparison();
+    }
+    
+    bool parseComparison()
+    {
+        // profile == "matrice": strings only compare for equality
+        for (quint8 field = 0; field < std::size(kTextFields); ++field) {
+            if (!isKeyword(kTextFields[field])) {
+                continue;
+            }
+            ++m_position;
+            const bool negate = isSymbol("!=");
+            if (!negate && !isSymbol("==") && !isSymbol("=")) {
+                return fail(peek(), QString("%1 only compares with == or !=").arg(kTextFields[field]));
+            }
+            ++m_position;
+            const Token literal = next();
+            if (literal.kind != Token::String) {
+                return fail(literal, "expected a quoted string");
+            }
+            m_program.m_literals.append(literal.text);
+            return append(Op::TextEqual, 1, field, quint32(m_program.m_literals.size() - 1))
+                && (!negate || append(Op::Not, 0));
+        }
+        
+        if (!parseAdditive()) {
+            return false;
+        }
+        
+        static const std::pair<const char *, Op> comparisons[] = {
+            {"<=", Op::LessEqual}, {">=", Op::GreaterEqual}, {"<", Op::Less}, {">", Op::Greater},
+            {"==", Op::Equal}, {"=", Op::Equal}, {"!=", Op::NotEqual},
+        };
+        for (const auto &comparison : comparisons) {
+            if (isSymbol(comparison.first)) {
+                ++m_position;
+                return parseAdditive() && append(comparison.second, -1);
+            }
+        }
+        return true;
+    }
+    
+    bool parseAdditive()
+    {
+        if (!parseTerm()) {
+            return false;
+        }
+        while (isSymbol("+") || isSymbol("-")) {
+            const Op op = next().text == "+" ? Op::Add : Op::Subtract;
+            if (!parseTerm() || !append(op, -1)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    
+    bool parseTerm()
+    {
+        if (!parseUnary()) {
+            return false;
+        }
+        while (isSymbol("*") || isSymbol("/")) {
+            const Op op = next().text == "*" ? Op::Multiply : Op::Divide;
+            if (!parseUnary() || !append(op, -1)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    
+    bool parseUnary()
+    {
+        if (isSymbol("-")) {
+            ++m_position;
+            return parseUnary() && append(Op::Negate, 0);
+        }
+        return parsePrimary();
+    }
+    
+    bool parsePrimary()
+    {
+        const Token token = next();
+        switch (token.kind) {
+        case Token::Number:
+            return append(Op::Constant, 1, 0, 0, token.number);
+        case Token::Symbol:
+            if (token.text == "(") {
+                return parseOr() && expectSymbol(")");
+            }
+            break;
+        case Token::Identifier:
+            if (token.text == "true" || token.text == "false") {
+                return append(Op::Constant, 1, 0, 0, token.text == "true" ? 1.0 : 0.0);
+            }
+            if (token.text == "wx") {
+                if (!expectSymbol("(")) {
+                    return false;
+                }
+                const Token groups = next();
+                const quint32 mask = groups.kind == Token::String ? WeatherPhenomena::decode(QStringView(groups.text)) : 0;
+                if (mask == 0) {
+                    return fail(groups, "expected present weather such as \"TSRA\"");
+                }
+                return expectSymbol(")") && append(Op::Weather, 1, 0, mask);
+            }
+            for (const FieldName &field : kFieldNames) {
+                if (token.text == QLatin1String(field.name)) {
+                    return append(Op::Field, 1, quint8(field.field));
+                }
+            }
+            return fail(token, QString("unknown field '%1'").arg(token.text));
+        case Token::String:
+            return fail(token, "strings only compare with profile or station");
+        case Token::End:
+            return fail(token, "unexpected end of rule");
+        }
+        return fail(token, QString("unexpected '%1'").arg(token.text));
+    }
+    
+    RuleProgram &m_program;
+    std::vector<Token> m_tokens;
+    size_t m_position = 0;
+    int m_depth = 0;
+    QString m_error;
+};
+
+RuleInputs RuleInputs::from(const WeatherData &weather, QStringView profile, double altitude, double sunElevation)
+{
+    RuleInputs inputs;
+    auto set = [&inputs](RuleField field, double value) { inputs.values[size_t(field)] = value; };
+    set(RuleField::Wind, weather.windSpeed);
+    set(RuleField::Gust, weather.windGust);
+    set(RuleField::Direction, weather.windDirection);
+    set(RuleField::Visibility, weather.visibility);
+    set(RuleField::Ceiling, weather.ceiling > 0.0 ? weather.ceiling : qQNaN());
+    set(RuleField::Temperature, weather.temperature);
+    set(RuleField::Dewpoint, weather.dewpoint);
+    set(RuleField::Spread, weather.temperature - weather.dewpoint);
+    set(RuleField::Humidity, weather.humidity);
+    set(RuleField::Pressure, weather.pressure);
+    set(RuleField::CloudCover, weather.cloudCover);
+    set(RuleField::DensityAltitude, weather.densityAltitude);
+    set(RuleField::CloudBase, weather.cloudBase);
+    set(RuleField::Icing, weather.icingRisk);
+    set(RuleField::Elevation, weather.elevation);
+    set(RuleField::Altitude, altitude);
+    set(RuleField::Sun, sunElevation);
+    inputs.phenomena = weather.phenomena;
+    inputs.profile = profile;
+    inputs.station = weather.stationId;
+    return inputs;
+}
+
+std::shared_ptr<const RuleProgram> RuleProgram::compile(const QString &source, QString *error)
+{
+    auto program = std::make_shared<RuleProgram>();
+    const QStringList lines = source.split('\n');
+    for (int i = 0; i < lines.size(); ++i) {
+        std::vector<Token> tokens;
+        int failedColumn = 0;
+        if (!tokenize(lines[i], tokens, failedColumn)) {
+            if (error) {
+                *error = QString("line %1: column %2: unexpected character").arg(i + 1).arg(failedColumn);
+            }
+            return nullptr;
+        }
+        if (tokens.front().kind == Token::End) {
+            continue; // blank or comment
+        }
+        
+        RuleCompiler compiler(*program, std::move(tokens));
+        if (!compiler.compile(i + 1)) {
+            if (error) {
+                *error = QString("line %1: %2").arg(i + 1).arg(compiler.error());
+            }
+            return nullptr;
+        }
+    }
+    program->m_starts.append(program->m_code.size());
+    return program;
+}
+
+namespace {
+
+inline bool truthy(double value)
+{
+    return value == value && value != 0.0; // NaN is false
+}
+
+} // namespace
+
+bool RuleProgram::matches(int index, const RuleInputs &inputs) const
+{
+    double stack[kMaxStack];
+    int top = -1;
+    const Instruction *code = m_code.constData();
+    const int end = m_starts[index + 1];
+    
+    for (int pc = m_starts[index]; pc < end; ++pc) {
+        const Instruction &instruction = code[pc];
+        switch (instruction.op) {
+        case Op::Constant:
+            stack[++top] = instruction.value;
+            break;
+        case Op::Field:
+            stack[++top] = inputs.values[instruction.a];
+            break;
+        case Op::Weather:
+            stack[++top] = (inputs.phenomena & instruction.b) == instruction.b ? 1.0 : 0.0;
+            break;
+        case Op::TextEqual: {
+            const QStringView text = instruction.a == 0 ? inputs.profile : inputs.station;
+            stack[++top] = text.compare(m_literals[instruction.b], Qt::CaseInsensitive) == 0 ? 1.0 : 0.0;
+            break;
+        }
+        case Op::Add:
+            --top;
+            stack[top] += stack[top + 1];
+            break;
+        case Op::Subtract:
+            --top;
+            stack[top] -= stack[top + 1];
+            break;
+        case Op::Multiply:
+            --top;
+            stack[top] *= stack[top + 1];
+            break;
+        case Op::Divide:
+            --top;
+            stack[top] /= stack[top + 1];
+            break;
+        case Op::Negate:
+            stack[top] = -stack[top];
+            break;
+        case Op::Less:
+            --top;
+            stack[top] = stack[top] < stack[top + 1] ? 1.0 : 0.0;
+            break;
+        case Op::LessEqual:
+            --top;
+            stack[top] = stack[top] <= stack[top + 1] ? 1.0 : 0.0;
+            break;
+        case Op::Greater:
+            --top;
+            stack[top] = stack[top] > stack[top + 1] ? 1.0 : 0.0;
+            break;
+        case Op::GreaterEqual:
+            --top;
+            stack[top] = stack[top] >= stack[top + 1] ? 1.0 : 0.0;
+            break;
+        case Op::Equal:
+            --top;
+            stack[top] = stack[top] == stack[top + 1] ? 1.0 : 0.0;
+            break;
+        case Op::NotEqual:
+            --top;
+            // Like the other comparisons, false when either side is missing
+            stack[top] = stack[top] < stack[top + 1] || stack[top] > stack[top + 1] ? 1.0 : 0.0;
+            break;
+        case Op::And:
+            --top;
+            stack[top] = truthy(stack[top]) && truthy(stack[top + 1]) ? 1.0 : 0.0;
+            break;
+        case Op::Or:
+            --top;
+            stack[top] = truthy(stack[top]) || truthy(stack[top + 1]) ? 1.0 : 0.0;
+            break;
+        case Op::Not:
+            stack[top] = truthy(stack[top]) ? 0.0 : 1.0;
+            break;
+        }
+    }
+    return top >= 0 && truthy(stack[top]);
+}
+
+FlightSafety RuleProgram::grade(const RuleInputs &inputs) const
+{
+    FlightSafety result = FlightSafety::Safe;
+    for (int i = 0; i < m_rules.size(); ++i) {
+        if (m_rules[i].severity > result && matches(i, inputs)) {
+            result = m_rules[i].severity;
+        }
+    }
+    return result;
+}
+
+OperatingRules::OperatingRules(QObject *parent)
+    : QObject(parent)
+    , m_program(std::make_shared<RuleProgram>())
+    , m_watcher(new QFileSystemWatcher(this))
+    , m_reloadTimer(new QTimer(this))
+{
+    // Editors save in several writes or replace the file outright; settle
+    // before recompiling
+    m_reloadTimer->setSingleShot(true);
+    m_reloadTimer->setInterval(250);
+    connect(m_reloadTimer, &QTimer::timeout, this, &OperatingRules::reload);
+    connect(m_watcher, &QFileSystemWatcher::fileChanged, m_reloadTimer, qOverload<>(&QTimer::start));
+    connect(m_watcher, &QFileSystemWatcher::directoryChanged, m_reloadTimer, qOverload<>(&QTimer::start));
+}
+
+QString OperatingRules::storagePath()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/operatingrules.txt";
+}
+
+bool OperatingRules::load(const QString &path)
+{
+    m_path = path;
+    m_source.clear();
+    m_program = std::make_shared<RuleProgram>();
+    watch();
+    return compileFile(true);
+}
+
+void OperatingRules::reload()
+{
+    watch(); // a replaced file drops out of the watcher
+    compileFile(false);
+}
+
+bool OperatingRules::compileFile(bool force)
+{
+    QByteArray source;
+    QFile file(m_path);
+    if (file.exists()) {
+        if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+            QString message = QString("%1: %2").arg(m_path, file.errorString());
+            qDebug() << "OperatingRules: cannot read" << message;
+            emit loadFailed(message);
+            return false;
+        }
+        source = file.readAll();
+    }
+    if (!force && source == m_source) {
+        return true; // touched, or a neighbour changed
+    }
+    
+    QString error;
+    std::shared_ptr<const RuleProgram> program = RuleProgram::compile(QString::fromUtf8(source), &error);
+    if (!program) {
+        QString message = QString("%1: %2").arg(m_path, error);
+        qDebug() << "OperatingRules:" << message;
+        emit loadFailed(message);
+        return false;
+    }
+    
+    m_source = source;
+    m_program = program;
+    emit rulesChanged();
+    return true;
+}
+
+void OperatingRules::watch()
+{
+    if (!m_watcher->files().isEmpty()) {
+        m_watcher->removePaths(m_watcher->files());
+    }
+    if (!m_watcher->directories().isEmpty()) {
+        m_watcher->removePaths(m_watcher->directories());
+    }
+    
+    if (QFileInfo::exists(m_path)) {
+        m_watcher->addPath(m_path);
+    }
+    // Catches the file being created or replaced
+    const QString directory = QFileInfo(m_path).absolutePath();
+    if (QFileInfo::exists(directory)) {
+        m_watcher->addPath(directory);
+    }
+}
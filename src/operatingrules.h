@@ -0,0 +1,154 @@
+#pragma once
+
+#include <QObject>
+#include <QList>
+#include <QStringList>
+#include <array>
+#include <memory>
+#include "flightconditions.h"
+
+class QFileSystemWatcher;
+class QTimer;
+
+// Values a rule can test, looked up by name when rules are compiled.
+// WeatherData units (kts, statute miles, ft, °C, %); altitude is the
+// operating height in m AGL and sun the sun's elevation in degrees.
+enum class RuleField : quint8 {
+    Wind,
+    Gust,
+    Direction,
+    Visibility,
+    Ceiling,        // NaN when no ceiling is reported
+    Temperature,
+    Dewpoint,
+    Spread,         // temperature - dewpoint
+    Humidity,
+    Pressure,
+    CloudCover,
+    DensityAltitude,
+    CloudBase,
+    Icing,          // DerivedMeteorology::IcingRisk
+    Elevation,
+    Altitude,
+    Sun,
+    Count
+};
+
+// One observation flattened for evaluation, built once and shared by every
+// rule. Views must outlive the evaluation.
+struct RuleInputs {
+    std::array<double, size_t(RuleField::Count)> values = {};
+    quint32 phenomena = 0;
+    QStringView profile; // DroneProfile id
+    QStringView station;
+    
+    static RuleInputs from(const WeatherData &weather, QStringView profile, double altitude, double sunElevation);
+};
+
+struct OperatingRule {
+    QString name;
+    FlightSafety severity = FlightSafety::Caution;
+    int line = 0; // in the source file
+};
+
+// A rule set compiled to stack-machine bytecode. Each line of the source is
+//
+//     <caution|unsafe|nofly> "<name>": <expression>
+//
+// with # comments. Expressions combine fields, numbers and arithmetic with
+// comparisons, and, or, not and "a unless b"; wx("TSRA") tests for all the
+// given present weather flags and profile/station compare to a string,
+// ignoring case. Comparisons with a missing (NaN) value are false.
+//
+//     unsafe "Gusty under low cloud": gust - wind > 10 and ceiling < 1000 unless profile == "matrice"
+//
+// Programs are immutable once compiled, so one can be shared with worker
+// threads while a reload builds its successor. Evaluation walks a flat
+// instruction array over a fixed-size stack and never allocates.
+class RuleProgram
+{
+public:
+    static constexpr int kMaxStack = 32;
+    
+    // Null with a "line N: ..." message in error when the text does not compile
+    static std::shared_ptr<const RuleProgram> compile(const QString &source, QString *error = nullptr);
+    
+    int size() const { return m_rules.size(); }
+    bool isEmpty() const { return m_rules.isEmpty(); }
+    const OperatingRule &rule(int index) const { return m_rules[index]; }
+    
+    bool matches(int index, const RuleInputs &inputs) const;
+    // Worst severity of the matching rules, Safe when none match
+    FlightSafety grade(const RuleInputs &inputs) const;
+
+private:
+    enum class Op : quint8 {
+        Constant,
+        Field,
+        Weather,    // phenomena contain all bits of mask
+        TextEqual,  // string field a equals literal b
+        Add,
+        Subtract,
+        Multiply,
+        Divide,
+        Negate,
+        Less,
+        LessEqual,
+        Greater,
+        GreaterEqual,
+        Equal,
+        NotEqual,
+        And,
+        Or,
+        Not
+    };
+    
+    struct Instruction {
+        Op op;
+        quint8 a = 0;
+        quint32 b = 0;
+        double value = 0.0;
+    };
+    
+    friend class RuleCompiler;
+    
+    QList<OperatingRule> m_rules;
+    QList<int> m_starts; // first instruction of each rule, plus the end
+    QList<Instruction> m_code;
+    QStringList m_literals;
+};
+
+// The safety office's rule file, operatingrules.txt under AppDataLocation
+// by default, recompiled whenever it changes on disk. A file that does not
+// compile leaves the previous rules in force.
+class OperatingRules : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit OperatingRules(QObject *parent = nullptr);
+    
+    // A missing file is an empty rule set, not an error
+    bool load(const QString &path);
+    QString path() const { return m_path; }
+    std::shared_ptr<const RuleProgram> program() const { return m_program; }
+    
+    static QString storagePath();
+
+signals:
+    void rulesChanged();
+    void loadFailed(const QString &message);
+
+private slots:
+    void reload();
+
+private:
+    bool compileFile(bool force);
+    void watch();
+    
+    QString m_path;
+    QByteArray m_source;
+    std::shared_ptr<const RuleProgram> m_program;
+    QFileSystemWatcher *m_watcher;
+    QTimer *m_reloadTimer;
+};
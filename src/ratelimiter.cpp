@@ -0,0 +1,269 @@
+#include "ratelimiter.h"
+#include <QSettings>
+#include <QStringList>
+#include <QDebug>
+#include <QtMath>
+#include <algorithm>
+
+namespace {
+
+struct HostDefaults {
+    const char *host;
+    double perMinute;
+    double burst;
+};
+
+// Conservative defaults below the published limits of each service
+const HostDefaults kHostDefaults[] = {
+    {"aviationweather.gov", 60.0, 10.0},
+    {"api.weather.gov", 60.0, 10.0},
+    {"api.open-meteo.com", 60.0, 10.0},
+    {"mesonet.agron.iastate.edu", 240.0, 60.0},
+    // Basemap tiles for the radar map, a viewport at a time
+    {"a.basemaps.cartocdn.com", 600.0, 60.0},
+    {"b.basemaps.cartocdn.com", 600.0, 60.0},
+    {"c.basemaps.cartocdn.com", 600.0, 60.0},
+    {"d.basemaps.cartocdn.com", 600.0, 60.0},
+};
+
+} // namespace
+
+RateLimiter *RateLimiter::instance()
+{
+    static RateLimiter *limiter = new RateLimiter();
+    return limiter;
+}
+
+RateLimiter::RateLimiter(QObject *parent)
+    : QObject(parent)
+    , m_wakeTimer(new QTimer(this))
+    , m_backgroundReserve(0.25)
+    , m_nextTicket(1)
+{
+    QSettings settings("DroneView", "Settings");
+    m_backgroundReserve = qBound(0.0, settings.value("rateLimit/backgroundReserve", 0.25).toDouble(), 0.9);
+    
+    m_wakeTimer->setSingleShot(true);
+    connect(m_wakeTimer, &QTimer::timeout, this, &RateLimiter::drainAll);
+}
+
+RateLimiter::Bucket &RateLimiter::bucketFor(const QString &host)
+{
+    auto it = m_buckets.find(host);
+    if (it != m_buckets.end()) {
+        return it.value();
+    }
+    
+    double perMinute = 60.0;
+    double burst = 10.0;
+    for (const HostDefaults &defaults : kHostDefaults) {
+        if (host == QLatin1String(defaults.host)) {
+            perMinute = defaults.perMinute;
+            burst = defaults.burst;
+            break;
+        }
+    }
+    
+    QSettings settings("DroneView", "Settings");
+    Bucket bucket;
+    bucket.capacity = qMax(1.0, settings.value(QString("rateLimit/%1/burst").arg(host), burst).toDouble());
+    bucket.refillPerSecond = qMax(0.01, settings.value(QString("rateLimit/%1/perMinute").arg(host), perMinute).toDouble() / 60.0);
+    bucket.tokens = bucket.capacity;
+    bucket.lastRefill.start();
+    
+    return m_buckets.insert(host, bucket).value();
+}
+
+quint64 RateLimiter::submit(const QString &host, RequestPriority priority,
+                            std::function<void()> dispatch, double cost)
+{
+    QList<std::function<void()>> admitted;
+    quint64 ticket = 0;
+    {
+        QMutexLocker locker(&m_mutex);
+        Bucket &bucket = bucketFor(host);
+        
+        Pending pending;
+        pending.ticket = ticket = m_nextTicket++;
+        pending.dispatch = std::move(dispatch);
+        // Background work must fit above the reserve, or it would never be admitted
+        const double maxCost = priority == RequestPriority::Background
+            ? bucket.capacity * (1.0 - m_backgroundReserve) : bucket.capacity;
+        pending.cost = qBound(0.0, cost, maxCost);
+        pending.waited.start();
+        bucket.queues[int(priority)].enqueue(std::move(pending));
+        
+        drain(bucket, admitted);
+        scheduleWakeup();
+    }
+    
+    for (const auto &dispatchAdmitted : admitted) {
+        dispatchAdmitted();
+    }
+    emit statsChanged();
+    return ticket;
+}
+
+bool RateLimiter::cancel(quint64 ticket)
+{
+    QList<std::function<void()>> admitted;
+    {
+        QMutexLocker locker(&m_mutex);
+        bool found = false;
+        for (auto it = m_buckets.begin(); it != m_buckets.end() && !found; ++it) {
+            for (QQueue<Pending> &queue : it->queues) {
+                auto pending = std::find_if(queue.begin(), queue.end(), [ticket](const Pending &p) {
+                    return p.ticket == ticket;
+                });
+                if (pending != queue.end()) {
+                    queue.erase(pending);
+                    // Whatever queued behind it may fit now
+                    drain(it.value(), admitted);
+                    found = true;
+                    break;
+                }
+            }
+        }
+        if (!found) {
+            return false;
+        }
+        scheduleWakeup();
+    }
+    
+    for (const auto &dispatch : admitted) {
+        dispatch();
+    }
+    emit statsChanged();
+    return true;
+}
+
+void RateLimiter::refill(Bucket &bucket) const
+{
+    double elapsed = bucket.lastRefill.restart() / 1000.0;
+    bucket.tokens = qMin(bucket.capacity, bucket.tokens + elapsed * bucket.refillPerSecond);
+}
+
+void RateLimiter::drain(Bucket &bucket, QList<std::function<void()>> &admitted)
+{
+    refill(bucket);
+    
+    for (int priority = 0; priority < int(bucket.queues.size()); ++priority) {
+        QQueue<Pending> &queue = bucket.queues[priority];
+        
+        // Background work leaves a reserve in the bucket so a user action
+        // arriving right after a poll burst is not kept waiting
+        double reserve = priority == int(RequestPriority::Background)
+            ? bucket.capacity * m_backgroundReserve : 0.0;
+        
+        while (!queue.isEmpty() && bucket.tokens - queue.head().cost >= reserve - 1e-9) {
+            Pending pending = queue.dequeue();
+            bucket.tokens -= pending.cost;
+            
+            qint64 waited = pending.waited.elapsed();
+            bucket.admitted++;
+            bucket.lastWaitMs = waited;
+            bucket.maxWaitMs = qMax(bucket.maxWaitMs, waited);
+            bucket.totalWaitMs += waited;
+            
+            // Dispatched by the caller after the lock is released, so a
+            // dispatch may safely submit again
+            admitted.append(std::move(pending.dispatch));
+        }
+        
+        // Lower classes never overtake a blocked higher class
+        if (!queue.isEmpty()) {
+            break;
+        }
+    }
+}
+
+void RateLimiter::drainAll()
+{
+    QList<std::function<void()>> admitted;
+    {
+        QMutexLocker locker(&m_mutex);
+        for (auto it = m_buckets.begin(); it != m_buckets.end(); ++it) {
+            drain(it.value(), admitted);
+        }
+        scheduleWakeup();
+    }
+    
+    for (const auto &dispatch : admitted) {
+        dispatch();
+    }
+    if (!admitted.isEmpty()) {
+        emit statsChanged();
+    }
+}
+
+void RateLimiter::scheduleWakeup()
+{
+    // Sleep until the earliest head-of-line request can be admitted
+    qint64 nextMs = -1;
+    for (auto it = m_buckets.cbegin(); it != m_buckets.cend(); ++it) {
+        const Bucket &bucket = it.value();
+        for (int priority = 0; priority < int(bucket.queues.size()); ++priority) {
+            const QQueue<Pending> &queue = bucket.queues[priority];
+            if (queue.isEmpty()) {
+                continue;
+            }
+            
+            double reserve = priority == int(RequestPriority::Background)
+                ? bucket.capacity * m_backgroundReserve : 0.0;
+            double tokens = qMin(bucket.capacity, bucket.tokens + bucket.lastRefill.elapsed() / 1000.0 * bucket.refillPerSecond);
+            double missing = queue.head().cost + reserve - tokens;
+            qint64 waitMs = qMax<qint64>(1, qCeil(missing / bucket.refillPerSecond * 1000.0));
+            nextMs = nextMs < 0 ? waitMs : qMin(nextMs, waitMs);
+            break;
+        }
+    }
+    
+    if (nextMs < 0) {
+        m_wakeTimer->stop();
+    } else if (!m_wakeTimer->isActive() || m_wakeTimer->remainingTime() > nextMs) {
+        m_wakeTimer->start(int(nextMs));
+    }
+}
+
+QList<RateLimiter::HostStats> RateLimiter::stats() const
+{
+    QMutexLocker locker(&m_mutex);
+    QList<HostStats> result;
+    for (auto it = m_buckets.cbegin(); it != m_buckets.cend(); ++it) {
+        const Bucket &bucket = it.value();
+        
+        HostStats stats;
+        stats.host = it.key();
+        for (const QQueue<Pending> &queue : bucket.queues) {
+            stats.queueDepth += queue.size();
+        }
+        stats.tokens = bucket.tokens;
+        stats.capacity = bucket.capacity;
+        stats.admitted = bucket.admitted;
+        stats.lastWaitMs = bucket.lastWaitMs;
+        stats.maxWaitMs = bucket.maxWaitMs;
+        stats.averageWaitMs = bucket.admitted > 0 ? double(bucket.totalWaitMs) / bucket.admitted : 0.0;
+        result.append(stats);
+    }
+    return result;
+}
+
+QString RateLimiter::diagnostics() const
+{
+    QStringList lines;
+    for (const HostStats &stats : this->stats()) {
+        lines.append(QString("%1: queued %2, tokens %3/%4, admitted %5, wait avg %6 ms / max %7 ms")
+                     .arg(stats.host)
+                     .arg(stats.queueDepth)
+                     .arg(stats.tokens, 0, 'f', 1)
+                     .arg(stats.capacity, 0, 'f', 0)
+                     .arg(stats.admitted)
+                     .arg(stats.averageWaitMs, 0, 'f', 0)
+                     .arg(stats.maxWaitMs));
+    }
+    
+    if (lines.isEmpty()) {
+        return "No upstream requests yet";
+    }
+    return lines.join("\n");
+}
\ No newline at end of file
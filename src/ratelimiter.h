@@ -0,0 +1,93 @@
+#pragma once
+
+#include <QObject>
+#include <QHash>
+#include <QQueue>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <array>
+#include <functional>
+
+enum class RequestPriority {
+    Interactive, // user is waiting on the answer
+    Normal,
+    Background   // periodic polling and prefetch
+};
+
+// Process-wide token buckets, one per upstream host. Every outbound request
+// is submitted here and only dispatched once its host has tokens to spare;
+// queued requests are admitted strictly by priority class.
+//
+// The limiter lives on the network I/O thread; submit() must be called from
+// there, stats() and diagnostics() from anywhere.
+class RateLimiter : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct HostStats {
+        QString host;
+        int queueDepth = 0;
+        double tokens = 0.0;
+        double capacity = 0.0;
+        quint64 admitted = 0;
+        qint64 lastWaitMs = 0;
+        qint64 maxWaitMs = 0;
+        double averageWaitMs = 0.0;
+    };
+    
+    static RateLimiter *instance();
+    
+    // cost is the number of tokens the request consumes (a map view costs one
+    // per tile); it is clamped to the bucket capacity, less the reserve kept
+    // for higher classes when the request is Background. Returns a ticket
+    // for cancel().
+    quint64 submit(const QString &host, RequestPriority priority,
+                   std::function<void()> dispatch, double cost = 1.0);
+    // Drops a request that is still queued, so it costs no tokens; false
+    // once it was admitted
+    bool cancel(quint64 ticket);
+    
+    QList<HostStats> stats() const;
+    QString diagnostics() const;
+
+signals:
+    void statsChanged();
+
+private slots:
+    void drainAll();
+
+private:
+    explicit RateLimiter(QObject *parent = nullptr);
+    
+    struct Pending {
+        quint64 ticket;
+        std::function<void()> dispatch;
+        double cost;
+        QElapsedTimer waited;
+    };
+    
+    struct Bucket {
+        double capacity = 10.0;
+        double refillPerSecond = 1.0;
+        double tokens = 10.0;
+        QElapsedTimer lastRefill;
+        std::array<QQueue<Pending>, 3> queues;
+        quint64 admitted = 0;
+        qint64 lastWaitMs = 0;
+        qint64 maxWaitMs = 0;
+        qint64 totalWaitMs = 0;
+    };
+    
+    Bucket &bucketFor(const QString &host);
+    void refill(Bucket &bucket) const;
+    void drain(Bucket &bucket, QList<std::function<void()>> &admitted);
+    void scheduleWakeup();
+    
+    mutable QMutex m_mutex;
+    QHash<QString, Bucket> m_buckets;
+    QTimer *m_wakeTimer;
+    double m_backgroundReserve;
+    quint64 m_nextTicket;
+};
\ No newline at end of file
@@ -0,0 +1,282 @@
+#include "stationindex.h"
+#include "networkdispatcher.h"
+#include "corridorsampler.h"
+#include <QtConcurrent>
+#include <QStandardPaths>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QUrlQuery>
+#include <QDataStream>
+#include <QDateTime>
+#include <QSaveFile>
+#include <QFileInfo>
+#include <QFile>
+#include <QDir>
+#include <QTimer>
+#include <QDebug>
+#include <QtMath>
+#include <algorithm>
+
+namespace {
+
+const quint32 kIndexMagic = 0x44564931; // "DVI1"
+const qint32 kIndexVersion = 1;
+const double kKmPerDegree = 111.2;
+
+struct StoredIndex {
+    QHash<QString, StationInfo> stations;
+    QHash<quint32, qint64> cells;
+};
+
+QDataStream &operator<<(QDataStream &out, const StationInfo &station)
+{
+    return out << station.id << station.name << station.latitude << station.longitude << station.elevation;
+}
+
+QDataStream &operator>>(QDataStream &in, StationInfo &station)
+{
+    return in >> station.id >> station.name >> station.latitude >> station.longitude >> station.elevation;
+}
+
+StoredIndex readIndex(const QString &path)
+{
+    StoredIndex index;
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return index;
+    }
+    
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_6_0);
+    
+    quint32 magic = 0;
+    qint32 version = 0;
+    in >> magic >> version;
+    if (magic != kIndexMagic || version != kIndexVersion) {
+        qDebug() << "StationIndex: ignoring store with unknown format" << path;
+        return index;
+    }
+    
+    qint32 count = 0;
+    in >> index.cells >> count;
+    for (qint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        StationInfo station;
+        in >> station;
+        index.stations.insert(station.id, station);
+    }
+    if (in.status() != QDataStream::Ok) {
+        qDebug() << "StationIndex: corrupt store" << path;
+        return StoredIndex();
+    }
+    return index;
+}
+
+bool writeIndex(const QString &path, const StoredIndex &index)
+{
+    QDir().mkpath(QFileInfo(path).path());
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_6_0);
+    out << kIndexMagic << kIndexVersion << index.cells << qint32(index.stations.size());
+    for (const StationInfo &station : index.stations) {
+        out << station;
+    }
+    return out.status() == QDataStream::Ok && file.commit();
+}
+
+} // namespace
+
+StationIndex::StationIndex(const QUrl &baseUrl, QObject *parent)
+    : QObject(parent)
+    , m_baseUrl(baseUrl)
+    , m_loaded(false)
+    , m_saveTimer(new QTimer(this))
+{
+    // One write for a burst of arriving cells
+    m_saveTimer->setSingleShot(true);
+    m_saveTimer->setInterval(2000);
+    connect(m_saveTimer, &QTimer::timeout, this, [this]() {
+        // Saves must not commit out of order; a newer one waits its turn
+        if (m_saving.isRunning()) {
+            m_saveTimer->start();
+            return;
+        }
+        m_saving = QtConcurrent::run(writeIndex, storagePath(), StoredIndex{m_stations, m_cells});
+    });
+    
+    QtConcurrent::run(readIndex, storagePath()).then(this, [this](const StoredIndex &stored) {
+        // Cells fetched while the store was read are newer than it
+        for (auto it = stored.stations.cbegin(); it != stored.stations.cend(); ++it) {
+            if (!m_stations.contains(it.key())) {
+                m_stations.insert(it.key(), it.value());
+            }
+        }
+        for (auto it = stored.cells.cbegin(); it != stored.cells.cend(); ++it) {
+            if (!m_cells.contains(it.key())) {
+                m_cells.insert(it.key(), it.value());
+            }
+        }
+        m_loaded = true;
+        
+        if (!m_stations.isEmpty()) {
+            emit stationsAdded();
+        }
+        if (!m_wanted.isNull()) {
+            ensureCoverage(m_wanted.top(), m_wanted.left(), m_wanted.bottom(), m_wanted.right());
+            m_wanted = QRectF();
+        }
+    });
+}
+
+StationIndex::~StationIndex()
+{
+    m_saving.waitForFinished();
+}
+
+QString StationIndex::storagePath()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/stations.idx";
+}
+
+quint32 StationIndex::cellKey(int row, int column)
+{
+    return quint32(row + 90 / kCellDegrees) * (360 / kCellDegrees) + quint32(column + 180 / kCellDegrees);
+}
+
+void StationIndex::ensureCoverage(double south, double west, double north, double east)
+{
+    if (!m_loaded) {
+        // x is longitude, y latitude
+        m_wanted = QRectF(QPointF(west, south), QPointF(east, north));
+        return;
+    }
+    
+    const int firstRow = qBound(-90 / kCellDegrees, qFloor(south / kCellDegrees), 90 / kCellDegrees - 1);
+    const int lastRow = qBound(-90 / kCellDegrees, qFloor(north / kCellDegrees), 90 / kCellDegrees - 1);
+    const int firstColumn = qBound(-180 / kCellDegrees, qFloor(west / kCellDegrees), 180 / kCellDegrees - 1);
+    const int lastColumn = qBound(-180 / kCellDegrees, qFloor(east / kCellDegrees), 180 / kCellDegrees - 1);
+    const qint64 stale = QDateTime::currentSecsSinceEpoch() - qint64(kMaxAgeDays) * 86400;
+    
+    for (int row = firstRow; row <= lastRow; ++row) {
+        for (int column = firstColumn; column <= lastColumn; ++column) {
+            const quint32 key = cellKey(row, column);
+            if (m_cells.value(key, 0) < stale && !m_fetching.contains(key)) {
+                fetchCell(key);
+            }
+        }
+    }
+}
+
+void StationIndex::fetchCell(quint32 key)
+{
+    const int row = int(key / (360 / kCellDegrees)) - 90 / kCellDegrees;
+    const int column = int(key % (360 / kCellDegrees)) - 180 / kCellDegrees;
+    
+    QUrl url(m_baseUrl.toString() + "/stationinfo");
+    QUrlQuery query;
+    query.addQueryItem("format", "json");
+    query.addQueryItem("bbox", QString("%1,%2,%3,%4")
+        .arg(row * kCellDegrees).arg(column * kCellDegrees)
+        .arg((row + 1) * kCellDegrees).arg((column + 1) * kCellDegrees));
+    url.setQuery(query);
+    
+    QNetworkRequest request(url);
+    request.setHeader(QNetworkRequest::UserAgentHeader, "DroneView/1.0 (contact@droneview.app)");
+    
+    m_fetching.insert(key);
+    NetworkDispatcher::instance()->get(request, RequestPriority::Background, this,
+        [this, key](const NetworkResponse &response) {
+            m_fetching.remove(key);
+            if (!response.ok() || !response.json.isArray()) {
+                qDebug() << "StationIndex: station info request failed:" << response.errorString;
+                return; // asked for again with the next lookup of the area
+            }
+            
+            for (const QJsonValue &value : response.json.array()) {
+                const QJsonObject object = value.toObject();
+                const QJsonArray types = object["siteType"].toArray();
+                if (!types.isEmpty() && !types.contains(QJsonValue("METAR"))) {
+                    continue; // no observations to fetch
+                }
+                
+                StationInfo station;
+                station.id = object["icaoId"].toString().trimmed().toUpper();
+                station.name = object["site"].toString();
+                station.latitude = object["lat"].toDouble();
+                station.longitude = object["lon"].toDouble();
+                station.elevation = object["elev"].toDouble();
+                if (!station.id.isEmpty()) {
+                    m_stations.insert(station.id, station);
+                }
+            }
+            m_cells.insert(key, QDateTime::currentSecsSinceEpoch());
+            m_saveTimer->start();
+            emit stationsAdded();
+        });
+}
+
+QList<StationInfo> StationIndex::nearest(double latitude, double longitude, int count, double maxDistanceKm) const
+{
+    // The latitude band rules out most of the index without trigonometry
+    const double band = maxDistanceKm / kKmPerDegree;
+    QList<QPair<double, const StationInfo *>> ranked;
+    for (const StationInfo &station : m_stations) {
+        if (qAbs(station.latitude - latitude) > band) {
+            continue;
+        }
+        const double distance = CorridorSampler::distanceKm(latitude, longitude, station.latitude, station.longitude);
+        if (distance <= maxDistanceKm) {
+            ranked.append({distance, &station});
+        }
+    }
+    
+    const qsizetype kept = qMin<qsizetype>(qMax(0, count), ranked.size());
+    std::partial_sort(ranked.begin(), ranked.begin() + kept, ranked.end(),
+                      [](const auto &a, const auto &b) { return a.first < b.first; });
+    
+    QList<StationInfo> stations;
+    stations.reserve(kept);
+    for (qsizetype i = 0; i < kept; ++i) {
+        stations.append(*ranked[i].second);
+    }
+    return stations;
+}
+
+QList<StationInfo> StationIndex::within(double south, double west, double north, double east, int count) const
+{
+    const double latitude = (south + north) / 2.0;
+    const double longitude = (west + east) / 2.0;
+    QList<QPair<double, const StationInfo *>> ranked;
+    for (const StationInfo &station : m_stations) {
+        if (station.latitude >= south && station.latitude <= north
+            && station.longitude >= west && station.longitude <= east) {
+            ranked.append({CorridorSampler::distanceKm(latitude, longitude, station.latitude, station.longitude), &station});
+        }
+    }
+    
+    const qsizetype kept = qMin<qsizetype>(qMax(0, count), ranked.size());
+    std::partial_sort(ranked.begin(), ranked.begin() + kept, ranked.end(),
+                      [](const auto &a, const auto &b) { return a.first < b.first; });
+    
+    QList<StationInfo> stations;
+    stations.reserve(kept);
+    for (qsizetype i = 0; i < kept; ++i) {
+        stations.append(*ranked[i].second);
+    }
+    return stations;
+}
+
+bool StationIndex::position(const QString &stationId, double &latitude, double &longitude) const
+{
+    auto it = m_stations.constFind(stationId);
+    if (it == m_stations.constEnd()) {
+        return false;
+    }
+    latitude = it->latitude;
+    longitude = it->longitude;
+    return true;
+}
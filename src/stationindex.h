@@ -0,0 +1,67 @@
+#pragma once
+
+#include <QObject>
+#include <QHash>
+#include <QSet>
+#include <QRectF>
+#include <QUrl>
+#include <QFuture>
+#include <limits>
+
+class QTimer;
+
+struct StationInfo {
+    QString id; // ICAO
+    QString name;
+    double latitude = 0.0;
+    double longitude = 0.0;
+    double elevation = 0.0; // m
+};
+
+// METAR stations by position, from the aviationweather.gov station info
+// API. Regions are fetched a kCellDegrees square at a time when first looked
+// at and kept under AppDataLocation for kMaxAgeDays, so lookups work offline
+// once an area has been seen. Stored stations are read on a worker thread at
+// construction; lookups made before that finishes see none.
+class StationIndex : public QObject
+{
+    Q_OBJECT
+
+public:
+    static const int kCellDegrees = 5;
+    static const int kMaxAgeDays = 30;
+    
+    StationIndex(const QUrl &baseUrl, QObject *parent = nullptr);
+    // Lets a save still in progress commit
+    ~StationIndex() override;
+    
+    // Fetches the cells of the region that are missing or stale;
+    // stationsAdded follows for each one that arrives
+    void ensureCoverage(double south, double west, double north, double east);
+    
+    // Nearest first, at most count, none beyond maxDistanceKm
+    QList<StationInfo> nearest(double latitude, double longitude, int count,
+                               double maxDistanceKm = std::numeric_limits<double>::infinity()) const;
+    // Inside the region, nearest to its centre first, at most count
+    QList<StationInfo> within(double south, double west, double north, double east, int count) const;
+    bool position(const QString &stationId, double &latitude, double &longitude) const;
+    bool isEmpty() const { return m_stations.isEmpty(); }
+    
+    static QString storagePath();
+
+signals:
+    void stationsAdded();
+
+private:
+    static quint32 cellKey(int row, int column);
+    void fetchCell(quint32 key);
+    
+    QUrl m_baseUrl;
+    QHash<QString, StationInfo> m_stations; // by id
+    QHash<quint32, qint64> m_cells;         // fetched at, UTC seconds
+    QSet<quint32> m_fetching;
+    QRectF m_wanted;                        // asked for before the store was read
+    bool m_loaded;
+    QTimer *m_saveTimer;
+    QFuture<bool> m_saving; // the store being written, one at a time
+};
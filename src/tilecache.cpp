@@ -0,0 +1,284 @@
+#include "tilecache.h"
+#include <QtConcurrent>
+#include <QThreadPool>
+#include <QStandardPaths>
+#include <QSettings>
+#include <QDirIterator>
+#include <QSaveFile>
+#include <QFile>
+#include <QDir>
+#include <QDebug>
+#include <algorithm>
+
+namespace {
+
+const quint32 kTileMagic = 0x44565431; // "DVT1"
+const qint32 kTileVersion = 1;
+
+// Evicting down to a little under capacity keeps each store from evicting
+const double kEvictTarget = 0.9;
+
+QByteArray header(const QList<QNetworkReply::RawHeaderPair> &headers, const char *name)
+{
+    for (const auto &pair : headers) {
+        if (pair.first.compare(name, Qt::CaseInsensitive) == 0) {
+            return pair.second;
+        }
+    }
+    return QByteArray();
+}
+
+} // namespace
+
+QString TileCacheKey::relativePath() const
+{
+    QString path = QString("%1/%2/%3/%4").arg(layer).arg(zoom).arg(x).arg(y);
+    if (validTime != 0) {
+        path += QString("_%1").arg(validTime);
+    }
+    return path + ".tile";
+}
+
+TileCache *TileCache::instance()
+{
+    static TileCache *cache = new TileCache();
+    return cache;
+}
+
+TileCache::TileCache(QObject *parent)
+    : QObject(parent)
+    , m_bytes(0)
+    , m_capacity(qMax(1, QSettings("DroneView", "Settings").value("tiles/cacheMB", 256).toInt()) * 1024LL * 1024)
+    , m_indexed(false)
+{
+}
+
+QString TileCache::storageDirectory()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/tiles";
+}
+
+qint64 TileCache::capacity() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_capacity;
+}
+
+void TileCache::setCapacity(qint64 bytes)
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        m_capacity = qMax<qint64>(1, bytes);
+    }
+    QThreadPool::globalInstance()->start([this]() {
+        QMutexLocker locker(&m_mutex);
+        ensureIndex();
+        evict();
+    });
+}
+
+QFuture<CachedTile> TileCache::find(const TileCacheKey &key)
+{
+    return QtConcurrent::run([this, relative = key.relativePath()]() {
+        QMutexLocker locker(&m_mutex);
+        ensureIndex();
+        acquire(relative);
+        auto it = m_index.find(relative);
+        if (it == m_index.end()) {
+            release(relative);
+            return CachedTile();
+        }
+        it->lastUsed = QDateTime::currentMSecsSinceEpoch();
+        
+        locker.unlock();
+        const CachedTile tile = read(storageDirectory() + "/" + relative);
+        locker.relock();
+        release(relative);
+        return tile;
+    });
+}
+
+void TileCache::store(const TileCacheKey &key, const QByteArray &data, const QByteArray &etag, const QDateTime &expires)
+{
+    if (data.isEmpty()) {
+        return;
+    }
+    
+    QThreadPool::globalInstance()->start([this, relative = key.relativePath(), tile = CachedTile{data, etag, expires}]() {
+        const QString path = storageDirectory() + "/" + relative;
+        QMutexLocker locker(&m_mutex);
+        ensureIndex();
+        acquire(relative);
+        
+        locker.unlock();
+        QDir().mkpath(QFileInfo(path).path());
+        const bool written = write(path, tile);
+        const qint64 bytes = QFileInfo(path).size();
+        locker.relock();
+        release(relative);
+        if (!written) {
+            qDebug() << "TileCache: cannot write" << path;
+            return;
+        }
+        
+        Record &record = m_index[relative];
+        m_bytes += bytes - record.bytes;
+        record.bytes = bytes;
+        record.lastUsed = QDateTime::currentMSecsSinceEpoch();
+        evict();
+    });
+}
+
+void TileCache::revalidated(const TileCacheKey &key, const QDateTime &expires)
+{
+    QThreadPool::globalInstance()->start([this, relative = key.relativePath(), expires]() {
+        const QString path = storageDirectory() + "/" + relative;
+        QMutexLocker locker(&m_mutex);
+        ensureIndex();
+        acquire(relative);
+        if (!m_index.contains(relative)) {
+            release(relative);
+            return; // evicted meanwhile
+        }
+        
+        locker.unlock();
+        CachedTile tile = read(path);
+        if (!tile.isNull()) {
+            tile.expires = expires;
+            write(path, tile);
+        }
+        locker.relock();
+        release(relative);
+    });
+}
+
+CachedTile TileCache::read(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return CachedTile();
+    }
+    
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_6_0);
+    
+    quint32 magic = 0;
+    qint32 version = 0;
+    in >> magic >> version;
+    if (magic != kTileMagic || version != kTileVersion) {
+        return CachedTile();
+    }
+    
+    CachedTile tile;
+    in >> tile.etag >> tile.expires >> tile.data;
+    if (in.status() != QDataStream::Ok) {
+        qDebug() << "TileCache: corrupt tile" << path;
+        return CachedTile();
+    }
+    
+    // The modification time is the last use when the index is rebuilt
+    file.setFileTime(QDateTime::currentDateTimeUtc(), QFileDevice::FileModificationTime);
+    return tile;
+}
+
+bool TileCache::write(const QString &path, const CachedTile &tile)
+{
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_6_0);
+    out << kTileMagic << kTileVersion << tile.etag << tile.expires << tile.data;
+    return out.status() == QDataStream::Ok && file.commit();
+}
+
+void TileCache::ensureIndex()
+{
+    if (m_indexed) {
+        return;
+    }
+    m_indexed = true;
+    
+    const QString root = storageDirectory();
+    QDirIterator it(root, {"*.tile"}, QDir::Files, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        it.next();
+        const QFileInfo info = it.fileInfo();
+        Record record;
+        record.bytes = info.size();
+        record.lastUsed = info.lastModified().toMSecsSinceEpoch();
+        m_index.insert(info.filePath().mid(root.size() + 1), record);
+        m_bytes += record.bytes;
+    }
+    evict();
+}
+
+void TileCache::acquire(const QString &relative)
+{
+    while (m_busy.contains(relative)) {
+        m_released.wait(&m_mutex);
+    }
+    m_busy.insert(relative);
+}
+
+void TileCache::release(const QString &relative)
+{
+    m_busy.remove(relative);
+    m_released.wakeAll();
+}
+
+void TileCache::evict()
+{
+    if (m_bytes <= m_capacity) {
+        return;
+    }
+    
+    QList<QPair<qint64, QString>> byAge;
+    byAge.reserve(m_index.size());
+    for (auto it = m_index.cbegin(); it != m_index.cend(); ++it) {
+        byAge.append({it->lastUsed, it.key()});
+    }
+    std::sort(byAge.begin(), byAge.end());
+    
+    const QString root = storageDirectory() + "/";
+    const qint64 target = qint64(m_capacity * kEvictTarget);
+    for (const auto &entry : byAge) {
+        if (m_bytes <= target) {
+            break;
+        }
+        if (m_busy.contains(entry.second)) {
+            continue; // in use; the next eviction gets it if it is still oldest
+        }
+        QFile::remove(root + entry.second);
+        m_bytes -= m_index.take(entry.second).bytes;
+    }
+}
+
+QDateTime TileCache::expiry(const QList<QNetworkReply::RawHeaderPair> &headers, const QDateTime &fallback)
+{
+    const QDateTime now = QDateTime::currentDateTimeUtc();
+    const QByteArray cacheControl = header(headers, "Cache-Control");
+    for (const QByteArray &directive : cacheControl.split(',')) {
+        const QByteArray trimmed = directive.trimmed().toLower();
+        if (trimmed == "no-cache" || trimmed == "no-store") {
+            return now; // kept, but revalidated on every use
+        }
+        if (trimmed.startsWith("max-age=")) {
+            bool ok = false;
+            const qint64 seconds = trimmed.mid(8).toLongLong(&ok);
+            if (ok) {
+                return now.addSecs(seconds);
+            }
+        }
+    }
+    
+    const QDateTime expires = QDateTime::fromString(QString::fromLatin1(header(headers, "Expires")), Qt::RFC2822Date);
+    return expires.isValid() ? expires.toUTC() : fallback;
+}
+
+QByteArray TileCache::etag(const QList<QNetworkReply::RawHeaderPair> &headers)
+{
+    return header(headers, "ETag");
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <QObject>
+#include <QFuture>
+#include <QHash>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QSet>
+#include <QDateTime>
+#include <QNetworkReply>
+
+// A tile of one layer. validTime is the UTC start, in seconds, of the scan
+// the tile shows for layers that change on a schedule, 0 for layers that
+// only change when the server says so.
+struct TileCacheKey {
+    QString layer; // stable id, used as a directory name
+    int zoom = 0;
+    int x = 0;
+    int y = 0;
+    qint64 validTime = 0;
+    
+    QString relativePath() const;
+};
+
+struct CachedTile {
+    QByteArray data; // encoded as served
+    QByteArray etag;
+    QDateTime expires;
+    
+    bool isNull() const { return data.isEmpty(); }
+    bool isFresh() const { return expires.isValid() && expires > QDateTime::currentDateTimeUtc(); }
+};
+
+// Encoded map tiles on disk under CacheLocation, evicted least recently used
+// first once the store outgrows its capacity (setting tiles/cacheMB, 256 MB
+// by default). File I/O runs on the global thread pool, one operation per
+// tile at a time, and eviction leaves a tile alone while it is being read or
+// written; the index of sizes and last use is built from the directory on
+// first access.
+class TileCache : public QObject
+{
+    Q_OBJECT
+
+public:
+    static TileCache *instance();
+    
+    // A null tile when none is stored; reading one counts as a use
+    QFuture<CachedTile> find(const TileCacheKey &key);
+    void store(const TileCacheKey &key, const QByteArray &data, const QByteArray &etag, const QDateTime &expires);
+    // After a 304: the stored tile is good until expires
+    void revalidated(const TileCacheKey &key, const QDateTime &expires);
+    
+    qint64 capacity() const;
+    void setCapacity(qint64 bytes);
+    
+    // From Cache-Control max-age or Expires, else fallback
+    static QDateTime expiry(const QList<QNetworkReply::RawHeaderPair> &headers, const QDateTime &fallback);
+    static QByteArray etag(const QList<QNetworkReply::RawHeaderPair> &headers);
+    static QString storageDirectory();
+
+private:
+    explicit TileCache(QObject *parent = nullptr);
+    
+    struct Record {
+        qint64 bytes = 0;
+        qint64 lastUsed = 0; // ms since epoch
+    };
+    
+    static CachedTile read(const QString &path);
+    static bool write(const QString &path, const CachedTile &tile);
+    // Callers hold m_mutex
+    void ensureIndex();
+    void evict();
+    // Claims a tile's file for I/O done without m_mutex, waiting while
+    // another operation has it. Callers hold m_mutex.
+    void acquire(const QString &relative);
+    void release(const QString &relative);
+    
+    mutable QMutex m_mutex;
+    QWaitCondition m_released;
+    QSet<QString> m_busy; // tiles whose file is being read or written
+    QHash<QString, Record> m_index; // by relative path
+    qint64 m_bytes;
+    qint64 m_capacity;
+    bool m_indexed;
+};
@@ -0,0 +1,287 @@
+#include "weatherbroker.h"
+#include "brokerprotocol.h"
+#include <QCoreApplication>
+#include <QSettings>
+#include <QDebug>
+
+WeatherBroker::WeatherBroker(QObject *parent)
+    : QObject(parent)
+    , m_server(new QLocalServer(this))
+    , m_weatherService(new WeatherService(this))
+    , m_idleTimer(new QTimer(this))
+    , m_maxAgeSeconds(120)
+    , m_pollIntervalMs(300000)
+{
+    QSettings settings("DroneView", "Settings");
+    m_maxAgeSeconds = settings.value("broker/maxAgeSeconds", 120).toInt();
+    m_pollIntervalMs = settings.value("broker/pollIntervalMs", 300000).toInt();
+    
+    // Started on demand by the first console, so leave once the last one is gone
+    m_idleTimer->setSingleShot(true);
+    m_idleTimer->setInterval(settings.value("broker/idleExitMs", 600000).toInt());
+    connect(m_idleTimer, &QTimer::timeout, QCoreApplication::instance(), &QCoreApplication::quit);
+    
+    connect(m_server, &QLocalServer::newConnection, this, &WeatherBroker::acceptConnections);
+    connect(m_weatherService, &WeatherService::fetchProgress, this, &WeatherBroker::handleFetchProgress);
+}
+
+bool WeatherBroker::listen()
+{
+    QLocalSocket probe;
+    probe.connectToServer(BrokerProtocol::serverName());
+    if (probe.waitForConnected(500)) {
+        qDebug() << "WeatherBroker: another broker is already running";
+        return false;
+    }
+    
+    // Clears the socket file a crashed broker may have left behind
+    QLocalServer::removeServer(BrokerProtocol::serverName());
+    m_server->setSocketOptions(QLocalServer::UserAccessOption);
+    if (!m_server->listen(BrokerProtocol::serverName())) {
+        qDebug() << "WeatherBroker: cannot listen:" << m_server->errorString();
+        return false;
+    }
+    
+    qDebug() << "WeatherBroker: listening on" << m_server->fullServerName();
+    updateIdleTimer();
+    return true;
+}
+
+void WeatherBroker::acceptConnections()
+{
+    while (QLocalSocket *socket = m_server->nextPendingConnection()) {
+        m_clients.insert(socket, Client());
+        connect(socket, &QLocalSocket::readyRead, this, [this, socket]() {
+            readClient(socket);
+        });
+        connect(socket, &QLocalSocket::disconnected, this, [this, socket]() {
+            dropClient(socket);
+        });
+    }
+    updateIdleTimer();
+}
+
+void WeatherBroker::readClient(QLocalSocket *socket)
+{
+    auto it = m_clients.find(socket);
+    if (it == m_clients.end()) {
+        return;
+    }
+    
+    it->buffer.append(socket->readAll());
+    
+    QList<QByteArray> payloads;
+    if (!BrokerProtocol::takeMessages(it->buffer, payloads)) {
+        qDebug() << "WeatherBroker: malformed message, dropping client";
+        socket->abort();
+        return;
+    }
+    
+    for (const QByteArray &payload : std::as_const(payloads)) {
+        handleMessage(socket, payload);
+    }
+}
+
+void WeatherBroker::handleMessage(QLocalSocket *socket, const QByteArray &payload)
+{
+    QDataStream in(payload);
+    in.setVersion(QDataStream::Qt_6_0);
+    
+    quint8 type = 0;
+    in >> type;
+    
+    QString stationId;
+    switch (BrokerProtocol::MessageType(type)) {
+    case BrokerProtocol::MessageType::Hello: {
+        quint32 version = 0;
+        in >> version;
+        if (version != BrokerProtocol::kVersion) {
+            qDebug() << "WeatherBroker: client speaks protocol" << version << "- dropping it";
+            socket->disconnectFromServer();
+        }
+        break;
+    }
+    case BrokerProtocol::MessageType::Subscribe:
+        in >> stationId;
+        subscribe(socket, stationId.trimmed().toUpper());
+        break;
+    case BrokerProtocol::MessageType::Unsubscribe:
+        in >> stationId;
+        unsubscribe(socket, stationId.trimmed().toUpper());
+        break;
+    case BrokerProtocol::MessageType::Refresh: {
+        quint8 priority = 0;
+        in >> stationId >> priority;
+        refresh(socket, stationId.trimmed().toUpper(),
+                RequestPriority(qMin<quint8>(priority, quint8(RequestPriority::Background))));
+        break;
+    }
+    default:
+        qDebug() << "WeatherBroker: ignoring message type" << type;
+        break;
+    }
+}
+
+void WeatherBroker::subscribe(QLocalSocket *socket, const QString &stationId)
+{
+    if (stationId.isEmpty()) {
+        return;
+    }
+    
+    m_clients[socket].stations.insert(stationId);
+    Station &station = m_stations[stationId];
+    station.subscribers.insert(socket);
+    
+    if (!station.pollTimer) {
+        station.pollTimer = new QTimer(this);
+        connect(station.pollTimer, &QTimer::timeout, this, [this, stationId]() {
+            fetchStation(stationId, RequestPriority::Background);
+        });
+    }
+    if (!station.pollTimer->isActive()) {
+        station.pollTimer->start(m_pollIntervalMs);
+    }
+    
+    if (!station.encoded.isEmpty()) {
+        socket->write(station.encoded);
+    }
+}
+
+void WeatherBroker::unsubscribe(QLocalSocket *socket, const QString &stationId)
+{
+    auto client = m_clients.find(socket);
+    if (client != m_clients.end()) {
+        client->stations.remove(stationId);
+    }
+    
+    auto it = m_stations.find(stationId);
+    if (it == m_stations.end()) {
+        return;
+    }
+    
+    it->subscribers.remove(socket);
+    it->waiting.remove(socket);
+    if (it->subscribers.isEmpty() && it->pollTimer) {
+        // Nobody is watching; keep the cache but stop polling upstream
+        it->pollTimer->stop();
+    }
+}
+
+void WeatherBroker::refresh(QLocalSocket *socket, const QString &stationId, RequestPriority priority)
+{
+    if (stationId.isEmpty()) {
+        return;
+    }
+    
+    Station &station = m_stations[stationId];
+    bool fresh = station.fetchedAt.isValid()
+        && station.fetchedAt.secsTo(QDateTime::currentDateTimeUtc()) < m_maxAgeSeconds;
+    if (fresh) {
+        socket->write(station.encoded);
+        return;
+    }
+    
+    station.waiting.insert(socket);
+    fetchStation(stationId, priority);
+}
+
+void WeatherBroker::fetchStation(const QString &stationId, RequestPriority priority)
+{
+    Station &station = m_stations[stationId];
+    if (station.fetching) {
+        return; // every console waiting on it gets the same answer
+    }
+    station.fetching = true;
+    
+    m_weatherService->fetch(stationId, 15000, priority)
+        .then(this, [this, stationId](const WeatherData &data) {
+            m_stations[stationId].fetching = false;
+            push(stationId, data, true);
+        })
+        .onFailed(this, [this, stationId](const WeatherFetchError &error) {
+            Station &station = m_stations[stationId];
+            station.fetching = false;
+            
+            QByteArray message = BrokerProtocol::frame(BrokerProtocol::MessageType::Error,
+                                                       stationId, error.message());
+            QSet<QLocalSocket *> recipients = station.encoded.isEmpty()
+                ? station.subscribers + station.waiting : station.waiting;
+            for (QLocalSocket *socket : std::as_const(recipients)) {
+                socket->write(message);
+            }
+            station.waiting.clear();
+        });
+}
+
+void WeatherBroker::handleFetchProgress(const WeatherData &data)
+{
+    auto it = m_stations.find(data.stationId);
+    if (it != m_stations.end() && it->fetching) {
+        push(data.stationId, data, false);
+    }
+}
+
+void WeatherBroker::push(const QString &stationId, const WeatherData &data, bool settled)
+{
+    Station &station = m_stations[stationId];
+    const QDateTime now = QDateTime::currentDateTimeUtc();
+    
+    // Subscribers only hear about it when the weather itself changed, or
+    // when the record they hold is no longer provisional
+    QByteArray weather;
+    {
+        QDataStream out(&weather, QIODevice::WriteOnly);
+        out.setVersion(QDataStream::Qt_6_0);
+        out << data;
+    }
+    const bool changed = weather != station.weather || (settled && !station.settled);
+    station.weather = weather;
+    station.settled = settled;
+    
+    const QByteArray message = BrokerProtocol::frame(BrokerProtocol::MessageType::Snapshot,
+                                                     stationId, data, now, settled);
+    if (settled) {
+        station.fetchedAt = now;
+        station.encoded = message;
+    }
+    
+    // Clients waiting on a refresh get the partial answer too, but stay
+    // waiting for the final one
+    QSet<QLocalSocket *> recipients = changed ? station.subscribers + station.waiting
+                                              : (settled ? station.waiting : QSet<QLocalSocket *>());
+    for (QLocalSocket *socket : std::as_const(recipients)) {
+        socket->write(message);
+    }
+    if (settled) {
+        station.waiting.clear();
+    }
+}
+
+void WeatherBroker::dropClient(QLocalSocket *socket)
+{
+    auto it = m_clients.find(socket);
+    if (it == m_clients.end()) {
+        return;
+    }
+    
+    const QSet<QString> stations = it->stations;
+    for (const QString &stationId : stations) {
+        unsubscribe(socket, stationId);
+    }
+    m_clients.erase(it);
+    
+    for (Station &station : m_stations) {
+        station.waiting.remove(socket);
+    }
+    socket->deleteLater();
+    updateIdleTimer();
+}
+
+void WeatherBroker::updateIdleTimer()
+{
+    if (m_clients.isEmpty()) {
+        m_idleTimer->start();
+    } else {
+        m_idleTimer->stop();
+    }
+}
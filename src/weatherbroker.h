@@ -0,0 +1,66 @@
+#pragma once
+
+#include <QObject>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QHash>
+#include <QSet>
+#include <QTimer>
+#include <QDateTime>
+#include "weatherservice.h"
+
+// The DroneViewBroker process: fetches each subscribed station upstream once
+// on behalf of every local DroneView instance, keeps the latest result and
+// pushes it to all subscribers whenever it changes. The first provider's
+// answer goes out as soon as it arrives; the fused record follows.
+class WeatherBroker : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit WeatherBroker(QObject *parent = nullptr);
+    
+    // False if another broker already serves this user
+    bool listen();
+
+private slots:
+    void acceptConnections();
+
+private:
+    struct Client {
+        QByteArray buffer;
+        QSet<QString> stations;
+    };
+    
+    struct Station {
+        QByteArray weather; // data last pushed, as serialized, to detect changes
+        bool settled = true; // whether that push was a final record
+        QByteArray encoded; // last settled snapshot message
+        QDateTime fetchedAt;
+        bool fetching = false;
+        QSet<QLocalSocket *> subscribers;
+        QSet<QLocalSocket *> waiting; // asked for a refresh since the last fetch
+        QTimer *pollTimer = nullptr;
+    };
+    
+    void readClient(QLocalSocket *socket);
+    void handleMessage(QLocalSocket *socket, const QByteArray &payload);
+    void subscribe(QLocalSocket *socket, const QString &stationId);
+    void unsubscribe(QLocalSocket *socket, const QString &stationId);
+    void refresh(QLocalSocket *socket, const QString &stationId, RequestPriority priority);
+    void fetchStation(const QString &stationId, RequestPriority priority);
+    void handleFetchProgress(const WeatherData &data);
+    // Sends to subscribers and waiting clients when the weather changed, and
+    // to waiting clients in any case once the record is settled
+    void push(const QString &stationId, const WeatherData &data, bool settled);
+    void dropClient(QLocalSocket *socket);
+    void updateIdleTimer();
+    
+    QLocalServer *m_server;
+    WeatherService *m_weatherService;
+    QHash<QLocalSocket *, Client> m_clients;
+    QHash<QString, Station> m_stations;
+    QTimer *m_idleTimer;
+    int m_maxAgeSeconds;
+    int m_pollIntervalMs;
+};
@@ -0,0 +1,208 @@
+#include "weatherphenomena.h"
+#include <array>
+
+namespace WeatherPhenomena {
+
+namespace {
+
+struct Code {
+    char text[3];
+    quint32 flag;
+};
+
+const Code kCodes[] = {
+    {"MI", None}, {"PR", None}, {"BC", None}, {"DR", None}, // shallow, partial, patches, drifting
+    {"BL", Blowing}, {"SH", Showers}, {"TS", Thunderstorm}, {"FZ", Freezing},
+    {"DZ", Drizzle}, {"RA", Rain}, {"SN", Snow}, {"SG", SnowGrains}, {"IC", IceCrystals},
+    {"PL", IcePellets}, {"GR", Hail}, {"GS", SmallHail}, {"UP", UnknownPrecip},
+    {"BR", Mist}, {"FG", Fog}, {"FU", Smoke}, {"VA", VolcanicAsh}, {"DU", Dust},
+    {"SA", Sand}, {"HZ", Haze}, {"PY", None}, {"PO", DustWhirls}, {"SQ", Squall},
+    {"FC", FunnelCloud}, {"SS", Sandstorm}, {"DS", Duststorm},
+};
+
+// The rules only look at eight features of a mask, so every combination of
+// them is graded once up front and grade() is a single lookup
+enum Feature : quint8 {
+    Liquid      = 1 << 0, // DZ RA UP
+    Frozen      = 1 << 1, // SN SG IC PL GR GS
+    Intense     = 1 << 2, // + on any group
+    Icing       = 1 << 3, // FZ
+    Severe      = 1 << 4, // TS FC SQ VA
+    Obscuring   = 1 << 5, // BR FG
+    Storm       = 1 << 6, // SS DS
+    Convective  = 1 << 7  // SH, including VCSH with nothing else reported
+};
+
+quint8 features(quint32 phenomena)
+{
+    quint8 result = 0;
+    if (phenomena & (Drizzle | Rain | UnknownPrecip)) {
+        result |= Liquid;
+    }
+    if (phenomena & (Snow | SnowGrains | IceCrystals | IcePellets | Hail | SmallHail)) {
+        result |= Frozen;
+    }
+    if (phenomena & Heavy) {
+        result |= Intense;
+    }
+    if (phenomena & Freezing) {
+        result |= Icing;
+    }
+    if (phenomena & (Thunderstorm | FunnelCloud | Squall | VolcanicAsh)) {
+        result |= Severe;
+    }
+    if (phenomena & (Mist | Fog)) {
+        result |= Obscuring;
+    }
+    if (phenomena & (Sandstorm | Duststorm)) {
+        result |= Storm;
+    }
+    if (phenomena & Showers) {
+        result |= Convective;
+    }
+    return result;
+}
+
+FlightSafety ruleFor(quint8 f)
+{
+    if (f & Severe) {
+        return FlightSafety::NoFly;
+    }
+    if (f & (Frozen | Storm)) {
+        return FlightSafety::Unsafe;
+    }
+    // Freezing drizzle, rain or fog all mean airframe icing
+    if ((f & Icing) && (f & (Liquid | Obscuring))) {
+        return FlightSafety::Unsafe;
+    }
+    if ((f & Intense) && (f & Liquid)) {
+        return FlightSafety::Unsafe;
+    }
+    if (f & (Liquid | Obscuring | Convective)) {
+        return FlightSafety::Caution;
+    }
+    return FlightSafety::Safe;
+}
+
+std::array<quint8, 256> buildRuleTable()
+{
+    std::array<quint8, 256> table;
+    for (int f = 0; f < 256; ++f) {
+        table[f] = quint8(ruleFor(quint8(f)));
+    }
+    return table;
+}
+
+const std::array<quint8, 256> kRuleTable = buildRuleTable();
+
+char latin1(QChar c) { return c.toLatin1(); }
+char latin1(char c) { return c; }
+
+// Shared by the QString (live feeds) and raw byte (archive import) overloads
+template <typename View>
+quint32 decodeGroups(View text)
+{
+    quint32 phenomena = None;
+    
+    while (!text.isEmpty()) {
+        qsizetype end = text.indexOf(' ');
+        View group = end < 0 ? text : text.first(end);
+        text = end < 0 ? View() : text.sliced(end + 1);
+        if (group.size() >= 2 && latin1(group[0]) == 'R' && latin1(group[1]) == 'E') {
+            continue; // recent, not current
+        }
+        
+        quint32 groupFlags = None;
+        if (!group.isEmpty() && latin1(group[0]) == '+') {
+            groupFlags |= Heavy;
+            group = group.sliced(1);
+        } else if (!group.isEmpty() && latin1(group[0]) == '-') {
+            groupFlags |= Light;
+            group = group.sliced(1);
+        }
+        if (group.size() >= 2 && latin1(group[0]) == 'V' && latin1(group[1]) == 'C') {
+            groupFlags |= Vicinity;
+            group = group.sliced(2);
+        }
+        
+        bool recognised = !group.isEmpty() && group.size() % 2 == 0;
+        for (qsizetype i = 0; recognised && i < group.size(); i += 2) {
+            recognised = false;
+            for (const Code &code : kCodes) {
+                if (latin1(group[i]) == code.text[0] && latin1(group[i + 1]) == code.text[1]) {
+                    groupFlags |= code.flag;
+                    recognised = true;
+                    break;
+                }
+            }
+        }
+        
+        // Cloud layers, visibilities and "M" share the field in some feeds
+        if (recognised) {
+            phenomena |= groupFlags;
+        }
+    }
+    
+    return phenomena;
+}
+
+} // namespace
+
+quint32 decode(QStringView wxString)
+{
+    return decodeGroups(wxString);
+}
+
+quint32 decode(QByteArrayView wxString)
+{
+    return decodeGroups(wxString);
+}
+
+FlightSafety grade(quint32 phenomena)
+{
+    return FlightSafety(kRuleTable[features(phenomena)]);
+}
+
+QString describe(quint32 phenomena)
+{
+    quint8 f = features(phenomena);
+    if (phenomena & Thunderstorm) {
+        return "Thunderstorm";
+    }
+    if (phenomena & FunnelCloud) {
+        return "Funnel cloud";
+    }
+    if (phenomena & Squall) {
+        return "Squalls";
+    }
+    if (phenomena & VolcanicAsh) {
+        return "Volcanic ash";
+    }
+    if ((f & Icing) && (f & (Liquid | Obscuring))) {
+        return "Freezing precipitation or fog";
+    }
+    if (f & Frozen) {
+        return "Snow, ice pellets or hail";
+    }
+    if (f & Storm) {
+        return "Dust or sand storm";
+    }
+    if ((f & Intense) && (f & Liquid)) {
+        return "Heavy precipitation";
+    }
+    if (f & Liquid) {
+        return "Precipitation";
+    }
+    if (phenomena & Fog) {
+        return "Fog";
+    }
+    if (phenomena & Mist) {
+        return "Mist";
+    }
+    if (f & Convective) {
+        return "Showers";
+    }
+    return QString();
+}
+
+} // namespace WeatherPhenomena
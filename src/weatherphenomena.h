@@ -0,0 +1,69 @@
+#pragma once
+
+#include <QString>
+#include <QByteArrayView>
+#include "flightconditions.h"
+
+// METAR/TAF present weather as a bitmask, one bit per intensity, descriptor
+// and phenomenon, so a whole wx string grades without string handling
+namespace WeatherPhenomena {
+
+enum Flag : quint32 {
+    None          = 0,
+    
+    // intensity and proximity
+    Light         = 1u << 0,  // -
+    Heavy         = 1u << 1,  // +
+    Vicinity      = 1u << 2,  // VC
+    
+    // descriptors
+    Showers       = 1u << 3,  // SH
+    Thunderstorm  = 1u << 4,  // TS
+    Freezing      = 1u << 5,  // FZ
+    Blowing       = 1u << 6,  // BL
+    
+    // precipitation
+    Drizzle       = 1u << 8,  // DZ
+    Rain          = 1u << 9,  // RA
+    Snow          = 1u << 10, // SN
+    SnowGrains    = 1u << 11, // SG
+    IceCrystals   = 1u << 12, // IC
+    IcePellets    = 1u << 13, // PL
+    Hail          = 1u << 14, // GR
+    SmallHail     = 1u << 15, // GS
+    UnknownPrecip = 1u << 16, // UP
+    
+    // obscurations
+    Mist          = 1u << 17, // BR
+    Fog           = 1u << 18, // FG
+    Smoke         = 1u << 19, // FU
+    VolcanicAsh   = 1u << 20, // VA
+    Dust          = 1u << 21, // DU
+    Sand          = 1u << 22, // SA
+    Haze          = 1u << 23, // HZ
+    
+    // other
+    DustWhirls    = 1u << 24, // PO
+    Squall        = 1u << 25, // SQ
+    FunnelCloud   = 1u << 26, // FC
+    Sandstorm     = 1u << 27, // SS
+    Duststorm     = 1u << 28  // DS
+};
+
+const quint32 kPrecipitation = Drizzle | Rain | Snow | SnowGrains | IceCrystals | IcePellets
+                               | Hail | SmallHail | UnknownPrecip;
+
+// Decodes METAR/TAF present weather groups such as "-SHRA BR" or "+TSRA
+// VCFG". Intensity and descriptors are recorded for the whole string;
+// recent weather (RE..) and unknown groups are ignored.
+quint32 decode(QStringView wxString);
+quint32 decode(QByteArrayView wxString);
+
+// Precipitation factor of a flight assessment for the given phenomena:
+// one table lookup on the mask folded down to the features the rules use
+FlightSafety grade(quint32 phenomena);
+
+// Short description of the most severe phenomenon, for warnings
+QString describe(quint32 phenomena);
+
+} // namespace WeatherPhenomena
@@ -0,0 +1,580 @@
+#include "weatherprovider.h"
+#include "weatherphenomena.h"
+#include <QUrlQuery>
+#include <QJsonDocument>
+#include <QDateTime>
+#include <QtMath>
+#include <QDebug>
+
+WeatherProvider::WeatherProvider(const QString &id, const QUrl &baseUrl, QObject *parent)
+    : QObject(parent)
+    , m_id(id)
+    , m_baseUrl(baseUrl)
+{
+}
+
+QUrl WeatherProvider::endpoint(const QString &path) const
+{
+    QUrl url(m_baseUrl);
+    QString basePath = url.path();
+    if (basePath.endsWith('/')) {
+        basePath.chop(1);
+    }
+    url.setPath(basePath + path);
+    return url;
+}
+
+void WeatherProvider::get(quint64 round, const QUrl &url, RequestPriority priority,
+                          NetworkDispatcher::ResponseHandler onFinished, const QByteArray &accept)
+{
+    QNetworkRequest request(url);
+    request.setHeader(QNetworkRequest::UserAgentHeader, "DroneView/1.0 (contact@droneview.app)");
+    if (!accept.isEmpty()) {
+        request.setRawHeader("Accept", accept);
+    }
+    
+    quint64 requestId = NetworkDispatcher::instance()->get(request, priority, this,
+        [this, round, onFinished](const NetworkResponse &response) {
+            m_requests.remove(round, response.requestId);
+            onFinished(response);
+        });
+    m_requests.insert(round, requestId);
+}
+
+void WeatherProvider::cancel(quint64 round)
+{
+    const QList<quint64> requestIds = m_requests.values(round);
+    for (quint64 requestId : requestIds) {
+        NetworkDispatcher::instance()->abort(requestId);
+    }
+    m_requests.remove(round);
+}
+
+// ---------------------------------------------------------------------------
+// AWC
+
+AwcProvider::AwcProvider(const QUrl &baseUrl, QObject *parent)
+    : WeatherProvider("awc", baseUrl, parent)
+{
+}
+
+void AwcProvider::fetchObservation(quint64 round, const QString &stationId,
+                                   double latitude, double longitude, RequestPriority priority)
+{
+    Q_UNUSED(latitude)
+    Q_UNUSED(longitude)
+    
+    QUrl metarUrl = endpoint("/metar");
+    QUrlQuery metarQuery;
+    metarQuery.addQueryItem("ids", stationId);
+    metarQuery.addQueryItem("format", "json");
+    metarQuery.addQueryItem("hours", "2");
+    metarUrl.setQuery(metarQuery);
+    
+    get(round, metarUrl, priority, [this, round](const NetworkResponse &metarResponse) {
+        if (!metarResponse.ok()) {
+            emit fetchFailed(round, m_id, QString("Aviation Weather METAR API error: %1").arg(metarResponse.errorString));
+            return;
+        }
+        
+        QJsonDocument doc = metarResponse.json;
+        if (doc.isNull() || !doc.isArray()) {
+            emit fetchFailed(round, m_id, "Invalid JSON response from Aviation Weather METAR API");
+            return;
+        }
+        
+        QJsonArray metars = doc.array();
+        if (metars.isEmpty()) {
+            emit fetchFailed(round, m_id, "No METAR data available for the specified station");
+            return;
+        }
+        
+        WeatherData data;
+        QStringList fields;
+        parseMetar(metars[0].toObject(), data, fields);
+        emit observationReady(round, m_id, data, fields);
+    });
+    
+    QUrl tafUrl = endpoint("/taf");
+    QUrlQuery tafQuery;
+    tafQuery.addQueryItem("ids", stationId);
+    tafQuery.addQueryItem("format", "json");
+    tafUrl.setQuery(tafQuery);
+    
+    // Always answered, with an empty record when there is no TAF, so callers
+    // waiting on the whole round know the forecast leg is done
+    get(round, tafUrl, priority, [this, round](const NetworkResponse &tafResponse) {
+        WeatherData data;
+        if (!tafResponse.ok()) {
+            qDebug() << "AwcProvider: TAF request failed:" << tafResponse.errorString;
+            emit forecastReady(round, m_id, data);
+            return;
+        }
+        
+        QJsonDocument doc = tafResponse.json;
+        if (!doc.isNull() && doc.isArray() && !doc.array().isEmpty()) {
+            parseTaf(doc.array()[0].toObject(), data);
+        }
+        emit forecastReady(round, m_id, data);
+    });
+}
+
+void AwcProvider::parseMetar(const QJsonObject &metar, WeatherData &data, QStringList &fields)
+{
+    data.stationId = metar["icaoId"].toString();
+    data.metar = metar["rawOb"].toString();
+    fields << "stationId" << "metar";
+    
+    if (metar.contains("lat") && metar.contains("lon")) {
+        data.latitude = metar["lat"].toDouble();
+        data.longitude = metar["lon"].toDouble();
+        data.location = QString("Station %1 (%2, %3)")
+            .arg(data.stationId)
+            .arg(data.latitude, 0, 'f', 4)
+            .arg(data.longitude, 0, 'f', 4);
+        fields << "latitude" << "longitude" << "location";
+    }
+    
+    if (metar.contains("obsTime")) {
+        data.timestamp = QDateTime::fromString(metar["obsTime"].toString(), Qt::ISODate);
+        fields << "timestamp";
+    }
+    
+    if (metar.contains("temp")) {
+        data.temperature = metar["temp"].toDouble();
+        fields << "temperature";
+    }
+    
+    if (metar.contains("dewp") && metar.contains("temp")) {
+        double dewpoint = metar["dewp"].toDouble();
+        double temp = data.temperature;
+        if (!qIsNaN(temp) && !qIsNaN(dewpoint)) {
+            data.dewpoint = dewpoint;
+            data.humidity = 100.0 * qExp((17.625 * dewpoint) / (243.04 + dewpoint) - (17.625 * temp) / (243.04 + temp));
+            fields << "dewpoint" << "humidity";
+        }
+    }
+    
+    if (metar["elev"].isDouble()) {
+        data.elevation = metar["elev"].toDouble();
+        fields << "elevation";
+    }
+    
+    if (metar.contains("altim")) {
+        data.altimeter = parseAltimeter(metar["altim"]);
+        data.pressure = data.altimeter * 33.8639;
+        fields << "altimeter" << "pressure";
+    }
+    
+    if (metar.contains("wdir") && metar.contains("wspd")) {
+        data.windDirection = metar["wdir"].toDouble();
+        data.windSpeed = parseWindSpeed(metar["wspd"]);
+        fields << "windDirection" << "windSpeed";
+    }
+    
+    if (metar.contains("wgst")) {
+        data.windGust = parseWindSpeed(metar["wgst"]);
+        fields << "windGust";
+    }
+    
+    if (metar.contains("visib")) {
+        data.visibility = parseVisibility(metar["visib"]);
+        fields << "visibility";
+    }
+    
+    // AWC omits wxString both when nothing is reported and when the station
+    // has no present-weather sensor, so only a reported string is authoritative
+    if (metar.contains("wxString")) {
+        data.phenomena = WeatherPhenomena::decode(metar["wxString"].toString());
+        fields << "phenomena";
+    }
+    
+    if (metar.contains("fltcat")) {
+        data.flightCategory = metar["fltcat"].toString();
+        data.condition = convertFlightCategory(data.flightCategory);
+        fields << "flightCategory" << "condition";
+    }
+    
+    if (metar.contains("cover")) {
+        data.skyCover = parseSkyCover(metar["cover"].toArray());
+        fields << "skyCover";
+    }
+    
+    if (metar.contains("ceiling")) {
+        data.ceiling = metar["ceiling"].toDouble();
+        fields << "ceiling";
+    }
+}
+
+void AwcProvider::parseTaf(const QJsonObject &taf, WeatherData &data) const
+{
+    data.taf = taf["rawTAF"].toString();
+    
+    if (taf.contains("fcsts") && taf["fcsts"].isArray()) {
+        QJsonArray forecasts = taf["fcsts"].toArray();
+        
+        for (const auto &fcstValue : forecasts) {
+            QJsonObject fcst = fcstValue.toObject();
+            
+            WeatherData::Forecast forecast;
+            
+            // Periods are given as epoch seconds; fcstTime is the older form
+            if (fcst.contains("timeFrom")) {
+                forecast.time = QDateTime::fromSecsSinceEpoch(fcst["timeFrom"].toInteger(), Qt::UTC);
+            } else if (fcst.contains("fcstTime")) {
+                forecast.time = QDateTime::fromString(fcst["fcstTime"].toString(), Qt::ISODate);
+            }
+            if (fcst.contains("timeTo")) {
+                forecast.endTime = QDateTime::fromSecsSinceEpoch(fcst["timeTo"].toInteger(), Qt::UTC);
+            }
+            if (fcst["fcstChange"].isString()) {
+                forecast.changeIndicator = fcst["fcstChange"].toString();
+            }
+            
+            if (fcst.contains("temp")) {
+                forecast.temperature = fcst["temp"].toDouble();
+            }
+            
+            if (fcst.contains("wdir") && fcst.contains("wspd")) {
+                forecast.windDirection = fcst["wdir"].toDouble();
+                forecast.windSpeed = parseWindSpeed(fcst["wspd"]);
+            }
+            
+            if (fcst.contains("wgst") && !fcst["wgst"].isNull()) {
+                forecast.windGust = parseWindSpeed(fcst["wgst"]);
+            }
+            
+            if (fcst.contains("visib") && !fcst["visib"].isNull()) {
+                forecast.visibility = parseVisibility(fcst["visib"]);
+            }
+            
+            if (fcst["wxString"].isString()) {
+                forecast.wxString = fcst["wxString"].toString();
+                forecast.phenomena = WeatherPhenomena::decode(forecast.wxString);
+            }
+            
+            if (fcst.contains("fltcat")) {
+                forecast.condition = convertFlightCategory(fcst["fltcat"].toString());
+            }
+            
+            if (data.hourlyForecast.size() < 24) {
+                data.hourlyForecast.append(forecast);
+            }
+        }
+    }
+}
+
+QString AwcProvider::convertFlightCategory(const QString &category)
+{
+    if (category == "VFR") {
+        return "Clear";
+    } else if (category == "MVFR") {
+        return "Partly Cloudy";
+    } else if (category == "IFR") {
+        return "Cloudy";
+    } else if (category == "LIFR") {
+        return "Poor Visibility";
+    }
+    return category;
+}
+
+QString AwcProvider::parseSkyCover(const QJsonArray &skyConditions)
+{
+    if (skyConditions.isEmpty()) {
+        return "Clear";
+    }
+    
+    QStringList conditions;
+    for (const auto &condition : skyConditions) {
+        QJsonObject sky = condition.toObject();
+        QString cover = sky["cover"].toString();
+        if (sky.contains("base")) {
+            conditions.append(QString("%1 at %2 ft").arg(cover).arg(sky["base"].toInt()));
+        } else {
+            conditions.append(cover);
+        }
+    }
+    
+    return conditions.join(", ");
+}
+
+double AwcProvider::parseVisibility(const QJsonValue &visibility)
+{
+    if (visibility.isDouble()) {
+        return visibility.toDouble();
+    } else if (visibility.isString()) {
+        // "6+" / "10+" mean at least that far
+        QString visStr = visibility.toString().trimmed();
+        if (visStr.endsWith('+')) {
+            visStr.chop(1);
+        }
+        bool ok;
+        double vis = visStr.toDouble(&ok);
+        if (ok) {
+            return vis;
+        }
+    }
+    return 0.0;
+}
+
+double AwcProvider::parseAltimeter(const QJsonValue &altimeter)
+{
+    // No inHg setting comes near 100, no hPa setting near 40
+    const double value = altimeter.toDouble();
+    return value > 100.0 ? value / 33.8639 : value;
+}
+
+double AwcProvider::parseWindSpeed(const QJsonValue &windSpeed)
+{
+    if (windSpeed.isDouble()) {
+        return windSpeed.toDouble();
+    } else if (windSpeed.isString()) {
+        QString speedStr = windSpeed.toString();
+        bool ok;
+        double speed = speedStr.toDouble(&ok);
+        if (ok) {
+            return speed;
+        }
+    }
+    return 0.0;
+}
+
+// ---------------------------------------------------------------------------
+// NWS
+
+namespace {
+
+// NWS quantitative values look like {"unitCode": "wmoUnit:km_h-1", "value": 12.3}
+bool nwsValue(const QJsonObject &properties, const char *key, double &value, QString *unit = nullptr)
+{
+    QJsonObject quantity = properties[key].toObject();
+    QJsonValue raw = quantity["value"];
+    if (!raw.isDouble()) {
+        return false;
+    }
+    value = raw.toDouble();
+    if (unit) {
+        *unit = quantity["unitCode"].toString();
+    }
+    return true;
+}
+
+double nwsSpeedToKnots(double value, const QString &unit)
+{
+    if (unit.endsWith("m_s-1")) {
+        return value * 1.94384;
+    }
+    if (unit.endsWith("km_h-1")) {
+        return value / 1.852;
+    }
+    return value;
+}
+
+} // namespace
+
+NwsProvider::NwsProvider(const QUrl &baseUrl, QObject *parent)
+    : WeatherProvider("nws", baseUrl, parent)
+{
+}
+
+void NwsProvider::fetchObservation(quint64 round, const QString &stationId,
+                                   double latitude, double longitude, RequestPriority priority)
+{
+    Q_UNUSED(latitude)
+    Q_UNUSED(longitude)
+    
+    QUrl url = endpoint(QString("/stations/%1/observations/latest").arg(stationId));
+    get(round, url, priority, [this, round](const NetworkResponse &response) {
+        if (!response.ok()) {
+            emit fetchFailed(round, m_id, QString("NWS observation API error: %1").arg(response.errorString));
+            return;
+        }
+        
+        QJsonDocument doc = response.json;
+        if (doc.isNull() || !doc.isObject() || !doc.object().contains("properties")) {
+            emit fetchFailed(round, m_id, "Invalid JSON response from NWS observation API");
+            return;
+        }
+        
+        WeatherData data;
+        QStringList fields;
+        parseObservation(doc.object()["properties"].toObject(), data, fields);
+        emit observationReady(round, m_id, data, fields);
+    }, "application/geo+json");
+}
+
+void NwsProvider::parseObservation(const QJsonObject &properties, WeatherData &data, QStringList &fields) const
+{
+    QString station = properties["stationId"].toString();
+    if (!station.isEmpty()) {
+        data.stationId = station;
+        fields << "stationId";
+    }
+    
+    if (properties.contains("timestamp")) {
+        data.timestamp = QDateTime::fromString(properties["timestamp"].toString(), Qt::ISODate);
+        fields << "timestamp";
+    }
+    
+    QString text = properties["textDescription"].toString();
+    if (!text.isEmpty()) {
+        data.description = text;
+        fields << "description";
+    }
+    
+    QString raw = properties["rawMessage"].toString();
+    if (!raw.isEmpty()) {
+        data.metar = raw;
+        fields << "metar";
+    }
+    
+    if (properties["presentWeather"].isArray()) {
+        QStringList groups;
+        const QJsonArray present = properties["presentWeather"].toArray();
+        for (const QJsonValue &weather : present) {
+            groups << weather.toObject()["rawString"].toString();
+        }
+        data.phenomena = WeatherPhenomena::decode(groups.join(' '));
+        fields << "phenomena";
+    }
+    
+    // Same "BKN at 2500 ft" form as the AWC sky cover
+    if (properties["cloudLayers"].isArray()) {
+        QStringList layers;
+        const QJsonArray cloudLayers = properties["cloudLayers"].toArray();
+        for (const QJsonValue &layer : cloudLayers) {
+            QJsonObject cloud = layer.toObject();
+            double base;
+            if (nwsValue(cloud, "base", base)) {
+                layers << QString("%1 at %2 ft").arg(cloud["amount"].toString()).arg(qRound(base * 3.28084 / 100.0) * 100);
+            } else {
+                layers << cloud["amount"].toString();
+            }
+        }
+        data.skyCover = layers.isEmpty() ? QString("Clear") : layers.join(", ");
+        fields << "skyCover";
+    }
+    
+    double value;
+    QString unit;
+    if (nwsValue(properties, "temperature", value)) {
+        data.temperature = value;
+        fields << "temperature";
+    }
+    if (nwsValue(properties, "relativeHumidity", value)) {
+        data.humidity = value;
+        fields << "humidity";
+    }
+    if (nwsValue(properties, "dewpoint", value)) {
+        data.dewpoint = value;
+        fields << "dewpoint";
+    }
+    if (nwsValue(properties, "elevation", value)) {
+        data.elevation = value;
+        fields << "elevation";
+    }
+    if (nwsValue(properties, "windDirection", value)) {
+        data.windDirection = value;
+        fields << "windDirection";
+    }
+    if (nwsValue(properties, "windSpeed", value, &unit)) {
+        data.windSpeed = nwsSpeedToKnots(value, unit);
+        fields << "windSpeed";
+    }
+    if (nwsValue(properties, "windGust", value, &unit)) {
+        data.windGust = nwsSpeedToKnots(value, unit);
+        fields << "windGust";
+    }
+    if (nwsValue(properties, "visibility", value)) {
+        data.visibility = value / 1609.344;
+        fields << "visibility";
+    }
+    if (nwsValue(properties, "barometricPressure", value)) {
+        data.pressure = value / 100.0;
+        data.altimeter = value / 3386.39;
+        fields << "pressure" << "altimeter";
+    }
+    if (nwsValue(properties, "heatIndex", value) || nwsValue(properties, "windChill", value)) {
+        data.feelsLike = value;
+        fields << "feelsLike";
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Open-Meteo
+
+OpenMeteoProvider::OpenMeteoProvider(const QUrl &baseUrl, QObject *parent)
+    : WeatherProvider("openmeteo", baseUrl, parent)
+{
+}
+
+void OpenMeteoProvider::fetchObservation(quint64 round, const QString &stationId,
+                                         double latitude, double longitude, RequestPriority priority)
+{
+    Q_UNUSED(stationId)
+    
+    QUrl url = endpoint("/forecast");
+    QUrlQuery query;
+    query.addQueryItem("latitude", QString::number(latitude, 'f', 4));
+    query.addQueryItem("longitude", QString::number(longitude, 'f', 4));
+    query.addQueryItem("current", "temperature_2m,relative_humidity_2m,apparent_temperature,"
+                                  "pressure_msl,cloud_cover,wind_speed_10m,wind_direction_10m,"
+                                  "wind_gusts_10m,visibility,uv_index");
+    query.addQueryItem("wind_speed_unit", "kn");
+    query.addQueryItem("timezone", "GMT");
+    url.setQuery(query);
+    
+    get(round, url, priority, [this, round](const NetworkResponse &response) {
+        if (!response.ok()) {
+            emit fetchFailed(round, m_id, QString("Open-Meteo API error: %1").arg(response.errorString));
+            return;
+        }
+        
+        QJsonDocument doc = response.json;
+        if (doc.isNull() || !doc.isObject() || !doc.object()["current"].isObject()) {
+            emit fetchFailed(round, m_id, "Invalid JSON response from Open-Meteo API");
+            return;
+        }
+        
+        WeatherData data;
+        QStringList fields;
+        parseCurrent(doc.object()["current"].toObject(), data, fields);
+        emit observationReady(round, m_id, data, fields);
+    });
+}
+
+void OpenMeteoProvider::parseCurrent(const QJsonObject &current, WeatherData &data, QStringList &fields) const
+{
+    struct Mapping {
+        const char *key;
+        double WeatherData::*member;
+        const char *field;
+        double scale;
+    };
+    static const Mapping mappings[] = {
+        {"temperature_2m", &WeatherData::temperature, "temperature", 1.0},
+        {"relative_humidity_2m", &WeatherData::humidity, "humidity", 1.0},
+        {"apparent_temperature", &WeatherData::feelsLike, "feelsLike", 1.0},
+        {"pressure_msl", &WeatherData::pressure, "pressure", 1.0},
+        {"cloud_cover", &WeatherData::cloudCover, "cloudCover", 1.0},
+        {"wind_speed_10m", &WeatherData::windSpeed, "windSpeed", 1.0},
+        {"wind_direction_10m", &WeatherData::windDirection, "windDirection", 1.0},
+        {"wind_gusts_10m", &WeatherData::windGust, "windGust", 1.0},
+        {"visibility", &WeatherData::visibility, "visibility", 1.0 / 1609.344},
+        {"uv_index", &WeatherData::uvIndex, "uvIndex", 1.0},
+    };
+    
+    for (const Mapping &mapping : mappings) {
+        QJsonValue value = current[mapping.key];
+        if (value.isDouble()) {
+            data.*(mapping.member) = value.toDouble() * mapping.scale;
+            fields << mapping.field;
+        }
+    }
+    
+    if (current.contains("time")) {
+        // times are requested in GMT but carry no offset suffix
+        data.timestamp = QDateTime::fromString(current["time"].toString() + "Z", Qt::ISODate);
+        fields << "timestamp";
+    }
+}
\ No newline at end of file
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <QObject>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QUrl>
+#include <QMultiHash>
+#include "weatherservice.h"
+#include "networkdispatcher.h"
+
+// One upstream source of observations. Every provider reports the fields it
+// actually filled in so WeatherService can fuse answers field by field.
+class WeatherProvider : public QObject
+{
+    Q_OBJECT
+
+public:
+    WeatherProvider(const QString &id, const QUrl &baseUrl, QObject *parent = nullptr);
+    
+    QString id() const { return m_id; }
+    QUrl baseUrl() const { return m_baseUrl; }
+    
+    // Point APIs can only answer for a known station position
+    virtual bool requiresCoordinates() const { return false; }
+    // Providers that also emit forecastReady for every round
+    virtual bool providesForecast() const { return false; }
+    // Model output for a grid point rather than a station's measurements;
+    // fused only into fields no observing provider reported
+    virtual bool isModel() const { return false; }
+    virtual void fetchObservation(quint64 round, const QString &stationId,
+                                  double latitude, double longitude, RequestPriority priority) = 0;
+    // Aborts whatever is still outstanding for the round; nothing more is emitted for it
+    void cancel(quint64 round);
+
+signals:
+    void observationReady(quint64 round, const QString &providerId,
+                          const WeatherData &data, const QStringList &fields);
+    void forecastReady(quint64 round, const QString &providerId, const WeatherData &data);
+    void fetchFailed(quint64 round, const QString &providerId, const QString &error);
+
+protected:
+    QUrl endpoint(const QString &path) const;
+    // Issued on the network I/O thread; onFinished runs on this provider's thread
+    void get(quint64 round, const QUrl &url, RequestPriority priority,
+             NetworkDispatcher::ResponseHandler onFinished, const QByteArray &accept = QByteArray());
+    
+    QString m_id;
+    QUrl m_baseUrl;
+    QMultiHash<quint64, quint64> m_requests; // round -> dispatcher request ids
+};
+
+// aviationweather.gov data API: METAR observations plus TAF forecast
+class AwcProvider : public WeatherProvider
+{
+    Q_OBJECT
+
+public:
+    AwcProvider(const QUrl &baseUrl, QObject *parent = nullptr);
+    
+    bool providesForecast() const override { return true; }
+    void fetchObservation(quint64 round, const QString &stationId,
+                          double latitude, double longitude, RequestPriority priority) override;
+    
+    static QString convertFlightCategory(const QString &category);
+    static double parseVisibility(const QJsonValue &visibility);
+    static double parseWindSpeed(const QJsonValue &windSpeed);
+    // altim is in hPa, though older feeds sent inHg; returns inHg
+    static double parseAltimeter(const QJsonValue &altimeter);
+    // One entry of a /metar JSON answer; fields names what it filled in
+    static void parseMetar(const QJsonObject &metar, WeatherData &data, QStringList &fields);
+
+private:
+    void parseTaf(const QJsonObject &taf, WeatherData &data) const;
+    static QString parseSkyCover(const QJsonArray &skyConditions);
+};
+
+// api.weather.gov latest station observation (GeoJSON, SI units)
+class NwsProvider : public WeatherProvider
+{
+    Q_OBJECT
+
+public:
+    NwsProvider(const QUrl &baseUrl, QObject *parent = nullptr);
+    
+    void fetchObservation(quint64 round, const QString &stationId,
+                          double latitude, double longitude, RequestPriority priority) override;
+
+private:
+    void parseObservation(const QJsonObject &properties, WeatherData &data, QStringList &fields) const;
+};
+
+// Open-Meteo style point forecast API queried for current conditions
+class OpenMeteoProvider : public WeatherProvider
+{
+    Q_OBJECT
+
+public:
+    OpenMeteoProvider(const QUrl &baseUrl, QObject *parent = nullptr);
+    
+    bool requiresCoordinates() const override { return true; }
+    bool isModel() const override { return true; }
+    void fetchObservation(quint64 round, const QString &stationId,
+                          double latitude, double longitude, RequestPriority priority) override;
+
+private:
+    void parseCurrent(const QJsonObject &current, WeatherData &data, QStringList &fields) const;
+};
\ No newline at end of file
@@ -0,0 +1,356 @@
+#include "weatherraster.h"
+#include "weatherphenomena.h"
+#include "batchassessment.h"
+#include <QtConcurrent>
+#include <QPromise>
+#include <QtMath>
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+namespace {
+
+const double kEarthRadiusKm = 6371.0088;
+
+// Stations in a local equirectangular frame about the region's middle
+// latitude, in km; accurate enough for the few hundred km of a region
+struct PlanarStation {
+    double x;
+    double y;
+    float wind; // at the operating altitude
+    float gust;
+    float visibility;
+    float ceiling; // NaN when none reported
+    quint32 phenomena;
+    quint8 icingRisk;
+};
+
+struct Tile {
+    int left;
+    int top;
+    int right; // exclusive
+    int bottom;
+};
+
+struct Job {
+    std::vector<PlanarStation> stations;
+    std::vector<double> columnX; // planar km of each column and row centre
+    std::vector<double> rowY;
+    FlightAssessment::Limits limits;
+    double altitude;
+    int neighbours;
+    double power;
+    int width;
+    QList<Tile> tiles;
+    
+    // Fields of the raster being filled; tiles write disjoint cells
+    float *wind;
+    float *gust;
+    float *visibility;
+    float *ceiling;
+    quint8 *category;
+};
+
+double mercatorY(double latitude)
+{
+    return std::log(std::tan(M_PI / 4.0 + qDegreesToRadians(latitude) / 2.0));
+}
+
+void fillTile(const Job &job, const Tile &tile)
+{
+    const int stationCount = int(job.stations.size());
+    const int k = qMin(job.neighbours, stationCount);
+    
+    // A cell within r of the tile centre has its k nearest within
+    // d_k(centre) + r of itself, hence within d_k(centre) + 2r of the centre
+    const double centreX = (job.columnX[tile.left] + job.columnX[tile.right - 1]) / 2.0;
+    const double centreY = (job.rowY[tile.top] + job.rowY[tile.bottom - 1]) / 2.0;
+    const double radius = std::hypot(job.columnX[tile.right - 1] - job.columnX[tile.left],
+                                     job.rowY[tile.top] - job.rowY[tile.bottom - 1]) / 2.0;
+    
+    std::vector<double> centreDistance(stationCount);
+    for (int i = 0; i < stationCount; ++i) {
+        centreDistance[i] = std::hypot(job.stations[i].x - centreX, job.stations[i].y - centreY);
+    }
+    std::vector<double> sorted = centreDistance;
+    std::nth_element(sorted.begin(), sorted.begin() + (k - 1), sorted.end());
+    const double reach = sorted[k - 1] + 2.0 * radius;
+    
+    std::vector<PlanarStation> candidates;
+    for (int i = 0; i < stationCount; ++i) {
+        if (centreDistance[i] <= reach) {
+            candidates.push_back(job.stations[i]);
+        }
+    }
+    
+    const bool inverseSquare = job.power == 2.0;
+    const double halfPower = job.power / 2.0;
+    int nearest[WeatherRasterGenerator::kMaxNeighbours];
+    double distances[WeatherRasterGenerator::kMaxNeighbours]; // squared
+    
+    // Interpolated cells of the tile, graded as one batch once it is filled.
+    // Temperature is not rastered: NaN grades Safe.
+    const qsizetype cells = qsizetype(tile.right - tile.left) * (tile.bottom - tile.top);
+    std::vector<double> cellWind(cells), cellGust(cells), cellVisibility(cells), cellCeiling(cells);
+    std::vector<double> noTemperature(cells, qQNaN()), noHumidity(cells, 0.0);
+    std::vector<quint32> cellPhenomena(cells);
+    std::vector<quint8> cellIcing(cells);
+    qsizetype index = 0;
+    
+    for (int row = tile.top; row < tile.bottom; ++row) {
+        const double y = job.rowY[row];
+        for (int column = tile.left; column < tile.right; ++column) {
+            const double x = job.columnX[column];
+            
+            // k nearest candidates by insertion into a short sorted array
+            int found = 0;
+            for (int i = 0; i < int(candidates.size()); ++i) {
+                const double dx = candidates[i].x - x;
+                const double dy = candidates[i].y - y;
+                const double distance = dx * dx + dy * dy;
+                if (found == k && distance >= distances[found - 1]) {
+                    continue;
+                }
+                int slot = found < k ? found++ : found - 1;
+                while (slot > 0 && distances[slot - 1] > distance) {
+                    distances[slot] = distances[slot - 1];
+                    nearest[slot] = nearest[slot - 1];
+                    --slot;
+                }
+                distances[slot] = distance;
+                nearest[slot] = i;
+            }
+            
+            double weightSum = 0.0, wind = 0.0, gust = 0.0, visibility = 0.0;
+            double ceilingWeightSum = 0.0, ceiling = 0.0;
+            for (int i = 0; i < found; ++i) {
+                const PlanarStation &station = candidates[nearest[i]];
+                // Cells on top of a station take its values
+                const double distance = qMax(distances[i], 1e-6);
+                const double weight = inverseSquare ? 1.0 / distance : std::pow(distance, -halfPower);
+                weightSum += weight;
+                wind += weight * station.wind;
+                gust += weight * station.gust;
+                visibility += weight * station.visibility;
+                if (!qIsNaN(station.ceiling)) {
+                    ceilingWeightSum += weight;
+                    ceiling += weight * station.ceiling;
+                }
+            }
+            wind /= weightSum;
+            gust /= weightSum;
+            visibility /= weightSum;
+            ceiling = ceilingWeightSum > 0.0 ? ceiling / ceilingWeightSum : qQNaN();
+            
+            // Present weather and icing are not interpolated: the nearest report stands
+            cellWind[index] = wind;
+            cellGust[index] = gust;
+            cellVisibility[index] = visibility;
+            cellCeiling[index] = ceiling;
+            cellPhenomena[index] = candidates[nearest[0]].phenomena;
+            cellIcing[index] = quint8(qMin<int>(candidates[nearest[0]].icingRisk, int(FlightSafety::NoFly)));
+            ++index;
+            
+            const qsizetype cell = qsizetype(row) * job.width + column;
+            job.wind[cell] = float(wind);
+            job.gust[cell] = float(gust);
+            job.visibility[cell] = float(visibility);
+            job.ceiling[cell] = float(ceiling);
+        }
+    }
+    
+    WeatherBatch batch;
+    batch.count = cells;
+    batch.windSpeed = cellWind.data();
+    batch.windGust = cellGust.data();
+    batch.visibility = cellVisibility.data();
+    batch.temperature = noTemperature.data();
+    batch.humidity = noHumidity.data();
+    batch.phenomena = cellPhenomena.data();
+    BatchGrades grades;
+    BatchAssessment::assess(batch, job.limits, grades);
+    
+    index = 0;
+    for (int row = tile.top; row < tile.bottom; ++row) {
+        for (int column = tile.left; column < tile.right; ++column) {
+            FlightSafety grade = FlightConditions::worst(grades.overallAt(index),
+                                                         FlightConditions::gradeCeiling(cellCeiling[index], job.altitude));
+            grade = FlightConditions::worst(grade, FlightSafety(cellIcing[index]));
+            job.category[qsizetype(row) * job.width + column] = quint8(grade);
+            ++index;
+        }
+    }
+}
+
+// Blue through green and yellow to red for t in [0, 1]
+QRgb ramp(double t, int alpha)
+{
+    t = qBound(0.0, t, 1.0);
+    int red, green, blue;
+    if (t < 1.0 / 3.0) {
+        const double u = t * 3.0;
+        red = 0;
+        green = int(200 * u);
+        blue = int(255 * (1.0 - u));
+    } else if (t < 2.0 / 3.0) {
+        const double u = (t - 1.0 / 3.0) * 3.0;
+        red = int(255 * u);
+        green = 200 + int(55 * u);
+        blue = 0;
+    } else {
+        const double u = (t - 2.0 / 3.0) * 3.0;
+        red = 255;
+        green = int(255 * (1.0 - u));
+        blue = 0;
+    }
+    return qRgba(red, green, blue, alpha);
+}
+
+} // namespace
+
+QImage WeatherRaster::toImage(RasterField field) const
+{
+    if (isEmpty()) {
+        return QImage();
+    }
+    
+    QImage image(width, height, QImage::Format_ARGB32);
+    
+    static const QRgb categoryColors[] = {
+        qRgba(0, 200, 0, 60),    // Safe
+        qRgba(255, 170, 0, 110), // Caution
+        qRgba(255, 102, 0, 140), // Unsafe
+        qRgba(255, 0, 0, 160),   // NoFly
+    };
+    
+    for (int row = 0; row < height; ++row) {
+        QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(row));
+        const qsizetype offset = qsizetype(row) * width;
+        for (int column = 0; column < width; ++column) {
+            const qsizetype cell = offset + column;
+            switch (field) {
+            case RasterField::Category:
+                line[column] = categoryColors[qMin<int>(category[cell], 3)];
+                break;
+            case RasterField::Wind:
+                line[column] = ramp(wind[cell] / 40.0, 140);
+                break;
+            case RasterField::Gust:
+                line[column] = ramp(gust[cell] / 50.0, 140);
+                break;
+            case RasterField::Visibility:
+                line[column] = ramp(1.0 - visibility[cell] / 10.0, 140);
+                break;
+            case RasterField::Ceiling:
+                line[column] = qIsNaN(ceiling[cell]) ? qRgba(0, 0, 0, 0) : ramp(1.0 - ceiling[cell] / 3000.0, 140);
+                break;
+            }
+        }
+    }
+    return image;
+}
+
+WeatherRasterGenerator::WeatherRasterGenerator(QObject *parent)
+    : QObject(parent)
+    , m_limits()
+    , m_altitude(60.0)
+    , m_terrain(WindProfile::Terrain::Open)
+    , m_neighbours(8)
+    , m_power(2.0)
+{
+}
+
+void WeatherRasterGenerator::setLimits(const FlightAssessment::Limits &limits)
+{
+    m_limits = limits;
+}
+
+QFuture<WeatherRaster> WeatherRasterGenerator::generate(const QList<WeatherData> &observations,
+                                                        const RasterBounds &bounds,
+                                                        int width, int height) const
+{
+    auto raster = std::make_shared<WeatherRaster>();
+    auto job = std::make_shared<Job>();
+    
+    const double middle = qDegreesToRadians((bounds.north + bounds.south) / 2.0);
+    const double kmPerRadianX = kEarthRadiusKm * std::cos(middle);
+    const qint64 now = QDateTime::currentSecsSinceEpoch();
+    for (const WeatherData &data : observations) {
+        if (data.latitude == 0.0 && data.longitude == 0.0) {
+            continue; // position unknown
+        }
+        
+        // Each station's wind is projected under its own stability, as
+        // FlightConditions does for the current one, before interpolating
+        const qint64 observed = data.timestamp.isValid() ? data.timestamp.toSecsSinceEpoch() : now;
+        const bool daytime = Ephemeris::sunElevation(data.latitude, data.longitude, observed) > 0.0;
+        const WindProfile profile(m_terrain, WindProfile::estimateStability(data.windSpeed, data.cloudCover, daytime));
+        double wind = 0.0;
+        double gust = 0.0;
+        profile.project(data.windSpeed, data.windGust, &m_altitude, 1, &wind, &gust);
+        
+        job->stations.push_back({kmPerRadianX * qDegreesToRadians(data.longitude),
+                                 kEarthRadiusKm * qDegreesToRadians(data.latitude),
+                                 float(wind), float(gust), float(data.visibility),
+                                 float(data.ceiling > 0.0 ? data.ceiling : qQNaN()), data.phenomena,
+                                 data.icingRisk});
+    }
+    
+    if (!bounds.isValid() || width <= 0 || height <= 0 || job->stations.empty()) {
+        QPromise<WeatherRaster> promise;
+        promise.start();
+        promise.addResult(WeatherRaster());
+        promise.finish();
+        return promise.future();
+    }
+    
+    raster->bounds = bounds;
+    raster->width = width;
+    raster->height = height;
+    const qsizetype cells = qsizetype(width) * height;
+    raster->wind.resize(cells);
+    raster->gust.resize(cells);
+    raster->visibility.resize(cells);
+    raster->ceiling.resize(cells);
+    raster->category.resize(cells);
+    
+    // Cell centres: columns evenly in longitude, rows evenly in Mercator y
+    job->columnX.resize(width);
+    for (int column = 0; column < width; ++column) {
+        const double longitude = bounds.west + (column + 0.5) / width * (bounds.east - bounds.west);
+        job->columnX[column] = kmPerRadianX * qDegreesToRadians(longitude);
+    }
+    const double northY = mercatorY(bounds.north);
+    const double southY = mercatorY(bounds.south);
+    job->rowY.resize(height);
+    for (int row = 0; row < height; ++row) {
+        const double y = northY - (row + 0.5) / height * (northY - southY);
+        job->rowY[row] = kEarthRadiusKm * (2.0 * std::atan(std::exp(y)) - M_PI / 2.0);
+    }
+    
+    job->limits = m_limits;
+    job->altitude = m_altitude;
+    job->neighbours = m_neighbours;
+    job->power = m_power;
+    job->width = width;
+    job->wind = raster->wind.data();
+    job->gust = raster->gust.data();
+    job->visibility = raster->visibility.data();
+    job->ceiling = raster->ceiling.data();
+    job->category = raster->category.data();
+    
+    // map() works in place, so the tile list lives in the shared job
+    for (int top = 0; top < height; top += kTileSize) {
+        for (int left = 0; left < width; left += kTileSize) {
+            job->tiles.append({left, top, qMin(left + kTileSize, width), qMin(top + kTileSize, height)});
+        }
+    }
+    
+    return QtConcurrent::map(job->tiles, [job](const Tile &tile) {
+            fillTile(*job, tile);
+        })
+        .then([raster, job]() {
+            return *raster;
+        });
+}
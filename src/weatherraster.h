@@ -0,0 +1,81 @@
+#pragma once
+
+#include <QObject>
+#include <QFuture>
+#include <QImage>
+#include "flightconditions.h"
+
+// Geographic extent of a raster; rows are spaced evenly in Web Mercator so
+// the image drops straight onto a slippy map
+struct RasterBounds {
+    double north = 0.0;
+    double south = 0.0;
+    double west = 0.0;
+    double east = 0.0;
+    
+    bool isValid() const { return north > south && east > west; }
+};
+
+enum class RasterField : quint8 {
+    Category,
+    Wind,
+    Gust,
+    Visibility,
+    Ceiling
+};
+
+// Gridded weather over a region, stored field by field in row-major order.
+// Values use WeatherData units, wind and gust at the operating altitude;
+// ceiling is NaN where no station nearby reports one.
+struct WeatherRaster {
+    RasterBounds bounds;
+    int width = 0;
+    int height = 0;
+    QList<float> wind;
+    QList<float> gust;
+    QList<float> visibility;
+    QList<float> ceiling;
+    QList<quint8> category; // FlightSafety
+    
+    bool isEmpty() const { return width == 0 || height == 0; }
+    // Translucent colour map of one field, for map overlays
+    QImage toImage(RasterField field) const;
+};
+
+// Interpolates station observations onto a grid by inverse distance
+// weighting of each cell's nearest stations. The grid is cut into square
+// tiles spread over every core; each tile first narrows the stations to
+// those that can be among the nearest of any of its cells, so the per-cell
+// search only looks at a handful of candidates.
+class WeatherRasterGenerator : public QObject
+{
+    Q_OBJECT
+
+public:
+    static const int kTileSize = 64;
+    static const int kMaxNeighbours = 16;
+    
+    explicit WeatherRasterGenerator(QObject *parent = nullptr);
+    
+    void setLimits(const FlightAssessment::Limits &limits);
+    // Height (m AGL) the wind is projected to and the ceiling checked at
+    void setOperatingAltitude(double altitude, WindProfile::Terrain terrain)
+    {
+        m_altitude = altitude;
+        m_terrain = terrain;
+    }
+    void setNeighbours(int count) { m_neighbours = qBound(1, count, kMaxNeighbours); }
+    void setPower(double power) { m_power = qMax(0.5, power); }
+    
+    // Observations without a position are skipped; an empty raster results
+    // when none is left
+    QFuture<WeatherRaster> generate(const QList<WeatherData> &observations, const RasterBounds &bounds,
+                                    int width, int height) const;
+
+private:
+    FlightAssessment::Limits m_limits;
+    double m_altitude;
+    WindProfile::Terrain m_terrain;
+    int m_neighbours;
+    double m_power;
+};
@@ -1,4 +1,9 @@
 #include "weatherservice.h"
+#include "weatherprovider.h"
+#include "brokerclient.h"
+#include "derivedmeteorology.h"
+#include "corridorsampler.h"
+#include "stationindex.h"
 #include <QUrl>
 #include <QUrlQuery>
 #include <QJsonArray>
@@ -7,31 +12,80 @@
 #include <QDateTime>
 #include <QtMath>
 #include <QSettings>
+#include <QFutureWatcher>
+#include <QSet>
+#include <algorithm>
+#include <iterator>
 
 WeatherService::WeatherService(QObject *parent)
     : QObject(parent)
-    , m_networkManager(new QNetworkAccessManager(this))
     , m_dataValid(false)
-    , m_metarReply(nullptr)
-    , m_tafReply(nullptr)
-    , m_stationLookupReply(nullptr)
+    , m_stationLookupRequest(0)
+    , m_nextRoundId(1)
+    , m_publishedRound(0)
+    , m_broker(nullptr)
+    , m_brokerPendingPriority(RequestPriority::Interactive)
+    , m_stationIndex(nullptr)
     , m_settings(new QSettings("DroneView", "Settings", this))
 {
+    setupProviders();
+    m_stationIndex = new StationIndex(QUrl(m_settings->value("providers/awc/url", "https://aviationweather.gov/api/data").toString()), this);
 }
 
-void WeatherService::fetchWeatherData(double latitude, double longitude)
+void WeatherService::setupProviders()
+{
+    // Base URLs are configurable so any provider can be pointed at a local stand-in
+    const QStringList order = m_settings->value("providers/order", QStringList{"awc", "nws", "openmeteo"}).toStringList();
+    
+    for (const QString &id : order) {
+        if (!m_settings->value(QString("providers/%1/enabled").arg(id), true).toBool()) {
+            continue;
+        }
+        
+        WeatherProvider *provider = nullptr;
+        if (id == "awc") {
+            QUrl url(m_settings->value("providers/awc/url", "https://aviationweather.gov/api/data").toString());
+            provider = new AwcProvider(url, this);
+        } else if (id == "nws") {
+            QUrl url(m_settings->value("providers/nws/url", "https://api.weather.gov").toString());
+            provider = new NwsProvider(url, this);
+        } else if (id == "openmeteo") {
+            QUrl url(m_settings->value("providers/openmeteo/url", "https://api.open-meteo.com/v1").toString());
+            provider = new OpenMeteoProvider(url, this);
+        } else {
+            qDebug() << "WeatherService: ignoring unknown provider" << id;
+            continue;
+        }
+        
+        connect(provider, &WeatherProvider::observationReady, this, &WeatherService::handleProviderObservation);
+        connect(provider, &WeatherProvider::forecastReady, this, &WeatherService::handleProviderForecast);
+        connect(provider, &WeatherProvider::fetchFailed, this, &WeatherService::handleProviderFailure);
+        m_providers.append(provider);
+    }
+}
+
+QStringList WeatherService::providerIds() const
+{
+    QStringList ids;
+    for (const WeatherProvider *provider : m_providers) {
+        ids.append(provider->id());
+    }
+    return ids;
+}
+
+void WeatherService::fetchWeatherData(double latitude, double longitude, RequestPriority priority)
 {
     QString preferredAirport = getPreferredAirport();
     if (!preferredAirport.isEmpty()) {
-        fetchWeatherByStation(preferredAirport);
+        fetchWeatherByStation(preferredAirport, priority);
         return;
     }
     
     QString nearestStation = findNearestStation(latitude, longitude);
     if (!nearestStation.isEmpty()) {
-        fetchWeatherByStation(nearestStation);
+        fetchWeatherByStation(nearestStation, priority);
     } else {
-        QUrl stationUrl("https://aviationweather.gov/api/data/metar");
+        QUrl stationUrl(m_settings->value("providers/awc/url", "https://aviationweather.gov/api/data").toString() + "/metar");
         QUrlQuery query;
         query.addQueryItem("format", "json");
         query.addQueryItem("hours", "2");
@@ -45,106 +99,348 @@ void WeatherService::fetchWeatherData(double latitude, double longitude)
         QNetworkRequest request(stationUrl);
         request.setHeader(QNetworkRequest::UserAgentHeader, "DroneView/1.0 (contact@droneview.app)");
         
-        if (m_stationLookupReply) {
-            m_stationLookupReply->deleteLater();
+        if (m_stationLookupRequest) {
+            NetworkDispatcher::instance()->abort(m_stationLookupRequest);
         }
         
-        m_stationLookupReply = m_networkManager->get(request);
-        connect(m_stationLookupReply, &QNetworkReply::finished, this, &WeatherService::handleStationLookupReply);
-        connect(m_stationLookupReply, QOverload<QNetworkReply::NetworkError>::of(&QNetworkReply::errorOccurred),
-                this, &WeatherService::handleNetworkError);
+        m_stationLookupRequest = NetworkDispatcher::instance()->get(request, priority, this,
+            [this, priority](const NetworkResponse &response) {
+                m_stationLookupRequest = 0;
+                handleStationLookupReply(response, priority);
+            });
     }
 }
 
-void WeatherService::fetchWeatherByStation(const QString &stationId)
+void WeatherService::fetchWeatherByStation(const QString &stationId, RequestPriority priority)
 {
-    QUrl metarUrl("https://aviationweather.gov/api/data/metar");
-    QUrlQuery metarQuery;
-    metarQuery.addQueryItem("ids", stationId);
-    metarQuery.addQueryItem("format", "json");
-    metarQuery.addQueryItem("hours", "2");
-    metarUrl.setQuery(metarQuery);
+    // A new refresh supersedes whatever the previous one is still waiting on
+    if (m_publishedRound) {
+        cancelRound(m_publishedRound);
+    }
     
-    QNetworkRequest metarRequest(metarUrl);
-    metarRequest.setHeader(QNetworkRequest::UserAgentHeader, "DroneView/1.0 (contact@droneview.app)");
+    // Decided once the connection attempt ends, see handleBrokerConnection()
+    if (m_broker && m_broker->isConnecting()) {
+        m_brokerPendingStation = stationId;
+        m_brokerPendingPriority = priority;
+        return;
+    }
+    m_brokerPendingStation.clear();
     
-    if (m_metarReply) {
-        m_metarReply->deleteLater();
+    if (m_broker && m_broker->isConnected()) {
+        if (m_brokerStation != stationId) {
+            if (!m_brokerStation.isEmpty()) {
+                m_broker->unsubscribe(m_brokerStation);
+            }
+            m_brokerStation = stationId;
+            m_broker->subscribe(stationId);
+        }
+        m_broker->refresh(stationId, priority);
+        return;
     }
     
-    m_metarReply = m_networkManager->get(metarRequest);
-    connect(m_metarReply, &QNetworkReply::finished, this, &WeatherService::handleMetarReply);
-    connect(m_metarReply, QOverload<QNetworkReply::NetworkError>::of(&QNetworkReply::errorOccurred),
-            this, &WeatherService::handleNetworkError);
+    quint64 id = startRound(stationId, priority, m_settings->value("providers/timeoutMs", 15000).toInt());
+    if (!id) {
+        emit errorOccurred(QString("No weather providers are enabled for station %1").arg(stationId));
+        return;
+    }
     
-    QUrl tafUrl("https://aviationweather.gov/api/data/taf");
-    QUrlQuery tafQuery;
-    tafQuery.addQueryItem("ids", stationId);
-    tafQuery.addQueryItem("format", "json");
-    tafUrl.setQuery(tafQuery);
+    m_rounds[id].publish = true;
+    m_publishedRound = id;
+}
+
+void WeatherService::setBrokerClient(BrokerClient *broker)
+{
+    if (m_broker) {
+        disconnect(m_broker, nullptr, this, nullptr);
+    }
     
-    QNetworkRequest tafRequest(tafUrl);
-    tafRequest.setHeader(QNetworkRequest::UserAgentHeader, "DroneView/1.0 (contact@droneview.app)");
+    m_broker = broker;
+    m_brokerStation.clear();
+    m_brokerPendingStation.clear();
     
-    if (m_tafReply) {
-        m_tafReply->deleteLater();
+    if (m_broker) {
+        connect(m_broker, &BrokerClient::snapshotReceived, this, &WeatherService::handleBrokerSnapshot);
+        connect(m_broker, &BrokerClient::errorReceived, this, &WeatherService::handleBrokerError);
+        connect(m_broker, &BrokerClient::connectionChanged, this, &WeatherService::handleBrokerConnection);
     }
-    
-    m_tafReply = m_networkManager->get(tafRequest);
-    connect(m_tafReply, &QNetworkReply::finished, this, &WeatherService::handleTafReply);
-    connect(m_tafReply, QOverload<QNetworkReply::NetworkError>::of(&QNetworkReply::errorOccurred),
-            this, &WeatherService::handleNetworkError);
 }
 
-void WeatherService::handleMetarReply()
+void WeatherService::handleBrokerConnection(bool connected)
 {
-    if (!m_metarReply) return;
+    Q_UNUSED(connected)
     
-    if (m_metarReply->error() == QNetworkReply::NoError) {
-        QByteArray data = m_metarReply->readAll();
-        QJsonDocument doc = QJsonDocument::fromJson(data);
-        
-        if (!doc.isNull() && doc.isArray()) {
-            parseMetarData(doc.array());
-        } else {
-            emit errorOccurred("Invalid JSON response from Aviation Weather METAR API");
+    // Through the broker if the attempt worked, upstream if it did not
+    if (!m_brokerPendingStation.isEmpty() && !m_broker->isConnecting()) {
+        const QString stationId = m_brokerPendingStation;
+        m_brokerPendingStation.clear();
+        fetchWeatherByStation(stationId, m_brokerPendingPriority);
+    }
+}
+
+void WeatherService::handleBrokerSnapshot(const QString &stationId, const WeatherData &data, const QDateTime &fetchedAt,
+                                          bool settled)
+{
+    // Waiters and the cache get the final record, as from fetch()
+    if (settled) {
+        m_observations.insert(stationId, {data, fetchedAt.isValid() ? fetchedAt : QDateTime::currentDateTimeUtc()});
+        for (const auto &promise : m_brokerWaiters.values(stationId)) {
+            promise->addResult(data);
+            promise->finish();
         }
-    } else {
-        emit errorOccurred(QString("Aviation Weather METAR API error: %1").arg(m_metarReply->errorString()));
+        m_brokerWaiters.remove(stationId);
+    }
+    
+    if (stationId != m_brokerStation) {
+        return;
+    }
+    
+    rememberStationPosition(data);
+    m_currentWeather = data;
+    m_dataValid = true;
+    emit weatherDataUpdated(m_currentWeather);
+    if (settled) {
+        emit observationSettled(m_currentWeather);
+    }
+}
+
+void WeatherService::handleBrokerError(const QString &stationId, const QString &error)
+{
+    for (const auto &promise : m_brokerWaiters.values(stationId)) {
+        promise->setException(WeatherFetchError(error));
+        promise->finish();
+    }
+    m_brokerWaiters.remove(stationId);
+    
+    if (stationId == m_brokerStation) {
+        emit errorOccurred(error);
+    }
+}
+
+QFuture<WeatherData> WeatherService::fetch(const QString &stationId, int timeoutMs, RequestPriority priority)
+{
+    auto promise = std::make_shared<QPromise<WeatherData>>();
+    QFuture<WeatherData> future = promise->future();
+    promise->start();
+    
+    QString cleanId = stationId.trimmed().toUpper();
+    quint64 id = startRound(cleanId, priority, timeoutMs);
+    if (!id) {
+        promise->setException(WeatherFetchError(QString("No weather providers are enabled for station %1").arg(cleanId)));
+        promise->finish();
+        return future;
     }
+    m_rounds[id].promise = promise;
+    
+    // Canceling the caller's future aborts the fan-out
+    auto *watcher = new QFutureWatcher<WeatherData>(this);
+    connect(watcher, &QFutureWatcherBase::canceled, this, [this, id]() {
+        cancelRound(id);
+    });
+    connect(watcher, &QFutureWatcherBase::finished, watcher, &QObject::deleteLater);
+    watcher->setFuture(future);
     
-    m_metarReply->deleteLater();
-    m_metarReply = nullptr;
+    return future;
 }
 
-void WeatherService::handleTafReply()
+QFuture<WeatherData> WeatherService::observation(const QString &stationId, int maxAgeSeconds, RequestPriority priority)
 {
-    if (!m_tafReply) return;
+    const QString cleanId = stationId.trimmed().toUpper();
+    auto cached = m_observations.constFind(cleanId);
+    if (cached != m_observations.constEnd()
+        && cached->fetchedAt.secsTo(QDateTime::currentDateTimeUtc()) < maxAgeSeconds) {
+        QPromise<WeatherData> ready;
+        ready.start();
+        ready.addResult(cached->data);
+        ready.finish();
+        return ready.future();
+    }
+    
+    if (!m_broker || !m_broker->isConnected()) {
+        return fetch(cleanId, 15000, priority);
+    }
     
-    if (m_tafReply->error() == QNetworkReply::NoError) {
-        QByteArray data = m_tafReply->readAll();
-        QJsonDocument doc = QJsonDocument::fromJson(data);
+    // The broker answers every console asking for a station with one fetch
+    auto promise = std::make_shared<QPromise<WeatherData>>();
+    QFuture<WeatherData> future = promise->future();
+    promise->start();
+    const bool asked = m_brokerWaiters.contains(cleanId);
+    m_brokerWaiters.insert(cleanId, promise);
+    if (!asked) {
+        m_broker->refresh(cleanId, priority);
+    }
+    
+    QTimer::singleShot(15000, this, [this, cleanId, promise]() {
+        if (m_brokerWaiters.remove(cleanId, promise) > 0) {
+            promise->setException(WeatherFetchError(QString("The broker did not answer for %1 in time").arg(cleanId)));
+            promise->finish();
+        }
+    });
+    return future;
+}
+
+QFuture<QList<WeatherData>> WeatherService::metarsWithin(double south, double west, double north, double east,
+                                                        RequestPriority priority)
+{
+    QUrl url(m_settings->value("providers/awc/url", "https://aviationweather.gov/api/data").toString() + "/metar");
+    QUrlQuery query;
+    query.addQueryItem("format", "json");
+    query.addQueryItem("bbox", QString("%1,%2,%3,%4")
+        .arg(south, 0, 'f', 4)
+        .arg(west, 0, 'f', 4)
+        .arg(north, 0, 'f', 4)
+        .arg(east, 0, 'f', 4));
+    url.setQuery(query);
+    
+    QNetworkRequest request(url);
+    request.setHeader(QNetworkRequest::UserAgentHeader, "DroneView/1.0 (contact@droneview.app)");
+    
+    auto promise = std::make_shared<QPromise<QList<WeatherData>>>();
+    QFuture<QList<WeatherData>> future = promise->future();
+    promise->start();
+    NetworkDispatcher::instance()->get(request, priority, this, [promise](const NetworkResponse &response) {
+        if (!response.ok() || !response.json.isArray()) {
+            promise->setException(WeatherFetchError(response.ok()
+                ? QString("Invalid JSON response from Aviation Weather METAR API")
+                : QString("Aviation Weather METAR API error: %1").arg(response.errorString)));
+            promise->finish();
+            return;
+        }
         
-        if (!doc.isNull() && doc.isArray()) {
-            parseTafData(doc.array());
-        } else {
-            emit errorOccurred("Invalid JSON response from Aviation Weather TAF API");
+        // Newest first; older reports of a station already seen are skipped
+        const QJsonArray metars = response.json.array();
+        QList<WeatherData> reports;
+        reports.reserve(metars.size());
+        QSet<QString> seen;
+        for (const QJsonValue &metar : metars) {
+            WeatherData data;
+            QStringList fields;
+            AwcProvider::parseMetar(metar.toObject(), data, fields);
+            if (data.stationId.isEmpty() || seen.contains(data.stationId)) {
+                continue;
+            }
+            seen.insert(data.stationId);
+            reports.append(data);
         }
-    } else {
-        emit errorOccurred(QString("Aviation Weather TAF API error: %1").arg(m_tafReply->errorString()));
+        DerivedMeteorology::apply(reports.data(), reports.size());
+        promise->addResult(reports);
+        promise->finish();
+    });
+    return future;
+}
+
+void WeatherService::cacheObservation(const WeatherData &data)
+{
+    if (!data.stationId.isEmpty()) {
+        m_observations.insert(data.stationId, {data, QDateTime::currentDateTimeUtc()});
     }
-    
-    m_tafReply->deleteLater();
-    m_tafReply = nullptr;
 }
 
-void WeatherService::handleStationLookupReply()
+QFuture<QList<WeatherData>> WeatherService::whenAll(const QList<QFuture<WeatherData>> &futures)
 {
-    if (!m_stationLookupReply) return;
+    return QtFuture::whenAll(futures.begin(), futures.end())
+        .then([](const QList<QFuture<WeatherData>> &done) {
+            QList<WeatherData> results;
+            results.reserve(done.size());
+            for (QFuture<WeatherData> future : done) {
+                future.waitForFinished(); // already finished; rethrows a failed fetch
+                if (future.resultCount() == 0) {
+                    throw WeatherFetchError("Weather fetch was canceled");
+                }
+                results.append(future.result());
+            }
+            return results;
+        });
+}
+
+QFuture<QList<WeatherData>> WeatherService::whenSettled(const QList<QFuture<WeatherData>> &futures)
+{
+    return QtFuture::whenAll(futures.begin(), futures.end())
+        .then([](const QList<QFuture<WeatherData>> &done) {
+            QList<WeatherData> results;
+            results.reserve(done.size());
+            for (QFuture<WeatherData> future : done) {
+                try {
+                    future.waitForFinished();
+                } catch (const QException &) {
+                    continue; // one station down leaves the rest of the field
+                }
+                if (future.resultCount() > 0) {
+                    results.append(future.result());
+                }
+            }
+            return results;
+        });
+}
+
+quint64 WeatherService::startRound(const QString &stationId, RequestPriority priority, int timeoutMs)
+{
+    FetchRound round;
+    round.id = m_nextRoundId++;
+    round.stationId = stationId;
+    
+    double latitude = 0.0;
+    double longitude = 0.0;
+    bool hasPosition = stationPosition(stationId, latitude, longitude);
+    
+    QList<WeatherProvider *> selected;
+    for (WeatherProvider *provider : m_providers) {
+        if (provider->requiresCoordinates() && !hasPosition) {
+            continue;
+        }
+        selected.append(provider);
+        round.pending++;
+        if (provider->providesForecast()) {
+            round.pendingForecasts++;
+        }
+    }
+    
+    if (selected.isEmpty()) {
+        return 0;
+    }
     
-    if (m_stationLookupReply->error() == QNetworkReply::NoError) {
-        QByteArray data = m_stationLookupReply->readAll();
-        QJsonDocument doc = QJsonDocument::fromJson(data);
+    quint64 id = round.id;
+    round.deadline = new QTimer(this);
+    round.deadline->setSingleShot(true);
+    connect(round.deadline, &QTimer::timeout, this, [this, id]() {
+        completeRound(id, true);
+    });
+    round.deadline->start(timeoutMs);
+    m_rounds.insert(id, round);
+    
+    for (WeatherProvider *provider : selected) {
+        // Secondary providers may be held back by a hedge delay so that a
+        // fast primary answer saves the extra upstream traffic
+        int hedgeDelay = m_settings->value(QString("providers/%1/hedgeDelayMs").arg(provider->id()), 0).toInt();
+        if (hedgeDelay <= 0) {
+            provider->fetchObservation(id, stationId, latitude, longitude, priority);
+            continue;
+        }
+        
+        QTimer::singleShot(hedgeDelay, provider, [this, provider, id, stationId, latitude, longitude, priority]() {
+            auto it = m_rounds.find(id);
+            if (it == m_rounds.end()) {
+                return;
+            }
+            
+            if (it->answers.isEmpty()) {
+                provider->fetchObservation(id, stationId, latitude, longitude, priority);
+            } else {
+                it->pending--;
+                if (provider->providesForecast()) {
+                    it->pendingForecasts--;
+                }
+                checkRoundComplete(id);
+            }
+        });
+    }
+    
+    return id;
+}
+
+void WeatherService::handleStationLookupReply(const NetworkResponse &response, RequestPriority priority)
+{
+    if (response.ok()) {
+        QJsonDocument doc = response.json;
         
         if (!doc.isNull() && doc.isArray()) {
             QJsonArray stations = doc.array();
@@ -152,7 +448,7 @@ void WeatherService::handleStationLookupReply()
                 QJsonObject station = stations[0].toObject();
                 QString stationId = station["icaoId"].toString();
                 if (!stationId.isEmpty()) {
-                    fetchWeatherByStation(stationId);
+                    fetchWeatherByStation(stationId, priority);
                 } else {
                     emit errorOccurred("No aviation weather stations found in the specified area");
                 }
@@ -163,138 +459,251 @@ void WeatherService::handleStationLookupReply()
             emit errorOccurred("Invalid JSON response from Aviation Weather station lookup");
         }
     } else {
-        emit errorOccurred(QString("Aviation Weather station lookup error: %1").arg(m_stationLookupReply->errorString()));
+        emit errorOccurred(QString("Aviation Weather station lookup error: %1").arg(response.errorString));
     }
-    
-    m_stationLookupReply->deleteLater();
-    m_stationLookupReply = nullptr;
 }
 
-void WeatherService::handleNetworkError(QNetworkReply::NetworkError error)
+void WeatherService::handleProviderObservation(quint64 round, const QString &providerId,
+                                               const WeatherData &data, const QStringList &fields)
 {
-    Q_UNUSED(error)
-    emit errorOccurred("Network error occurred while fetching aviation weather data");
-}
-
-void WeatherService::parseMetarData(const QJsonArray &metars)
-{
-    if (metars.isEmpty()) {
-        emit errorOccurred("No METAR data available for the specified station");
+    auto it = m_rounds.find(round);
+    if (it == m_rounds.end()) {
         return;
     }
     
-    QJsonObject metar = metars[0].toObject();
+    it->answers.insert(providerId, {data, fields});
+    it->pending--;
+    rememberStationPosition(data);
+    
+    // The first observation is published straight away unless it is also
+    // the last answer; later ones only refine the final record, so
+    // listeners see at most two updates per round. fetch() rounds hand it
+    // to fetchProgress instead. Model output alone is not worth an interim
+    // update.
+    const bool observed = std::any_of(m_providers.cbegin(), m_providers.cend(), [&providerId](const WeatherProvider *provider) {
+        return provider->id() == providerId && !provider->isModel();
+    });
+    if (!it->publishedInterim && observed && (it->pending > 0 || it->pendingForecasts > 0)) {
+        it->publishedInterim = true;
+        if (it->publish) {
+            publishRound(*it, false);
+        }
+        if (it->promise) {
+            emit fetchProgress(fuseRound(*it));
+        }
+    }
     
-    m_currentWeather.stationId = metar["icaoId"].toString();
-    m_currentWeather.metar = metar["rawOb"].toString();
+    checkRoundComplete(round);
+}
+
+void WeatherService::handleProviderForecast(quint64 round, const QString &providerId, const WeatherData &data)
+{
+    Q_UNUSED(providerId)
     
-    if (metar.contains("lat") && metar.contains("lon")) {
-        m_currentWeather.location = QString("Station %1 (%2, %3)")
-            .arg(m_currentWeather.stationId)
-            .arg(metar["lat"].toDouble(), 0, 'f', 4)
-            .arg(metar["lon"].toDouble(), 0, 'f', 4);
+    auto it = m_rounds.find(round);
+    if (it == m_rounds.end()) {
+        return;
     }
     
-    if (metar.contains("obsTime")) {
-        m_currentWeather.timestamp = QDateTime::fromString(metar["obsTime"].toString(), Qt::ISODate);
+    it->pendingForecasts--;
+    if (!data.taf.isEmpty() || !data.hourlyForecast.isEmpty()) {
+        it->forecast = data;
+        it->hasForecast = true;
     }
     
-    if (metar.contains("temp")) {
-        m_currentWeather.temperature = metar["temp"].toDouble();
+    checkRoundComplete(round);
+}
+
+void WeatherService::handleProviderFailure(quint64 round, const QString &providerId, const QString &error)
+{
+    auto it = m_rounds.find(round);
+    if (it == m_rounds.end()) {
+        return;
     }
     
-    if (metar.contains("dewp")) {
-        double dewpoint = metar["dewp"].toDouble();
-        double temp = m_currentWeather.temperature;
-        if (!qIsNaN(temp) && !qIsNaN(dewpoint)) {
-            m_currentWeather.humidity = 100.0 * qExp((17.625 * dewpoint) / (243.04 + dewpoint) - (17.625 * temp) / (243.04 + temp));
-        }
-    }
+    qDebug() << "WeatherService: provider" << providerId << "failed:" << error;
+    it->errors.append(error);
+    it->pending--;
     
-    if (metar.contains("altim")) {
-        m_currentWeather.altimeter = metar["altim"].toDouble();
-        m_currentWeather.pressure = m_currentWeather.altimeter * 33.8639;
+    checkRoundComplete(round);
+}
+
+void WeatherService::checkRoundComplete(quint64 id)
+{
+    auto it = m_rounds.constFind(id);
+    if (it != m_rounds.constEnd() && it->pending <= 0 && it->pendingForecasts <= 0) {
+        completeRound(id, false);
     }
-    
-    if (metar.contains("wdir") && metar.contains("wspd")) {
-        m_currentWeather.windDirection = metar["wdir"].toDouble();
-        m_currentWeather.windSpeed = parseWindSpeed(metar["wspd"]);
+}
+
+void WeatherService::completeRound(quint64 id, bool timedOut)
+{
+    auto it = m_rounds.find(id);
+    if (it == m_rounds.end()) {
+        return;
     }
     
-    if (metar.contains("wgst")) {
-        m_currentWeather.windGust = parseWindSpeed(metar["wgst"]);
-    }
+    FetchRound round = it.value();
+    m_rounds.erase(it);
+    round.deadline->deleteLater();
     
-    if (metar.contains("visib")) {
-        m_currentWeather.visibility = parseVisibility(metar["visib"]);
+    // Late answers from this round are not wanted any more
+    for (WeatherProvider *provider : m_providers) {
+        provider->cancel(id);
     }
     
-    if (metar.contains("fltcat")) {
-        m_currentWeather.flightCategory = metar["fltcat"].toString();
-        m_currentWeather.condition = convertFlightCategory(m_currentWeather.flightCategory);
-    }
+    QString error = timedOut
+        ? QString("No weather provider answered for %1 in time").arg(round.stationId)
+        : round.errors.join("; ");
     
-    if (metar.contains("cover")) {
-        m_currentWeather.skyCover = parseSkyCover(metar["cover"].toArray());
+    if (round.publish) {
+        if (m_publishedRound == id) {
+            m_publishedRound = 0;
+        }
+        if (round.answers.isEmpty()) {
+            emit errorOccurred(error);
+        } else {
+            publishRound(round, true);
+        }
     }
     
-    if (metar.contains("ceiling")) {
-        m_currentWeather.ceiling = metar["ceiling"].toDouble();
+    if (round.promise) {
+        if (!round.answers.isEmpty()) {
+            const WeatherData fused = fuseRound(round);
+            cacheObservation(fused);
+            round.promise->addResult(fused);
+        } else {
+            round.promise->setException(WeatherFetchError(error));
+        }
+        round.promise->finish();
     }
-    
-    m_dataValid = true;
-    emit weatherDataUpdated(m_currentWeather);
 }
 
-void WeatherService::parseTafData(const QJsonArray &tafs)
+void WeatherService::cancelRound(quint64 id)
 {
-    if (tafs.isEmpty()) {
+    auto it = m_rounds.find(id);
+    if (it == m_rounds.end()) {
         return;
     }
     
-    QJsonObject taf = tafs[0].toObject();
-    m_currentWeather.taf = taf["rawTAF"].toString();
+    FetchRound round = it.value();
+    m_rounds.erase(it);
+    round.deadline->deleteLater();
     
-    m_currentWeather.hourlyForecast.clear();
-    m_currentWeather.dailyForecast.clear();
+    for (WeatherProvider *provider : m_providers) {
+        provider->cancel(id);
+    }
     
-    if (taf.contains("fcsts") && taf["fcsts"].isArray()) {
-        QJsonArray forecasts = taf["fcsts"].toArray();
+    if (m_publishedRound == id) {
+        m_publishedRound = 0;
+    }
+    if (round.promise) {
+        round.promise->finish();
+    }
+}
+
+void WeatherService::publishRound(const FetchRound &round, bool settled)
+{
+    m_currentWeather = fuseRound(round);
+    cacheObservation(m_currentWeather);
+    m_dataValid = true;
+    emit weatherDataUpdated(m_currentWeather);
+    if (settled) {
+        emit observationSettled(m_currentWeather);
+    }
+}
+
+WeatherData WeatherService::fuseRound(const FetchRound &round) const
+{
+    static const QHash<QString, double WeatherData::*> numericFields = {
+        {"temperature", &WeatherData::temperature},
+        {"feelsLike", &WeatherData::feelsLike},
+        {"humidity", &WeatherData::humidity},
+        {"pressure", &WeatherData::pressure},
+        {"windSpeed", &WeatherData::windSpeed},
+        {"windDirection", &WeatherData::windDirection},
+        {"windGust", &WeatherData::windGust},
+        {"visibility", &WeatherData::visibility},
+        {"cloudCover", &WeatherData::cloudCover},
+        {"uvIndex", &WeatherData::uvIndex},
+        {"latitude", &WeatherData::latitude},
+        {"longitude", &WeatherData::longitude},
+        {"altimeter", &WeatherData::altimeter},
+        {"ceiling", &WeatherData::ceiling},
+        {"dewpoint", &WeatherData::dewpoint},
+        {"elevation", &WeatherData::elevation},
+    };
+    static const QHash<QString, QString WeatherData::*> textFields = {
+        {"condition", &WeatherData::condition},
+        {"description", &WeatherData::description},
+        {"location", &WeatherData::location},
+        {"stationId", &WeatherData::stationId},
+        {"metar", &WeatherData::metar},
+        {"flightCategory", &WeatherData::flightCategory},
+        {"skyCover", &WeatherData::skyCover},
+    };
+    
+    WeatherData fused;
+    fused.stationId = round.stationId;
+    
+    // Observing providers are walked in priority order, then the models;
+    // the first one to report a field owns it
+    QList<WeatherProvider *> providers;
+    std::copy_if(m_providers.cbegin(), m_providers.cend(), std::back_inserter(providers),
+                 [](const WeatherProvider *provider) { return !provider->isModel(); });
+    std::copy_if(m_providers.cbegin(), m_providers.cend(), std::back_inserter(providers),
+                 [](const WeatherProvider *provider) { return provider->isModel(); });
+    
+    for (WeatherProvider *provider : providers) {
+        auto answer = round.answers.constFind(provider->id());
+        if (answer == round.answers.constEnd()) {
+            continue;
+        }
         
-        for (const auto &fcstValue : forecasts) {
-            QJsonObject fcst = fcstValue.toObject();
-            
-            WeatherData::Forecast forecast;
-            
-            if (fcst.contains("fcstTime")) {
-                forecast.time = QDateTime::fromString(fcst["fcstTime"].toString(), Qt::ISODate);
-            }
-            
-            if (fcst.contains("temp")) {
-                forecast.temperature = fcst["temp"].toDouble();
-            }
-            
-            if (fcst.contains("wdir") && fcst.contains("wspd")) {
-                forecast.windDirection = fcst["wdir"].toDouble();
-                forecast.windSpeed = parseWindSpeed(fcst["wspd"]);
+        for (const QString &field : answer->fields) {
+            if (fused.provenance.contains(field)) {
+                continue;
             }
-            
-            if (fcst.contains("fltcat")) {
-                forecast.condition = convertFlightCategory(fcst["fltcat"].toString());
+            // A station reports gusts only while it is gusting, so measured
+            // wind without a gust is an observed absence the model must not fill
+            if (provider->isModel() && field == "windGust" && fused.provenance.contains("windSpeed")) {
+                continue;
             }
             
-            if (m_currentWeather.hourlyForecast.size() < 24) {
-                m_currentWeather.hourlyForecast.append(forecast);
+            if (auto numeric = numericFields.value(field)) {
+                fused.*numeric = answer->data.*numeric;
+            } else if (auto text = textFields.value(field)) {
+                fused.*text = answer->data.*text;
+            } else if (field == "timestamp") {
+                fused.timestamp = answer->data.timestamp;
+            } else if (field == "phenomena") {
+                fused.phenomena = answer->data.phenomena;
+            } else {
+                continue;
             }
+            fused.provenance.insert(field, provider->isModel() ? WeatherData::kModelled + provider->id() : provider->id());
         }
     }
     
-    emit weatherDataUpdated(m_currentWeather);
+    if (fused.location.isEmpty()) {
+        fused.location = QString("Station %1").arg(round.stationId);
+    }
+    
+    if (round.hasForecast) {
+        fused.taf = round.forecast.taf;
+        fused.hourlyForecast = round.forecast.hourlyForecast;
+        fused.dailyForecast = round.forecast.dailyForecast;
+    }
+    
+    DerivedMeteorology::apply(fused);
+    return fused;
 }
 
-QString WeatherService::findNearestStation(double latitude, double longitude)
+namespace {
+
+const QMap<QString, QPair<double, double>> &majorStations()
 {
-    QMap<QString, QPair<double, double>> majorStations = {
+    static const QMap<QString, QPair<double, double>> stations = {
         {"KJFK", {40.6398, -73.7789}},  // New York JFK
         {"KLAX", {33.9425, -118.4081}}, // Los Angeles
         {"KORD", {41.9786, -87.9048}},  // Chicago O'Hare
@@ -312,11 +721,48 @@ QString WeatherService::findNearestStation(double latitude, double longitude)
         {"KDTW", {42.2124, -83.3534}},  // Detroit
         {"KPHL", {39.8719, -75.2411}},  // Philadelphia
     };
+    return stations;
+}
+
+} // namespace
+
+QStringList WeatherService::stationsNear(double latitude, double longitude, int count, double maxDistanceKm) const
+{
+    QStringList stations;
+    for (const StationInfo &station : m_stationIndex->nearest(latitude, longitude, count, maxDistanceKm)) {
+        stations.append(station.id);
+    }
+    if (!stations.isEmpty()) {
+        return stations;
+    }
+    
+    // Until the index has the area, the built-in airports
+    QList<QPair<double, QString>> ranked;
+    for (auto it = majorStations().begin(); it != majorStations().end(); ++it) {
+        double distance = CorridorSampler::distanceKm(latitude, longitude, it.value().first, it.value().second);
+        if (distance <= maxDistanceKm) {
+            ranked.append({distance, it.key()});
+        }
+    }
+    std::sort(ranked.begin(), ranked.end());
+    
+    for (int i = 0; i < qMin(count, int(ranked.size())); ++i) {
+        stations.append(ranked[i].second);
+    }
+    return stations;
+}
+
+QString WeatherService::findNearestStation(double latitude, double longitude)
+{
+    const QList<StationInfo> indexed = m_stationIndex->nearest(latitude, longitude, 1);
+    if (!indexed.isEmpty()) {
+        return indexed.first().id;
+    }
     
     QString nearestStation;
     double minDistance = std::numeric_limits<double>::max();
     
-    for (auto it = majorStations.begin(); it != majorStations.end(); ++it) {
+    for (auto it = majorStations().begin(); it != majorStations().end(); ++it) {
         double stationLat = it.value().first;
         double stationLon = it.value().second;
         
@@ -331,68 +777,36 @@ QString WeatherService::findNearestStation(double latitude, double longitude)
     return nearestStation;
 }
 
-QString WeatherService::convertFlightCategory(const QString &category) const
-{
-    if (category == "VFR") {
-        return "Clear";
-    } else if (category == "MVFR") {
-        return "Partly Cloudy";
-    } else if (category == "IFR") {
-        return "Cloudy";
-    } else if (category == "LIFR") {
-        return "Poor Visibility";
-    }
-    return category;
-}
-
-QString WeatherService::parseSkyCover(const QJsonArray &skyConditions) const
+bool WeatherService::stationPosition(const QString &stationId, double &latitude, double &longitude) const
 {
-    if (skyConditions.isEmpty()) {
-        return "Clear";
+    QString key = QString("stations/%1").arg(stationId);
+    if (m_settings->contains(key + "/lat")) {
+        latitude = m_settings->value(key + "/lat").toDouble();
+        longitude = m_settings->value(key + "/lon").toDouble();
+        return true;
     }
-    
-    QStringList conditions;
-    for (const auto &condition : skyConditions) {
-        QJsonObject sky = condition.toObject();
-        QString cover = sky["cover"].toString();
-        if (sky.contains("base")) {
-            conditions.append(QString("%1 at %2 ft").arg(cover).arg(sky["base"].toInt()));
-        } else {
-            conditions.append(cover);
-        }
+    if (m_stationIndex->position(stationId, latitude, longitude)) {
+        return true;
     }
     
-    return conditions.join(", ");
-}
-
-double WeatherService::parseVisibility(const QJsonValue &visibility) const
-{
-    if (visibility.isDouble()) {
-        return visibility.toDouble();
-    } else if (visibility.isString()) {
-        QString visStr = visibility.toString();
-        bool ok;
-        double vis = visStr.toDouble(&ok);
-        if (ok) {
-            return vis;
-        }
+    auto known = majorStations().constFind(stationId);
+    if (known != majorStations().constEnd()) {
+        latitude = known.value().first;
+        longitude = known.value().second;
+        return true;
     }
-    return 0.0;
+    return false;
 }
 
-double WeatherService::parseWindSpeed(const QJsonValue &windSpeed) const
+void WeatherService::rememberStationPosition(const WeatherData &data)
 {
-    if (windSpeed.isDouble()) {
-        return windSpeed.toDouble();
-    } else if (windSpeed.isString()) {
-        QString speedStr = windSpeed.toString();
-        bool ok;
-        double speed = speedStr.toDouble(&ok);
-        if (ok) {
-            return speed;
-        }
+    if (data.stationId.isEmpty() || (data.latitude == 0.0 && data.longitude == 0.0)) {
+        return;
     }
-    return 0.0;
+    
+    QString key = QString("stations/%1").arg(data.stationId);
+    m_settings->setValue(key + "/lat", data.latitude);
+    m_settings->setValue(key + "/lon", data.longitude);
 }
 
 void WeatherService::setPreferredAirport(const QString &icaoCode)
@@ -1,51 +1,100 @@
 #pragma once
 
 #include <QObject>
-#include <QNetworkAccessManager>
-#include <QNetworkReply>
 #include <QJsonObject>
 #include <QJsonDocument>
 #include <QTimer>
 #include <QSettings>
+#include <QMap>
+#include <QtNumeric>
+#include <QFuture>
+#include <QPromise>
+#include <QException>
+#include <memory>
+#include <limits>
+#include "networkdispatcher.h"
 
 struct WeatherData {
     QString condition;
     QString description;
-    double temperature;
-    double feelsLike;
-    double humidity;
-    double pressure;
-    double windSpeed;
-    double windDirection;
-    double windGust;
-    double visibility;
-    double cloudCover;
-    double uvIndex;
+    double temperature = 0.0;
+    double feelsLike = 0.0;
+    double humidity = 0.0;
+    double pressure = 0.0;
+    double windSpeed = 0.0;
+    double windDirection = 0.0;
+    double windGust = 0.0;
+    double visibility = 0.0;
+    double cloudCover = 0.0;
+    double uvIndex = 0.0;
     QString location;
     QString stationId;
+    double latitude = 0.0;
+    double longitude = 0.0;
     QDateTime timestamp;
     
     // aviation data
     QString metar;
     QString taf;
-    double altimeter;
+    double altimeter = 0.0;    // inHg
     QString flightCategory;
     QString skyCover;
-    double ceiling;
+    double ceiling = 0.0;
+    quint32 phenomena = 0; // WeatherPhenomena flags decoded from the METAR wx groups
+    double dewpoint = qQNaN(); // °C
+    double elevation = 0.0;    // station elevation, m
+    
+    // filled in by DerivedMeteorology after fusion
+    double densityAltitude = qQNaN(); // ft
+    double cloudBase = qQNaN();       // ft AGL, estimated from the T/Td spread
+    quint8 icingRisk = 0;             // DerivedMeteorology::IcingRisk
+    
+    // field name -> id of the provider that supplied it, e.g. "windGust" -> "nws";
+    // fields filled in from a forecast model carry kModelled before the id
+    QMap<QString, QString> provenance;
+    static constexpr const char *kModelled = "model:";
+    bool isModelled(const QString &field) const { return provenance.value(field).startsWith(QLatin1String(kModelled)); }
     
     struct Forecast {
         QDateTime time;
+        QDateTime endTime;      // invalid when the source only gives a point in time
+        QString changeIndicator; // TAF FM, BECMG, TEMPO or PROB; empty for the base period
         QString condition;
-        double temperature;
-        double windSpeed;
-        double windDirection;
-        double precipitation;
+        double temperature = qQNaN(); // °C, NaN when not forecast
+        double windSpeed = 0.0;
+        double windDirection = 0.0;
+        double windGust = 0.0;
+        double visibility = qQNaN(); // statute miles, NaN when not forecast
+        double precipitation = 0.0;
+        QString wxString;
+        quint32 phenomena = 0; // WeatherPhenomena flags decoded from wxString
     };
     
     QList<Forecast> hourlyForecast;
     QList<Forecast> dailyForecast;
 };
 
+class WeatherProvider;
+class BrokerClient;
+class StationIndex;
+
+// Error carried by futures returned from WeatherService::fetch()
+class WeatherFetchError : public QException
+{
+public:
+    explicit WeatherFetchError(const QString &message)
+        : m_message(message), m_what(message.toUtf8()) {}
+    
+    QString message() const { return m_message; }
+    const char *what() const noexcept override { return m_what.constData(); }
+    void raise() const override { throw *this; }
+    WeatherFetchError *clone() const override { return new WeatherFetchError(*this); }
+
+private:
+    QString m_message;
+    QByteArray m_what;
+};
+
 class WeatherService : public QObject
 {
     Q_OBJECT
@@ -53,40 +102,134 @@ class WeatherService : public QObject
 public:
     explicit WeatherService(QObject *parent = nullptr);
     
-    void fetchWeatherData(double latitude, double longitude);
-    void fetchWeatherByStation(const QString &stationId);
+    void fetchWeatherData(double latitude, double longitude,
+                          RequestPriority priority = RequestPriority::Interactive);
+    void fetchWeatherByStation(const QString &stationId,
+                               RequestPriority priority = RequestPriority::Interactive);
     void setPreferredAirport(const QString &icaoCode);
     QString getPreferredAirport() const;
+    QStringList providerIds() const;
+    
+    // While connected, published refreshes are served by the shared local
+    // broker instead of going upstream from this process
+    void setBrokerClient(BrokerClient *broker);
+    
+    // Independent of the published weather: fans out to every provider and
+    // resolves with the fused record once all of them have answered, or when
+    // timeoutMs passes with at least one answer. Fails with WeatherFetchError;
+    // canceling the future aborts its outstanding requests.
+    QFuture<WeatherData> fetch(const QString &stationId, int timeoutMs = 15000,
+                               RequestPriority priority = RequestPriority::Interactive);
+    
+    // For bulk readers such as map overlays: an observation no older than
+    // maxAgeSeconds from this process's cache, else from the shared broker
+    // while connected, else like fetch(). Fails with WeatherFetchError.
+    QFuture<WeatherData> observation(const QString &stationId, int maxAgeSeconds = 900,
+                                     RequestPriority priority = RequestPriority::Background);
+    
+    // For area readers such as the map overlay: the latest METAR of every
+    // station in the box, from a single AWC request. METAR fields only, not
+    // fused with the other providers. Fails with WeatherFetchError.
+    QFuture<QList<WeatherData>> metarsWithin(double south, double west, double north, double east,
+                                             RequestPriority priority = RequestPriority::Background);
+    
+    // Resolves with every result in input order, or fails with the first error
+    static QFuture<QList<WeatherData>> whenAll(const QList<QFuture<WeatherData>> &futures);
+    // Resolves with the results that succeeded, in input order; failed and
+    // canceled fetches are left out
+    static QFuture<QList<WeatherData>> whenSettled(const QList<QFuture<WeatherData>> &futures);
+    
+    // METAR stations by position; areas are filled in as they are looked at
+    StationIndex *stationIndex() const { return m_stationIndex; }
+    // Known stations ordered by great-circle distance, nearest first, none
+    // beyond maxDistanceKm
+    QStringList stationsNear(double latitude, double longitude, int count,
+                             double maxDistanceKm = std::numeric_limits<double>::infinity()) const;
     
     const WeatherData& currentWeather() const { return m_currentWeather; }
     bool isDataValid() const { return m_dataValid; }
 
 signals:
+    // Every publish of the current weather, interim answers included
     void weatherDataUpdated(const WeatherData &data);
+    // Once per observation, with the final fused record, for consumers that
+    // keep a history
+    void observationSettled(const WeatherData &data);
+    // The first observing answer of a fetch() round that is still waiting
+    // on other providers, fused; the future resolves with the final record
+    void fetchProgress(const WeatherData &data);
     void errorOccurred(const QString &error);
 
 private slots:
-    void handleMetarReply();
-    void handleTafReply();
-    void handleStationLookupReply();
-    void handleNetworkError(QNetworkReply::NetworkError error);
+    void handleProviderObservation(quint64 round, const QString &providerId,
+                                   const WeatherData &data, const QStringList &fields);
+    void handleProviderForecast(quint64 round, const QString &providerId, const WeatherData &data);
+    void handleProviderFailure(quint64 round, const QString &providerId, const QString &error);
+    void handleBrokerSnapshot(const QString &stationId, const WeatherData &data, const QDateTime &fetchedAt,
+                              bool settled);
+    void handleBrokerError(const QString &stationId, const QString &error);
+    void handleBrokerConnection(bool connected);
 
 private:
-    void parseMetarData(const QJsonArray &metars);
-    void parseTafData(const QJsonArray &tafs);
+    struct CachedObservation {
+        WeatherData data;
+        QDateTime fetchedAt;
+    };
+    
+    struct ProviderAnswer {
+        WeatherData data;
+        QStringList fields;
+    };
+    
+    // One hedged fan-out to every enabled provider for a single station
+    struct FetchRound {
+        quint64 id = 0;
+        QString stationId;
+        QMap<QString, ProviderAnswer> answers;
+        WeatherData forecast;
+        bool hasForecast = false;
+        QStringList errors;
+        int pending = 0;
+        int pendingForecasts = 0;
+        bool publish = false; // drives currentWeather() and weatherDataUpdated
+        bool publishedInterim = false; // the first observation went out before the round completed
+        std::shared_ptr<QPromise<WeatherData>> promise;
+        QTimer *deadline = nullptr;
+    };
+    
+    void setupProviders();
+    void handleStationLookupReply(const NetworkResponse &response, RequestPriority priority);
+    quint64 startRound(const QString &stationId, RequestPriority priority, int timeoutMs);
+    void checkRoundComplete(quint64 id);
+    void completeRound(quint64 id, bool timedOut);
+    void cancelRound(quint64 id);
+    WeatherData fuseRound(const FetchRound &round) const;
+    void publishRound(const FetchRound &round, bool settled);
+    bool stationPosition(const QString &stationId, double &latitude, double &longitude) const;
+    void rememberStationPosition(const WeatherData &data);
     QString findNearestStation(double latitude, double longitude);
-    QString convertFlightCategory(const QString &category) const;
-    QString parseSkyCover(const QJsonArray &skyConditions) const;
-    double parseVisibility(const QJsonValue &visibility) const;
-    double parseWindSpeed(const QJsonValue &windSpeed) const;
+    void cacheObservation(const WeatherData &data);
     
-    QNetworkAccessManager *m_networkManager;
     WeatherData m_currentWeather;
     bool m_dataValid;
     
-    QNetworkReply *m_metarReply;
-    QNetworkReply *m_tafReply;
-    QNetworkReply *m_stationLookupReply;
+    quint64 m_stationLookupRequest;
+    
+    QList<WeatherProvider *> m_providers; // fusion priority order
+    QHash<quint64, FetchRound> m_rounds;
+    quint64 m_nextRoundId;
+    quint64 m_publishedRound;
+    
+    BrokerClient *m_broker;
+    QString m_brokerStation;
+    // A refresh asked for while the broker connection was still being made
+    QString m_brokerPendingStation;
+    RequestPriority m_brokerPendingPriority;
+    // observation() calls waiting on a broker snapshot, by station
+    QMultiHash<QString, std::shared_ptr<QPromise<WeatherData>>> m_brokerWaiters;
+    
+    QHash<QString, CachedObservation> m_observations;
+    StationIndex *m_stationIndex;
     
     QSettings *m_settings;
 };
\ No newline at end of file
@@ -0,0 +1,188 @@
+#include "weathersnapshot.h"
+#include <QStandardPaths>
+#include <QSaveFile>
+#include <QSettings>
+#include <QFile>
+#include <QDir>
+#include <QDebug>
+
+namespace {
+
+const quint32 kSnapshotMagic = 0x44565331; // "DVS1"
+const qint32 kSnapshotVersion = 6;
+
+QString snapshotPath(const QString &stationId)
+{
+    return WeatherSnapshot::storageDirectory() + "/" + stationId + ".snap";
+}
+
+QDataStream &operator<<(QDataStream &out, FlightSafety safety)
+{
+    return out << qint8(safety);
+}
+
+QDataStream &operator>>(QDataStream &in, FlightSafety &safety)
+{
+    qint8 value = 0;
+    in >> value;
+    safety = FlightSafety(qBound<qint8>(0, value, qint8(FlightSafety::NoFly)));
+    return in;
+}
+
+QDataStream &operator<<(QDataStream &out, const FlightFinding &finding)
+{
+    return out << quint8(finding.code) << finding.severity << finding.detail << finding.measured << finding.limit;
+}
+
+QDataStream &operator>>(QDataStream &in, FlightFinding &finding)
+{
+    quint8 code = 0;
+    in >> code >> finding.severity >> finding.detail >> finding.measured >> finding.limit;
+    finding.code = FindingCode(qMin<quint8>(code, quint8(FindingCode::LowCeiling)));
+    return in;
+}
+
+} // namespace
+
+QDataStream &operator<<(QDataStream &out, const WeatherData::Forecast &forecast)
+{
+    return out << forecast.time << forecast.endTime << forecast.changeIndicator << forecast.condition
+               << forecast.temperature << forecast.windSpeed << forecast.windDirection << forecast.windGust
+               << forecast.visibility << forecast.precipitation << forecast.wxString
+               << forecast.phenomena;
+}
+
+QDataStream &operator>>(QDataStream &in, WeatherData::Forecast &forecast)
+{
+    return in >> forecast.time >> forecast.endTime >> forecast.changeIndicator >> forecast.condition
+              >> forecast.temperature >> forecast.windSpeed >> forecast.windDirection >> forecast.windGust
+              >> forecast.visibility >> forecast.precipitation >> forecast.wxString
+              >> forecast.phenomena;
+}
+
+QDataStream &operator<<(QDataStream &out, const WeatherData &data)
+{
+    out << data.condition << data.description
+        << data.temperature << data.feelsLike << data.humidity << data.pressure
+        << data.windSpeed << data.windDirection << data.windGust
+        << data.visibility << data.cloudCover << data.uvIndex
+        << data.location << data.stationId << data.latitude << data.longitude << data.timestamp
+        << data.metar << data.taf << data.altimeter << data.flightCategory << data.skyCover << data.ceiling << data.phenomena
+        << data.dewpoint << data.elevation << data.densityAltitude << data.cloudBase << data.icingRisk
+        << data.provenance << data.hourlyForecast << data.dailyForecast;
+    return out;
+}
+
+QDataStream &operator>>(QDataStream &in, WeatherData &data)
+{
+    in >> data.condition >> data.description
+       >> data.temperature >> data.feelsLike >> data.humidity >> data.pressure
+       >> data.windSpeed >> data.windDirection >> data.windGust
+       >> data.visibility >> data.cloudCover >> data.uvIndex
+       >> data.location >> data.stationId >> data.latitude >> data.longitude >> data.timestamp
+       >> data.metar >> data.taf >> data.altimeter >> data.flightCategory >> data.skyCover >> data.ceiling >> data.phenomena
+       >> data.dewpoint >> data.elevation >> data.densityAltitude >> data.cloudBase >> data.icingRisk
+       >> data.provenance >> data.hourlyForecast >> data.dailyForecast;
+    return in;
+}
+
+QDataStream &operator<<(QDataStream &out, const FlightAssessment &assessment)
+{
+    const FlightAssessment::Limits &limits = assessment.limits;
+    out << assessment.overall << assessment.wind << assessment.visibility
+        << assessment.precipitation << assessment.temperature << assessment.ceiling
+        << qint32(assessment.findingCount);
+    for (int i = 0; i < assessment.findingCount; ++i) {
+        out << assessment.findings[i];
+    }
+    out << limits.maxWindSpeed << limits.maxWindGust << limits.minVisibility
+        << limits.minTemperature << limits.maxTemperature << limits.maxHumidity;
+    return out;
+}
+
+QDataStream &operator>>(QDataStream &in, FlightAssessment &assessment)
+{
+    FlightAssessment::Limits &limits = assessment.limits;
+    qint32 count = 0;
+    in >> assessment.overall >> assessment.wind >> assessment.visibility
+       >> assessment.precipitation >> assessment.temperature >> assessment.ceiling
+       >> count;
+    assessment.clearFindings();
+    for (qint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        FlightFinding finding;
+        in >> finding;
+        assessment.addFinding(finding);
+    }
+    in >> limits.maxWindSpeed >> limits.maxWindGust >> limits.minVisibility
+       >> limits.minTemperature >> limits.maxTemperature >> limits.maxHumidity;
+    return in;
+}
+
+QString WeatherSnapshot::storageDirectory()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/snapshots";
+}
+
+bool WeatherSnapshot::save(const WeatherData &weather, const FlightAssessment &assessment)
+{
+    if (weather.stationId.isEmpty()) {
+        return false;
+    }
+    
+    QDir().mkpath(storageDirectory());
+    QSaveFile file(snapshotPath(weather.stationId));
+    if (!file.open(QIODevice::WriteOnly)) {
+        qDebug() << "WeatherSnapshot: cannot write" << file.fileName() << file.errorString();
+        return false;
+    }
+    
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_6_0);
+    out << kSnapshotMagic << kSnapshotVersion << QDateTime::currentDateTimeUtc() << weather << assessment;
+    
+    if (out.status() != QDataStream::Ok || !file.commit()) {
+        return false;
+    }
+    
+    QSettings settings("DroneView", "Settings");
+    settings.setValue("snapshot/lastStation", weather.stationId);
+    return true;
+}
+
+WeatherSnapshot WeatherSnapshot::load(const QString &stationId)
+{
+    WeatherSnapshot snapshot;
+    
+    QFile file(snapshotPath(stationId.trimmed().toUpper()));
+    if (!file.open(QIODevice::ReadOnly)) {
+        return snapshot;
+    }
+    
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_6_0);
+    
+    quint32 magic = 0;
+    qint32 version = 0;
+    in >> magic >> version;
+    if (magic != kSnapshotMagic || version != kSnapshotVersion) {
+        qDebug() << "WeatherSnapshot: ignoring snapshot with unknown format" << file.fileName();
+        return snapshot;
+    }
+    
+    in >> snapshot.savedAt >> snapshot.weather >> snapshot.assessment;
+    if (in.status() != QDataStream::Ok) {
+        qDebug() << "WeatherSnapshot: corrupt snapshot" << file.fileName();
+        return WeatherSnapshot();
+    }
+    return snapshot;
+}
+
+WeatherSnapshot WeatherSnapshot::loadLatest()
+{
+    QSettings settings("DroneView", "Settings");
+    QString stationId = settings.value("snapshot/lastStation").toString();
+    if (stationId.isEmpty()) {
+        return WeatherSnapshot();
+    }
+    return load(stationId);
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <QDataStream>
+#include <QDateTime>
+#include "weatherservice.h"
+#include "flightconditions.h"
+
+// Last known weather and assessment for one station, persisted so the next
+// launch can render something useful before the first network round trip
+struct WeatherSnapshot {
+    WeatherData weather;
+    FlightAssessment assessment;
+    QDateTime savedAt;
+    
+    bool isValid() const { return savedAt.isValid() && !weather.stationId.isEmpty(); }
+    // When the data was true, which is what its age should be measured from
+    QDateTime observedAt() const { return weather.timestamp.isValid() ? weather.timestamp : savedAt; }
+    
+    static bool save(const WeatherData &weather, const FlightAssessment &assessment);
+    static WeatherSnapshot load(const QString &stationId);
+    // Snapshot of whichever station was saved last
+    static WeatherSnapshot loadLatest();
+    static QString storageDirectory();
+};
+
+QDataStream &operator<<(QDataStream &out, const WeatherData::Forecast &forecast);
+QDataStream &operator>>(QDataStream &in, WeatherData::Forecast &forecast);
+QDataStream &operator<<(QDataStream &out, const WeatherData &data);
+QDataStream &operator>>(QDataStream &in, WeatherData &data);
+QDataStream &operator<<(QDataStream &out, const FlightAssessment &assessment);
+QDataStream &operator>>(QDataStream &in, FlightAssessment &assessment);
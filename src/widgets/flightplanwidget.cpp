@@ -1,7 +1,8 @@
 #include "flightplanwidget.h"
+#include "../weatherservice.h"
+#include "../stationindex.h"
 #include <QMessageBox>
 #include <QInputDialog>
-#include <QTimer>
 #include <QSizePolicy>
 #include <qmath.h>
 
@@ -10,10 +11,41 @@ FlightPlanWidget::FlightPlanWidget(QWidget *parent)
     , m_mainLayout(nullptr)
     , m_currentLatitude(37.7749)
     , m_currentLongitude(-122.4194)
+    , m_weatherService(nullptr)
+    , m_awaitingStations(false)
+    , m_magneticVariation(nullptr)
+    , m_operatingAltitude(100.0)
 {
     setupUI();
 }
 
+void FlightPlanWidget::setWeatherService(WeatherService *service)
+{
+    m_weatherService = service;
+    if (m_weatherService) {
+        connect(m_weatherService->stationIndex(), &StationIndex::stationsAdded, this, [this]() {
+            if (m_awaitingStations) {
+                m_awaitingStations = false;
+                checkWeatherForPlan();
+            }
+        });
+    }
+}
+
+void FlightPlanWidget::setMagneticVariation(const MagneticVariation *variation)
+{
+    m_magneticVariation = variation;
+}
+
+void FlightPlanWidget::setOperatingConditions(const FlightAssessment::Limits &limits, double altitude,
+                                              WindProfile::Terrain terrain)
+{
+    m_operatingAltitude = altitude;
+    m_corridorSampler.setLimits(limits);
+    m_corridorSampler.setTerrain(terrain);
+    m_altitudeSpinBox->setValue(altitude * 3.28084);
+}
+
 void FlightPlanWidget::setupUI()
 {
     m_mainLayout = new QVBoxLayout(this);
@@ -146,7 +178,7 @@ void FlightPlanWidget::setupUI()
         "    color: #f0f6ff;"
         "    padding: 4px 0px;"
         "}";
-        
+    
     QString modernInputStyle = 
         "QLineEdit, QComboBox, QDateEdit, QTimeEdit {"
         "    font-family: 'SF Pro Text', 'Segoe UI', 'Arial';"
@@ -490,13 +522,137 @@ void FlightPlanWidget::removeWaypoint()
 
 void FlightPlanWidget::checkWeatherForPlan()
 {
+    if (!m_weatherService) {
+        m_weatherSuitabilityLabel->setText("Weather: Unavailable");
+        m_weatherSuitabilityLabel->setStyleSheet("color: #888888;");
+        return;
+    }
+    
+    const QList<CorridorPoint> path = planPath(getCurrentPlan());
+    
+    // The index fetches the stations of areas it has not seen yet
+    const double margin = kMaxStationDistanceKm / 111.0;
+    double south = path.first().latitude, north = south;
+    double west = path.first().longitude, east = west;
+    for (const CorridorPoint &point : path) {
+        south = qMin(south, point.latitude);
+        north = qMax(north, point.latitude);
+        west = qMin(west, point.longitude);
+        east = qMax(east, point.longitude);
+    }
+    m_weatherService->stationIndex()->ensureCoverage(south - margin, west - margin, north + margin, east + margin);
+    
+    // Stations around every vertex, so samples between them have neighbours
+    // on both sides of the route
+    QStringList stations;
+    for (const CorridorPoint &point : path) {
+        const QStringList nearest = m_weatherService->stationsNear(point.latitude, point.longitude, 3,
+                                                                   kMaxStationDistanceKm);
+        for (const QString &stationId : nearest) {
+            if (!stations.contains(stationId)) {
+                stations.append(stationId);
+            }
+        }
+    }
+    
+    if (stations.isEmpty()) {
+        m_awaitingStations = true;
+        m_weatherSuitabilityLabel->setText(QString("Weather: No stations within %1 km").arg(kMaxStationDistanceKm, 0, 'f', 0));
+        m_weatherSuitabilityLabel->setStyleSheet("color: #888888;");
+        return;
+    }
+    
     m_weatherSuitabilityLabel->setText("Weather: Checking...");
     m_weatherSuitabilityLabel->setStyleSheet("color: #ffaa00;");
+    m_checkWeatherButton->setEnabled(false);
+    
+    QList<QFuture<WeatherData>> fetches;
+    for (const QString &stationId : stations) {
+        fetches.append(m_weatherService->observation(stationId, 900, RequestPriority::Interactive));
+    }
     
-    QTimer::singleShot(2000, [this]() {
+    // A station that does not answer leaves a gap rather than failing the check
+    WeatherService::whenSettled(fetches)
+        .then(this, [this, path, stations](const QList<WeatherData> &observations) {
+            m_checkWeatherButton->setEnabled(true);
+            QStringList missing = stations;
+            for (const WeatherData &data : observations) {
+                missing.removeAll(data.stationId.toUpper());
+            }
+            // Unchanged observations keep the version, so only edited legs regrade
+            m_corridorSampler.setObservations(observations);
+            showCorridorResult(m_corridorSampler.sample(path), missing);
+        });
+}
+
+QList<CorridorPoint> FlightPlanWidget::planPath(const FlightPlan &plan) const
+{
+    QList<CorridorPoint> path;
+    path.append({plan.homeLatitude, plan.homeLongitude, plan.altitude});
+    for (const FlightPlan::Waypoint &waypoint : plan.waypoints) {
+        path.append({waypoint.latitude, waypoint.longitude, waypoint.altitude});
+    }
+    path.append({plan.targetLatitude, plan.targetLongitude, plan.altitude});
+    return path;
+}
+
+void FlightPlanWidget::showCorridorResult(const CorridorResult &result, const QStringList &missing)
+{
+    const QString gaps = missing.isEmpty() ? QString() : QString("No data from %1").arg(missing.join(", "));
+    if (result.isEmpty()) {
+        m_weatherSuitabilityLabel->setText("Weather: No station data");
+        m_weatherSuitabilityLabel->setStyleSheet("color: #888888;");
+        m_weatherSuitabilityLabel->setToolTip(gaps);
+        return;
+    }
+    
+    // One line per leg in the tooltip
+    QStringList legs;
+    for (int i = 0; i < result.segments.size(); ++i) {
+        const CorridorSegment &segment = result.segments[i];
+        QString ceiling = qIsNaN(segment.ceiling) ? QString("none") : QString("%1 ft").arg(segment.ceiling, 0, 'f', 0);
+        QString course = QString("%1°T").arg(qRound(segment.trueCourse) % 360, 3, 10, QChar('0'));
+        if (m_magneticVariation && m_magneticVariation->isValid()) {
+            double magnetic = m_magneticVariation->toMagnetic(segment.trueCourse, segment.from.latitude,
+                                                              segment.from.longitude);
+            course += QString(" %1°M").arg(qRound(magnetic) % 360, 3, 10, QChar('0'));
+        }
+        legs.append(QString("Leg %1 (%2 km, %3): wind %4 G%5 kts, vis %6 SM, ceiling %7 [%8]")
+                    .arg(i + 1)
+                    .arg(segment.lengthKm, 0, 'f', 1)
+                    .arg(course)
+                    .arg(segment.windSpeed, 0, 'f', 0)
+                    .arg(segment.windGust, 0, 'f', 0)
+                    .arg(segment.visibility, 0, 'f', 1)
+                    .arg(ceiling, segment.stations.join(", ")));
+    }
+    if (!gaps.isEmpty()) {
+        legs.append(gaps);
+    }
+    m_weatherSuitabilityLabel->setToolTip(legs.join("\n"));
+    
+    switch (result.overall) {
+    case FlightSafety::Safe:
         m_weatherSuitabilityLabel->setText("Weather: Good for flight");
         m_weatherSuitabilityLabel->setStyleSheet("color: #00aa00;");
-    });
+        break;
+    case FlightSafety::Caution:
+        m_weatherSuitabilityLabel->setText("Weather: Caution along route");
+        m_weatherSuitabilityLabel->setStyleSheet("color: #ffaa00;");
+        break;
+    case FlightSafety::Unsafe:
+        m_weatherSuitabilityLabel->setText("Weather: Unsafe along route");
+        m_weatherSuitabilityLabel->setStyleSheet("color: #ff6600;");
+        break;
+    case FlightSafety::NoFly:
+        m_weatherSuitabilityLabel->setText("Weather: No fly");
+        m_weatherSuitabilityLabel->setStyleSheet("color: #ff0000;");
+        break;
+    }
+    if (!missing.isEmpty()) {
+        m_weatherSuitabilityLabel->setText(m_weatherSuitabilityLabel->text()
+                                           + QString(" (%1 of the stations silent)").arg(missing.size()));
+    }
 }
 
 void FlightPlanWidget::clearPlanForm()
@@ -511,7 +667,7 @@ void FlightPlanWidget::clearPlanForm()
     m_homeLonSpinBox->setValue(m_currentLongitude);
     m_targetLatSpinBox->setValue(m_currentLatitude);
     m_targetLonSpinBox->setValue(m_currentLongitude);
-    m_altitudeSpinBox->setValue(100.0);
+    m_altitudeSpinBox->setValue(m_operatingAltitude * 3.28084);
     m_speedSpinBox->setValue(5.0);
     m_distanceLabel->setText("Distance: --");
     m_estimatedTimeLabel->setText("Est. Time: --");
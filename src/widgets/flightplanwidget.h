@@ -14,6 +14,10 @@
 #include <QComboBox>
 #include <QTimeEdit>
 #include <QDateEdit>
+#include "../corridorsampler.h"
+#include "../magneticvariation.h"
+
+class WeatherService;
 
 struct FlightPlan {
     QString name;
@@ -46,6 +50,18 @@ class FlightPlanWidget : public QWidget
 
 public:
     explicit FlightPlanWidget(QWidget *parent = nullptr);
+    
+    // Stations within kMaxStationDistanceKm of a plan vertex feed the check
+    static constexpr double kMaxStationDistanceKm = 50.0;
+    
+    // Observations for the weather check are fetched through this service
+    void setWeatherService(WeatherService *service);
+    // Leg courses are also shown magnetic once the grid is built
+    void setMagneticVariation(const MagneticVariation *variation);
+    // The limits, altitude (m AGL) and terrain of the live assessment, so a
+    // route is graded like the current conditions; new plans fly at altitude
+    void setOperatingConditions(const FlightAssessment::Limits &limits, double altitude,
+                                WindProfile::Terrain terrain);
 
 public slots:
     void updateCurrentLocation(double latitude, double longitude);
@@ -69,6 +85,9 @@ private:
     double calculateDistanceBetweenPoints(double lat1, double lon1, double lat2, double lon2) const;
     QString formatDistance(double distance) const;
     QString formatDuration(int seconds) const;
+    QList<CorridorPoint> planPath(const FlightPlan &plan) const;
+    // missing lists the stations that returned no observation
+    void showCorridorResult(const CorridorResult &result, const QStringList &missing);
     
     QVBoxLayout *m_mainLayout;
     
@@ -113,4 +132,10 @@ private:
     QList<FlightPlan> m_savedPlans;
     double m_currentLatitude;
     double m_currentLongitude;
+    
+    WeatherService *m_weatherService;
+    bool m_awaitingStations; // rechecked when the station index grows
+    const MagneticVariation *m_magneticVariation;
+    double m_operatingAltitude; // m AGL
+    CorridorSampler m_corridorSampler;
 };
\ No newline at end of file
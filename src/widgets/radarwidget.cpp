@@ -1,21 +1,111 @@
 #include "radarwidget.h"
+#include "tilemapwidget.h"
 #include <QDebug>
 #include <QSizePolicy>
+#include <QSignalBlocker>
+#include <QEvent>
+#include <QTime>
+#include <QDateTime>
+#ifdef DRONEVIEW_WEBENGINE
+#include <QWebEngineView>
+#include <QWebEnginePage>
+#include <QJsonDocument>
+#include <QJsonObject>
+#endif
+#include <QBuffer>
+#include <QSettings>
+#include <QtMath>
+#include <cmath>
+
+namespace {
+const char kIemHost[] = "mesonet.agron.iastate.edu";
+const char kBasemapUrl[] = "https://{s}.basemaps.cartocdn.com/dark_all/{z}/{x}/{y}{r}.png";
+
+// The loop runs over IEM's composites of the last 50 minutes, one per scan
+const int kLoopFrames = 11;
+const int kScanSeconds = 300;
+// A composite is published a few minutes after its scan; the loop ends on
+// the newest one that is certainly there
+const int kPublishLagSeconds = 600;
+const int kFrameMs = 500;
+const int kDwellMs = 1500; // on the newest frame before starting over
+const int kAnimationTickMs = 33;
+
+TileLayer loopStyle()
+{
+    return {QString(), QString(), 0.7, 19, "uscomp-n0q"};
+}
+
+qint64 newestLoopSlot()
+{
+    const qint64 published = QDateTime::currentSecsSinceEpoch() - kPublishLagSeconds;
+    return published - published % kScanSeconds;
+}
+}
 
 RadarWidget::RadarWidget(QWidget *parent)
     : QWidget(parent)
     , m_mainLayout(nullptr)
     , m_radarGroup(nullptr)
+    , m_mapView(nullptr)
+#ifdef DRONEVIEW_WEBENGINE
     , m_webView(nullptr)
+#endif
     , m_controlsLayout(nullptr)
     , m_latitude(37.7749)
     , m_longitude(-122.4194)
     , m_zoomLevel(8)
     , m_currentLayer("ridge-current")
     , m_isAnimating(false)
+    , m_animationTimer(new QTimer(this))
+    , m_loopSlot(0)
+    , m_loopPosition(0.0)
+    , m_loopReady(false)
+    , m_radarRefreshTimer(new QTimer(this))
+    , m_zoomTimer(new QTimer(this))
+#ifdef DRONEVIEW_WEBENGINE
+    , m_mapLoadPending(false)
+    , m_pageRequested(false)
+    , m_pageReady(false)
+#endif
+    , m_overlayCellPixels(QSettings("DroneView", "Settings").value("overlay/cellPixels", 4).toInt())
 {
+    // Startup of the two renderers is compared from the log
+    m_startupClock.start();
     setupUI();
+    if (m_mapView) {
+        m_mapView->installEventFilter(this);
+    }
+#ifdef DRONEVIEW_WEBENGINE
+    if (m_webView) {
+        connect(m_webView, &QWebEngineView::loadFinished, this, [this](bool ok) {
+            // A failed load is retried by the next change
+            m_pageReady = ok;
+            m_pageRequested = ok;
+            if (ok) {
+                reportStartup();
+                // Changes made while the page loaded
+                m_webView->page()->runJavaScript(QString("updateMap(%1);").arg(mapState()));
+                applyOverlay();
+            }
+        });
+    }
+#endif
     loadRadarMap();
+    
+    // A slider drag settles into one map update
+    m_zoomTimer->setSingleShot(true);
+    m_zoomTimer->setInterval(150);
+    connect(m_zoomTimer, &QTimer::timeout, this, [this]() {
+        loadRadarMap();
+    });
+    
+    m_animationTimer->setInterval(kAnimationTickMs);
+    connect(m_animationTimer, &QTimer::timeout, this, &RadarWidget::advanceAnimation);
+    
+    // Refresh radar data every 5 minutes
+    connect(m_radarRefreshTimer, &QTimer::timeout, this, &RadarWidget::redrawRadarLayer);
+    m_radarRefreshTimer->start(300000);
 }
 
 void RadarWidget::setupUI()
@@ -86,6 +176,17 @@ void RadarWidget::setupUI()
     connect(m_layerComboBox, QOverload<int>::of(&QComboBox::currentIndexChanged),
             this, &RadarWidget::onLayerChanged);
     
+    m_overlayComboBox = new QComboBox(this);
+    m_overlayComboBox->addItem("No Overlay", -1);
+    m_overlayComboBox->addItem("Flight Category", int(RasterField::Category));
+    m_overlayComboBox->addItem("Wind", int(RasterField::Wind));
+    m_overlayComboBox->addItem("Gusts", int(RasterField::Gust));
+    m_overlayComboBox->addItem("Visibility", int(RasterField::Visibility));
+    m_overlayComboBox->addItem("Ceiling", int(RasterField::Ceiling));
+    m_overlayComboBox->setStyleSheet(controlStyle);
+    connect(m_overlayComboBox, QOverload<int>::of(&QComboBox::currentIndexChanged),
+            this, &RadarWidget::onOverlayChanged);
+    
     m_zoomSlider = new QSlider(Qt::Horizontal, this);
     m_zoomSlider->setRange(3, 15);
     m_zoomSlider->setValue(m_zoomLevel);
@@ -122,9 +223,12 @@ void RadarWidget::setupUI()
     m_animateButton->setCheckable(true);
     m_animateButton->setStyleSheet(controlStyle);
     connect(m_animateButton, &QPushButton::toggled, [this](bool animate) {
-        m_isAnimating = animate;
         m_animateButton->setText(animate ? "Stop" : "Animate");
-        loadRadarMap();
+        if (animate) {
+            startAnimation();
+        } else {
+            stopAnimation();
+        }
     });
     
     auto *layerLabel = new QLabel("Layer:", this);
@@ -132,6 +236,7 @@ void RadarWidget::setupUI()
     
     m_controlsLayout->addWidget(layerLabel);
     m_controlsLayout->addWidget(m_layerComboBox);
+    m_controlsLayout->addWidget(m_overlayComboBox);
     m_controlsLayout->addWidget(m_zoomLabel);
     m_controlsLayout->addWidget(m_zoomSlider);
     m_controlsLayout->addStretch();
@@ -139,26 +244,112 @@ void RadarWidget::setupUI()
     m_controlsLayout->addWidget(m_animateButton);
     
     radarLayout->addLayout(m_controlsLayout);
-    
-    m_webView = new QWebEngineView(this);
-    m_webView->setMinimumHeight(280);
-    m_webView->setSizePolicy(QSizePolicy::Expanding, QSizePolicy::Expanding);
-    radarLayout->addWidget(m_webView);
+
+#ifdef DRONEVIEW_WEBENGINE
+    // The Leaflet page stays available for comparison with the native map
+    if (QSettings("DroneView", "Settings").value("radar/renderer").toString() == "web") {
+        m_webView = new QWebEngineView(this);
+    }
+    if (!m_webView)
+#endif
+    {
+        m_mapView = new TileMapWidget(this);
+        m_mapView->setBaseLayer({kBasemapUrl, "abcd", 1.0, 19, "carto-dark"});
+        m_mapView->setAttribution("© OpenStreetMap contributors © CARTO · Weather data courtesy of Iowa Environmental Mesonet & NOAA");
+        m_mapView->setCenter(m_latitude, m_longitude);
+        m_mapView->setZoom(m_zoomLevel);
+        
+        // Wheel and double-click zoom drive the slider without reloading
+        connect(m_mapView, &TileMapWidget::zoomChanged, this, [this](int zoom) {
+            const QSignalBlocker blocker(m_zoomSlider);
+            m_zoomLevel = zoom;
+            m_zoomSlider->setValue(zoom);
+            m_zoomLabel->setText(QString("Zoom: %1").arg(zoom));
+        });
+        connect(m_mapView, &TileMapWidget::framesProgress, this, [this](int settled, int total) {
+            // Playback starts once every frame is in memory
+            if (!m_isAnimating || m_loopReady) {
+                return;
+            }
+            if (settled >= total) {
+                m_loopReady = true;
+                m_animationClock.restart();
+            } else {
+                m_mapView->setStatusText(QString("Loading radar loop\n%1%").arg(total > 0 ? 100 * settled / total : 0));
+            }
+        });
+        connect(m_mapView, &TileMapWidget::viewChanged, this, [this]() {
+            m_raster = WeatherRaster();
+            applyOverlay();
+            requestOverlay();
+        });
+    }
+#ifdef DRONEVIEW_WEBENGINE
+    if (m_webView) {
+        m_animateButton->setEnabled(false);
+        m_animateButton->setToolTip("The radar loop needs the native map renderer");
+    }
+#endif
+    mapView()->setMinimumHeight(280);
+    mapView()->setSizePolicy(QSizePolicy::Expanding, QSizePolicy::Expanding);
+    radarLayout->addWidget(mapView());
     
     m_mainLayout->addWidget(m_radarGroup);
     setSizePolicy(QSizePolicy::Expanding, QSizePolicy::Expanding);
 }
 
+bool RadarWidget::eventFilter(QObject *watched, QEvent *event)
+{
+    if (watched == m_mapView && event->type() == QEvent::Paint) {
+        reportStartup();
+        m_mapView->removeEventFilter(this);
+    }
+    return QWidget::eventFilter(watched, event);
+}
+
+void RadarWidget::reportStartup()
+{
+    if (!m_startupClock.isValid()) {
+        return;
+    }
+    qDebug() << "Radar: first map drawn" << m_startupClock.elapsed() << "ms after start with the"
+             << (m_mapView ? "native" : "web") << "renderer";
+    m_startupClock.invalidate();
+}
+
+QWidget *RadarWidget::mapView() const
+{
+#ifdef DRONEVIEW_WEBENGINE
+    if (m_webView) {
+        return m_webView;
+    }
+#endif
+    return m_mapView;
+}
+
 void RadarWidget::updateLocation(double latitude, double longitude)
 {
+    // Location fixes repeat while stationary; a move only pans the map, so
+    // just the tiles that come into view are fetched
+    if (latitude == m_latitude && longitude == m_longitude) {
+        return;
+    }
     m_latitude = latitude;
     m_longitude = longitude;
-    loadRadarMap();
+    if (m_mapView) {
+        m_mapView->setCenter(m_latitude, m_longitude);
+        m_mapView->setMarker(m_latitude, m_longitude, "Current Location");
+        m_raster = WeatherRaster();
+        applyOverlay();
+        requestOverlay();
+        return;
+    }
+    loadRadarMap(RequestPriority::Background);
 }
 
 void RadarWidget::refreshRadarData()
 {
-    loadRadarMap();
+    redrawRadarLayer();
 }
 
 void RadarWidget::onLayerChanged()
@@ -171,7 +362,7 @@ void RadarWidget::onZoomChanged()
 {
     m_zoomLevel = m_zoomSlider->value();
     m_zoomLabel->setText(QString("Zoom: %1").arg(m_zoomLevel));
-    loadRadarMap();
+    m_zoomTimer->start();
 }
 
 void RadarWidget::onTimeChanged()
@@ -179,28 +370,121 @@ void RadarWidget::onTimeChanged()
     loadRadarMap();
 }
 
-void RadarWidget::loadRadarMap()
+void RadarWidget::onOverlayChanged()
 {
-    QString baseUrl;
-    QString layerName = m_layerComboBox->currentText();
-    
-    // Set the appropriate IEM tile URL based on layer type
-    if (m_currentLayer == "ridge-current") {
-        baseUrl = "https://mesonet.agron.iastate.edu/cache/tile.py/1.0.0/ridge::USCOMP-N0Q-0/{z}/{x}/{y}.png";
-    } else if (m_currentLayer == "mrms-p1h") {
-        baseUrl = "https://mesonet.agron.iastate.edu/cache/tile.py/1.0.0/mrms::p1h-0/{z}/{x}/{y}.png";
+    // Fields of the last raster switch without regenerating it
+    if (m_raster.isEmpty()) {
+        requestOverlay();
+    } else {
+        applyOverlay();
+    }
+}
+
+QString RadarWidget::buildRadarUrl() const
+{
+    // The IEM tile URL for the selected product
+    if (m_currentLayer == "mrms-p1h") {
+        return "https://mesonet.agron.iastate.edu/cache/tile.py/1.0.0/mrms::p1h-0/{z}/{x}/{y}.png";
     } else if (m_currentLayer == "mrms-p24h") {
-        baseUrl = "https://mesonet.agron.iastate.edu/cache/tile.py/1.0.0/mrms::p24h-0/{z}/{x}/{y}.png";
+        return "https://mesonet.agron.iastate.edu/cache/tile.py/1.0.0/mrms::p24h-0/{z}/{x}/{y}.png";
     } else if (m_currentLayer == "nexrd2-n0q") {
-        baseUrl = "https://mesonet.agron.iastate.edu/cache/tile.py/1.0.0/nexrd2-n0q-900913/{z}/{x}/{y}.png";
+        return "https://mesonet.agron.iastate.edu/cache/tile.py/1.0.0/nexrd2-n0q-900913/{z}/{x}/{y}.png";
     } else if (m_currentLayer == "nexrd2-ncr") {
-        baseUrl = "https://mesonet.agron.iastate.edu/cache/tile.py/1.0.0/nexrd2-ncr-900913/{z}/{x}/{y}.png";
-    } else {
-        // Fallback to ridge current
-        baseUrl = "https://mesonet.agron.iastate.edu/cache/tile.py/1.0.0/ridge::USCOMP-N0Q-0/{z}/{x}/{y}.png";
+        return "https://mesonet.agron.iastate.edu/cache/tile.py/1.0.0/nexrd2-ncr-900913/{z}/{x}/{y}.png";
+    }
+    // ridge-current, also the fallback
+    return "https://mesonet.agron.iastate.edu/cache/tile.py/1.0.0/ridge::USCOMP-N0Q-0/{z}/{x}/{y}.png";
+}
+
+QList<QPair<QColor, QString>> RadarWidget::legendEntries() const
+{
+    if (m_currentLayer.startsWith("mrms")) {
+        return {{QColor("#4169E1"), "Light Rain"},
+                {QColor("#00FF00"), "Moderate Rain"},
+                {QColor("#FFFF00"), "Heavy Rain"},
+                {QColor("#FF8C00"), "Very Heavy"},
+                {QColor("#FF0000"), "Extreme"}};
+    }
+    return {{QColor("#4169E1"), "Light (0-20 dBZ)"},
+            {QColor("#00FF00"), "Moderate (20-35 dBZ)"},
+            {QColor("#FFFF00"), "Heavy (35-50 dBZ)"},
+            {QColor("#FF0000"), "Severe (50+ dBZ)"}};
+}
+
+void RadarWidget::loadRadarMap(RequestPriority priority)
+{
+    QString layerName = m_layerComboBox->currentText();
+    
+    if (m_mapView) {
+        // Tiles go through the dispatcher one by one, so there is nothing to
+        // admit up front and unchanged tiles are not fetched again. The centre
+        // is left alone, so a panned view survives layer changes.
+        Q_UNUSED(priority)
+        // IEM products update about every five minutes
+        m_mapView->setOverlayLayer({buildRadarUrl(), QString(), 0.7, 19, m_currentLayer, 300});
+        m_mapView->setZoom(m_zoomLevel);
+        m_mapView->setMarker(m_latitude, m_longitude, "Current Location");
+        if (!m_isAnimating) {
+            m_mapView->setLegend(layerName, legendEntries());
+            m_mapView->setStatusText(QString("Last Updated:\n%1").arg(QTime::currentTime().toString()));
+        }
+        
+        m_raster = WeatherRaster();
+        applyOverlay();
+        requestOverlay();
+        return;
+    }
+
+#ifdef DRONEVIEW_WEBENGINE
+    // Leaflet fetches the radar tiles itself, so the IEM bucket is charged
+    // one viewport worth of tiles before the page sees a change. The page is
+    // loaded once and later changes are pushed into it, so Leaflet only
+    // fetches the tiles they uncover. Changes made while one is queued are
+    // picked up when it is admitted.
+    Q_UNUSED(layerName)
+    if (!m_mapLoadPending) {
+        m_mapLoadPending = true;
+        NetworkDispatcher::instance()->admit(kIemHost, priority, this, [this]() {
+            m_mapLoadPending = false;
+            if (!m_pageRequested) {
+                m_pageRequested = true;
+                m_webView->setHtml(buildMapHtml());
+            } else if (m_pageReady) {
+                m_webView->page()->runJavaScript(QString("updateMap(%1);").arg(mapState()));
+            }
+            // While the page loads, loadFinished pushes the latest state
+        }, visibleTileCount());
     }
     
-    QString html = QString(R"(
+    // The view moved, so the raster no longer covers it
+    m_raster = WeatherRaster();
+    requestOverlay();
+#endif
+}
+
+#ifdef DRONEVIEW_WEBENGINE
+QString RadarWidget::mapState() const
+{
+    const QString layerName = m_layerComboBox->currentText().toHtmlEscaped();
+    QString legend = QString("<strong>%1</strong>").arg(layerName);
+    for (const auto &entry : legendEntries()) {
+        legend += QString("<br/><span style=\"color: %1;\">■</span> %2").arg(entry.first.name(), entry.second);
+    }
+    
+    const QJsonObject state{
+        {"latitude", m_latitude},
+        {"longitude", m_longitude},
+        {"zoom", m_zoomLevel},
+        {"radarUrl", buildRadarUrl()},
+        {"popup", QString("<strong>Current Location</strong><br/>%1 View").arg(layerName)},
+        {"legend", legend}
+    };
+    return QString::fromUtf8(QJsonDocument(state).toJson(QJsonDocument::Compact));
+}
+
+QString RadarWidget::buildMapHtml() const
+{
+    return QString(R"(
 <!DOCTYPE html>
 <html>
 <head>
@@ -210,7 +494,7 @@ void RadarWidget::loadRadarMap()
     <link rel="stylesheet" href="https://unpkg.com/leaflet@1.7.1/dist/leaflet.css" />
     <style>
         body { margin: 0; padding: 0; background: #1a1a1a; }
-        #map { height: 100vh; width: 100%%; }
+        #map { height: 100vh; width: 100%; }
         .legend {
             background: rgba(0,0,0,0.8);
             color: white;
@@ -235,7 +519,7 @@ void RadarWidget::loadRadarMap()
     <script>
         var map = L.map('map', {
             zoomControl: false
-        }).setView([%1, %2], %3);
+        });
         
         // Dark tile layer
         L.tileLayer('https://{s}.basemaps.cartocdn.com/dark_all/{z}/{x}/{y}{r}.png', {
@@ -244,51 +528,28 @@ void RadarWidget::loadRadarMap()
             maxZoom: 19
         }).addTo(map);
         
-        // Add IEM NEXRAD weather radar layer
-        var radarLayer = L.tileLayer('%4', {
-            attribution: 'Weather data courtesy of <a href="https://mesonet.agron.iastate.edu/">Iowa Environmental Mesonet</a> & NOAA',
-            opacity: 0.7,
-            maxZoom: 19
-        }).addTo(map);
+        // IEM NEXRAD radar layer and location marker, created by the first
+        // updateMap
+        var radarLayer = null;
+        var marker = null;
         
-        // Add location marker
-        var marker = L.marker([%1, %2]).addTo(map);
-        marker.bindPopup('<strong>Current Location</strong><br/>%5 View').openPopup();
+        // Interpolated weather field, replaced in place from the widget
+        var weatherOverlay = null;
+        function setWeatherOverlay(url, bounds) {
+            if (weatherOverlay) {
+                map.removeLayer(weatherOverlay);
+            }
+            weatherOverlay = url ? L.imageOverlay(url, bounds, {opacity: 0.8}).addTo(map) : null;
+        }
         
-        // Add legend based on radar type
+        // Legend, filled in by updateMap
+        var legendDiv = L.DomUtil.create('div', 'legend');
         var legend = L.control({position: 'bottomright'});
         legend.onAdd = function(map) {
-            var div = L.DomUtil.create('div', 'legend');
-            var layerType = '%6';
-            
-            if (layerType.includes('MRMS') || layerType.includes('Precip')) {
-                div.innerHTML = '<strong>%5</strong><br/>' +
-                               '<span style="color: #4169E1;">■</span> Light Rain<br/>' +
-                               '<span style="color: #00FF00;">■</span> Moderate Rain<br/>' +
-                               '<span style="color: #FFFF00;">■</span> Heavy Rain<br/>' +
-                               '<span style="color: #FF8C00;">■</span> Very Heavy<br/>' +
-                               '<span style="color: #FF0000;">■</span> Extreme';
-            } else if (layerType.includes('Velocity')) {
-                div.innerHTML = '<strong>%5</strong><br/>' +
-                               '<span style="color: #ff0000;">■</span> Away from radar<br/>' +
-                               '<span style="color: #00ff00;">■</span> Toward radar<br/>' +
-                               '<span style="color: #ffff00;">■</span> Turbulence';
-            } else {
-                div.innerHTML = '<strong>%5</strong><br/>' +
-                               '<span style="color: #4169E1;">■</span> Light (0-20 dBZ)<br/>' +
-                               '<span style="color: #00FF00;">■</span> Moderate (20-35 dBZ)<br/>' +
-                               '<span style="color: #FFFF00;">■</span> Heavy (35-50 dBZ)<br/>' +
-                               '<span style="color: #FF0000;">■</span> Severe (50+ dBZ)';
-            }
-            return div;
+            return legendDiv;
         };
         legend.addTo(map);
         
-        // Auto refresh radar data every 5 minutes
-        setInterval(function() {
-            radarLayer.redraw();
-        }, 300000);
-        
         // Add timestamp display
         var timestamp = L.control({position: 'topleft'});
         timestamp.onAdd = function(map) {
@@ -297,15 +558,228 @@ void RadarWidget::loadRadarMap()
             return div;
         };
         timestamp.addTo(map);
+        
+        // State pushed from the widget. Only what changed is touched, so the
+        // tiles already on screen stay.
+        function updateMap(state) {
+            var centre = L.latLng(state.latitude, state.longitude);
+            if (!map._loaded || !map.getCenter().equals(centre) || map.getZoom() !== state.zoom) {
+                map.setView(centre, state.zoom);
+            }
+            
+            if (!radarLayer) {
+                radarLayer = L.tileLayer(state.radarUrl, {
+                    attribution: 'Weather data courtesy of <a href="https://mesonet.agron.iastate.edu/">Iowa Environmental Mesonet</a> & NOAA',
+                    opacity: 0.7,
+                    maxZoom: 19
+                }).addTo(map);
+            } else if (radarLayer._url !== state.radarUrl) {
+                radarLayer.setUrl(state.radarUrl);
+            }
+            
+            if (!marker) {
+                marker = L.marker(centre).addTo(map);
+                marker.bindPopup(state.popup).openPopup();
+            } else {
+                marker.setLatLng(centre);
+                marker.setPopupContent(state.popup);
+            }
+            
+            legendDiv.innerHTML = state.legend;
+        }
+        
+        updateMap(%1);
     </script>
 </body>
 </html>
-    )").arg(m_latitude)
-       .arg(m_longitude)
-       .arg(m_zoomLevel)
-       .arg(baseUrl)
-       .arg(layerName)
-       .arg(m_currentLayer);
-    
-    m_webView->setHtml(html);
-}
\ No newline at end of file
+    )").arg(mapState());
+}
+#endif
+
+void RadarWidget::setWeatherRaster(const WeatherRaster &raster)
+{
+    m_raster = raster;
+    applyOverlay();
+}
+
+void RadarWidget::requestOverlay()
+{
+    if (m_overlayComboBox->currentData().toInt() < 0) {
+        return;
+    }
+    
+    int cellPixels = qMax(1, m_overlayCellPixels);
+    emit overlayRequested(visibleBounds(),
+                          qMax(1, mapView()->width() / cellPixels),
+                          qMax(1, mapView()->height() / cellPixels));
+}
+
+void RadarWidget::applyOverlay()
+{
+    int field = m_overlayComboBox->currentData().toInt();
+    if (m_mapView) {
+        bool visible = field >= 0 && !m_raster.isEmpty();
+        m_mapView->setImageOverlay(visible ? m_raster.toImage(RasterField(field)) : QImage(), m_raster.bounds);
+        return;
+    }
+
+#ifdef DRONEVIEW_WEBENGINE
+    if (field < 0 || m_raster.isEmpty()) {
+        m_webView->page()->runJavaScript("if (typeof setWeatherOverlay === 'function') setWeatherOverlay(null);");
+        return;
+    }
+    
+    QByteArray png;
+    QBuffer buffer(&png);
+    buffer.open(QIODevice::WriteOnly);
+    m_raster.toImage(RasterField(field)).save(&buffer, "PNG");
+    
+    const RasterBounds &bounds = m_raster.bounds;
+    m_webView->page()->runJavaScript(
+        QString("if (typeof setWeatherOverlay === 'function') "
+                "setWeatherOverlay('data:image/png;base64,%1', [[%2, %3], [%4, %5]]);")
+        .arg(QString::fromLatin1(png.toBase64()))
+        .arg(bounds.south, 0, 'f', 6).arg(bounds.west, 0, 'f', 6)
+        .arg(bounds.north, 0, 'f', 6).arg(bounds.east, 0, 'f', 6));
+#endif
+}
+
+RasterBounds RadarWidget::visibleBounds() const
+{
+    if (m_mapView) {
+        return m_mapView->visibleBounds();
+    }
+    
+    // Web Mercator pixel space of the current zoom, 256 px per tile
+    const double worldSize = 256.0 * qPow(2.0, m_zoomLevel);
+    const double centreX = (m_longitude + 180.0) / 360.0 * worldSize;
+    const double sinLatitude = qSin(qDegreesToRadians(m_latitude));
+    const double centreY = (0.5 - qLn((1.0 + sinLatitude) / (1.0 - sinLatitude)) / (4.0 * M_PI)) * worldSize;
+    
+    auto latitudeAt = [worldSize](double y) {
+        const double n = M_PI * (1.0 - 2.0 * y / worldSize);
+        return qRadiansToDegrees(qAtan(std::sinh(n)));
+    };
+    
+    RasterBounds bounds;
+    bounds.west = (centreX - mapView()->width() / 2.0) / worldSize * 360.0 - 180.0;
+    bounds.east = (centreX + mapView()->width() / 2.0) / worldSize * 360.0 - 180.0;
+    bounds.north = latitudeAt(centreY - mapView()->height() / 2.0);
+    bounds.south = latitudeAt(centreY + mapView()->height() / 2.0);
+    return bounds;
+}
+
+void RadarWidget::redrawRadarLayer()
+{
+    if (m_mapView) {
+        // A running loop picks up new scans itself
+        if (!m_isAnimating) {
+            m_mapView->reloadOverlay();
+            m_mapView->setStatusText(QString("Last Updated:\n%1").arg(QTime::currentTime().toString()));
+        }
+        return;
+    }
+
+#ifdef DRONEVIEW_WEBENGINE
+    NetworkDispatcher::instance()->admit(kIemHost, RequestPriority::Background, this, [this]() {
+        m_webView->page()->runJavaScript("if (radarLayer) radarLayer.redraw();");
+    }, visibleTileCount());
+#endif
+}
+
+double RadarWidget::visibleTileCount() const
+{
+    if (m_mapView) {
+        return m_mapView->visibleTileCount();
+    }
+    
+    // 256 px tiles plus the partial ring Leaflet keeps around the viewport
+    int columns = mapView()->width() / 256 + 2;
+    int rows = mapView()->height() / 256 + 2;
+    return double(columns * rows);
+}
+
+QList<TileFrame> RadarWidget::loopFrames(qint64 slot)
+{
+    // IEM's archived composites are named by scan time, so a frame's tiles
+    // never change once published and its label is the scan it shows
+    QList<TileFrame> frames;
+    for (int age = kLoopFrames - 1; age >= 0; --age) {
+        TileFrame frame;
+        frame.validTime = slot - qint64(age) * kScanSeconds;
+        frame.urlTemplate = QString("https://mesonet.agron.iastate.edu/cache/tile.py/1.0.0/ridge::USCOMP-N0Q-%1/{z}/{x}/{y}.png")
+            .arg(QDateTime::fromSecsSinceEpoch(frame.validTime, Qt::UTC).toString("yyyyMMddHHmm"));
+        frames.append(frame);
+    }
+    return frames;
+}
+
+void RadarWidget::startAnimation()
+{
+    if (!m_mapView) {
+        return;
+    }
+    
+    m_isAnimating = true;
+    m_loopSlot = newestLoopSlot();
+    m_loopPosition = 0.0;
+    m_loopReady = false;
+    m_mapView->setLegend("NEXRAD Loop", {{QColor("#4169E1"), "Light (0-20 dBZ)"},
+                                         {QColor("#00FF00"), "Moderate (20-35 dBZ)"},
+                                         {QColor("#FFFF00"), "Heavy (35-50 dBZ)"},
+                                         {QColor("#FF0000"), "Severe (50+ dBZ)"}});
+    m_mapView->setFramePosition(0.0);
+    m_mapView->setFrames(loopStyle(), loopFrames(m_loopSlot));
+    m_animationClock.start();
+    m_animationTimer->start();
+}
+
+void RadarWidget::stopAnimation()
+{
+    m_animationTimer->stop();
+    m_isAnimating = false;
+    if (m_mapView) {
+        m_mapView->setFrames(TileLayer(), {});
+        loadRadarMap();
+    }
+}
+
+void RadarWidget::advanceAnimation()
+{
+    const qint64 elapsed = m_animationClock.restart();
+    
+    // A new composite shifts the loop by one frame: the frames it shares
+    // with the old loop keep their tiles and only the newest is fetched.
+    // Until that one has loaded, playback stops a frame short.
+    const qint64 slot = newestLoopSlot();
+    if (slot != m_loopSlot) {
+        const int steps = int((slot - m_loopSlot) / kScanSeconds);
+        m_loopSlot = slot;
+        m_loopPosition = qMax(0.0, m_loopPosition - steps);
+        // After a long gap (a suspended tablet) nothing is shared; load afresh
+        if (steps >= kLoopFrames) {
+            m_loopReady = false;
+        }
+        m_mapView->setFrames(loopStyle(), loopFrames(slot));
+    }
+    if (!m_loopReady) {
+        return;
+    }
+    
+    int last = m_mapView->frameCount() - 1;
+    if (last > 0 && !m_mapView->isFrameLoaded(last)) {
+        last--;
+    }
+    
+    // Time, not ticks, moves the loop, so a late tick does not slow it down
+    m_loopPosition += double(elapsed) / kFrameMs;
+    if (m_loopPosition >= last + double(kDwellMs) / kFrameMs) {
+        m_loopPosition = 0.0;
+    }
+    const double position = qMin(m_loopPosition, double(last));
+    m_mapView->setFramePosition(position);
+    
+    const int age = m_mapView->frameCount() - 1 - int(position + 0.5);
+    const QDateTime shown = QDateTime::fromSecsSinceEpoch(m_loopSlot - qint64(age) * kScanSeconds, Qt::UTC);
+    m_mapView->setStatusText(QString("Radar Loop\n%1").arg(shown.toString("HH:mm 'UTC'")));
+}
@@ -4,11 +4,21 @@
 #include <QVBoxLayout>
 #include <QHBoxLayout>
 #include <QLabel>
-#include <QWebEngineView>
 #include <QGroupBox>
 #include <QPushButton>
 #include <QComboBox>
 #include <QSlider>
+#include <QTimer>
+#include <QColor>
+#include <QElapsedTimer>
+#include "../networkdispatcher.h"
+#include "../weatherraster.h"
+
+class TileMapWidget;
+struct TileFrame;
+#ifdef DRONEVIEW_WEBENGINE
+class QWebEngineView;
+#endif
 
 class RadarWidget : public QWidget
 {
@@ -20,23 +30,58 @@ public:
 public slots:
     void updateLocation(double latitude, double longitude);
     void refreshRadarData();
+    // Drawn over the radar as the field picked in the overlay selector
+    void setWeatherRaster(const WeatherRaster &raster);
+    // Emits overlayRequested for the visible map while an overlay is picked
+    void requestOverlay();
+
+signals:
+    // The overlay needs a raster of the visible map at this many cells
+    void overlayRequested(const RasterBounds &bounds, int width, int height);
+
+protected:
+    bool eventFilter(QObject *watched, QEvent *event) override;
 
 private slots:
     void onLayerChanged();
     void onZoomChanged();
     void onTimeChanged();
+    void onOverlayChanged();
+    void advanceAnimation();
 
 private:
     void setupUI();
-    void loadRadarMap();
+    void loadRadarMap(RequestPriority priority = RequestPriority::Interactive);
+    void redrawRadarLayer();
     QString buildRadarUrl() const;
+    QList<QPair<QColor, QString>> legendEntries() const;
+    // The native map, or the web view when radar/renderer is "web"
+    QWidget *mapView() const;
+#ifdef DRONEVIEW_WEBENGINE
+    // Loaded once; updateMap(mapState()) moves it to the widget's state
+    QString buildMapHtml() const;
+    QString mapState() const;
+#endif
+    double visibleTileCount() const;
+    RasterBounds visibleBounds() const;
+    void applyOverlay();
+    // The loop of time-stamped NEXRAD composites ending at the scan slot
+    void startAnimation();
+    void stopAnimation();
+    static QList<TileFrame> loopFrames(qint64 slot);
+    // Logs the time from construction to the first drawn map, once
+    void reportStartup();
     
     QVBoxLayout *m_mainLayout;
     QGroupBox *m_radarGroup;
+    TileMapWidget *m_mapView;
+#ifdef DRONEVIEW_WEBENGINE
     QWebEngineView *m_webView;
-    
+#endif
+
     QHBoxLayout *m_controlsLayout;
     QComboBox *m_layerComboBox;
+    QComboBox *m_overlayComboBox;
     QSlider *m_zoomSlider;
     QSlider *m_timeSlider;
     QLabel *m_zoomLabel;
@@ -49,4 +94,21 @@ private:
     int m_zoomLevel;
     QString m_currentLayer;
     bool m_isAnimating;
+    QTimer *m_animationTimer;
+    QElapsedTimer m_animationClock;
+    QElapsedTimer m_startupClock;
+    qint64 m_loopSlot;      // UTC seconds of the newest frame's scan
+    double m_loopPosition;  // frames from the oldest, past the end while dwelling
+    bool m_loopReady;       // every frame was loaded once
+    
+    QTimer *m_radarRefreshTimer;
+    QTimer *m_zoomTimer;
+#ifdef DRONEVIEW_WEBENGINE
+    bool m_mapLoadPending;
+    bool m_pageRequested;
+    bool m_pageReady;
+#endif
+
+    WeatherRaster m_raster;
+    int m_overlayCellPixels;
 };
\ No newline at end of file
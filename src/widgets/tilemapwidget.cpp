@@ -0,0 +1,715 @@
+#include "tilemapwidget.h"
+#include "../networkdispatcher.h"
+#include <QtConcurrent>
+#include <QPainter>
+#include <QMouseEvent>
+#include <QWheelEvent>
+#include <QTimer>
+#include <QSet>
+#include <QtMath>
+#include <cmath>
+
+namespace {
+
+// Web Mercator stops short of the poles
+const double kMaxLatitude = 85.05112878;
+
+// Decoded tiles kept for panning back and for ancestor fallbacks
+const int kTileCacheKiB = 96 * 1024;
+const int kTileKiB = 256; // one decoded 256 px ARGB tile
+
+int wrapTile(int x, int count)
+{
+    return ((x % count) + count) % count;
+}
+
+} // namespace
+
+TileMapWidget::TileMapWidget(QWidget *parent)
+    : QWidget(parent)
+    , m_latitude(0.0)
+    , m_longitude(0.0)
+    , m_zoom(8)
+    , m_generation{0, 0}
+    , m_previousGeneration{0, 0}
+    , m_tiles(kTileCacheKiB)
+    , m_framePosition(0.0)
+    , m_hasMarker(false)
+    , m_markerLatitude(0.0)
+    , m_markerLongitude(0.0)
+    , m_dragging(false)
+    , m_settleTimer(new QTimer(this))
+{
+    setMouseTracking(false);
+    setCursor(Qt::OpenHandCursor);
+    setAttribute(Qt::WA_OpaquePaintEvent);
+    
+    m_settleTimer->setSingleShot(true);
+    m_settleTimer->setInterval(300);
+    connect(m_settleTimer, &QTimer::timeout, this, &TileMapWidget::viewChanged);
+}
+
+void TileMapWidget::setCenter(double latitude, double longitude)
+{
+    m_latitude = qBound(-kMaxLatitude, latitude, kMaxLatitude);
+    m_longitude = longitude;
+    requestVisibleTiles();
+    update();
+}
+
+void TileMapWidget::setZoom(int zoom)
+{
+    zoom = qBound(kMinZoom, zoom, kMaxZoom);
+    if (zoom == m_zoom) {
+        return;
+    }
+    m_zoom = zoom;
+    requestVisibleTiles();
+    update();
+}
+
+void TileMapWidget::setBaseLayer(const TileLayer &layer)
+{
+    m_layers[Base] = layer;
+    m_previousGeneration[Base] = ++m_generation[Base];
+    requestVisibleTiles();
+    update();
+}
+
+void TileMapWidget::setOverlayLayer(const TileLayer &layer)
+{
+    if (layer.urlTemplate == m_layers[Overlay].urlTemplate) {
+        m_layers[Overlay].opacity = layer.opacity;
+        update();
+        return;
+    }
+    // A different product: nothing of the old one should show through
+    m_layers[Overlay] = layer;
+    m_previousGeneration[Overlay] = ++m_generation[Overlay];
+    requestVisibleTiles();
+    update();
+}
+
+void TileMapWidget::reloadOverlay()
+{
+    m_previousGeneration[Overlay] = m_generation[Overlay]++;
+    requestVisibleTiles();
+}
+
+void TileMapWidget::setFrames(const TileLayer &style, const QList<TileFrame> &frames)
+{
+    m_frameStyle = style;
+    m_frames = frames;
+    m_framePosition = qBound(0.0, m_framePosition, qMax(0.0, double(frames.size() - 1)));
+    requestVisibleTiles();
+    reportFrameProgress();
+    update();
+}
+
+void TileMapWidget::setFramePosition(double position)
+{
+    m_framePosition = qBound(0.0, position, qMax(0.0, double(m_frames.size() - 1)));
+    update();
+}
+
+bool TileMapWidget::isFrameLoaded(int index) const
+{
+    const quint32 generation = quint32(m_frames.value(index).validTime / 60);
+    for (auto it = m_pending.cbegin(); it != m_pending.cend(); ++it) {
+        if (it.key().layer == Frames && it.key().generation == generation) {
+            return false;
+        }
+    }
+    return index >= 0 && index < m_frames.size();
+}
+
+void TileMapWidget::reportFrameProgress()
+{
+    if (m_frames.isEmpty()) {
+        return;
+    }
+    
+    int pending = 0;
+    for (auto it = m_pending.cbegin(); it != m_pending.cend(); ++it) {
+        pending += it.key().layer == Frames;
+    }
+    const int total = m_frames.size() * visibleTileCount();
+    emit framesProgress(qMax(0, total - pending), total);
+}
+
+void TileMapWidget::setMarker(double latitude, double longitude, const QString &label)
+{
+    m_hasMarker = true;
+    m_markerLatitude = latitude;
+    m_markerLongitude = longitude;
+    m_markerLabel = label;
+    update();
+}
+
+void TileMapWidget::setLegend(const QString &title, const QList<QPair<QColor, QString>> &entries)
+{
+    m_legendTitle = title;
+    m_legend = entries;
+    update();
+}
+
+void TileMapWidget::setStatusText(const QString &text)
+{
+    m_statusText = text;
+    update();
+}
+
+void TileMapWidget::setAttribution(const QString &text)
+{
+    m_attribution = text;
+    update();
+}
+
+void TileMapWidget::setImageOverlay(const QImage &image, const RasterBounds &bounds)
+{
+    m_image = image;
+    m_imageBounds = bounds;
+    update();
+}
+
+QPointF TileMapWidget::project(double latitude, double longitude) const
+{
+    const double worldSize = double(kTileSize) * (1 << m_zoom);
+    const double sinLatitude = qSin(qDegreesToRadians(qBound(-kMaxLatitude, latitude, kMaxLatitude)));
+    return QPointF((longitude + 180.0) / 360.0 * worldSize,
+                   (0.5 - qLn((1.0 + sinLatitude) / (1.0 - sinLatitude)) / (4.0 * M_PI)) * worldSize);
+}
+
+void TileMapWidget::unproject(const QPointF &point, double &latitude, double &longitude) const
+{
+    const double worldSize = double(kTileSize) * (1 << m_zoom);
+    longitude = point.x() / worldSize * 360.0 - 180.0;
+    latitude = qRadiansToDegrees(qAtan(std::sinh(M_PI * (1.0 - 2.0 * point.y() / worldSize))));
+}
+
+QPointF TileMapWidget::topLeft() const
+{
+    return project(m_latitude, m_longitude) - QPointF(width() / 2.0, height() / 2.0);
+}
+
+RasterBounds TileMapWidget::visibleBounds() const
+{
+    const QPointF origin = topLeft();
+    RasterBounds bounds;
+    unproject(origin, bounds.north, bounds.west);
+    unproject(origin + QPointF(width(), height()), bounds.south, bounds.east);
+    return bounds;
+}
+
+int TileMapWidget::visibleTileCount() const
+{
+    const QRect tiles = visibleTiles();
+    return tiles.isValid() ? tiles.width() * tiles.height() : 0;
+}
+
+QRect TileMapWidget::visibleTiles() const
+{
+    const int count = 1 << m_zoom;
+    const QPointF origin = topLeft();
+    return QRect(QPoint(int(std::floor(origin.x() / kTileSize)),
+                        qMax(0, int(std::floor(origin.y() / kTileSize)))),
+                 QPoint(int(std::floor((origin.x() + width() - 1) / kTileSize)),
+                        qMin(count - 1, int(std::floor((origin.y() + height() - 1) / kTileSize)))));
+}
+
+void TileMapWidget::requestVisibleTiles()
+{
+    if (width() <= 0 || height() <= 0) {
+        return;
+    }
+    
+    const int count = 1 << m_zoom;
+    const QRect visible = visibleTiles();
+    QList<TileKey> wanted;
+    QList<TileKey> prefetch;
+    for (quint8 layer : {Base, Overlay}) {
+        const TileLayer &source = m_layers[layer];
+        if (source.isEmpty() || m_zoom > source.maxZoom || (layer == Overlay && !m_frames.isEmpty())) {
+            continue;
+        }
+        const quint32 generation = m_generation[layer];
+        for (int row = qMax(0, visible.top() - 1); row <= qMin(count - 1, visible.bottom() + 1); ++row) {
+            for (int column = visible.left() - 1; column <= visible.right() + 1; ++column) {
+                const TileKey key{layer, quint8(m_zoom), generation, wrapTile(column, count), row};
+                (visible.contains(column, row) ? wanted : prefetch).append(key);
+            }
+        }
+        if (m_zoom < qMin<int>(kMaxZoom, source.maxZoom)) {
+            for (int row = visible.top() * 2; row <= visible.bottom() * 2 + 1; ++row) {
+                for (int column = visible.left() * 2; column <= visible.right() * 2 + 1; ++column) {
+                    prefetch.append({layer, quint8(m_zoom + 1), generation, wrapTile(column, count * 2), row});
+                }
+            }
+        }
+    }
+    
+    // Centre tiles first, so the middle of the view fills in before the edges
+    const QPointF centre = topLeft() + QPointF(width() / 2.0, height() / 2.0);
+    auto distance = [centre](const TileKey &key) {
+        return std::hypot((key.x + 0.5) * kTileSize - centre.x(), (key.y + 0.5) * kTileSize - centre.y());
+    };
+    std::stable_sort(wanted.begin(), wanted.end(), [&distance](const TileKey &a, const TileKey &b) {
+        return a.layer != b.layer ? a.layer < b.layer : distance(a) < distance(b);
+    });
+    
+    // Every frame of a loop is wanted before playback, oldest first, with
+    // room in memory for all of them on top of the usual tiles
+    QList<TileKey> frames;
+    if (!m_frames.isEmpty() && m_zoom <= m_frameStyle.maxZoom) {
+        for (const TileFrame &frame : std::as_const(m_frames)) {
+            for (int row = visible.top(); row <= visible.bottom(); ++row) {
+                for (int column = visible.left(); column <= visible.right(); ++column) {
+                    frames.append({Frames, quint8(m_zoom), quint32(frame.validTime / 60), wrapTile(column, count), row});
+                }
+            }
+        }
+    }
+    m_tiles.setMaxCost(kTileCacheKiB + frames.size() * kTileKiB);
+    
+    // Requests for tiles the view has left only hold up the ones it needs
+    QSet<TileKey> keep(wanted.cbegin(), wanted.cend());
+    keep.unite(QSet<TileKey>(prefetch.cbegin(), prefetch.cend()));
+    keep.unite(QSet<TileKey>(frames.cbegin(), frames.cend()));
+    for (auto it = m_pending.begin(); it != m_pending.end();) {
+        if (!keep.contains(it.key())) {
+            if (it.value() != 0) {
+                NetworkDispatcher::instance()->abort(it.value());
+            }
+            it = m_pending.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    
+    for (const TileKey &key : wanted) {
+        if (!m_tiles.contains(key) && !m_pending.contains(key)) {
+            requestTile(key, RequestPriority::Interactive);
+        }
+    }
+    for (const TileKey &key : frames) {
+        if (!m_tiles.contains(key) && !m_pending.contains(key)) {
+            requestTile(key, RequestPriority::Normal);
+        }
+    }
+    for (const TileKey &key : prefetch) {
+        if (!m_tiles.contains(key) && !m_pending.contains(key)) {
+            requestTile(key, RequestPriority::Background);
+        }
+    }
+    reportFrameProgress();
+}
+
+TileLayer TileMapWidget::layerFor(const TileKey &key) const
+{
+    if (key.layer != Frames) {
+        return m_layers[key.layer];
+    }
+    
+    TileLayer layer = m_frameStyle;
+    layer.refreshSeconds = 0;
+    layer.urlTemplate.clear();
+    for (const TileFrame &frame : m_frames) {
+        if (quint32(frame.validTime / 60) == key.generation) {
+            layer.urlTemplate = frame.urlTemplate;
+            break;
+        }
+    }
+    return layer;
+}
+
+TileCacheKey TileMapWidget::cacheKey(const TileKey &key) const
+{
+    const TileLayer layer = layerFor(key);
+    TileCacheKey diskKey;
+    diskKey.layer = layer.cacheId;
+    diskKey.zoom = key.zoom;
+    diskKey.x = key.x;
+    diskKey.y = key.y;
+    if (key.layer == Frames) {
+        diskKey.validTime = qint64(key.generation) * 60;
+    } else if (layer.refreshSeconds > 0) {
+        const qint64 now = QDateTime::currentSecsSinceEpoch();
+        diskKey.validTime = now - now % layer.refreshSeconds;
+    }
+    return diskKey;
+}
+
+void TileMapWidget::requestTile(const TileKey &key, RequestPriority priority)
+{
+    if (layerFor(key).cacheId.isEmpty()) {
+        fetchTile(key, TileCacheKey(), QByteArray(), priority);
+        return;
+    }
+    
+    const TileCacheKey diskKey = cacheKey(key);
+    m_pending.insert(key, 0);
+    TileCache::instance()->find(diskKey).then(this, [this, key, diskKey, priority](const CachedTile &tile) {
+        auto it = m_pending.find(key);
+        if (it == m_pending.end() || it.value() != 0) {
+            return; // left the view while on disk
+        }
+        if (!tile.isNull()) {
+            decodeTile(key, tile.data);
+        }
+        if (tile.isFresh()) {
+            return; // settled once decoded
+        }
+        if (tile.isNull() && key.layer == Frames && layerFor(key).urlTemplate.isEmpty()) {
+            m_pending.erase(it);
+            reportFrameProgress();
+            return; // dropped from the loop while on disk
+        }
+        // Stale tiles stay on screen while the server is asked whether they changed
+        fetchTile(key, diskKey, tile.etag, priority);
+    });
+}
+
+void TileMapWidget::fetchTile(const TileKey &key, const TileCacheKey &diskKey, const QByteArray &etag,
+                              RequestPriority priority)
+{
+    const TileLayer layer = layerFor(key);
+    QNetworkRequest request(QUrl(tileUrl(layer, key)));
+    request.setHeader(QNetworkRequest::UserAgentHeader, "DroneView/1.0 (contact@droneview.app)");
+    if (!etag.isEmpty()) {
+        request.setRawHeader("If-None-Match", etag);
+    }
+    
+    const int refreshSeconds = layer.refreshSeconds;
+    quint64 requestId = NetworkDispatcher::instance()->get(request, priority, this,
+        [this, key, diskKey, refreshSeconds](const NetworkResponse &response) {
+            // Decoding keeps the tile pending, so a loop only starts on tiles it can draw
+            auto it = m_pending.find(key);
+            const bool current = it != m_pending.end() && it.value() == response.requestId;
+            if (current) {
+                if (response.ok() && response.httpStatus != 304) {
+                    it.value() = 0;
+                } else {
+                    m_pending.erase(it);
+                    if (key.layer == Frames) {
+                        reportFrameProgress();
+                    }
+                }
+            }
+            if (!response.ok()) {
+                return; // asked for again when the view next moves
+            }
+            
+            if (!diskKey.layer.isEmpty()) {
+                // Scheduled layers are good until the next scan, others for a week
+                // unless the server says otherwise
+                const QDateTime fallback = refreshSeconds > 0
+                    ? QDateTime::fromSecsSinceEpoch(diskKey.validTime + refreshSeconds, Qt::UTC)
+                    : QDateTime::currentDateTimeUtc().addDays(7);
+                const QDateTime expires = TileCache::expiry(response.headers, fallback);
+                if (response.httpStatus == 304) {
+                    TileCache::instance()->revalidated(diskKey, expires);
+                    return;
+                }
+                TileCache::instance()->store(diskKey, response.body, TileCache::etag(response.headers), expires);
+            }
+            decodeTile(key, response.body);
+        });
+    m_pending.insert(key, requestId);
+}
+
+void TileMapWidget::decodeTile(const TileKey &key, const QByteArray &data)
+{
+    // PNG decoding stays off the GUI thread. A stale tile from disk and its
+    // refetch may both be decoding; only the newer one may land.
+    m_decoding.take(key).cancel();
+    QFuture<QImage> decoded = QtConcurrent::run([data]() {
+        QImage image = QImage::fromData(data);
+        return image.isNull() ? image : image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    });
+    m_decoding.insert(key, decoded);
+    
+    decoded.then(this, [this, key](const QImage &image) {
+        m_decoding.remove(key);
+        if (!image.isNull()) {
+            m_tiles.insert(key, new QImage(image), qMax<qsizetype>(1, image.sizeInBytes() / 1024));
+            update();
+        }
+        
+        // A stale tile decoded while its refetch is in flight leaves it pending
+        auto it = m_pending.find(key);
+        if (it != m_pending.end() && it.value() == 0) {
+            m_pending.erase(it);
+            if (key.layer == Frames) {
+                reportFrameProgress();
+            }
+        }
+    });
+}
+
+QString TileMapWidget::tileUrl(const TileLayer &layer, const TileKey &key) const
+{
+    QString url = layer.urlTemplate;
+    url.replace("{z}", QString::number(key.zoom))
+       .replace("{x}", QString::number(key.x))
+       .replace("{y}", QString::number(key.y))
+       .replace("{r}", QString());
+    if (!layer.subdomains.isEmpty()) {
+        url.replace("{s}", QString(layer.subdomains[(key.x + key.y) % layer.subdomains.size()]));
+    }
+    return url;
+}
+
+const QImage *TileMapWidget::findTile(const TileKey &key, QRectF &source) const
+{
+    // Frames fall back to their own ancestors only, never to another scan
+    const quint32 generations[] = {key.generation, key.layer == Frames ? key.generation : m_previousGeneration[key.layer]};
+    for (int up = 0; up <= 4 && key.zoom - up >= 0; ++up) {
+        TileKey ancestor = key;
+        ancestor.zoom = quint8(key.zoom - up);
+        ancestor.x = key.x >> up;
+        ancestor.y = key.y >> up;
+        for (quint32 generation : generations) {
+            ancestor.generation = generation;
+            if (const QImage *image = m_tiles.object(ancestor)) {
+                // The part of the ancestor over this tile, in its own pixels
+                const double size = double(image->width()) / (1 << up);
+                source = QRectF((key.x - (ancestor.x << up)) * size, (key.y - (ancestor.y << up)) * size, size, size);
+                return image;
+            }
+            if (generations[0] == generations[1]) {
+                break;
+            }
+        }
+    }
+    return nullptr;
+}
+
+void TileMapWidget::paintEvent(QPaintEvent *event)
+{
+    Q_UNUSED(event)
+    
+    QPainter painter(this);
+    painter.fillRect(rect(), QColor(26, 26, 26)); // #1a1a1a
+    
+    drawLayer(painter, Base);
+    if (m_frames.isEmpty()) {
+        drawLayer(painter, Overlay);
+    } else if (m_zoom <= m_frameStyle.maxZoom) {
+        const int frame = int(m_framePosition);
+        const double fade = m_framePosition - frame;
+        drawTiles(painter, Frames, quint32(m_frames[frame].validTime / 60), m_frameStyle.opacity * (1.0 - fade));
+        if (fade > 0.0 && frame + 1 < m_frames.size()) {
+            drawTiles(painter, Frames, quint32(m_frames[frame + 1].validTime / 60), m_frameStyle.opacity * fade);
+        }
+    }
+    
+    if (!m_image.isNull() && m_imageBounds.isValid()) {
+        const QPointF origin = topLeft();
+        const QRectF target(project(m_imageBounds.north, m_imageBounds.west) - origin,
+                            project(m_imageBounds.south, m_imageBounds.east) - origin);
+        painter.setOpacity(0.8);
+        painter.setRenderHint(QPainter::SmoothPixmapTransform);
+        painter.drawImage(target, m_image);
+        painter.setRenderHint(QPainter::SmoothPixmapTransform, false);
+        painter.setOpacity(1.0);
+    }
+    
+    painter.setRenderHint(QPainter::Antialiasing);
+    drawMarker(painter);
+    drawLegend(painter);
+}
+
+void TileMapWidget::drawLayer(QPainter &painter, Layer layer)
+{
+    if (m_layers[layer].isEmpty() || m_zoom > m_layers[layer].maxZoom) {
+        return;
+    }
+    drawTiles(painter, layer, m_generation[layer], m_layers[layer].opacity);
+}
+
+void TileMapWidget::drawTiles(QPainter &painter, quint8 layer, quint32 generation, double opacity)
+{
+    const int count = 1 << m_zoom;
+    const QPointF origin = topLeft();
+    const QRect tiles = visibleTiles();
+    
+    painter.setOpacity(opacity);
+    for (int row = tiles.top(); row <= tiles.bottom(); ++row) {
+        for (int column = tiles.left(); column <= tiles.right(); ++column) {
+            const TileKey key{layer, quint8(m_zoom), generation, wrapTile(column, count), row};
+            QRectF source;
+            if (const QImage *image = findTile(key, source)) {
+                // Unwrapped column, so the map repeats across the antimeridian
+                const QRectF target(column * kTileSize - origin.x(), row * kTileSize - origin.y(), kTileSize, kTileSize);
+                painter.drawImage(target, *image, source);
+            }
+        }
+    }
+    painter.setOpacity(1.0);
+}
+
+void TileMapWidget::drawMarker(QPainter &painter)
+{
+    if (!m_hasMarker) {
+        return;
+    }
+    
+    const QPointF point = project(m_markerLatitude, m_markerLongitude) - topLeft();
+    painter.setPen(QPen(Qt::white, 2));
+    painter.setBrush(QColor(102, 204, 255)); // #66ccff
+    painter.drawEllipse(point, 7, 7);
+    
+    if (m_markerLabel.isEmpty()) {
+        return;
+    }
+    QFont font = painter.font();
+    font.setPointSize(9);
+    font.setBold(true);
+    painter.setFont(font);
+    const QRectF text = painter.fontMetrics().boundingRect(m_markerLabel).adjusted(-6, -3, 6, 3);
+    const QRectF box = text.translated(point - QPointF(text.width() / 2.0, text.height() + 12) - text.topLeft());
+    painter.setPen(Qt::NoPen);
+    painter.setBrush(QColor(0, 0, 0, 200));
+    painter.drawRoundedRect(box, 4, 4);
+    painter.setPen(Qt::white);
+    painter.drawText(box, Qt::AlignCenter, m_markerLabel);
+}
+
+void TileMapWidget::drawLegend(QPainter &painter)
+{
+    QFont font = painter.font();
+    font.setPointSize(9);
+    font.setBold(false);
+    painter.setFont(font);
+    const QFontMetrics metrics = painter.fontMetrics();
+    const int lineHeight = metrics.height() + 2;
+    const int margin = 10;
+    
+    auto panel = [&painter](const QRectF &box) {
+        painter.setPen(Qt::NoPen);
+        painter.setBrush(QColor(0, 0, 0, 200));
+        painter.drawRoundedRect(box, 5, 5);
+    };
+    
+    if (!m_legend.isEmpty()) {
+        int textWidth = metrics.horizontalAdvance(m_legendTitle);
+        for (const auto &entry : m_legend) {
+            textWidth = qMax(textWidth, metrics.horizontalAdvance(entry.second) + lineHeight);
+        }
+        const QRectF box(width() - textWidth - 3 * margin, height() - (m_legend.size() + 1) * lineHeight - 3 * margin,
+                         textWidth + 2 * margin, (m_legend.size() + 1) * lineHeight + margin);
+        panel(box);
+        
+        QPointF position = box.topLeft() + QPointF(margin, margin / 2.0);
+        QFont bold = font;
+        bold.setBold(true);
+        painter.setFont(bold);
+        painter.setPen(Qt::white);
+        painter.drawText(QRectF(position, QSizeF(textWidth, lineHeight)), Qt::AlignVCenter, m_legendTitle);
+        painter.setFont(font);
+        for (const auto &entry : m_legend) {
+            position.ry() += lineHeight;
+            painter.fillRect(QRectF(position + QPointF(0, 3), QSizeF(lineHeight - 6, lineHeight - 6)), entry.first);
+            painter.drawText(QRectF(position + QPointF(lineHeight, 0), QSizeF(textWidth, lineHeight)),
+                             Qt::AlignVCenter, entry.second);
+        }
+    }
+    
+    if (!m_statusText.isEmpty()) {
+        const QRectF text = metrics.boundingRect(QRect(0, 0, width() / 2, height()), Qt::TextWordWrap, m_statusText);
+        const QRectF box(margin, margin, text.width() + 2 * margin, text.height() + margin);
+        panel(box);
+        painter.setPen(Qt::white);
+        painter.drawText(box.adjusted(margin, margin / 2.0, -margin, 0), Qt::TextWordWrap, m_statusText);
+    }
+    
+    if (!m_attribution.isEmpty()) {
+        font.setPointSize(7);
+        painter.setFont(font);
+        const QRectF text = painter.fontMetrics().boundingRect(m_attribution).adjusted(-4, -2, 4, 2);
+        const QRectF box(0, height() - text.height(), text.width(), text.height());
+        painter.setPen(Qt::NoPen);
+        painter.setBrush(QColor(0, 0, 0, 180));
+        painter.drawRect(box);
+        painter.setPen(QColor(224, 224, 224));
+        painter.drawText(box, Qt::AlignCenter, m_attribution);
+    }
+}
+
+void TileMapWidget::resizeEvent(QResizeEvent *event)
+{
+    QWidget::resizeEvent(event);
+    requestVisibleTiles();
+    m_settleTimer->start();
+}
+
+void TileMapWidget::mousePressEvent(QMouseEvent *event)
+{
+    if (event->button() == Qt::LeftButton) {
+        m_dragging = true;
+        m_lastMouse = event->position().toPoint();
+        setCursor(Qt::ClosedHandCursor);
+    }
+}
+
+void TileMapWidget::mouseMoveEvent(QMouseEvent *event)
+{
+    if (!m_dragging) {
+        return;
+    }
+    
+    const QPoint position = event->position().toPoint();
+    const QPointF centre = project(m_latitude, m_longitude) - QPointF(position - m_lastMouse);
+    m_lastMouse = position;
+    double latitude, longitude;
+    unproject(centre, latitude, longitude);
+    m_latitude = qBound(-kMaxLatitude, latitude, kMaxLatitude);
+    m_longitude = std::remainder(longitude, 360.0);
+    requestVisibleTiles();
+    update();
+}
+
+void TileMapWidget::mouseReleaseEvent(QMouseEvent *event)
+{
+    if (event->button() == Qt::LeftButton && m_dragging) {
+        m_dragging = false;
+        setCursor(Qt::OpenHandCursor);
+        m_settleTimer->start();
+    }
+}
+
+void TileMapWidget::mouseDoubleClickEvent(QMouseEvent *event)
+{
+    zoomAround(m_zoom + (event->modifiers() & Qt::ShiftModifier ? -1 : 1), event->position());
+}
+
+void TileMapWidget::wheelEvent(QWheelEvent *event)
+{
+    const int steps = event->angleDelta().y() / 120;
+    if (steps != 0) {
+        zoomAround(m_zoom + steps, event->position());
+    }
+    event->accept();
+}
+
+void TileMapWidget::zoomAround(int zoom, const QPointF &anchor)
+{
+    zoom = qBound(kMinZoom, zoom, kMaxZoom);
+    if (zoom == m_zoom) {
+        return;
+    }
+    
+    // Keep the point under the cursor where it is
+    double latitude, longitude;
+    unproject(topLeft() + anchor, latitude, longitude);
+    m_zoom = zoom;
+    const QPointF centre = project(latitude, longitude) - (anchor - QPointF(width() / 2.0, height() / 2.0));
+    unproject(centre, latitude, longitude);
+    m_latitude = qBound(-kMaxLatitude, latitude, kMaxLatitude);
+    m_longitude = std::remainder(longitude, 360.0);
+    
+    requestVisibleTiles();
+    update();
+    emit zoomChanged(m_zoom);
+    m_settleTimer->start();
+}
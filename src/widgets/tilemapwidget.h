@@ -0,0 +1,185 @@
+#pragma once
+
+#include <QWidget>
+#include <QCache>
+#include <QHash>
+#include <QImage>
+#include <QFuture>
+#include <QColor>
+#include <QPair>
+#include "../weatherraster.h"
+#include "../tilecache.h"
+#include "../ratelimiter.h"
+
+class QTimer;
+
+// An XYZ tile source. {z}/{x}/{y} are the tile address, {s} rotates through
+// subdomains and {r} is dropped (no high-DPI variants are requested).
+// Layers with a cacheId are kept in the TileCache; refreshSeconds > 0 files
+// them under the scan slot they were fetched in.
+struct TileLayer {
+    QString urlTemplate;
+    QString subdomains;
+    double opacity = 1.0;
+    int maxZoom = 19;
+    QString cacheId;
+    int refreshSeconds = 0;
+    
+    bool isEmpty() const { return urlTemplate.isEmpty(); }
+};
+
+// One step of an overlay loop. Frames are told apart by valid time (UTC
+// seconds), so the template may change as the frame ages.
+struct TileFrame {
+    qint64 validTime = 0;
+    QString urlTemplate;
+};
+
+// Slippy map drawn with QPainter: a basemap, one translucent tile overlay
+// such as radar, an optional georeferenced image, a location marker and a
+// legend. Tiles come through the NetworkDispatcher, so they share the I/O
+// thread and per-host rate limits, and are decoded on the global thread
+// pool. Missing tiles are drawn from a cached ancestor until they arrive.
+// The ring of tiles around the view and the next zoom level are prefetched
+// at background priority so short pans and zooms draw from memory.
+// A loop of frames can stand in for the overlay layer; each frame's tiles
+// stay decoded in memory and are cross-faded as the position moves.
+class TileMapWidget : public QWidget
+{
+    Q_OBJECT
+
+public:
+    static const int kTileSize = 256;
+    static const int kMinZoom = 2;
+    static const int kMaxZoom = 18;
+    
+    explicit TileMapWidget(QWidget *parent = nullptr);
+    
+    double latitude() const { return m_latitude; }
+    double longitude() const { return m_longitude; }
+    int zoom() const { return m_zoom; }
+    void setCenter(double latitude, double longitude);
+    void setZoom(int zoom);
+    
+    void setBaseLayer(const TileLayer &layer);
+    void setOverlayLayer(const TileLayer &layer);
+    // Fetches the overlay again, e.g. after a new radar scan; the previous
+    // tiles stay on screen until their replacements are decoded
+    void reloadOverlay();
+    
+    void setMarker(double latitude, double longitude, const QString &label);
+    void setLegend(const QString &title, const QList<QPair<QColor, QString>> &entries);
+    void setStatusText(const QString &text);
+    void setAttribution(const QString &text);
+    // Drawn over the tiles; a null image removes it
+    void setImageOverlay(const QImage &image, const RasterBounds &bounds);
+    
+    // Shown instead of the overlay while not empty; style supplies opacity,
+    // zoom limit, subdomains and cacheId. Frames whose valid time was in the
+    // previous list keep their tiles, so a loop shifted by one scan only
+    // fetches the new frame.
+    void setFrames(const TileLayer &style, const QList<TileFrame> &frames);
+    int frameCount() const { return m_frames.size(); }
+    // The integer part picks a frame, the fraction fades into the next
+    void setFramePosition(double position);
+    // Every visible tile of the frame has been decoded or has failed
+    bool isFrameLoaded(int index) const;
+    
+    RasterBounds visibleBounds() const;
+    int visibleTileCount() const;
+
+signals:
+    // After a pan or zoom by the user has settled
+    void viewChanged();
+    void zoomChanged(int zoom);
+    // Visible frame tiles settled so far; playback can start at settled == total
+    void framesProgress(int settled, int total);
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+    void resizeEvent(QResizeEvent *event) override;
+    void mousePressEvent(QMouseEvent *event) override;
+    void mouseMoveEvent(QMouseEvent *event) override;
+    void mouseReleaseEvent(QMouseEvent *event) override;
+    void mouseDoubleClickEvent(QMouseEvent *event) override;
+    void wheelEvent(QWheelEvent *event) override;
+
+private:
+    enum Layer : quint8 { Base, Overlay, Frames };
+    
+    struct TileKey {
+        quint8 layer;
+        quint8 zoom;
+        quint32 generation; // valid minute for frames
+        int x;
+        int y;
+        
+        bool operator==(const TileKey &other) const
+        {
+            return layer == other.layer && zoom == other.zoom && generation == other.generation
+                && x == other.x && y == other.y;
+        }
+    };
+    friend size_t qHash(const TileKey &key, size_t seed)
+    {
+        return qHashMulti(seed, key.layer, key.zoom, key.generation, key.x, key.y);
+    }
+    
+    // World pixel coordinates at the current zoom
+    QPointF project(double latitude, double longitude) const;
+    void unproject(const QPointF &point, double &latitude, double &longitude) const;
+    QPointF topLeft() const;
+    
+    // Columns (unwrapped) and rows of the tiles covering the view
+    QRect visibleTiles() const;
+    void requestVisibleTiles();
+    // Disk first for cached layers, then the network
+    void requestTile(const TileKey &key, RequestPriority priority);
+    void fetchTile(const TileKey &key, const TileCacheKey &diskKey, const QByteArray &etag, RequestPriority priority);
+    void decodeTile(const TileKey &key, const QByteArray &data);
+    TileCacheKey cacheKey(const TileKey &key) const;
+    // Frame tiles use the frame style with the frame's template
+    TileLayer layerFor(const TileKey &key) const;
+    void reportFrameProgress();
+    QString tileUrl(const TileLayer &layer, const TileKey &key) const;
+    void drawLayer(QPainter &painter, Layer layer);
+    void drawTiles(QPainter &painter, quint8 layer, quint32 generation, double opacity);
+    // The cached tile, or an ancestor and the part of it covering key
+    const QImage *findTile(const TileKey &key, QRectF &source) const;
+    void drawMarker(QPainter &painter);
+    void drawLegend(QPainter &painter);
+    void zoomAround(int zoom, const QPointF &anchor);
+    
+    double m_latitude;
+    double m_longitude;
+    int m_zoom;
+    
+    TileLayer m_layers[2];
+    // Per layer; tiles of an older generation are stale. A reload keeps the
+    // previous generation drawable until its replacements arrive.
+    quint32 m_generation[2];
+    quint32 m_previousGeneration[2];
+    QCache<TileKey, QImage> m_tiles; // cost in KiB
+    // Request ids in flight, 0 while on disk or being decoded
+    QHash<TileKey, quint64> m_pending;
+    // Decodes on the pool; newer data for a tile cancels the older decode
+    QHash<TileKey, QFuture<QImage>> m_decoding;
+    TileLayer m_frameStyle;
+    QList<TileFrame> m_frames;
+    double m_framePosition;
+    
+    bool m_hasMarker;
+    double m_markerLatitude;
+    double m_markerLongitude;
+    QString m_markerLabel;
+    QString m_legendTitle;
+    QList<QPair<QColor, QString>> m_legend;
+    QString m_statusText;
+    QString m_attribution;
+    QImage m_image;
+    RasterBounds m_imageBounds;
+    
+    bool m_dragging;
+    QPoint m_lastMouse;
+    QTimer *m_settleTimer;
+};
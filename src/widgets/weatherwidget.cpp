@@ -1,16 +1,39 @@
 #include "weatherwidget.h"
+#include "../derivedmeteorology.h"
 #include <QDateTime>
 #include <QListWidgetItem>
 #include <QSizePolicy>
 
+namespace {
+
+QString lastUpdatedStyle(const QString &color)
+{
+    return QString(
+        "QLabel {"
+        "    font-family: 'SF Pro Text', 'Segoe UI', 'Arial';"
+        "    font-weight: 300;"
+        "    font-size: 11px;"
+        "    color: %1;"
+        "    font-style: italic;"
+        "    padding: 4px 6px;"
+        "}").arg(color);
+}
+
+} // namespace
+
 WeatherWidget::WeatherWidget(QWidget *parent)
     : QWidget(parent)
     , m_mainLayout(nullptr)
     , m_currentWeatherGroup(nullptr)
     , m_flightConditionsGroup(nullptr)
+    , m_fleetGroup(nullptr)
     , m_forecastGroup(nullptr)
+    , m_snapshotAgeTimer(new QTimer(this))
 {
     setupUI();
+    
+    m_snapshotAgeTimer->setInterval(60000);
+    connect(m_snapshotAgeTimer, &QTimer::timeout, this, &WeatherWidget::updateSnapshotAge);
 }
 
 void WeatherWidget::setupUI()
@@ -61,7 +84,7 @@ void WeatherWidget::setupUI()
         "    background: rgba(255, 255, 255, 0.05);"
         "    border-radius: 6px;"
         "}";
-        
+    
     QString secondaryLabelStyle = 
         "QLabel {"
         "    font-family: 'SF Pro Text', 'Segoe UI', 'Arial';"
@@ -70,7 +93,7 @@ void WeatherWidget::setupUI()
         "    color: #f8fafc;"
         "    padding: 4px 6px;"
         "}";
-        
+    
     QString dataLabelStyle = 
         "QLabel {"
         "    font-family: 'SF Pro Text', 'Segoe UI', 'Arial';"
@@ -114,18 +137,17 @@ void WeatherWidget::setupUI()
     m_cloudCoverLabel->setStyleSheet(dataLabelStyle);
     weatherLayout->addWidget(m_cloudCoverLabel, 4, 1);
     
+    m_densityAltitudeLabel = new QLabel("Density altitude: --", this);
+    m_densityAltitudeLabel->setStyleSheet(dataLabelStyle);
+    weatherLayout->addWidget(m_densityAltitudeLabel, 5, 0);
+    
+    m_cloudBaseLabel = new QLabel("Cloud base: --", this);
+    m_cloudBaseLabel->setStyleSheet(dataLabelStyle);
+    weatherLayout->addWidget(m_cloudBaseLabel, 5, 1);
+    
     m_lastUpdatedLabel = new QLabel("Last updated: --", this);
-    m_lastUpdatedLabel->setStyleSheet(
-        "QLabel {"
-        "    font-family: 'SF Pro Text', 'Segoe UI', 'Arial';"
-        "    font-weight: 300;"
-        "    font-size: 11px;"
-        "    color: #94a3b8;"
-        "    font-style: italic;"
-        "    padding: 4px 6px;"
-        "}"
-    );
-    weatherLayout->addWidget(m_lastUpdatedLabel, 5, 0, 1, 2);
+    m_lastUpdatedLabel->setStyleSheet(lastUpdatedStyle("#94a3b8"));
+    weatherLayout->addWidget(m_lastUpdatedLabel, 6, 0, 1, 2);
     
     m_mainLayout->addWidget(m_currentWeatherGroup);
     
@@ -174,11 +196,17 @@ void WeatherWidget::setupUI()
     m_precipitationStatusLabel->setStyleSheet(statusLabelStyle);
     m_temperatureStatusLabel = new QLabel("Temperature: --", this);
     m_temperatureStatusLabel->setStyleSheet(statusLabelStyle);
+    m_ceilingStatusLabel = new QLabel("Ceiling: --", this);
+    m_ceilingStatusLabel->setStyleSheet(statusLabelStyle);
+    m_gustRiskLabel = new QLabel("Gust risk: --", this);
+    m_gustRiskLabel->setStyleSheet(statusLabelStyle);
     
     statusGrid->addWidget(m_windStatusLabel, 0, 0);
     statusGrid->addWidget(m_visibilityStatusLabel, 0, 1);
     statusGrid->addWidget(m_precipitationStatusLabel, 1, 0);
     statusGrid->addWidget(m_temperatureStatusLabel, 1, 1);
+    statusGrid->addWidget(m_ceilingStatusLabel, 2, 0);
+    statusGrid->addWidget(m_gustRiskLabel, 3, 0, 1, 2);
     
     conditionsLayout->addLayout(statusGrid);
     
@@ -243,6 +271,19 @@ void WeatherWidget::setupUI()
     
     m_mainLayout->addWidget(m_flightConditionsGroup);
     
+    m_fleetGroup = new QGroupBox("Fleet Go/No-Go", this);
+    m_fleetGroup->setStyleSheet(modernGroupStyle);
+    auto *fleetLayout = new QVBoxLayout(m_fleetGroup);
+    fleetLayout->setContentsMargins(20, 24, 20, 20);
+    
+    m_fleetListWidget = new QListWidget(this);
+    m_fleetListWidget->setMaximumHeight(110);
+    m_fleetListWidget->setMinimumHeight(60);
+    m_fleetListWidget->setStyleSheet(modernListStyle);
+    fleetLayout->addWidget(m_fleetListWidget);
+    
+    m_mainLayout->addWidget(m_fleetGroup);
+    
     m_forecastGroup = new QGroupBox("3-Hour Forecast", this);
     m_forecastGroup->setMinimumHeight(140);
     m_forecastGroup->setStyleSheet(modernGroupStyle);
@@ -255,6 +296,14 @@ void WeatherWidget::setupUI()
     m_forecastListWidget->setStyleSheet(modernListStyle);
     forecastLayout->addWidget(m_forecastListWidget);
     
+    m_nextWindowLabel = new QLabel("Next flight window: --", this);
+    m_nextWindowLabel->setStyleSheet(dataLabelStyle);
+    forecastLayout->addWidget(m_nextWindowLabel);
+    
+    m_daylightLabel = new QLabel("Daylight: --", this);
+    m_daylightLabel->setStyleSheet(dataLabelStyle);
+    forecastLayout->addWidget(m_daylightLabel);
+    
     m_mainLayout->addWidget(m_forecastGroup);
     
     setMinimumWidth(500);
@@ -264,6 +313,12 @@ void WeatherWidget::setupUI()
 
 void WeatherWidget::updateWeatherData(const WeatherData &data)
 {
+    if (m_snapshotObservedAt.isValid()) {
+        m_snapshotObservedAt = QDateTime();
+        m_snapshotAgeTimer->stop();
+        m_lastUpdatedLabel->setStyleSheet(lastUpdatedStyle("#94a3b8"));
+    }
+    
     updateCurrentWeather(data);
     updateForecast(data);
 }
@@ -278,7 +333,25 @@ void WeatherWidget::updateCurrentWeather(const WeatherData &data)
     m_pressureLabel->setText(QString("Pressure: %1 inHg").arg(data.pressure / 33.8639, 0, 'f', 2));
     m_visibilityLabel->setText(QString("Visibility: %1 mi").arg(data.visibility, 0, 'f', 1));
     m_cloudCoverLabel->setText(QString("Cloud Cover: %1%").arg(data.cloudCover, 0, 'f', 0));
+    m_densityAltitudeLabel->setText(qIsNaN(data.densityAltitude)
+        ? QString("Density altitude: --")
+        : QString("Density altitude: %1 ft").arg(qRound(data.densityAltitude)));
+    m_cloudBaseLabel->setText(QString("Cloud base: %1, icing: %2")
+                              .arg(qIsNaN(data.cloudBase) ? QString("--") : QString("%1 ft").arg(qRound(data.cloudBase / 100.0) * 100))
+                              .arg(DerivedMeteorology::icingRiskName(DerivedMeteorology::IcingRisk(data.icingRisk))));
     m_lastUpdatedLabel->setText(QString("Last updated: %1").arg(data.timestamp.toString("hh:mm:ss")));
+    
+    if (data.latitude == 0.0 && data.longitude == 0.0) {
+        m_daylightLabel->setText("Daylight: --");
+        return;
+    }
+    QDate date = (data.timestamp.isValid() ? data.timestamp : QDateTime::currentDateTimeUtc()).toUTC().date();
+    SunEvents sun = Ephemeris::events(data.latitude, data.longitude, date);
+    auto time = [](const QDateTime &event) {
+        return event.isValid() ? event.toString("hh:mm") : QString("--");
+    };
+    m_daylightLabel->setText(QString("Civil dawn %1, sunrise %2, sunset %3, civil dusk %4 UTC")
+                             .arg(time(sun.civilDawn), time(sun.sunrise), time(sun.sunset), time(sun.civilDusk)));
 }
 
 void WeatherWidget::updateForecast(const WeatherData &data)
@@ -291,7 +364,7 @@ void WeatherWidget::updateForecast(const WeatherData &data)
         
         QString forecastText = QString("%1 - %2, %3, Wind: %4")
                               .arg(forecast.time.toString("hh:mm"))
-                              .arg(formatTemperature(forecast.temperature))
+                              .arg(qIsNaN(forecast.temperature) ? QString("--") : formatTemperature(forecast.temperature))
                               .arg(forecast.condition)
                               .arg(formatSpeed(forecast.windSpeed));
         
@@ -340,21 +413,109 @@ void WeatherWidget::updateFlightConditions(const FlightAssessment &assessment)
     m_temperatureStatusLabel->setText(QString("Temperature: %1").arg(getSafetyString(assessment.temperature)));
     m_temperatureStatusLabel->setStyleSheet(QString("color: %1;").arg(getSafetyColor(assessment.temperature)));
     
+    m_ceilingStatusLabel->setText(QString("Ceiling: %1").arg(getSafetyString(assessment.ceiling)));
+    m_ceilingStatusLabel->setStyleSheet(QString("color: %1;").arg(getSafetyColor(assessment.ceiling)));
+    
     m_warningsListWidget->clear();
-    for (const QString &warning : assessment.warnings) {
+    for (const QString &warning : assessment.warnings()) {
         auto *item = new QListWidgetItem(warning);
         item->setForeground(QColor("#ff6600"));
         m_warningsListWidget->addItem(item);
     }
     
     m_recommendationsListWidget->clear();
-    for (const QString &recommendation : assessment.recommendations) {
+    for (const QString &recommendation : assessment.recommendations()) {
         auto *item = new QListWidgetItem(recommendation);
         item->setForeground(QColor("#00aa00"));
         m_recommendationsListWidget->addItem(item);
     }
 }
 
+void WeatherWidget::showSnapshotAge(const QDateTime &observedAt)
+{
+    m_snapshotObservedAt = observedAt;
+    m_lastUpdatedLabel->setStyleSheet(lastUpdatedStyle("#f59e0b"));
+    updateSnapshotAge();
+    m_snapshotAgeTimer->start();
+}
+
+void WeatherWidget::updateSnapshotAge()
+{
+    qint64 minutes = qMax<qint64>(0, m_snapshotObservedAt.secsTo(QDateTime::currentDateTimeUtc()) / 60);
+    QString age = minutes < 60
+        ? QString("%1 min").arg(minutes)
+        : QString("%1 h %2 min").arg(minutes / 60).arg(minutes % 60);
+    
+    m_lastUpdatedLabel->setText(QString("Cached data from %1, %2 old - refreshing...")
+                                .arg(m_snapshotObservedAt.toString("hh:mm"), age));
+}
+
+void WeatherWidget::updateNextWindow(const FlightWindow &window, int minimumMinutes)
+{
+    QString duration = minimumMinutes % 60 == 0
+        ? QString("%1 h").arg(minimumMinutes / 60)
+        : QString("%1 min").arg(minimumMinutes);
+    
+    if (!window.isValid()) {
+        m_nextWindowLabel->setText(QString("No %1 SAFE window in the forecast").arg(duration));
+        return;
+    }
+    
+    m_nextWindowLabel->setText(QString("Next %1 SAFE window: %2 - %3 UTC")
+                               .arg(duration,
+                                    window.start.toUTC().toString("ddd hh:mm"),
+                                    window.end.toUTC().toString("hh:mm")));
+}
+
+void WeatherWidget::updateFleetStatus(const QList<FleetStatus> &fleet)
+{
+    m_fleetListWidget->clear();
+    
+    for (const FleetStatus &status : fleet) {
+        // Name the factors that ground the airframe
+        QStringList limiting;
+        if (status.wind > FlightSafety::Caution) limiting << "wind";
+        if (status.visibility > FlightSafety::Caution) limiting << "visibility";
+        if (status.precipitation > FlightSafety::Caution) limiting << "precipitation";
+        if (status.temperature > FlightSafety::Caution) limiting << "temperature";
+        if (status.ceiling > FlightSafety::Caution) limiting << "ceiling";
+        if (status.daylight > FlightSafety::Caution) limiting << "darkness";
+        if (status.rules > FlightSafety::Caution) limiting << "operating rules";
+        
+        QString text = status.canFly()
+            ? QString("GO      %1%2").arg(status.name, status.overall == FlightSafety::Caution ? " (caution)" : "")
+            : QString("NO-GO   %1 - %2").arg(status.name, limiting.join(", "));
+        
+        auto *item = new QListWidgetItem(text);
+        item->setForeground(QColor(status.canFly()
+            ? (status.overall == FlightSafety::Caution ? "#ffaa00" : "#00ff00")
+            : "#ff0000"));
+        m_fleetListWidget->addItem(item);
+    }
+}
+
+void WeatherWidget::updateGustRisk(const GustRisk &risk)
+{
+    m_gustRiskLabel->setText(QString("Gust > %1 kts in %2 min: %3% (%4-%5%)")
+                             .arg(risk.limit, 0, 'f', 0)
+                             .arg(risk.flightMinutes)
+                             .arg(risk.probability * 100.0, 0, 'f', 1)
+                             .arg(risk.lower * 100.0, 0, 'f', 1)
+                             .arg(risk.upper * 100.0, 0, 'f', 1));
+    m_gustRiskLabel->setToolTip(QString("%1 trials from %2 observations: wind %3 kts, trend %4 kts/h, "
+                                        "spread %5 kts, gust factor %6")
+                                .arg(risk.trials)
+                                .arg(risk.model.observations)
+                                .arg(risk.model.level, 0, 'f', 1)
+                                .arg(risk.model.trendPerHour, 0, 'f', 1)
+                                .arg(risk.model.deviation, 0, 'f', 1)
+                                .arg(risk.model.gustFactor, 0, 'f', 2));
+    
+    // Banded like the flight categories
+    QString color = risk.upper < 0.05 ? "#00ff00" : risk.probability < 0.2 ? "#ffaa00" : "#ff0000";
+    m_gustRiskLabel->setStyleSheet(QString("color: %1;").arg(color));
+}
+
 QString WeatherWidget::formatTemperature(double temp) const
 {
     double fahrenheit = (temp * 9.0 / 5.0) + 32.0;
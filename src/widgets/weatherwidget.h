@@ -8,8 +8,13 @@
 #include <QProgressBar>
 #include <QGroupBox>
 #include <QListWidget>
+#include <QTimer>
+#include <QDateTime>
 #include "../weatherservice.h"
 #include "../flightconditions.h"
+#include "../flightwindowfinder.h"
+#include "../droneprofiles.h"
+#include "../gustriskestimator.h"
 
 class WeatherWidget : public QWidget
 {
@@ -21,6 +26,12 @@ public:
 public slots:
     void updateWeatherData(const WeatherData &data);
     void updateFlightConditions(const FlightAssessment &assessment);
+    // Marks what is on screen as a cached snapshot observed at observedAt,
+    // until the next live update replaces it
+    void showSnapshotAge(const QDateTime &observedAt);
+    void updateNextWindow(const FlightWindow &window, int minimumMinutes);
+    void updateFleetStatus(const QList<FleetStatus> &fleet);
+    void updateGustRisk(const GustRisk &risk);
 
 private:
     void setupUI();
@@ -29,6 +40,7 @@ private:
     QString formatTemperature(double temp) const;
     QString formatSpeed(double speed) const;
     QString formatDirection(double degrees) const;
+    void updateSnapshotAge();
     
     QVBoxLayout *m_mainLayout;
     
@@ -41,7 +53,11 @@ private:
     QLabel *m_pressureLabel;
     QLabel *m_visibilityLabel;
     QLabel *m_cloudCoverLabel;
+    QLabel *m_densityAltitudeLabel;
+    QLabel *m_cloudBaseLabel;
     QLabel *m_lastUpdatedLabel;
+    QDateTime m_snapshotObservedAt;
+    QTimer *m_snapshotAgeTimer;
     
     QGroupBox *m_flightConditionsGroup;
     QLabel *m_overallStatusLabel;
@@ -49,9 +65,16 @@ private:
     QLabel *m_visibilityStatusLabel;
     QLabel *m_precipitationStatusLabel;
     QLabel *m_temperatureStatusLabel;
+    QLabel *m_ceilingStatusLabel;
+    QLabel *m_gustRiskLabel;
     QListWidget *m_warningsListWidget;
     QListWidget *m_recommendationsListWidget;
     
+    QGroupBox *m_fleetGroup;
+    QListWidget *m_fleetListWidget;
+    
     QGroupBox *m_forecastGroup;
     QListWidget *m_forecastListWidget;
+    QLabel *m_nextWindowLabel;
+    QLabel *m_daylightLabel;
 };
\ No newline at end of file
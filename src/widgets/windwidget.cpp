@@ -11,6 +11,7 @@ WindCompass::WindCompass(QWidget *parent)
     , m_windSpeed(0.0)
     , m_windDirection(0.0)
     , m_windGust(0.0)
+    , m_declination(qQNaN())
     , m_animationTimer(new QTimer(this))
     , m_animationFrame(0)
 {
@@ -33,6 +34,12 @@ void WindCompass::setWindData(double speed, double direction, double gust)
     update();
 }
 
+void WindCompass::setDeclination(double declination)
+{
+    m_declination = declination;
+    update();
+}
+
 void WindCompass::paintEvent(QPaintEvent *event)
 {
     Q_UNUSED(event)
@@ -73,6 +80,17 @@ void WindCompass::paintEvent(QPaintEvent *event)
     painter.drawText(-6, 75, "S");
     painter.drawText(-75, 6, "W");
     
+    if (!qIsNaN(m_declination)) {
+        painter.save();
+        painter.rotate(m_declination);
+        painter.setPen(QPen(QColor(100, 181, 246, 200), 2)); // #64B5F6
+        painter.drawLine(0, -80, 0, -72);
+        font.setPointSize(8);
+        painter.setFont(font);
+        painter.drawText(-4, -84, "M");
+        painter.restore();
+    }
+    
     if (m_windSpeed > 0.1) {
         QColor arrowColor;
         if (m_windSpeed < 6.0) {
@@ -95,7 +113,7 @@ void WindCompass::paintEvent(QPaintEvent *event)
         int arrowLength = qMin(60, (int)(m_windSpeed * 2 + 20));
         
         painter.drawLine(0, 0, 0, -arrowLength);
-
+        
         // arrow head
         QPolygon arrowHead;
         arrowHead << QPoint(0, -arrowLength) 
@@ -105,7 +123,7 @@ void WindCompass::paintEvent(QPaintEvent *event)
         
         painter.restore();
         
-
+        
         if (m_windGust > m_windSpeed + 2.0) {
             painter.save();
             painter.rotate(m_windDirection);
@@ -121,7 +139,7 @@ void WindCompass::paintEvent(QPaintEvent *event)
             painter.restore();
         }
     }
-    
+
 
 }
 
@@ -131,10 +149,16 @@ WindWidget::WindWidget(QWidget *parent)
     , m_windDataGroup(nullptr)
     , m_windHistoryGroup(nullptr)
     , m_windCompass(nullptr)
+    , m_magneticVariation(nullptr)
 {
     setupUI();
 }
 
+void WindWidget::setMagneticVariation(const MagneticVariation *variation)
+{
+    m_magneticVariation = variation;
+}
+
 void WindWidget::setupUI()
 {
     m_mainLayout = new QVBoxLayout(this);
@@ -282,7 +306,7 @@ void WindWidget::setupUI()
 void WindWidget::updateWindData(const WeatherData &data)
 {
     m_windSpeedLabel->setText(QString("%1 kts").arg(data.windSpeed, 0, 'f', 0));
-    m_windDirectionLabel->setText(formatWindDirection(data.windDirection));
+    m_windDirectionLabel->setText(formatWindDirection(data.windDirection, data.latitude, data.longitude));
     m_windStrengthLabel->setText(getWindStrength(data.windSpeed));
     
     if (data.windGust > data.windSpeed + 2.0) {
@@ -303,6 +327,9 @@ void WindWidget::updateWindData(const WeatherData &data)
     m_windStrengthLabel->setStyleSheet(strengthStyle);
     
     m_windCompass->setWindData(data.windSpeed, data.windDirection, data.windGust);
+    if (m_magneticVariation && m_magneticVariation->isValid()) {
+        m_windCompass->setDeclination(m_magneticVariation->declination(data.latitude, data.longitude));
+    }
     
     m_windSpeedHistory.append(data.windSpeed);
     m_windGustHistory.append(data.windGust);
@@ -369,12 +396,17 @@ QString WindWidget::formatWindSpeed(double speed) const
     return QString("%1 kts").arg(speed, 0, 'f', 1);
 }
 
-QString WindWidget::formatWindDirection(double degrees) const
+QString WindWidget::formatWindDirection(double degrees, double latitude, double longitude) const
 {
     const QStringList directions = {"N", "NNE", "NE", "ENE", "E", "ESE", "SE", "SSE",
                                    "S", "SSW", "SW", "WSW", "W", "WNW", "NW", "NNW"};
     int index = qRound(degrees / 22.5) % 16;
-    return QString("%1° (%2)").arg(degrees, 0, 'f', 0).arg(directions[index]);
+    QString text = QString("%1° (%2)").arg(degrees, 0, 'f', 0).arg(directions[index]);
+    if (m_magneticVariation && m_magneticVariation->isValid()) {
+        double magnetic = m_magneticVariation->toMagnetic(degrees, latitude, longitude);
+        text += QString(" · %1°M").arg(qRound(magnetic) % 360);
+    }
+    return text;
 }
 
 QString WindWidget::getWindStrength(double speed) const
@@ -9,6 +9,7 @@
 #include <QPainter>
 #include <QTimer>
 #include "../weatherservice.h"
+#include "../magneticvariation.h"
 
 class WindCompass : public QWidget
 {
@@ -18,6 +19,8 @@ public:
     explicit WindCompass(QWidget *parent = nullptr);
     
     void setWindData(double speed, double direction, double gust = 0.0);
+    // Marks magnetic north on the dial; NaN hides the mark
+    void setDeclination(double declination);
 
 protected:
     void paintEvent(QPaintEvent *event) override;
@@ -26,6 +29,7 @@ private:
     double m_windSpeed;
     double m_windDirection;
     double m_windGust;
+    double m_declination;
     QTimer *m_animationTimer;
     int m_animationFrame;
 };
@@ -36,6 +40,10 @@ class WindWidget : public QWidget
 
 public:
     explicit WindWidget(QWidget *parent = nullptr);
+    
+    // METAR directions are true; with a grid the magnetic equivalent is
+    // shown alongside
+    void setMagneticVariation(const MagneticVariation *variation);
 
 public slots:
     void updateWindData(const WeatherData &data);
@@ -43,7 +51,7 @@ public slots:
 private:
     void setupUI();
     QString formatWindSpeed(double speed) const;
-    QString formatWindDirection(double degrees) const;
+    QString formatWindDirection(double degrees, double latitude, double longitude) const;
     QString getWindStrength(double speed) const;
     QColor getWindSpeedColor(double speed) const;
     
@@ -56,6 +64,7 @@ private:
     QLabel *m_windStrengthLabel;
     
     WindCompass *m_windCompass;
+    const MagneticVariation *m_magneticVariation;
     
     QGroupBox *m_windHistoryGroup;
     QLabel *m_avgWindSpeedLabel;
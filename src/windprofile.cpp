@@ -0,0 +1,137 @@
+#include "windprofile.h"
+#include <QtMath>
+#include <cmath>
+
+namespace {
+
+double roughnessFor(WindProfile::Terrain terrain)
+{
+    switch (terrain) {
+    case WindProfile::Terrain::Water: return 0.0002;
+    case WindProfile::Terrain::Open: return 0.03;
+    case WindProfile::Terrain::Farmland: return 0.1;
+    case WindProfile::Terrain::Suburban: return 0.5;
+    case WindProfile::Terrain::Urban: return 1.0;
+    }
+    return 0.03;
+}
+
+// Irwin (1979) power-law exponents by stability class, rural and urban
+double exponentFor(WindProfile::Stability stability, WindProfile::Terrain terrain)
+{
+    static const double rural[] = {0.07, 0.07, 0.10, 0.15, 0.35, 0.55};
+    static const double urban[] = {0.15, 0.15, 0.20, 0.25, 0.30, 0.30};
+    bool isUrban = terrain == WindProfile::Terrain::Suburban || terrain == WindProfile::Terrain::Urban;
+    return (isUrban ? urban : rural)[int(stability)];
+}
+
+} // namespace
+
+WindProfile::WindProfile(Terrain terrain, Stability stability)
+    : m_terrain(terrain)
+    , m_stability(stability)
+    , m_z0(roughnessFor(terrain))
+    , m_logZ0(std::log(m_z0))
+    , m_logReference(std::log(kReferenceHeight / m_z0))
+    , m_exponent(stability == Stability::D ? 0.0 : exponentFor(stability, terrain))
+{
+}
+
+double WindProfile::clampAltitude(double altitude) const
+{
+    // The profiles only hold well above the roughness elements
+    return qMax(altitude, qMax(1.0, 2.0 * m_z0));
+}
+
+double WindProfile::speedFactor(double altitude) const
+{
+    double logZ = std::log(clampAltitude(altitude));
+    if (m_exponent == 0.0) {
+        return (logZ - m_logZ0) / m_logReference;
+    }
+    return std::exp(m_exponent * (logZ - std::log(kReferenceHeight)));
+}
+
+double WindProfile::speedAt(double surfaceSpeed, double altitude) const
+{
+    return surfaceSpeed * speedFactor(altitude);
+}
+
+double WindProfile::gustAt(double surfaceSpeed, double surfaceGust, double altitude) const
+{
+    double speed = 0.0;
+    double gust = 0.0;
+    project(surfaceSpeed, surfaceGust, &altitude, 1, &speed, &gust);
+    return gust;
+}
+
+void WindProfile::project(double surfaceSpeed, double surfaceGust, const double *altitudes, qsizetype count,
+                          double *speeds, double *gusts) const
+{
+    // Peak factor g from G = 1 + g * I with turbulence intensity I = 1 / ln(z / z0)
+    const bool hasGust = surfaceGust > 0.0;
+    const bool hasPeakFactor = hasGust && surfaceSpeed > 0.0 && surfaceGust > surfaceSpeed;
+    const double peakFactor = hasPeakFactor ? (surfaceGust / surfaceSpeed - 1.0) * m_logReference : 0.0;
+    const double invLogReference = 1.0 / m_logReference;
+    const double logReferenceHeight = std::log(kReferenceHeight);
+    const double floor = qMax(1.0, 2.0 * m_z0);
+    
+    for (qsizetype i = 0; i < count; ++i) {
+        const double logZ = std::log(altitudes[i] > floor ? altitudes[i] : floor);
+        const double logHeight = logZ - m_logZ0; // ln(z / z0)
+        const double factor = m_exponent == 0.0
+            ? logHeight * invLogReference
+            : std::exp(m_exponent * (logZ - logReferenceHeight));
+        
+        speeds[i] = surfaceSpeed * factor;
+        if (!hasGust) {
+            gusts[i] = 0.0;
+        } else if (hasPeakFactor) {
+            gusts[i] = speeds[i] * (1.0 + peakFactor / logHeight);
+        } else {
+            gusts[i] = surfaceGust * factor;
+        }
+    }
+}
+
+WindProfile::Stability WindProfile::estimateStability(double windSpeedKts, double cloudCoverPercent, bool daytime)
+{
+    const double wind = windSpeedKts * 0.514444; // m/s
+    
+    if (cloudCoverPercent >= 95.0) {
+        return Stability::D; // overcast, day or night
+    }
+    
+    if (daytime) {
+        // Insolation approximated from cloud cover: strong, moderate, slight
+        int insolation = cloudCoverPercent < 50.0 ? 0 : (cloudCoverPercent < 80.0 ? 1 : 2);
+        static const Stability table[5][3] = {
+            {Stability::A, Stability::A, Stability::B}, // < 2 m/s
+            {Stability::A, Stability::B, Stability::C}, // 2-3
+            {Stability::B, Stability::B, Stability::C}, // 3-5
+            {Stability::C, Stability::C, Stability::D}, // 5-6
+            {Stability::C, Stability::D, Stability::D}  // > 6
+        };
+        int row = wind < 2.0 ? 0 : wind < 3.0 ? 1 : wind < 5.0 ? 2 : wind < 6.0 ? 3 : 4;
+        return table[row][insolation];
+    }
+    
+    bool cloudy = cloudCoverPercent >= 50.0;
+    if (wind < 3.0) {
+        return cloudy ? Stability::E : Stability::F;
+    }
+    if (wind < 5.0) {
+        return cloudy ? Stability::D : Stability::E;
+    }
+    return Stability::D;
+}
+
+WindProfile::Terrain WindProfile::terrainFromName(const QString &name)
+{
+    QString key = name.trimmed().toLower();
+    if (key == "water") return Terrain::Water;
+    if (key == "farmland") return Terrain::Farmland;
+    if (key == "suburban") return Terrain::Suburban;
+    if (key == "urban") return Terrain::Urban;
+    return Terrain::Open;
+}
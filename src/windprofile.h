@@ -0,0 +1,59 @@
+#pragma once
+
+#include <QString>
+
+// Boundary-layer projection of the 10 m surface wind to flight altitude.
+// Neutral conditions use the logarithmic law over the terrain's roughness
+// length; other Pasquill classes use the power law with Irwin's exponents.
+// Gusts keep the surface peak factor, applied to the turbulence intensity
+// at height, so the gust factor shrinks as the wind strengthens aloft.
+class WindProfile
+{
+public:
+    enum class Terrain {
+        Water,      // z0 0.0002 m
+        Open,       // 0.03 m, airfields and short grass
+        Farmland,   // 0.1 m
+        Suburban,   // 0.5 m
+        Urban       // 1.0 m
+    };
+    
+    // Pasquill-Gifford classes, A very unstable to F moderately stable
+    enum class Stability { A, B, C, D, E, F };
+    
+    static constexpr double kReferenceHeight = 10.0; // m AGL of the observation
+    
+    explicit WindProfile(Terrain terrain = Terrain::Open, Stability stability = Stability::D);
+    
+    Terrain terrain() const { return m_terrain; }
+    Stability stability() const { return m_stability; }
+    double roughnessLength() const { return m_z0; }
+    
+    // Ratio of the mean wind at altitude (m AGL) to the 10 m wind
+    double speedFactor(double altitude) const;
+    double speedAt(double surfaceSpeed, double altitude) const;
+    // 0 when no surface gust is reported
+    double gustAt(double surfaceSpeed, double surfaceGust, double altitude) const;
+    
+    // Column form: one logarithm per altitude, everything else hoisted out of
+    // the loop. Suits an altitude sweep or every waypoint of a mission; the
+    // output arrays must hold count values.
+    void project(double surfaceSpeed, double surfaceGust, const double *altitudes, qsizetype count,
+                 double *speeds, double *gusts) const;
+    
+    // Stability class from the surface wind, cloud cover and time of day
+    // (Turner's simplified table)
+    static Stability estimateStability(double windSpeedKts, double cloudCoverPercent, bool daytime);
+    // "water", "open", "farmland", "suburban" or "urban"; Open otherwise
+    static Terrain terrainFromName(const QString &name);
+
+private:
+    double clampAltitude(double altitude) const;
+    
+    Terrain m_terrain;
+    Stability m_stability;
+    double m_z0;
+    double m_logZ0;
+    double m_logReference;  // ln(10 / z0)
+    double m_exponent;      // power-law exponent, 0 for the log law
+};
@@ -0,0 +1,494 @@
+#include <QtTest>
+#include <QTimeZone>
+#include "batchassessment.h"
+#include "assessmentstatemachine.h"
+#include "weatherphenomena.h"
+#include "operatingrules.h"
+#include "weatherservice.h"
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <new>
+#include <random>
+#include <vector>
+
+// Every allocation in the process goes through these; they are counted
+// only while an AllocationCounter is alive
+namespace {
+std::atomic<bool> g_countAllocations(false);
+std::atomic<qint64> g_allocations(0);
+
+void *allocate(std::size_t size)
+{
+    if (g_countAllocations.load(std::memory_order_relaxed)) {
+        g_allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (void *memory = std::malloc(size ? size : 1)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+} // namespace
+
+void *operator new(std::size_t size) { return allocate(size); }
+void *operator new[](std::size_t size) { return allocate(size); }
+void operator delete(void *memory) noexcept { std::free(memory); }
+void operator delete[](void *memory) noexcept { std::free(memory); }
+void operator delete(void *memory, std::size_t) noexcept { std::free(memory); }
+void operator delete[](void *memory, std::size_t) noexcept { std::free(memory); }
+
+Q_DECLARE_METATYPE(BatchAssessment::Kernel)
+Q_DECLARE_METATYPE(WeatherData)
+
+namespace {
+
+const double kNaN = std::numeric_limits<double>::quiet_NaN();
+const double kInfinity = std::numeric_limits<double>::infinity();
+
+// Columns of a WeatherBatch; every record starts comfortably Safe
+struct Records {
+    std::vector<double> windSpeed;
+    std::vector<double> windGust;
+    std::vector<double> visibility;
+    std::vector<double> temperature;
+    std::vector<double> humidity;
+    std::vector<quint32> phenomena;
+    
+    qsizetype append()
+    {
+        windSpeed.push_back(0.0);
+        windGust.push_back(0.0);
+        visibility.push_back(10.0);
+        temperature.push_back(20.0);
+        humidity.push_back(50.0);
+        phenomena.push_back(WeatherPhenomena::None);
+        return qsizetype(windSpeed.size()) - 1;
+    }
+    
+    WeatherBatch batch() const
+    {
+        WeatherBatch batch;
+        batch.count = qsizetype(windSpeed.size());
+        batch.windSpeed = windSpeed.data();
+        batch.windGust = windGust.data();
+        batch.visibility = visibility.data();
+        batch.temperature = temperature.data();
+        batch.humidity = humidity.data();
+        batch.phenomena = phenomena.data();
+        return batch;
+    }
+};
+
+// Each value on the threshold and one ulp either side of it
+void appendAround(Records &records, double threshold, std::vector<double> Records::*column)
+{
+    for (double value : {std::nextafter(threshold, -kInfinity), threshold, std::nextafter(threshold, kInfinity)}) {
+        (records.*column)[records.append()] = value;
+    }
+}
+
+Records edgeRecords(const FlightThresholds &t)
+{
+    Records records;
+    for (double threshold : {t.windCaution, t.windUnsafe, t.windNoFly}) {
+        appendAround(records, threshold, &Records::windSpeed);
+    }
+    for (double threshold : {t.gustCaution, t.gustUnsafe}) {
+        appendAround(records, threshold, &Records::windGust);
+    }
+    for (double threshold : {t.visibilityCaution, t.visibilityUnsafe, t.visibilityNoFly}) {
+        appendAround(records, threshold, &Records::visibility);
+    }
+    for (double threshold : {t.minTemperature, t.maxTemperature}) {
+        appendAround(records, threshold, &Records::temperature);
+    }
+    appendAround(records, t.maxHumidity, &Records::humidity);
+    
+    // Missing and unbounded values in every column
+    for (auto column : {&Records::windSpeed, &Records::windGust, &Records::visibility,
+                        &Records::temperature, &Records::humidity}) {
+        for (double value : {kNaN, kInfinity, -kInfinity}) {
+            (records.*column)[records.append()] = value;
+        }
+    }
+    
+    for (quint32 flags : {quint32(WeatherPhenomena::Light | WeatherPhenomena::Rain),
+                          quint32(WeatherPhenomena::Thunderstorm | WeatherPhenomena::Rain),
+                          quint32(WeatherPhenomena::Freezing | WeatherPhenomena::Drizzle),
+                          quint32(WeatherPhenomena::Fog)}) {
+        records.phenomena[records.append()] = flags;
+    }
+    
+    // Mixed records, an odd count so every kernel runs its scalar tail
+    std::mt19937 random(20240601);
+    std::uniform_real_distribution<double> wind(0.0, 2.0 * t.windNoFly);
+    std::uniform_real_distribution<double> visibility(0.0, 2.0 * t.visibilityCaution);
+    std::uniform_real_distribution<double> temperature(t.minTemperature - 10.0, t.maxTemperature + 10.0);
+    std::uniform_real_distribution<double> humidity(0.0, 100.0);
+    for (int i = 0; i < 1001; ++i) {
+        const qsizetype index = records.append();
+        records.windSpeed[index] = wind(random);
+        records.windGust[index] = records.windSpeed[index] + wind(random) / 2.0;
+        records.visibility[index] = visibility(random);
+        records.temperature[index] = temperature(random);
+        records.humidity[index] = humidity(random);
+        records.phenomena[index] = i % 7 == 0 ? quint32(WeatherPhenomena::Rain) : 0u;
+    }
+    return records;
+}
+
+class AllocationCounter
+{
+public:
+    AllocationCounter()
+    {
+        g_allocations.store(0);
+        g_countAllocations.store(true);
+    }
+    ~AllocationCounter() { g_countAllocations.store(false); }
+    
+    qint64 count() const { return g_allocations.load(); }
+};
+
+// Past every limit, with present weather, icing and a position at night so
+// each factor records a finding
+WeatherData severeWeather()
+{
+    WeatherData weather;
+    weather.stationId = "KSFO";
+    weather.latitude = 37.62;
+    weather.longitude = -122.37;
+    weather.timestamp = QDateTime(QDate(2024, 1, 15), QTime(8, 0), QTimeZone::UTC);
+    weather.windSpeed = 40.0;
+    weather.windGust = 55.0;
+    weather.visibility = 0.5;
+    weather.temperature = -15.0;
+    weather.humidity = 98.0;
+    weather.dewpoint = -16.0;
+    weather.cloudCover = 100.0;
+    weather.ceiling = 300.0;
+    weather.phenomena = WeatherPhenomena::Thunderstorm | WeatherPhenomena::Rain;
+    weather.icingRisk = 2;
+    return weather;
+}
+
+WeatherData calmWeather()
+{
+    WeatherData weather = severeWeather();
+    weather.timestamp = QDateTime(QDate(2024, 1, 15), QTime(20, 0), QTimeZone::UTC);
+    weather.windSpeed = 3.0;
+    weather.windGust = 0.0;
+    weather.visibility = 10.0;
+    weather.temperature = 15.0;
+    weather.humidity = 50.0;
+    weather.dewpoint = 5.0;
+    weather.ceiling = 0.0; // none reported
+    weather.phenomena = 0;
+    weather.icingRisk = 0;
+    return weather;
+}
+
+QString kernelName(BatchAssessment::Kernel kernel)
+{
+    switch (kernel) {
+    case BatchAssessment::Kernel::Scalar:
+        return "scalar";
+    case BatchAssessment::Kernel::Sse2:
+        return "sse2";
+    case BatchAssessment::Kernel::Avx2:
+        return "avx2";
+    }
+    return QString();
+}
+
+void addKernelRows()
+{
+    QTest::addColumn<BatchAssessment::Kernel>("kernel");
+    for (auto kernel : {BatchAssessment::Kernel::Scalar, BatchAssessment::Kernel::Sse2, BatchAssessment::Kernel::Avx2}) {
+        QTest::newRow(qPrintable(kernelName(kernel))) << kernel;
+    }
+}
+
+} // namespace
+
+class TestAssessment : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void batchMatchesScalarGraders_data() { addKernelRows(); }
+    void batchMatchesScalarGraders();
+    void batchThresholdEdges_data() { addKernelRows(); }
+    void batchThresholdEdges();
+    void batchMissingValuesGradeSafe_data() { addKernelRows(); }
+    void batchMissingValuesGradeSafe();
+    void benchmarkBatch_data() { addKernelRows(); }
+    void benchmarkBatch();
+    void assessConditionsAllocatesNothing_data();
+    void assessConditionsAllocatesNothing();
+    void benchmarkAssessConditions();
+    void heldCategoryFollowsObservationTime();
+    void gradeWeatherMatchesAssessConditions_data();
+    void gradeWeatherMatchesAssessConditions();
+};
+
+void TestAssessment::batchMatchesScalarGraders()
+{
+    QFETCH(BatchAssessment::Kernel, kernel);
+    if (!BatchAssessment::isSupported(kernel)) {
+        QSKIP("Kernel not supported on this CPU or build");
+    }
+    
+    const FlightAssessment::Limits limits;
+    const FlightThresholds t(limits);
+    const Records records = edgeRecords(t);
+    BatchGrades grades;
+    BatchAssessment::assess(records.batch(), limits, grades, kernel);
+    
+    for (qsizetype i = 0; i < qsizetype(records.windSpeed.size()); ++i) {
+        const FlightSafety wind = FlightConditions::gradeWind(records.windSpeed[i], records.windGust[i], t);
+        const FlightSafety visibility = FlightConditions::gradeVisibility(records.visibility[i], t);
+        const FlightSafety temperature = FlightConditions::gradeTemperature(records.temperature[i], records.humidity[i], t);
+        const FlightSafety precipitation = WeatherPhenomena::grade(records.phenomena[i]);
+        const FlightSafety overall = FlightConditions::worst(FlightConditions::worst(wind, visibility),
+                                                             FlightConditions::worst(temperature, precipitation));
+        
+        const QByteArray where = QByteArray("record ") + QByteArray::number(i);
+        QVERIFY2(grades.wind[i] == quint8(wind), where.constData());
+        QVERIFY2(grades.visibility[i] == quint8(visibility), where.constData());
+        QVERIFY2(grades.temperature[i] == quint8(temperature), where.constData());
+        QVERIFY2(grades.precipitation[i] == quint8(precipitation), where.constData());
+        QVERIFY2(grades.overall[i] == quint8(overall), where.constData());
+    }
+}
+
+void TestAssessment::batchThresholdEdges()
+{
+    QFETCH(BatchAssessment::Kernel, kernel);
+    if (!BatchAssessment::isSupported(kernel)) {
+        QSKIP("Kernel not supported on this CPU or build");
+    }
+    
+    // Limits are exceeded strictly: a value on the threshold keeps the lower grade
+    const FlightAssessment::Limits limits;
+    const FlightThresholds t(limits);
+    Records records;
+    records.windSpeed[records.append()] = t.windUnsafe;
+    records.windSpeed[records.append()] = std::nextafter(t.windUnsafe, kInfinity);
+    records.visibility[records.append()] = t.visibilityUnsafe;
+    records.visibility[records.append()] = std::nextafter(t.visibilityUnsafe, -kInfinity);
+    records.temperature[records.append()] = t.maxTemperature;
+    records.temperature[records.append()] = std::nextafter(t.maxTemperature, kInfinity);
+    
+    BatchGrades grades;
+    BatchAssessment::assess(records.batch(), limits, grades, kernel);
+    QCOMPARE(FlightSafety(grades.wind[0]), FlightSafety::Caution);
+    QCOMPARE(FlightSafety(grades.wind[1]), FlightSafety::Unsafe);
+    QCOMPARE(FlightSafety(grades.visibility[2]), FlightSafety::Caution);
+    QCOMPARE(FlightSafety(grades.visibility[3]), FlightSafety::Unsafe);
+    QCOMPARE(FlightSafety(grades.temperature[4]), FlightSafety::Safe);
+    QCOMPARE(FlightSafety(grades.temperature[5]), FlightSafety::Unsafe);
+}
+
+void TestAssessment::batchMissingValuesGradeSafe()
+{
+    QFETCH(BatchAssessment::Kernel, kernel);
+    if (!BatchAssessment::isSupported(kernel)) {
+        QSKIP("Kernel not supported on this CPU or build");
+    }
+    
+    const FlightAssessment::Limits limits;
+    Records records;
+    for (int i = 0; i < 5; ++i) {
+        const qsizetype index = records.append();
+        records.windSpeed[index] = kNaN;
+        records.windGust[index] = kNaN;
+        records.visibility[index] = kNaN;
+        records.temperature[index] = kNaN;
+        records.humidity[index] = kNaN;
+    }
+    
+    BatchGrades grades;
+    BatchAssessment::assess(records.batch(), limits, grades, kernel);
+    for (qsizetype i = 0; i < grades.overall.size(); ++i) {
+        QCOMPARE(grades.overallAt(i), FlightSafety::Safe);
+    }
+}
+
+void TestAssessment::benchmarkBatch()
+{
+    QFETCH(BatchAssessment::Kernel, kernel);
+    if (!BatchAssessment::isSupported(kernel)) {
+        QSKIP("Kernel not supported on this CPU or build");
+    }
+    
+    // A climatology block's worth of records
+    const FlightAssessment::Limits limits;
+    const FlightThresholds t(limits);
+    const Records edges = edgeRecords(t);
+    Records records;
+    while (records.windSpeed.size() < 64 * 1024) {
+        const qsizetype source = qsizetype(records.windSpeed.size() % edges.windSpeed.size());
+        const qsizetype index = records.append();
+        records.windSpeed[index] = edges.windSpeed[source];
+        records.windGust[index] = edges.windGust[source];
+        records.visibility[index] = edges.visibility[source];
+        records.temperature[index] = edges.temperature[source];
+        records.humidity[index] = edges.humidity[source];
+        records.phenomena[index] = edges.phenomena[source];
+    }
+    
+    const WeatherBatch batch = records.batch();
+    BatchGrades grades;
+    QBENCHMARK {
+        BatchAssessment::assess(batch, limits, grades, kernel);
+    }
+}
+
+void TestAssessment::assessConditionsAllocatesNothing_data()
+{
+    QTest::addColumn<QString>("rules");
+    QTest::newRow("no rules") << QString();
+    QTest::newRow("rules") << QString("unsafe \"Gust spread\": gust - wind > 10\n"
+                                      "caution \"Home field\": station == \"KSFO\" and wx(\"TSRA\")\n");
+}
+
+void TestAssessment::assessConditionsAllocatesNothing()
+{
+    QFETCH(QString, rules);
+    
+    FlightConditions conditions;
+    conditions.setOperatingAltitude(120.0, WindProfile::Terrain::Open);
+    if (!rules.isEmpty()) {
+        QString error;
+        std::shared_ptr<const RuleProgram> program = RuleProgram::compile(rules, &error);
+        QVERIFY2(program, qPrintable(error));
+        conditions.setOperatingRules(program);
+    }
+    
+    // Alternating reports change category, findings, daylight and matched
+    // rules on every call, so each change path runs while counted
+    const WeatherData severe = severeWeather();
+    const WeatherData calm = calmWeather();
+    conditions.assessConditions(severe);
+    conditions.assessConditions(calm);
+    
+    qint64 allocations = 0;
+    {
+        AllocationCounter counter;
+        for (int i = 0; i < 1000; ++i) {
+            conditions.assessConditions(i % 2 ? calm : severe);
+        }
+        allocations = counter.count();
+    }
+    QCOMPARE(allocations, qint64(0));
+    
+    conditions.assessConditions(severe);
+    QVERIFY(conditions.currentAssessment().findingCount > 0);
+}
+
+void TestAssessment::benchmarkAssessConditions()
+{
+    FlightConditions conditions;
+    const WeatherData severe = severeWeather();
+    conditions.assessConditions(severe);
+    
+    QBENCHMARK {
+        conditions.assessConditions(severe);
+    }
+}
+
+void TestAssessment::heldCategoryFollowsObservationTime()
+{
+    auto heldFinding = [](const FlightAssessment &assessment, FlightFactor factor) -> const FlightFinding * {
+        for (int i = 0; i < assessment.findingCount; ++i) {
+            const FlightFinding &finding = assessment.findings[i];
+            if (finding.code == FindingCode::Held && finding.detail == quint32(factor)) {
+                return &finding;
+            }
+        }
+        return nullptr;
+    };
+    
+    FlightConditions conditions;
+    const WeatherData severe = severeWeather();
+    conditions.assessConditions(severe);
+    QCOMPARE(conditions.currentAssessment().wind, FlightSafety::NoFly);
+    QVERIFY(!heldFinding(conditions.currentAssessment(), FlightFactor::Wind));
+    
+    // Calm a minute later: the category holds and says so
+    WeatherData calm = calmWeather();
+    calm.timestamp = severe.timestamp.addSecs(60);
+    conditions.assessConditions(calm);
+    QCOMPARE(conditions.currentAssessment().wind, FlightSafety::NoFly);
+    const FlightFinding *held = heldFinding(conditions.currentAssessment(), FlightFactor::Wind);
+    QVERIFY(held);
+    QCOMPARE(held->severity, FlightSafety::NoFly);
+    QCOMPARE(held->measured, 0.0);
+    
+    // The same observation reported again, however much later, is no evidence
+    const int dwell = conditions.stateMachine()->hysteresis(FlightFactor::Wind).dwellSeconds;
+    conditions.assessConditions(calm);
+    QCOMPARE(conditions.currentAssessment().wind, FlightSafety::NoFly);
+    
+    calm.timestamp = severe.timestamp.addSecs(60 + dwell);
+    conditions.assessConditions(calm);
+    QCOMPARE(conditions.currentAssessment().wind, FlightSafety::Safe);
+    QVERIFY(!heldFinding(conditions.currentAssessment(), FlightFactor::Wind));
+}
+
+void TestAssessment::gradeWeatherMatchesAssessConditions_data()
+{
+    QTest::addColumn<WeatherData>("weather");
+    
+    // Position unknown, so daylight, which gradeWeather leaves out, grades Safe
+    WeatherData calm = calmWeather();
+    calm.latitude = 0.0;
+    calm.longitude = 0.0;
+    WeatherData severe = severeWeather();
+    severe.latitude = 0.0;
+    severe.longitude = 0.0;
+    
+    QTest::newRow("calm") << calm;
+    QTest::newRow("severe") << severe;
+    WeatherData breezy = calm;
+    breezy.windSpeed = 14.0; // within limits at 10 m, not at 120 m
+    QTest::newRow("wind aloft") << breezy;
+    WeatherData overcast = calm;
+    overcast.ceiling = 500.0;
+    QTest::newRow("low ceiling") << overcast;
+    WeatherData icing = calm;
+    icing.icingRisk = 2;
+    QTest::newRow("icing") << icing;
+    WeatherData gusty = calm;
+    gusty.windGust = 16.0;
+    QTest::newRow("rule") << gusty;
+}
+
+void TestAssessment::gradeWeatherMatchesAssessConditions()
+{
+    QFETCH(WeatherData, weather);
+    
+    QString error;
+    std::shared_ptr<const RuleProgram> rules = RuleProgram::compile("unsafe \"Gust spread\": gust - wind > 10\n", &error);
+    QVERIFY2(rules, qPrintable(error));
+    
+    // A first report is taken as is, so the assessment has no hysteresis to add
+    FlightConditions conditions;
+    conditions.setOperatingAltitude(120.0, WindProfile::Terrain::Open);
+    conditions.setOperatingRules(rules);
+    conditions.assessConditions(weather);
+    
+    GradingContext context;
+    context.thresholds = FlightThresholds(conditions.currentAssessment().limits);
+    context.altitude = 120.0;
+    context.terrain = WindProfile::Terrain::Open;
+    context.sunElevation = Ephemeris::sunElevation(weather.latitude, weather.longitude,
+                                                   weather.timestamp.toSecsSinceEpoch());
+    context.rules = rules.get();
+    QCOMPARE(FlightConditions::gradeWeather(weather, context), conditions.currentAssessment().overall);
+}
+
+QTEST_GUILESS_MAIN(TestAssessment)
+#include "tst_assessment.moc"